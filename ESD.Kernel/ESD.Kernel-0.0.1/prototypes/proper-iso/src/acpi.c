@@ -0,0 +1,86 @@
+#include "acpi.h"
+#include "paging.h"
+#include "pmm.h"
+#include "mem.h"
+#include <stddef.h>
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+static acpi_sdt_header_t *rsdt = NULL;
+
+// Firmware tables usually sit above the RAM we identity-map, map them in
+static void *acpi_map(uint32_t phys, uint32_t len) {
+    for (uint32_t addr = phys & ~(PAGE_SIZE - 1); addr < phys + len; addr += PAGE_SIZE) {
+        if (paging_translate(addr) != addr) {
+            paging_map(addr, addr, PAGE_WRITE);
+        }
+    }
+    return (void *)phys;
+}
+
+static int acpi_checksum_ok(const void *ptr, uint32_t len) {
+    const uint8_t *p = ptr;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += p[i];
+    }
+    return sum == 0;
+}
+
+static acpi_rsdp_t *acpi_scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr < end; addr += 16) {
+        if (memcmp((void *)addr, "RSD PTR ", 8) == 0 && acpi_checksum_ok((void *)addr, 20)) {
+            return (acpi_rsdp_t *)addr;
+        }
+    }
+    return NULL;
+}
+
+void acpi_init() {
+    // The RSDP is in the first KiB of the EBDA or in the BIOS ROM area
+    // EBDA segment from the BIOS data area word at 0x40E
+    uint16_t ebda_segment;
+    asm volatile ( "movw 0x40E, %0" : "=r"(ebda_segment) );
+    uint32_t ebda = (uint32_t)ebda_segment << 4;
+    acpi_rsdp_t *rsdp = NULL;
+
+    if (ebda != 0) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    if (rsdp == NULL) {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x100000);
+    }
+    if (rsdp == NULL) {
+        return;
+    }
+
+    acpi_sdt_header_t *header = acpi_map(rsdp->rsdt_address, sizeof(acpi_sdt_header_t));
+    acpi_map(rsdp->rsdt_address, header->length);
+    if (acpi_checksum_ok(header, header->length)) {
+        rsdt = header;
+    }
+}
+
+acpi_sdt_header_t *acpi_find_table(const char *signature) {
+    if (rsdt == NULL) {
+        return NULL;
+    }
+
+    uint32_t count = (rsdt->length - sizeof(acpi_sdt_header_t)) / 4;
+    uint32_t *entries = (uint32_t *)(rsdt + 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        acpi_sdt_header_t *table = acpi_map(entries[i], sizeof(acpi_sdt_header_t));
+        if (memcmp(table->signature, signature, 4) == 0) {
+            acpi_map(entries[i], table->length);
+            return table;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed)) acpi_mcfg_entry_t;
+
+void acpi_init();
+acpi_sdt_header_t *acpi_find_table(const char *signature);
+
+#endif
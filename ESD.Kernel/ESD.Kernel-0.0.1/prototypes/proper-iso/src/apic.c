@@ -0,0 +1,58 @@
+#include "apic.h"
+#include "cpu.h"
+#include "paging.h"
+#include <stddef.h>
+
+static volatile uint32_t *lapic = NULL;
+
+// Local APIC ID of each logical CPU; only the BSP is known for now
+static uint32_t apic_ids[MAX_CPUS];
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+}
+
+void lapic_init() {
+    if (!cpu_features.apic) {
+        return;
+    }
+
+    uint64_t base = rdmsr(IA32_APIC_BASE_MSR);
+    wrmsr(IA32_APIC_BASE_MSR, base | APIC_BASE_ENABLE);
+
+    lapic = paging_map_mmio((uint32_t)base & 0xFFFFF000, 4096);
+    if (lapic == NULL) {
+        return;
+    }
+
+    // Software-enable; legacy PIC interrupts keep arriving through LINT0
+    lapic_write(APIC_SVR, 0x100 | APIC_SPURIOUS_VECTOR);
+    apic_ids[0] = lapic_id();
+}
+
+int lapic_present() {
+    return lapic != NULL;
+}
+
+void lapic_eoi() {
+    if (lapic != NULL) {
+        lapic_write(APIC_EOI, 0);
+    }
+}
+
+uint32_t lapic_id() {
+    return lapic != NULL ? lapic_read(APIC_ID) >> 24 : 0;
+}
+
+uint32_t cpu_apic_id(uint32_t cpu) {
+    return cpu < MAX_CPUS ? apic_ids[cpu] : apic_ids[0];
+}
+
+// Application processors are never started, so only the BSP runs code
+uint32_t cpu_online_count() {
+    return 1;
+}
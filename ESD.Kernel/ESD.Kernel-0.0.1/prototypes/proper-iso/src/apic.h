@@ -0,0 +1,25 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE   (1 << 11)
+
+#define APIC_ID       0x020
+#define APIC_EOI      0x0B0
+#define APIC_SVR      0x0F0
+#define APIC_ICR_LOW  0x300
+#define APIC_ICR_HIGH 0x310
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+void lapic_init();
+int lapic_present();
+void lapic_eoi();
+uint32_t lapic_id();
+uint32_t cpu_apic_id(uint32_t cpu);
+uint32_t cpu_online_count();
+
+#endif
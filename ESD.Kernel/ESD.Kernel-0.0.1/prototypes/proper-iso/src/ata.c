@@ -0,0 +1,480 @@
+#include "ata.h"
+#include "pci.h"
+#include "pmm.h"
+#include "paging.h"
+#include "isr.h"
+#include "timer.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static ata_channel_t channels[2];
+static const char *drive_names[4] = { "hda", "hdb", "hdc", "hdd" };
+
+static inline void ata_delay(ata_channel_t *chan) {
+    // Each alternate status read takes ~100ns
+    for (int i = 0; i < 4; i++) {
+        inb(chan->ctrl);
+    }
+}
+
+static int ata_wait_not_busy(ata_channel_t *chan) {
+    for (uint32_t i = 0; i < 1000000; i++) {
+        uint8_t status = inb(chan->io + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+    }
+    return -1;
+}
+
+static int ata_wait_drq(ata_channel_t *chan) {
+    int status = ata_wait_not_busy(chan);
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        return -1;
+    }
+    while (!(status & ATA_SR_DRQ)) {
+        status = inb(chan->io + ATA_REG_STATUS);
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void ata_select(ata_drive_t *drive, uint32_t lba) {
+    ata_channel_t *chan = drive->chan;
+    uint8_t head = drive->lba48 ? 0 : (lba >> 24) & 0x0F;
+
+    outb(chan->io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | head);
+    ata_delay(chan);
+}
+
+static void ata_setup_lba(ata_drive_t *drive, uint32_t lba, uint32_t count) {
+    uint16_t io = drive->chan->io;
+
+    if (drive->lba48) {
+        outb(io + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outb(io + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+        outb(io + ATA_REG_LBA1, 0);
+        outb(io + ATA_REG_LBA2, 0);
+    }
+    outb(io + ATA_REG_SECCOUNT, count & 0xFF);
+    outb(io + ATA_REG_LBA0, lba & 0xFF);
+    outb(io + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    outb(io + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+}
+
+// Synchronous word-at-a-time transfer, used without bus mastering
+static int ata_pio_transfer(ata_drive_t *drive, blk_request_t *group) {
+    ata_channel_t *chan = drive->chan;
+    int write = group->write;
+
+    ata_wait_not_busy(chan);
+    ata_select(drive, group->lba);
+    ata_setup_lba(drive, group->lba, group->total);
+    if (drive->lba48) {
+        outb(chan->io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT);
+    } else {
+        outb(chan->io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    }
+
+    for (blk_request_t *seg = group; seg != NULL; seg = seg->seg_next) {
+        uint16_t *buf = seg->buffer;
+        for (uint32_t s = 0; s < seg->count; s++) {
+            if (ata_wait_drq(chan) != 0) {
+                return -1;
+            }
+            if (write) {
+                asm volatile ( "rep outsw" : "+S"(buf) : "c"(256), "d"(chan->io) : "memory" );
+            } else {
+                asm volatile ( "rep insw" : "+D"(buf) : "c"(256), "d"(chan->io) : "memory" );
+            }
+        }
+    }
+
+    if (write) {
+        outb(chan->io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        ata_wait_not_busy(chan);
+    }
+    return 0;
+}
+
+// Send a 12-byte SCSI packet and read len bytes of response by PIO.
+// The byte count limit of one sector makes every DRQ block a sector.
+static int atapi_command(ata_drive_t *drive, const uint8_t *packet, void *buf, uint32_t len) {
+    ata_channel_t *chan = drive->chan;
+    uint16_t *out = buf;
+
+    if (ata_wait_not_busy(chan) < 0) {
+        return -1;
+    }
+    outb(chan->io + ATA_REG_DRIVE, 0xA0 | (drive->slave << 4));
+    ata_delay(chan);
+    outb(chan->io + ATA_REG_FEATURES, 0);
+    outb(chan->io + ATA_REG_LBA1, ATAPI_SECTOR_SIZE & 0xFF);
+    outb(chan->io + ATA_REG_LBA2, ATAPI_SECTOR_SIZE >> 8);
+    outb(chan->io + ATA_REG_COMMAND, ATA_CMD_PACKET);
+
+    if (ata_wait_drq(chan) != 0) {
+        return -1;
+    }
+    const uint16_t *words = (const uint16_t *)packet;
+    asm volatile ( "rep outsw" : "+S"(words) : "c"(6), "d"(chan->io) : "memory" );
+    ata_delay(chan);
+
+    while (len > 0) {
+        if (ata_wait_drq(chan) != 0) {
+            return -1;
+        }
+        uint32_t n = inb(chan->io + ATA_REG_LBA1) | (inb(chan->io + ATA_REG_LBA2) << 8);
+        if (n == 0 || n > len) {
+            return -1;
+        }
+        asm volatile ( "rep insw" : "+D"(out) : "c"(n / 2), "d"(chan->io) : "memory" );
+        len -= n;
+    }
+    return ata_wait_not_busy(chan) < 0 ? -1 : 0;
+}
+
+static int atapi_transfer(ata_drive_t *drive, blk_request_t *group) {
+    uint32_t lba = group->lba;
+
+    if (group->write) {
+        return -1;
+    }
+    for (blk_request_t *seg = group; seg != NULL; seg = seg->seg_next) {
+        uint8_t packet[12] = { ATAPI_CMD_READ10, 0,
+                               lba >> 24, lba >> 16, lba >> 8, lba,
+                               0, seg->count >> 8, seg->count, 0, 0, 0 };
+        if (atapi_command(drive, packet, seg->buffer, seg->count * ATAPI_SECTOR_SIZE) != 0) {
+            return -1;
+        }
+        lba += seg->count;
+    }
+    return 0;
+}
+
+// Returns the medium's sector count, 0 without a readable disc. The
+// first command after reset usually fails with a unit attention.
+static uint32_t atapi_capacity(ata_drive_t *drive) {
+    uint8_t packet[12] = { ATAPI_CMD_READ_CAPACITY };
+    uint8_t reply[8];
+
+    for (int tries = 0; tries < 3; tries++) {
+        if (atapi_command(drive, packet, reply, sizeof(reply)) == 0) {
+            uint32_t last = ((uint32_t)reply[0] << 24) | (reply[1] << 16) | (reply[2] << 8) | reply[3];
+            return last + 1;
+        }
+        inb(drive->chan->io + ATA_REG_ERROR);
+    }
+    return 0;
+}
+
+// Describe every segment of the group in the PRD table, splitting at
+// page and 64 KiB boundaries and coalescing physically contiguous runs
+static int ata_build_prdt(ata_channel_t *chan, blk_request_t *group) {
+    int n = -1;
+
+    for (blk_request_t *seg = group; seg != NULL; seg = seg->seg_next) {
+        uint32_t virt = (uint32_t)seg->buffer;
+        uint32_t left = seg->count * ATA_SECTOR_SIZE;
+
+        while (left > 0) {
+            uint32_t phys = paging_translate(virt);
+            uint32_t chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+            if (chunk > left) {
+                chunk = left;
+            }
+            if (phys == 0) {
+                return -1;
+            }
+
+            ata_prd_t *prev = n >= 0 ? &chan->prdt[n] : NULL;
+            uint32_t prev_len = prev != NULL ? (prev->bytes ? prev->bytes : 0x10000) : 0;
+            if (prev != NULL && prev->addr + prev_len == phys &&
+                ((phys ^ (phys + chunk - 1)) & 0xFFFF0000) == 0 &&
+                (prev->addr & 0xFFFF0000) == (phys & 0xFFFF0000) &&
+                prev_len + chunk <= 0x10000) {
+                prev->bytes = (uint16_t)(prev_len + chunk);
+            } else {
+                if (++n >= ATA_MAX_PRDS) {
+                    return -1;
+                }
+                chan->prdt[n].addr = phys;
+                chan->prdt[n].bytes = (uint16_t)chunk;
+                chan->prdt[n].flags = 0;
+            }
+            virt += chunk;
+            left -= chunk;
+        }
+    }
+
+    if (n < 0) {
+        return -1;
+    }
+    chan->prdt[n].flags = 0x8000;
+    return 0;
+}
+
+static int ata_dma_start(ata_drive_t *drive, blk_request_t *group) {
+    ata_channel_t *chan = drive->chan;
+
+    if (ata_build_prdt(chan, group) != 0) {
+        return -1;
+    }
+
+    outl(chan->bmide + BM_PRDT, paging_translate((uint32_t)chan->prdt));
+    outb(chan->bmide + BM_STATUS, inb(chan->bmide + BM_STATUS) | BM_SR_IRQ | BM_SR_ERR);
+    outb(chan->bmide + BM_COMMAND, group->write ? 0 : BM_CMD_READ);
+
+    ata_wait_not_busy(chan);
+    ata_select(drive, group->lba);
+    ata_setup_lba(drive, group->lba, group->total);
+    if (drive->lba48) {
+        outb(chan->io + ATA_REG_COMMAND, group->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        outb(chan->io + ATA_REG_COMMAND, group->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+
+    outb(chan->bmide + BM_COMMAND, inb(chan->bmide + BM_COMMAND) | BM_CMD_START);
+    return 0;
+}
+
+// Caller holds chan->lock. Alternates between the two drives' queues.
+static void ata_dispatch(ata_channel_t *chan) {
+    while (chan->active == NULL) {
+        ata_drive_t *drive = NULL;
+        for (int i = 1; i <= 2; i++) {
+            ata_drive_t *d = &chan->drives[(chan->last_drive + i) % 2];
+            if (d->present && !blk_queue_empty(&d->queue)) {
+                drive = d;
+                chan->last_drive = (chan->last_drive + i) % 2;
+                break;
+            }
+        }
+        if (drive == NULL) {
+            return;
+        }
+
+        blk_request_t *group = blk_queue_next(&drive->queue);
+
+        // Optical drives are rare and slow enough that PIO is fine
+        if (drive->atapi) {
+            int err = atapi_transfer(drive, group);
+            blk_complete(group, err ? BLK_ERROR : BLK_DONE);
+            continue;
+        }
+
+        if (chan->bmide != 0 && ata_dma_start(drive, group) == 0) {
+            chan->active = group;
+            chan->active_drive = drive;
+            return;
+        }
+
+        // No bus master (or an unmappable buffer): finish it right here
+        int err = ata_pio_transfer(drive, group);
+        blk_complete(group, err ? BLK_ERROR : BLK_DONE);
+    }
+}
+
+static void ata_irq(ata_channel_t *chan) {
+    uint32_t flags = spin_lock_irqsave(&chan->lock);
+
+    if (chan->active == NULL || chan->bmide == 0) {
+        inb(chan->io + ATA_REG_STATUS);
+        spin_unlock_irqrestore(&chan->lock, flags);
+        return;
+    }
+
+    uint8_t bm_status = inb(chan->bmide + BM_STATUS);
+    if (!(bm_status & BM_SR_IRQ)) {
+        spin_unlock_irqrestore(&chan->lock, flags);
+        return;
+    }
+
+    outb(chan->bmide + BM_COMMAND, 0);
+    uint8_t status = inb(chan->io + ATA_REG_STATUS);
+    outb(chan->bmide + BM_STATUS, bm_status | BM_SR_IRQ | BM_SR_ERR);
+
+    blk_request_t *group = chan->active;
+    chan->active = NULL;
+    int err = (status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & BM_SR_ERR);
+    blk_complete(group, err ? BLK_ERROR : BLK_DONE);
+
+    ata_dispatch(chan);
+    spin_unlock_irqrestore(&chan->lock, flags);
+}
+
+static void ata_primary_irq(registers_t *regs) {
+    (void)regs;
+    ata_irq(&channels[0]);
+}
+
+static void ata_secondary_irq(registers_t *regs) {
+    (void)regs;
+    ata_irq(&channels[1]);
+}
+
+static void ata_submit(block_device_t *dev, blk_request_t *req) {
+    ata_drive_t *drive = dev->driver_data;
+    ata_channel_t *chan = drive->chan;
+    uint32_t flags = spin_lock_irqsave(&chan->lock);
+
+    blk_queue_add(&drive->queue, req);
+    ata_dispatch(chan);
+
+    spin_unlock_irqrestore(&chan->lock, flags);
+}
+
+static void ata_copy_model(ata_drive_t *drive, uint16_t *ident) {
+    for (int i = 0; i < 20; i++) {
+        drive->model[i * 2] = ident[27 + i] >> 8;
+        drive->model[i * 2 + 1] = ident[27 + i] & 0xFF;
+    }
+    drive->model[40] = '\0';
+    for (int i = 39; i >= 0 && drive->model[i] == ' '; i--) {
+        drive->model[i] = '\0';
+    }
+}
+
+static void ata_identify(ata_drive_t *drive) {
+    ata_channel_t *chan = drive->chan;
+    uint16_t ident[256];
+
+    outb(chan->io + ATA_REG_DRIVE, 0xA0 | (drive->slave << 4));
+    ata_delay(chan);
+    outb(chan->io + ATA_REG_SECCOUNT, 0);
+    outb(chan->io + ATA_REG_LBA0, 0);
+    outb(chan->io + ATA_REG_LBA1, 0);
+    outb(chan->io + ATA_REG_LBA2, 0);
+    outb(chan->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    if (inb(chan->io + ATA_REG_STATUS) == 0 || ata_wait_not_busy(chan) < 0) {
+        return;
+    }
+
+    uint8_t mid = inb(chan->io + ATA_REG_LBA1);
+    uint8_t hi = inb(chan->io + ATA_REG_LBA2);
+    if (mid == 0x14 && hi == 0xEB) {
+        drive->atapi = 1;
+        outb(chan->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
+    } else if (mid != 0 || hi != 0) {
+        return;
+    }
+
+    if (ata_wait_drq(chan) != 0) {
+        return;
+    }
+    uint16_t *buf = ident;
+    asm volatile ( "rep insw" : "+D"(buf) : "c"(256), "d"(chan->io) : "memory" );
+
+    drive->present = 1;
+    ata_copy_model(drive, ident);
+    if (drive->atapi) {
+        return;
+    }
+
+    drive->lba48 = (ident[83] >> 10) & 1;
+    if (drive->lba48 && ident[103] == 0 && ident[102] == 0) {
+        drive->sectors = ident[100] | ((uint32_t)ident[101] << 16);
+    } else {
+        drive->lba48 = 0;
+        drive->sectors = ident[60] | ((uint32_t)ident[61] << 16);
+    }
+}
+
+static void ata_channel_init(ata_channel_t *chan, int index, uint16_t io, uint16_t ctrl,
+                             uint16_t bmide, uint8_t irq) {
+    chan->io = io;
+    chan->ctrl = ctrl;
+    chan->bmide = bmide;
+    chan->irq = irq;
+    chan->active = NULL;
+    chan->last_drive = 1;
+    spin_init(&chan->lock, index == 0 ? "ata0" : "ata1");
+
+    // Floating bus: no controller behind these ports
+    if (inb(io + ATA_REG_STATUS) == 0xFF) {
+        return;
+    }
+
+    if (bmide != 0) {
+        chan->prdt = (ata_prd_t *)pmm_alloc_frame();
+        if (chan->prdt == NULL) {
+            chan->bmide = 0;
+        }
+    }
+
+    // Interrupts only matter for DMA completion, PIO polls
+    outb(ctrl, chan->bmide != 0 ? 0x00 : 0x02);
+
+    for (int i = 0; i < 2; i++) {
+        ata_drive_t *drive = &chan->drives[i];
+        drive->chan = chan;
+        drive->slave = i;
+        ata_identify(drive);
+        if (!drive->present) {
+            continue;
+        }
+        if (drive->atapi) {
+            drive->sectors = atapi_capacity(drive);
+            if (drive->sectors == 0) {
+                continue;
+            }
+            blk_queue_init(&drive->queue, ATAPI_MAX_SECTORS, ATA_MAX_SEGS);
+        } else {
+            blk_queue_init(&drive->queue, drive->lba48 ? ATA_MAX_SECTORS : ATA_MAX_SECTORS - 1, ATA_MAX_SEGS);
+        }
+
+        drive->blk.name = drive_names[index * 2 + i];
+        drive->blk.sector_size = drive->atapi ? ATAPI_SECTOR_SIZE : ATA_SECTOR_SIZE;
+        drive->blk.sector_count = drive->sectors;
+        drive->blk.submit = ata_submit;
+        drive->blk.driver_data = drive;
+        blk_register(&drive->blk);
+    }
+}
+
+void ata_init() {
+    uint16_t bmide = 0;
+    pci_device_t *ide = pci_find_class(PCI_CLASS_STORAGE, 0x01, NULL);
+
+    // prog_if bit 7: controller supports bus mastering
+    if (ide != NULL && (ide->prog_if & 0x80) && ide->bars[4].is_io) {
+        bmide = ide->bars[4].base;
+        pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    }
+
+    ata_channel_init(&channels[0], 0, ATA_PRIMARY_IO, ATA_PRIMARY_CTRL, bmide, 14);
+    ata_channel_init(&channels[1], 1, ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, bmide ? bmide + 8 : 0, 15);
+
+    isr_install_handler(IRQ14, ata_primary_irq);
+    isr_install_handler(IRQ15, ata_secondary_irq);
+    pic_unmask_irq(2);
+    pic_unmask_irq(14);
+    pic_unmask_irq(15);
+}
+
+ata_drive_t *ata_get_drive(int index) {
+    if (index < 0 || index >= 4) {
+        return NULL;
+    }
+    ata_drive_t *drive = &channels[index / 2].drives[index % 2];
+    return drive->present ? drive : NULL;
+}
+
+void ata_print_drives() {
+    for (int i = 0; i < 4; i++) {
+        ata_drive_t *drive = ata_get_drive(i);
+        if (drive == NULL) {
+            continue;
+        }
+        k_print_string(drive_names[i]);
+        k_print_string(drive->atapi ? ": ATAPI " : ": ATA ");
+        k_print_string(drive->model);
+        k_print_string(" sectors=");
+        k_print_dec(drive->sectors);
+        k_print_string(drive->chan->bmide && !drive->atapi ? " dma" : " pio");
+        k_print_string("\n");
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include "blk.h"
+#include "spinlock.h"
+
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_SECONDARY_IO   0x170
+#define ATA_SECONDARY_CTRL 0x376
+
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_FEATURES 1
+#define ATA_REG_SECCOUNT 2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7
+#define ATA_REG_COMMAND  7
+
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_BSY  0x80
+
+#define ATA_CMD_READ_PIO      0x20
+#define ATA_CMD_READ_PIO_EXT  0x24
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_PIO     0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_PACKET        0xA0
+#define ATA_CMD_IDENTIFY_PACKET 0xA1
+#define ATA_CMD_IDENTIFY      0xEC
+
+// Bus master IDE registers, relative to the channel's BMIDE base
+#define BM_COMMAND 0
+#define BM_STATUS  2
+#define BM_PRDT    4
+
+#define BM_CMD_START 0x01
+#define BM_CMD_READ  0x08
+#define BM_SR_ERR    0x02
+#define BM_SR_IRQ    0x04
+
+#define ATAPI_CMD_READ_CAPACITY 0x25
+#define ATAPI_CMD_READ10        0x28
+
+#define ATA_SECTOR_SIZE 512
+#define ATAPI_SECTOR_SIZE 2048
+#define ATAPI_MAX_SECTORS 32
+#define ATA_MAX_SECTORS 256
+#define ATA_MAX_SEGS    32
+#define ATA_MAX_PRDS    128
+
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;             // 0 means 64 KiB
+    uint16_t flags;             // bit 15: last entry
+} __attribute__((packed)) ata_prd_t;
+
+struct ata_channel;
+
+typedef struct ata_drive {
+    struct ata_channel *chan;
+    uint8_t slave;
+    uint8_t present;
+    uint8_t atapi;
+    uint8_t lba48;
+    uint32_t sectors;
+    char model[41];
+    blk_queue_t queue;
+    block_device_t blk;
+} ata_drive_t;
+
+typedef struct ata_channel {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bmide;             // 0 when bus mastering is unavailable
+    uint8_t irq;
+    ata_prd_t *prdt;
+    ata_drive_t drives[2];
+    blk_request_t *active;
+    ata_drive_t *active_drive;
+    int last_drive;
+    spinlock_t lock;
+} ata_channel_t;
+
+void ata_init();
+ata_drive_t *ata_get_drive(int index);
+void ata_print_drives();
+
+#endif
@@ -0,0 +1,472 @@
+#include "bcache.h"
+#include "pmm.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "tasklet.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define BCACHE_RA_STREAMS 4
+
+typedef struct {
+    block_device_t *dev;
+    uint32_t last;                  // last block handed out
+    uint32_t next;                  // first block not yet read ahead
+} bcache_stream_t;
+
+static bcache_buf_t buffers[BCACHE_BUFFERS];
+static bcache_buf_t *hash_table[BCACHE_HASH_SIZE];
+static int buffer_count = 0;
+static uint32_t access_clock = 0;
+static bcache_stream_t streams[BCACHE_RA_STREAMS];
+static int stream_victim = 0;
+static bcache_stats_t stats;
+
+static spinlock_t bcache_lock;
+static ktimer_t writeback_timer;
+static tasklet_t writeback_tasklet;
+
+static inline uint32_t bcache_hash(block_device_t *dev, uint32_t block) {
+    return (((uint32_t)dev >> 4) ^ block ^ (block >> 6)) % BCACHE_HASH_SIZE;
+}
+
+static bcache_buf_t *bcache_lookup(block_device_t *dev, uint32_t block) {
+    for (bcache_buf_t *b = hash_table[bcache_hash(dev, block)]; b != NULL; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void bcache_unhash(bcache_buf_t *buf) {
+    if (buf->dev == NULL) {
+        return;
+    }
+    bcache_buf_t **pos = &hash_table[bcache_hash(buf->dev, buf->block)];
+    while (*pos != NULL && *pos != buf) {
+        pos = &(*pos)->hash_next;
+    }
+    if (*pos != NULL) {
+        *pos = buf->hash_next;
+    }
+    buf->dev = NULL;
+}
+
+static void bcache_touch(bcache_buf_t *buf) {
+    buf->prev_access = buf->last_access;
+    buf->last_access = ++access_clock;
+}
+
+// LRU-2: evict the block whose second-to-last reference is oldest. Blocks
+// referenced only once have an infinite backward distance and go first,
+// so a single large scan cannot push out the working set.
+static bcache_buf_t *bcache_victim() {
+    bcache_buf_t *victim = NULL;
+
+    for (int i = 0; i < buffer_count; i++) {
+        bcache_buf_t *b = &buffers[i];
+        if (b->refcount != 0 || (b->flags & (BUF_BUSY | BUF_DIRTY))) {
+            continue;
+        }
+        if (victim == NULL || b->prev_access < victim->prev_access ||
+            (b->prev_access == victim->prev_access && b->last_access < victim->last_access)) {
+            victim = b;
+        }
+    }
+
+    if (victim != NULL) {
+        if (victim->dev != NULL) {
+            stats.evictions++;
+        }
+        bcache_unhash(victim);
+    }
+    return victim;
+}
+
+static void bcache_assign(bcache_buf_t *buf, block_device_t *dev, uint32_t block) {
+    buf->dev = dev;
+    buf->block = block;
+    buf->flags = BUF_BUSY;
+    // No reference yet: the caller's touch makes it the first, and a
+    // read-ahead block stays unreferenced until it is used
+    buf->prev_access = 0;
+    buf->last_access = 0;
+
+    uint32_t h = bcache_hash(dev, block);
+    buf->hash_next = hash_table[h];
+    hash_table[h] = buf;
+}
+
+static void bcache_end_io(blk_request_t *req) {
+    bcache_buf_t *buf = req->private;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+
+    if (req->write) {
+        if (req->status != BLK_DONE) {
+            buf->flags |= BUF_DIRTY;
+        }
+    } else if (req->status == BLK_DONE) {
+        buf->flags |= BUF_VALID;
+    }
+    buf->flags &= ~BUF_BUSY;
+
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// Cache blocks on dev, counting a partial one at the end
+static inline uint32_t bcache_dev_blocks(block_device_t *dev) {
+    uint32_t per_block = BCACHE_BLOCK_SIZE / dev->sector_size;
+    return (dev->sector_count + per_block - 1) / per_block;
+}
+
+static void bcache_submit(bcache_buf_t *buf, int write) {
+    block_device_t *dev = buf->dev;
+    uint32_t per_block = BCACHE_BLOCK_SIZE / dev->sector_size;
+    uint32_t lba = buf->block * per_block;
+
+    buf->req.lba = lba;
+    buf->req.count = lba + per_block > dev->sector_count ? dev->sector_count - lba : per_block;
+    buf->req.buffer = buf->data;
+    buf->req.write = write;
+    buf->req.done = bcache_end_io;
+    buf->req.private = buf;
+    blk_submit(dev, &buf->req);
+}
+
+static bcache_stream_t *bcache_stream(block_device_t *dev) {
+    for (int i = 0; i < BCACHE_RA_STREAMS; i++) {
+        if (streams[i].dev == dev) {
+            return &streams[i];
+        }
+    }
+    bcache_stream_t *s = &streams[stream_victim];
+    stream_victim = (stream_victim + 1) % BCACHE_RA_STREAMS;
+    s->dev = dev;
+    s->last = 0xFFFFFFFF;
+    s->next = 0;
+    return s;
+}
+
+// On sequential access keep BCACHE_READAHEAD blocks in flight, topping
+// the window up once half of it has been consumed so each refill goes to
+// the device as one merged request. Caller holds bcache_lock; the
+// buffers to read are returned in batch.
+static int bcache_readahead(block_device_t *dev, uint32_t block, bcache_buf_t **batch) {
+    bcache_stream_t *s = bcache_stream(dev);
+    uint32_t blocks = bcache_dev_blocks(dev);
+    int n = 0;
+
+    int sequential = s->last + 1 == block;
+    s->last = block;
+    if (!sequential || (s->next > block && s->next - block > BCACHE_READAHEAD / 2)) {
+        return 0;
+    }
+
+    uint32_t start = s->next > block ? s->next : block + 1;
+    uint32_t end = block + 1 + BCACHE_READAHEAD;
+    if (end > blocks) {
+        end = blocks;
+    }
+    for (uint32_t b = start; b < end; b++) {
+        if (bcache_lookup(dev, b) != NULL) {
+            continue;
+        }
+        bcache_buf_t *buf = bcache_victim();
+        if (buf == NULL) {
+            break;
+        }
+        bcache_assign(buf, dev, b);
+        buf->flags |= BUF_READAHEAD;
+        batch[n++] = buf;
+    }
+    s->next = end;
+    stats.readahead += n;
+    return n;
+}
+
+// Write every dirty block (of dev, or all devices) sorted by device and
+// block number, with each device plugged so adjacent blocks merge into
+// large writes. Returns the number of blocks submitted. The batch lives
+// on the stack: the write-back tasklet can run at IRQ exit in the middle
+// of a foreground call.
+static int bcache_writeback(block_device_t *dev) {
+    bcache_buf_t *batch[BCACHE_BUFFERS];
+    int n = 0;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+
+    for (int i = 0; i < buffer_count; i++) {
+        bcache_buf_t *b = &buffers[i];
+        if ((b->flags & (BUF_DIRTY | BUF_BUSY)) != BUF_DIRTY || (dev != NULL && b->dev != dev)) {
+            continue;
+        }
+        b->flags = (b->flags & ~BUF_DIRTY) | BUF_BUSY;
+
+        int j = n++;
+        while (j > 0 && (batch[j - 1]->dev > b->dev ||
+                         (batch[j - 1]->dev == b->dev && batch[j - 1]->block > b->block))) {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = b;
+    }
+
+    if (n > 0) {
+        stats.writeback_blocks += n;
+        stats.writeback_batches++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || batch[i]->dev != batch[i - 1]->dev) {
+            blk_plug(batch[i]->dev);
+        }
+        bcache_submit(batch[i], 1);
+        if (i == n - 1 || batch[i + 1]->dev != batch[i]->dev) {
+            blk_unplug(batch[i]->dev);
+        }
+    }
+    return n;
+}
+
+// The timer fires in IRQ context; the write-back itself runs as a tasklet
+static void bcache_writeback_timer(void *ctx) {
+    tasklet_schedule(ctx);
+}
+
+static void bcache_writeback_work(void *ctx) {
+    (void)ctx;
+    bcache_writeback(NULL);
+    timer_add(&writeback_timer, MS_TO_TICKS(BCACHE_WRITEBACK_MS), bcache_writeback_timer, &writeback_tasklet);
+}
+
+void bcache_init() {
+    spin_init(&bcache_lock, "bcache");
+
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        uint32_t frame = pmm_alloc_frame();
+        if (frame == 0) {
+            break;
+        }
+        buffers[i].data = (uint8_t *)frame;
+        buffer_count++;
+    }
+
+    tasklet_init(&writeback_tasklet, bcache_writeback_work, NULL);
+    timer_add(&writeback_timer, MS_TO_TICKS(BCACHE_WRITEBACK_MS), bcache_writeback_timer, &writeback_tasklet);
+}
+
+static bcache_buf_t *bcache_getblk(block_device_t *dev, uint32_t block, int fill) {
+    bcache_buf_t *batch[BCACHE_READAHEAD];
+    bcache_buf_t *buf;
+    int need_read = 0;
+    int ra = 0;
+
+    if (block >= bcache_dev_blocks(dev)) {
+        return NULL;
+    }
+
+    for (int tries = 0; ; tries++) {
+        uint32_t flags = spin_lock_irqsave(&bcache_lock);
+        stats.lookups++;
+
+        buf = bcache_lookup(dev, block);
+        if (buf != NULL) {
+            stats.hits++;
+            if (buf->flags & BUF_READAHEAD) {
+                stats.readahead_hits++;
+                buf->flags &= ~BUF_READAHEAD;
+            }
+            if (!(buf->flags & (BUF_VALID | BUF_BUSY))) {
+                // An earlier read failed: retry, or overwrite it whole
+                if (fill) {
+                    buf->flags |= BUF_BUSY;
+                    need_read = 1;
+                } else {
+                    buf->flags |= BUF_VALID;
+                }
+            }
+        } else if ((buf = bcache_victim()) != NULL) {
+            stats.misses++;
+            bcache_assign(buf, dev, block);
+            if (fill) {
+                need_read = 1;
+            } else {
+                buf->flags = BUF_VALID;
+            }
+        }
+
+        if (buf != NULL) {
+            buf->refcount++;
+            bcache_touch(buf);
+            if (fill) {
+                ra = bcache_readahead(dev, block, batch);
+            }
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        if (buf != NULL) {
+            break;
+        }
+        // Every buffer is dirty or in use: flush and wait for one to free up
+        if (bcache_writeback(NULL) == 0 && tries > 0) {
+            return NULL;
+        }
+        for (int i = 0; i < buffer_count; i++) {
+            while (buffers[i].flags & BUF_BUSY) {
+                cpu_relax();
+            }
+        }
+    }
+
+    if (ra > 0 || need_read) {
+        blk_plug(dev);
+        if (need_read) {
+            bcache_submit(buf, 0);
+        }
+        for (int i = 0; i < ra; i++) {
+            bcache_submit(batch[i], 0);
+        }
+        blk_unplug(dev);
+    }
+
+    while (buf->flags & BUF_BUSY) {
+        cpu_relax();
+    }
+    if (!(buf->flags & BUF_VALID)) {
+        bcache_put(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// Returns the referenced, up to date block or NULL on I/O error
+bcache_buf_t *bcache_get(block_device_t *dev, uint32_t block) {
+    return bcache_getblk(dev, block, 1);
+}
+
+void bcache_put(bcache_buf_t *buf) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    buf->refcount--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// Mark after modifying; the write-back timer writes it out
+void bcache_dirty(bcache_buf_t *buf) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    buf->flags |= BUF_DIRTY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// Write back dev's dirty blocks now and wait for them; -1 if any failed
+int bcache_sync(block_device_t *dev) {
+    bcache_writeback(dev);
+
+    for (int i = 0; i < buffer_count; i++) {
+        while (buffers[i].dev == dev && (buffers[i].flags & BUF_BUSY)) {
+            cpu_relax();
+        }
+    }
+    for (int i = 0; i < buffer_count; i++) {
+        if (buffers[i].dev == dev && (buffers[i].flags & BUF_DIRTY)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int bcache_read(block_device_t *dev, uint32_t offset, void *dst, uint32_t len) {
+    uint8_t *out = dst;
+
+    while (len > 0) {
+        uint32_t in_block = offset % BCACHE_BLOCK_SIZE;
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        bcache_buf_t *buf = bcache_get(dev, offset / BCACHE_BLOCK_SIZE);
+        if (buf == NULL) {
+            return -1;
+        }
+        memcpy(out, buf->data + in_block, chunk);
+        bcache_put(buf);
+
+        out += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int bcache_write(block_device_t *dev, uint32_t offset, const void *src, uint32_t len) {
+    const uint8_t *in = src;
+
+    while (len > 0) {
+        uint32_t in_block = offset % BCACHE_BLOCK_SIZE;
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        // Whole-block overwrites skip reading the old contents
+        bcache_buf_t *buf = bcache_getblk(dev, offset / BCACHE_BLOCK_SIZE, chunk != BCACHE_BLOCK_SIZE);
+        if (buf == NULL) {
+            return -1;
+        }
+        memcpy(buf->data + in_block, in, chunk);
+        bcache_dirty(buf);
+        bcache_put(buf);
+
+        in += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+const bcache_stats_t *bcache_get_stats() {
+    return &stats;
+}
+
+void bcache_print_stats() {
+    uint32_t dirty = 0;
+    uint32_t used = 0;
+
+    for (int i = 0; i < buffer_count; i++) {
+        if (buffers[i].dev != NULL) {
+            used++;
+        }
+        if (buffers[i].flags & BUF_DIRTY) {
+            dirty++;
+        }
+    }
+
+    k_print_string("bcache: ");
+    k_print_dec(used);
+    k_print_string("/");
+    k_print_dec(buffer_count);
+    k_print_string(" blocks, ");
+    k_print_dec(dirty);
+    k_print_string(" dirty\n  lookups=");
+    k_print_dec(stats.lookups);
+    k_print_string(" hits=");
+    k_print_dec(stats.hits);
+    k_print_string(" (");
+    k_print_dec(stats.lookups ? div_u64((uint64_t)stats.hits * 100, stats.lookups) : 0);
+    k_print_string("%) misses=");
+    k_print_dec(stats.misses);
+    k_print_string(" evictions=");
+    k_print_dec(stats.evictions);
+    k_print_string("\n  readahead=");
+    k_print_dec(stats.readahead);
+    k_print_string(" used=");
+    k_print_dec(stats.readahead_hits);
+    k_print_string(" writeback=");
+    k_print_dec(stats.writeback_blocks);
+    k_print_string(" in ");
+    k_print_dec(stats.writeback_batches);
+    k_print_string(" batches\n");
+}
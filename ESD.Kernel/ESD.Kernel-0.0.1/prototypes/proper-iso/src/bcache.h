@@ -0,0 +1,53 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "blk.h"
+
+#define BCACHE_BLOCK_SIZE   4096
+#define BCACHE_BUFFERS      256
+#define BCACHE_HASH_SIZE    64
+#define BCACHE_READAHEAD    8       // blocks kept in flight ahead of a sequential reader
+#define BCACHE_WRITEBACK_MS 1000
+
+#define BUF_VALID     0x01
+#define BUF_DIRTY     0x02
+#define BUF_BUSY      0x04          // read or write in flight
+#define BUF_READAHEAD 0x08          // brought in speculatively, not used yet
+
+typedef struct bcache_buf {
+    block_device_t *dev;
+    uint32_t block;
+    uint8_t *data;
+    volatile uint32_t flags;
+    uint32_t refcount;
+    uint32_t last_access;
+    uint32_t prev_access;           // 0 until the second reference (LRU-2)
+    blk_request_t req;
+    struct bcache_buf *hash_next;
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t readahead;
+    uint32_t readahead_hits;
+    uint32_t writeback_blocks;
+    uint32_t writeback_batches;
+} bcache_stats_t;
+
+void bcache_init();
+bcache_buf_t *bcache_get(block_device_t *dev, uint32_t block);
+void bcache_put(bcache_buf_t *buf);
+void bcache_dirty(bcache_buf_t *buf);
+int bcache_sync(block_device_t *dev);
+
+int bcache_read(block_device_t *dev, uint32_t offset, void *dst, uint32_t len);
+int bcache_write(block_device_t *dev, uint32_t offset, const void *src, uint32_t len);
+
+const bcache_stats_t *bcache_get_stats();
+void bcache_print_stats();
+
+#endif
@@ -0,0 +1,218 @@
+#include "blk.h"
+#include "timer.h"
+#include "cpu.h"
+#include "mem.h"
+#include <stddef.h>
+
+static block_device_t *blk_devices = NULL;
+
+void blk_register(block_device_t *dev) {
+    dev->plugged = 0;
+    dev->next = blk_devices;
+    blk_devices = dev;
+}
+
+block_device_t *blk_find(const char *name) {
+    for (block_device_t *dev = blk_devices; dev != NULL; dev = dev->next) {
+        if (strcmp(dev->name, name) == 0) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+block_device_t *blk_first() {
+    return blk_devices;
+}
+
+void blk_submit(block_device_t *dev, blk_request_t *req) {
+    req->status = BLK_PENDING;
+    dev->submit(dev, req);
+}
+
+// Spin until the driver completes req; needs interrupts enabled
+int blk_wait(blk_request_t *req) {
+    while (req->status == BLK_PENDING) {
+        cpu_relax();
+    }
+    return req->status == BLK_DONE ? 0 : -1;
+}
+
+// While plugged, drivers that honour it queue requests without starting
+// them, so a burst of submissions reaches the device as one batch
+void blk_plug(block_device_t *dev) {
+    dev->plugged++;
+}
+
+void blk_unplug(block_device_t *dev) {
+    if (--dev->plugged == 0 && dev->unplug != NULL) {
+        dev->unplug(dev);
+    }
+}
+
+static int blk_rw(block_device_t *dev, uint32_t lba, uint32_t count, void *buffer, int write) {
+    blk_request_t req;
+
+    req.lba = lba;
+    req.count = count;
+    req.buffer = buffer;
+    req.write = write;
+    req.done = NULL;
+    req.private = NULL;
+    blk_submit(dev, &req);
+    return blk_wait(&req);
+}
+
+int blk_read(block_device_t *dev, uint32_t lba, uint32_t count, void *buffer) {
+    return blk_rw(dev, lba, count, buffer, 0);
+}
+
+int blk_write(block_device_t *dev, uint32_t lba, uint32_t count, const void *buffer) {
+    return blk_rw(dev, lba, count, (void *)buffer, 1);
+}
+
+void blk_queue_init(blk_queue_t *q, uint32_t max_sectors, uint32_t max_segs) {
+    q->sorted = NULL;
+    q->fifo = NULL;
+    q->head_pos = 0;
+    q->max_sectors = max_sectors;
+    q->max_segs = max_segs;
+    q->merges = 0;
+    q->dispatched = 0;
+}
+
+int blk_queue_empty(blk_queue_t *q) {
+    return q->sorted == NULL;
+}
+
+static void blk_unlink(blk_request_t **list, blk_request_t *req, int fifo) {
+    for (blk_request_t **pos = list; *pos != NULL;
+         pos = fifo ? &(*pos)->fifo_next : &(*pos)->sort_next) {
+        if (*pos == req) {
+            *pos = fifo ? req->fifo_next : req->sort_next;
+            return;
+        }
+    }
+}
+
+// Put new in old's place in both lists (front merge makes new the anchor)
+static void blk_replace(blk_queue_t *q, blk_request_t *old, blk_request_t *new) {
+    for (blk_request_t **pos = &q->sorted; *pos != NULL; pos = &(*pos)->sort_next) {
+        if (*pos == old) {
+            new->sort_next = old->sort_next;
+            *pos = new;
+            break;
+        }
+    }
+    for (blk_request_t **pos = &q->fifo; *pos != NULL; pos = &(*pos)->fifo_next) {
+        if (*pos == old) {
+            new->fifo_next = old->fifo_next;
+            *pos = new;
+            break;
+        }
+    }
+}
+
+static int blk_try_merge(blk_queue_t *q, blk_request_t *req) {
+    for (blk_request_t *cur = q->sorted; cur != NULL; cur = cur->sort_next) {
+        if (cur->write != req->write ||
+            cur->total + req->count > q->max_sectors ||
+            cur->nsegs + 1 > q->max_segs) {
+            continue;
+        }
+
+        if (cur->lba + cur->total == req->lba) {
+            // Back merge: append to the segment chain
+            blk_request_t *tail = cur;
+            while (tail->seg_next != NULL) {
+                tail = tail->seg_next;
+            }
+            tail->seg_next = req;
+            cur->total += req->count;
+            cur->nsegs++;
+            q->merges++;
+            return 1;
+        }
+
+        if (req->lba + req->count == cur->lba) {
+            // Front merge: req becomes the anchor, keep the older deadline
+            req->seg_next = cur;
+            req->total = cur->total + req->count;
+            req->nsegs = cur->nsegs + 1;
+            req->deadline = cur->deadline;
+            blk_replace(q, cur, req);
+            q->merges++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void blk_queue_add(blk_queue_t *q, blk_request_t *req) {
+    req->total = req->count;
+    req->nsegs = 1;
+    req->seg_next = NULL;
+    req->sort_next = NULL;
+    req->fifo_next = NULL;
+    req->deadline = timer_ticks() +
+        MS_TO_TICKS(req->write ? BLK_WRITE_DEADLINE_MS : BLK_READ_DEADLINE_MS);
+
+    if (blk_try_merge(q, req)) {
+        return;
+    }
+
+    blk_request_t **pos = &q->sorted;
+    while (*pos != NULL && (*pos)->lba <= req->lba) {
+        pos = &(*pos)->sort_next;
+    }
+    req->sort_next = *pos;
+    *pos = req;
+
+    pos = &q->fifo;
+    while (*pos != NULL) {
+        pos = &(*pos)->fifo_next;
+    }
+    *pos = req;
+}
+
+// Pick the next group to dispatch: an expired request first, otherwise
+// continue the one-way sweep from the last position (C-SCAN)
+blk_request_t *blk_queue_next(blk_queue_t *q) {
+    blk_request_t *req = NULL;
+
+    if (q->fifo != NULL && !time_after(q->fifo->deadline, timer_ticks())) {
+        req = q->fifo;
+    } else {
+        for (blk_request_t *cur = q->sorted; cur != NULL; cur = cur->sort_next) {
+            if (cur->lba >= q->head_pos) {
+                req = cur;
+                break;
+            }
+        }
+        if (req == NULL) {
+            req = q->sorted;
+        }
+    }
+
+    if (req != NULL) {
+        blk_unlink(&q->sorted, req, 0);
+        blk_unlink(&q->fifo, req, 1);
+        q->head_pos = req->lba + req->total;
+        q->dispatched++;
+    }
+    return req;
+}
+
+// Complete a dispatched group and every request merged into it
+void blk_complete(blk_request_t *req, int status) {
+    while (req != NULL) {
+        // A waiter may reuse req as soon as it sees the status change
+        blk_request_t *next = req->seg_next;
+        void (*done)(blk_request_t *) = req->done;
+        req->status = status;
+        if (done != NULL) {
+            done(req);
+        }
+        req = next;
+    }
+}
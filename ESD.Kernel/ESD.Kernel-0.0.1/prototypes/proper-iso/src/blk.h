@@ -0,0 +1,70 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include <stdint.h>
+
+#define BLK_PENDING 0
+#define BLK_DONE    1
+#define BLK_ERROR   2
+
+// Deadline elevator: a request older than its deadline jumps the sweep
+#define BLK_READ_DEADLINE_MS  50
+#define BLK_WRITE_DEADLINE_MS 500
+
+typedef struct blk_request {
+    uint32_t lba;
+    uint32_t count;                     // sectors
+    void *buffer;
+    int write;
+    volatile int status;
+    void (*done)(struct blk_request *req);
+    void *private;
+
+    // Elevator state
+    uint32_t deadline;
+    uint32_t total;                     // sectors in the merged group
+    uint32_t nsegs;                     // requests in the merged group
+    struct blk_request *sort_next;
+    struct blk_request *fifo_next;
+    struct blk_request *seg_next;       // merged requests in LBA order
+} blk_request_t;
+
+typedef struct {
+    blk_request_t *sorted;              // ascending LBA
+    blk_request_t *fifo;                // arrival order
+    uint32_t head_pos;                  // LBA after the last dispatch
+    uint32_t max_sectors;
+    uint32_t max_segs;
+    uint32_t merges;
+    uint32_t dispatched;
+} blk_queue_t;
+
+typedef struct block_device {
+    const char *name;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    void (*submit)(struct block_device *dev, blk_request_t *req);
+    void (*unplug)(struct block_device *dev);   // optional, see blk_plug
+    void *driver_data;
+    int plugged;
+    struct block_device *next;
+} block_device_t;
+
+void blk_register(block_device_t *dev);
+block_device_t *blk_find(const char *name);
+block_device_t *blk_first();
+
+void blk_submit(block_device_t *dev, blk_request_t *req);
+int blk_wait(blk_request_t *req);
+void blk_plug(block_device_t *dev);
+void blk_unplug(block_device_t *dev);
+int blk_read(block_device_t *dev, uint32_t lba, uint32_t count, void *buffer);
+int blk_write(block_device_t *dev, uint32_t lba, uint32_t count, const void *buffer);
+
+void blk_queue_init(blk_queue_t *q, uint32_t max_sectors, uint32_t max_segs);
+void blk_queue_add(blk_queue_t *q, blk_request_t *req);
+blk_request_t *blk_queue_next(blk_queue_t *q);
+int blk_queue_empty(blk_queue_t *q);
+void blk_complete(blk_request_t *req, int status);
+
+#endif
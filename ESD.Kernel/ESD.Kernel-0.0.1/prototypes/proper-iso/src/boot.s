@@ -5,7 +5,7 @@ MBOOT_HEADER_MAGIC  equ 0x1BADB002
 MBOOT_PAGE_ALIGN    equ 1<<0
 MBOOT_MEM_INFO      equ 1<<1
 MBOOT_VIDEO_MODE    equ 1<<2
-MBOOT_HEADER_FLAGS  equ MBOOT_PAGE_ALIGN | MBOOT_MEM_INFO
+MBOOT_HEADER_FLAGS  equ MBOOT_PAGE_ALIGN | MBOOT_MEM_INFO | MBOOT_VIDEO_MODE
 MBOOT_CHECKSUM      equ -(MBOOT_HEADER_MAGIC + MBOOT_HEADER_FLAGS)
 
 section .multiboot
@@ -21,6 +21,12 @@ align 4
     dd 0        ; bss_end_addr
     dd 0        ; entry_addr
 
+    ; Preferred video mode: linear 1024x768x32, falls back to text mode
+    dd 0        ; mode_type (linear graphics)
+    dd 1024     ; width
+    dd 768      ; height
+    dd 32       ; depth
+
 ; Reserve a large aligned stack to prevent page faults
 section .bss
 align 16
@@ -36,8 +42,7 @@ extern k_main
 
 _start:
     ; Critical: zero out registers to avoid accessing invalid memory
-    xor eax, eax
-    xor ebx, ebx
+    ; EAX (multiboot magic) and EBX (multiboot info) are passed to k_main
     xor ecx, ecx
     xor edx, edx
     
@@ -48,8 +53,9 @@ _start:
     mov esp, stack_top
     and esp, 0xFFFFFFF0  ; Align stack to 16 bytes
     
-    ; Save multiboot info pointer from EBX if available
+    ; Pass multiboot info pointer and magic: k_main(magic, mbi)
     push ebx
+    push eax
     
     ; Call kernel main function
     call k_main
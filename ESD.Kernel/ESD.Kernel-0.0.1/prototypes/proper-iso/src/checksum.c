@@ -0,0 +1,131 @@
+#include "checksum.h"
+#include "cpu.h"
+#include "fpu.h"
+#include <stddef.h>
+
+// Below this size the cost of kernel_fpu_begin/end outweighs SIMD gains
+#define CSUM_SIMD_THRESHOLD 256
+// Each 32-bit lane gains at most 2 * 0xFFFF per 16 bytes; stop well
+// before a lane can wrap
+#define CSUM_SIMD_CHUNK     (32 * 1024)
+
+typedef uint32_t (*csum_fn)(const uint8_t *buf, uint32_t len);
+
+static uint32_t fold64(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+static uint32_t csum_generic(const uint8_t *buf, uint32_t len) {
+    uint64_t sum = 0;
+
+    for (; len >= 16; len -= 16, buf += 16) {
+        const uint32_t *w = (const uint32_t *)buf;
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    }
+    for (; len >= 4; len -= 4, buf += 4) {
+        sum += *(const uint32_t *)buf;
+    }
+    if (len >= 2) {
+        sum += *(const uint16_t *)buf;
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += *buf;
+    }
+    return fold64(sum);
+}
+
+// Widen 16-bit words into 32-bit lanes and add them up, four lanes of
+// headroom per register
+static uint32_t csum_sse2(const uint8_t *buf, uint32_t len) {
+    if (len < CSUM_SIMD_THRESHOLD) {
+        return csum_generic(buf, len);
+    }
+
+    uint32_t lanes[4] __attribute__((aligned(16)));
+    uint64_t sum = 0;
+
+    kernel_fpu_begin();
+    while (len >= 32) {
+        uint32_t chunk = len < CSUM_SIMD_CHUNK ? len & ~31u : CSUM_SIMD_CHUNK;
+
+        asm volatile ( "pxor %%xmm0, %%xmm0\n\t"
+                       "pxor %%xmm1, %%xmm1\n\t"
+                       "pxor %%xmm7, %%xmm7"
+                       ::: "memory" );
+        for (uint32_t off = 0; off < chunk; off += 32) {
+            asm volatile ( "movdqu   (%0), %%xmm2\n\t"
+                           "movdqu 16(%0), %%xmm4\n\t"
+                           "movdqa %%xmm2, %%xmm3\n\t"
+                           "movdqa %%xmm4, %%xmm5\n\t"
+                           "punpcklwd %%xmm7, %%xmm2\n\t"
+                           "punpckhwd %%xmm7, %%xmm3\n\t"
+                           "punpcklwd %%xmm7, %%xmm4\n\t"
+                           "punpckhwd %%xmm7, %%xmm5\n\t"
+                           "paddd %%xmm2, %%xmm0\n\t"
+                           "paddd %%xmm3, %%xmm1\n\t"
+                           "paddd %%xmm4, %%xmm0\n\t"
+                           "paddd %%xmm5, %%xmm1"
+                           : : "r"(buf + off) : "memory" );
+        }
+        asm volatile ( "movdqa %%xmm0, (%0)" : : "r"(lanes) : "memory" );
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        asm volatile ( "movdqa %%xmm1, (%0)" : : "r"(lanes) : "memory" );
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+        buf += chunk;
+        len -= chunk;
+    }
+    kernel_fpu_end();
+
+    sum += csum_generic(buf, len);
+    return fold64(sum);
+}
+
+static csum_fn csum_impl = csum_generic;
+static const char *impl_name = "generic";
+
+void csum_init() {
+    if (cpu_features.sse2) {
+        csum_impl = csum_sse2;
+        impl_name = "sse2";
+    }
+}
+
+const char *csum_impl_name() {
+    return impl_name;
+}
+
+uint32_t csum_partial(const void *buf, uint32_t len, uint32_t sum) {
+    uint64_t total = (uint64_t)sum + csum_impl(buf, len);
+    return fold64(total);
+}
+
+// A piece starting at an odd byte of the packet contributes its sum with
+// the bytes swapped
+uint32_t csum_pbuf(const pbuf_t *p, uint32_t offset, uint32_t len, uint32_t sum) {
+    uint32_t pos = 0;
+
+    for (; p != NULL && len > 0; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint32_t chunk = p->len - offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        uint16_t part = csum_fold(csum_impl(p->payload + offset, chunk));
+        if (pos & 1) {
+            part = (uint16_t)((part << 8) | (part >> 8));
+        }
+        sum = fold64((uint64_t)sum + part);
+        pos += chunk;
+        len -= chunk;
+        offset = 0;
+    }
+    return sum;
+}
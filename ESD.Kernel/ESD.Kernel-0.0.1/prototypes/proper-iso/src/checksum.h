@@ -0,0 +1,28 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include "pbuf.h"
+
+// Internet (ones' complement) checksum. Sums are taken over native 16-bit
+// loads, so the folded result can be stored as-is into a header in
+// network byte order. Call csum_init() after mem_init().
+void csum_init();
+const char *csum_impl_name();
+
+// Add len bytes at buf to a running 32-bit sum, returned unfolded
+uint32_t csum_partial(const void *buf, uint32_t len, uint32_t sum);
+// Same over len bytes of a chain starting at offset
+uint32_t csum_pbuf(const pbuf_t *p, uint32_t offset, uint32_t len, uint32_t sum);
+
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+static inline uint16_t csum_finish(uint32_t sum) {
+    return (uint16_t)~csum_fold(sum);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include "cpu.h"
+
+cpu_features_t cpu_features;
+
+void cpu_detect() {
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    cpu_features.max_leaf = a;
+    for (int i = 0; i < 4; i++) {
+        cpu_features.vendor[i] = (char)(b >> (i * 8));
+        cpu_features.vendor[i + 4] = (char)(d >> (i * 8));
+        cpu_features.vendor[i + 8] = (char)(c >> (i * 8));
+    }
+    cpu_features.vendor[12] = '\0';
+
+    if (cpu_features.max_leaf >= 1) {
+        cpuid(1, 0, &a, &b, &c, &d);
+        cpu_features.fpu   = (d >> 0) & 1;
+        cpu_features.tsc   = (d >> 4) & 1;
+        cpu_features.apic  = (d >> 9) & 1;
+        cpu_features.mtrr  = (d >> 12) & 1;
+        cpu_features.pat   = (d >> 16) & 1;
+        cpu_features.fxsr  = (d >> 24) & 1;
+        cpu_features.sse   = (d >> 25) & 1;
+        cpu_features.sse2  = (d >> 26) & 1;
+        cpu_features.xsave = (c >> 26) & 1;
+        cpu_features.avx   = (c >> 28) & 1;
+    }
+
+    if (cpu_features.max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        cpu_features.avx2 = (b >> 5) & 1;
+        cpu_features.erms = (b >> 9) & 1;
+    }
+}
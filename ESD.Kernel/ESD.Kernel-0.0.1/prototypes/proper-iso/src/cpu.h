@@ -0,0 +1,131 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR0_NW (1 << 29)
+#define CR0_CD (1 << 30)
+
+#define CR4_PGE        (1 << 7)
+#define CR4_OSFXSR     (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE    (1 << 18)
+
+#define EFLAGS_IF (1 << 9)
+
+#define MAX_CPUS 8
+
+typedef struct {
+    uint32_t max_leaf;
+    char vendor[13];
+    uint8_t fpu;
+    uint8_t tsc;
+    uint8_t apic;
+    uint8_t mtrr;
+    uint8_t pat;
+    uint8_t fxsr;
+    uint8_t sse;
+    uint8_t sse2;
+    uint8_t xsave;
+    uint8_t avx;
+    uint8_t avx2;
+    uint8_t erms;
+} cpu_features_t;
+
+extern cpu_features_t cpu_features;
+
+void cpu_detect();
+
+// Only the bootstrap processor runs for now
+static inline uint32_t cpu_id() {
+    return 0;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    asm volatile ( "cpuid"
+                   : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                   : "a"(leaf), "c"(subleaf) );
+}
+
+static inline uint32_t read_cr0() {
+    uint32_t val;
+    asm volatile ( "mov %%cr0, %0" : "=r"(val) );
+    return val;
+}
+
+static inline void write_cr0(uint32_t val) {
+    asm volatile ( "mov %0, %%cr0" : : "r"(val) : "memory" );
+}
+
+static inline uint32_t read_cr4() {
+    uint32_t val;
+    asm volatile ( "mov %%cr4, %0" : "=r"(val) );
+    return val;
+}
+
+static inline void write_cr4(uint32_t val) {
+    asm volatile ( "mov %0, %%cr4" : : "r"(val) : "memory" );
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ( "rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr) );
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile ( "wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)) );
+}
+
+static inline void wbinvd() {
+    asm volatile ( "wbinvd" ::: "memory" );
+}
+
+static inline void clts() {
+    asm volatile ( "clts" ::: "memory" );
+}
+
+static inline void stts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// Disable interrupts and return the previous EFLAGS for irq_restore
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    asm volatile ( "pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory" );
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile ( "sti" ::: "memory" );
+    }
+}
+
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    asm volatile ( "rdtsc" : "=a"(lo), "=d"(hi) );
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// 64-by-32 division without pulling in libgcc's __udivdi3
+static inline uint64_t div_u64(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+
+    asm ( "divl %4" : "=a"(q_lo), "=d"(r) : "a"((uint32_t)n), "d"(r), "rm"(d) );
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+static inline void cpu_relax() {
+    asm volatile ( "pause" ::: "memory" );
+}
+
+#endif
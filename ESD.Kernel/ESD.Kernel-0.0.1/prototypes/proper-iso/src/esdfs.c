@@ -0,0 +1,388 @@
+#include "esdfs.h"
+#include "bcache.h"
+#include "panic.h"
+#include "mem.h"
+#include <stddef.h>
+
+static esdfs_fs_t mounts[ESDFS_MAX_MOUNTS];
+static int mount_count = 0;
+
+// Metadata comes straight from the block cache. The shared code cannot
+// recover from a missing metadata block, so that is fatal.
+static void *esdfs_map(void *ctx, uint32_t block, void **cookie) {
+    esdfs_fs_t *fs = ctx;
+    bcache_buf_t *buf = bcache_get(fs->dev, block);
+
+    if (buf == NULL) {
+        k_panic("esdfs: metadata read failed", NULL);
+    }
+    *cookie = buf;
+    return buf->data;
+}
+
+static void esdfs_unmap(void *ctx, void *cookie, int dirty) {
+    bcache_buf_t *buf = cookie;
+    (void)ctx;
+
+    if (dirty) {
+        bcache_dirty(buf);
+    }
+    bcache_put(buf);
+}
+
+esdfs_fs_t *esdfs_mount(block_device_t *dev) {
+    esdfs_super_t sb;
+
+    if (mount_count >= ESDFS_MAX_MOUNTS || dev->sector_size > ESDFS_BLOCK_SIZE) {
+        return NULL;
+    }
+    if (bcache_read(dev, 0, &sb, sizeof(sb)) != 0 ||
+        sb.magic != ESDFS_MAGIC || sb.version != ESDFS_VERSION ||
+        sb.block_size != ESDFS_BLOCK_SIZE ||
+        sb.block_count > dev->sector_count / (ESDFS_BLOCK_SIZE / dev->sector_size)) {
+        return NULL;
+    }
+
+    esdfs_fs_t *fs = &mounts[mount_count++];
+    fs->dev = dev;
+    fs->io.ctx = fs;
+    fs->io.map = esdfs_map;
+    fs->io.unmap = esdfs_unmap;
+    fs->block_count = sb.block_count;
+    fs->inode_count = sb.inode_count;
+    return fs;
+}
+
+esdfs_fs_t *esdfs_get_mount(int index) {
+    return index < mount_count ? &mounts[index] : NULL;
+}
+
+static int esdfs_valid_ino(esdfs_fs_t *fs, uint32_t ino) {
+    return ino != 0 && ino < fs->inode_count;
+}
+
+uint32_t esdfs_lookup(esdfs_fs_t *fs, uint32_t dir, const char *name, uint32_t len) {
+    void *cookie;
+    esdfs_dirent_t ent;
+    uint32_t result = 0;
+
+    if (!esdfs_valid_ino(fs, dir)) {
+        return 0;
+    }
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, dir, &cookie);
+    if (inode->type == ESDFS_TYPE_DIR && esdfs_dir_lookup(&fs->io, inode, name, len, &ent) == 0) {
+        result = ent.inode;
+    }
+    esdfs_unmap(fs, cookie, 0);
+    return result;
+}
+
+// Resolve an absolute path ("/a/b") from the root; 0 if missing
+uint32_t esdfs_namei(esdfs_fs_t *fs, const char *path) {
+    uint32_t ino = ESDFS_ROOT_INODE;
+
+    while (*path != '\0' && ino != 0) {
+        while (*path == '/') {
+            path++;
+        }
+        const char *end = path;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+        if (end > path) {
+            ino = esdfs_lookup(fs, ino, path, end - path);
+        }
+        path = end;
+    }
+    return ino;
+}
+
+int esdfs_stat(esdfs_fs_t *fs, uint32_t ino, uint16_t *type, uint32_t *size) {
+    void *cookie;
+
+    if (!esdfs_valid_ino(fs, ino)) {
+        return -1;
+    }
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, ino, &cookie);
+    *type = inode->type;
+    *size = inode->size;
+    esdfs_unmap(fs, cookie, 0);
+    return 0;
+}
+
+// Walk [offset, offset + len) one extent run at a time so contiguous
+// data goes to the cache (and its read-ahead) as a single range
+static int esdfs_transfer(esdfs_fs_t *fs, esdfs_inode_t *inode, uint32_t offset,
+                          uint8_t *buf, uint32_t len, int write) {
+    uint32_t done = 0;
+
+    while (done < len) {
+        uint32_t file_block = (offset + done) / ESDFS_BLOCK_SIZE;
+        uint32_t in_block = (offset + done) % ESDFS_BLOCK_SIZE;
+        uint32_t run;
+        uint32_t disk = esdfs_bmap(&fs->io, inode, file_block, &run);
+        if (disk == 0) {
+            return -1;
+        }
+
+        uint32_t chunk = run * ESDFS_BLOCK_SIZE - in_block;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        uint32_t pos = disk * ESDFS_BLOCK_SIZE + in_block;
+        int err = write ? bcache_write(fs->dev, pos, buf + done, chunk)
+                        : bcache_read(fs->dev, pos, buf + done, chunk);
+        if (err != 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+int esdfs_read(esdfs_fs_t *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len) {
+    void *cookie;
+    int result = -1;
+
+    if (!esdfs_valid_ino(fs, ino)) {
+        return -1;
+    }
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, ino, &cookie);
+    if (inode->type == ESDFS_TYPE_FILE) {
+        if (offset >= inode->size) {
+            result = 0;
+        } else {
+            if (len > inode->size - offset) {
+                len = inode->size - offset;
+            }
+            result = esdfs_transfer(fs, inode, offset, buf, len, 0);
+        }
+    }
+    esdfs_unmap(fs, cookie, 0);
+    return result;
+}
+
+int esdfs_write(esdfs_fs_t *fs, uint32_t ino, uint32_t offset, const void *buf, uint32_t len) {
+    void *cookie;
+    int result = -1;
+
+    if (!esdfs_valid_ino(fs, ino) || offset + len < offset) {
+        return -1;
+    }
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, ino, &cookie);
+    if (inode->type == ESDFS_TYPE_FILE) {
+        uint32_t end = offset + len;
+        uint32_t blocks = (end + ESDFS_BLOCK_SIZE - 1) / ESDFS_BLOCK_SIZE;
+
+        if (esdfs_extend(&fs->io, ino, inode, blocks) == 0) {
+            int err = 0;
+
+            // Zero the gap when writing past the end of file
+            if (offset > inode->size) {
+                static const uint8_t zeros[512];
+                for (uint32_t pos = inode->size; pos < offset && err == 0; ) {
+                    uint32_t n = offset - pos < sizeof(zeros) ? offset - pos : sizeof(zeros);
+                    err = esdfs_transfer(fs, inode, pos, (uint8_t *)zeros, n, 1) < 0;
+                    pos += n;
+                }
+            }
+            // A failed gap leaves the size alone, so stale blocks stay unreadable
+            if (err == 0) {
+                result = esdfs_transfer(fs, inode, offset, (uint8_t *)buf, len, 1);
+            }
+            if (result > 0 && end > inode->size) {
+                inode->size = end;
+            }
+        }
+    }
+    esdfs_unmap(fs, cookie, 1);
+    return result;
+}
+
+uint32_t esdfs_create(esdfs_fs_t *fs, uint32_t dir, const char *name, uint16_t type) {
+    void *dcookie, *cookie;
+    uint32_t len = strlen(name);
+
+    if (!esdfs_valid_ino(fs, dir) || len == 0 || len > ESDFS_NAME_MAX ||
+        esdfs_lookup(fs, dir, name, len) != 0) {
+        return 0;
+    }
+
+    // Only a directory has a B+tree to insert into
+    esdfs_inode_t *parent = esdfs_map_inode(&fs->io, dir, &dcookie);
+    if (parent->type != ESDFS_TYPE_DIR) {
+        esdfs_unmap(fs, dcookie, 0);
+        return 0;
+    }
+
+    uint32_t ino = esdfs_alloc_inode(&fs->io, type);
+    if (ino == 0) {
+        esdfs_unmap(fs, dcookie, 0);
+        return 0;
+    }
+
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, ino, &cookie);
+    int err = 0;
+
+    if (type == ESDFS_TYPE_DIR) {
+        inode->links = 2;
+        err = esdfs_dir_init(&fs->io, ino, inode, dir);
+    } else {
+        inode->links = 1;
+    }
+    if (err == 0) {
+        err = esdfs_dir_insert(&fs->io, parent, name, len, ino, type);
+    }
+    if (err != 0) {
+        esdfs_release_blocks(&fs->io, inode);
+        esdfs_dir_release(&fs->io, inode);
+        esdfs_free_inode(&fs->io, ino);
+        ino = 0;
+    } else if (type == ESDFS_TYPE_DIR) {
+        // The new directory's ".." links back to the parent
+        parent->links++;
+    }
+
+    esdfs_unmap(fs, dcookie, 1);
+    esdfs_unmap(fs, cookie, 1);
+    return ino;
+}
+
+static int esdfs_dir_has_children(void *arg, const esdfs_dirent_t *ent) {
+    (void)arg;
+    if (ent->name_len == 1 && ent->name[0] == '.') {
+        return 0;
+    }
+    if (ent->name_len == 2 && ent->name[0] == '.' && ent->name[1] == '.') {
+        return 0;
+    }
+    return 1;
+}
+
+// Directories must be empty apart from "." and ".."
+int esdfs_unlink(esdfs_fs_t *fs, uint32_t dir, const char *name) {
+    void *dcookie, *cookie;
+    uint32_t len = strlen(name);
+    uint32_t ino = esdfs_lookup(fs, dir, name, len);
+
+    if (ino == 0 || (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.')) {
+        return -1;
+    }
+
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, ino, &cookie);
+    if (inode->type == ESDFS_TYPE_DIR &&
+        esdfs_dir_iterate(&fs->io, inode, esdfs_dir_has_children, NULL) != 0) {
+        esdfs_unmap(fs, cookie, 0);
+        return -1;
+    }
+
+    esdfs_inode_t *parent = esdfs_map_inode(&fs->io, dir, &dcookie);
+    esdfs_dir_remove(&fs->io, parent, name, len);
+    if (inode->type == ESDFS_TYPE_DIR) {
+        parent->links--;
+    }
+    esdfs_unmap(fs, dcookie, 1);
+
+    if (--inode->links == 0 || inode->type == ESDFS_TYPE_DIR) {
+        esdfs_release_blocks(&fs->io, inode);
+        esdfs_dir_release(&fs->io, inode);
+        esdfs_free_inode(&fs->io, ino);
+    }
+    esdfs_unmap(fs, cookie, 1);
+    return 0;
+}
+
+int esdfs_readdir(esdfs_fs_t *fs, uint32_t dir,
+                  int (*fn)(void *arg, const esdfs_dirent_t *ent), void *arg) {
+    void *cookie;
+    int result = -1;
+
+    if (!esdfs_valid_ino(fs, dir)) {
+        return -1;
+    }
+    esdfs_inode_t *inode = esdfs_map_inode(&fs->io, dir, &cookie);
+    if (inode->type == ESDFS_TYPE_DIR) {
+        result = esdfs_dir_iterate(&fs->io, inode, fn, arg);
+    }
+    esdfs_unmap(fs, cookie, 0);
+    return result;
+}
+
+int esdfs_sync(esdfs_fs_t *fs) {
+    return bcache_sync(fs->dev);
+}
+
+static void *esdfs_vfs_mount(block_device_t *dev, uint32_t *root) {
+    *root = ESDFS_ROOT_INODE;
+    return esdfs_mount(dev);
+}
+
+static int esdfs_vfs_lookup(void *fs, uint32_t dir, const char *name, uint32_t len, uint32_t *ino) {
+    *ino = esdfs_lookup(fs, dir, name, len);
+    return *ino != 0 ? 0 : -1;
+}
+
+static int esdfs_vfs_stat(void *fs, uint32_t ino, vfs_stat_t *st) {
+    st->ino = ino;
+    return esdfs_stat(fs, ino, &st->type, &st->size);
+}
+
+static int esdfs_vfs_read(void *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len) {
+    return esdfs_read(fs, ino, offset, buf, len);
+}
+
+static int esdfs_vfs_write(void *fs, uint32_t ino, uint32_t offset, const void *buf, uint32_t len) {
+    return esdfs_write(fs, ino, offset, buf, len);
+}
+
+typedef struct {
+    vfs_filldir_t fn;
+    void *arg;
+} esdfs_filldir_t;
+
+static int esdfs_vfs_filldir(void *arg, const esdfs_dirent_t *ent) {
+    esdfs_filldir_t *fill = arg;
+    return fill->fn(fill->arg, ent->name, ent->name_len, ent->inode, ent->type);
+}
+
+static int esdfs_vfs_readdir(void *fs, uint32_t dir, vfs_filldir_t fn, void *arg) {
+    esdfs_filldir_t fill = { fn, arg };
+    return esdfs_readdir(fs, dir, esdfs_vfs_filldir, &fill);
+}
+
+static int esdfs_vfs_create(void *fs, uint32_t dir, const char *name, uint32_t len, uint16_t type, uint32_t *ino) {
+    char buf[ESDFS_NAME_MAX + 1];
+
+    if (len > ESDFS_NAME_MAX) {
+        return -1;
+    }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    *ino = esdfs_create(fs, dir, buf, type);
+    return *ino != 0 ? 0 : -1;
+}
+
+static int esdfs_vfs_unlink(void *fs, uint32_t dir, const char *name, uint32_t len) {
+    char buf[ESDFS_NAME_MAX + 1];
+
+    if (len > ESDFS_NAME_MAX) {
+        return -1;
+    }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    return esdfs_unlink(fs, dir, buf);
+}
+
+// esdfs file types use the VFS values
+const vfs_fs_type_t esdfs_vfs_type = {
+    "esdfs",
+    esdfs_vfs_mount,
+    esdfs_vfs_lookup,
+    esdfs_vfs_stat,
+    esdfs_vfs_read,
+    esdfs_vfs_write,
+    esdfs_vfs_readdir,
+    NULL,
+    esdfs_vfs_create,
+    esdfs_vfs_unlink,
+};
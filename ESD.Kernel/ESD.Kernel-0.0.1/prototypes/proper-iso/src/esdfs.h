@@ -0,0 +1,35 @@
+#ifndef ESDFS_H
+#define ESDFS_H
+
+#include <stdint.h>
+#include "esdfs_format.h"
+#include "esdfs_core.h"
+#include "blk.h"
+#include "vfs.h"
+
+#define ESDFS_MAX_MOUNTS 4
+
+extern const vfs_fs_type_t esdfs_vfs_type;
+
+typedef struct {
+    block_device_t *dev;
+    esdfs_io_t io;
+    uint32_t block_count;
+    uint32_t inode_count;
+} esdfs_fs_t;
+
+esdfs_fs_t *esdfs_mount(block_device_t *dev);
+esdfs_fs_t *esdfs_get_mount(int index);
+
+uint32_t esdfs_lookup(esdfs_fs_t *fs, uint32_t dir, const char *name, uint32_t len);
+uint32_t esdfs_namei(esdfs_fs_t *fs, const char *path);
+int esdfs_stat(esdfs_fs_t *fs, uint32_t ino, uint16_t *type, uint32_t *size);
+int esdfs_read(esdfs_fs_t *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len);
+int esdfs_write(esdfs_fs_t *fs, uint32_t ino, uint32_t offset, const void *buf, uint32_t len);
+uint32_t esdfs_create(esdfs_fs_t *fs, uint32_t dir, const char *name, uint16_t type);
+int esdfs_unlink(esdfs_fs_t *fs, uint32_t dir, const char *name);
+int esdfs_readdir(esdfs_fs_t *fs, uint32_t dir,
+                  int (*fn)(void *arg, const esdfs_dirent_t *ent), void *arg);
+int esdfs_sync(esdfs_fs_t *fs);
+
+#endif
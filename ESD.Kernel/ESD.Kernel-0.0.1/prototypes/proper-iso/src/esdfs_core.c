@@ -0,0 +1,586 @@
+#include "esdfs_core.h"
+#ifdef ESDFS_HOST
+#include <string.h>
+#else
+#include "mem.h"
+#endif
+#include <stddef.h>
+
+static inline uint32_t group_start(uint32_t g) {
+    return g * ESDFS_GROUP_BLOCKS;
+}
+
+// First run of want free bits in [from, to), else the longest one seen
+static uint32_t bitmap_find(uint32_t *bits, uint32_t from, uint32_t to, uint32_t want, uint32_t *len) {
+    uint32_t best = 0, best_len = 0;
+    uint32_t run = 0, run_len = 0;
+
+    for (uint32_t b = from; b < to; b++) {
+        if ((b & 31) == 0 && run_len == 0 && bits[b / 32] == 0xFFFFFFFF && b + 32 <= to) {
+            b += 31;
+            continue;
+        }
+        if (bits[b / 32] & (1u << (b & 31))) {
+            run_len = 0;
+            continue;
+        }
+        if (run_len++ == 0) {
+            run = b;
+        }
+        if (run_len > best_len) {
+            best = run;
+            best_len = run_len;
+            if (best_len == want) {
+                break;
+            }
+        }
+    }
+    *len = best_len;
+    return best;
+}
+
+// Allocate up to want contiguous blocks as close after goal as possible,
+// staying in goal's group when it has room. Returns 0 when full.
+uint32_t esdfs_alloc_blocks(esdfs_io_t *io, uint32_t goal, uint32_t want, uint32_t *got) {
+    void *sc, *gc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    esdfs_group_t *groups = io->map(io->ctx, ESDFS_GROUP_TABLE, &gc);
+    uint32_t result = 0;
+
+    if (goal >= sb->block_count) {
+        goal = 0;
+    }
+
+    uint32_t first = goal / ESDFS_GROUP_BLOCKS;
+    for (uint32_t i = 0; i < sb->group_count && result == 0; i++) {
+        uint32_t g = (first + i) % sb->group_count;
+        if (groups[g].free == 0) {
+            continue;
+        }
+
+        uint32_t nbits = sb->block_count - group_start(g);
+        if (nbits > ESDFS_GROUP_BLOCKS) {
+            nbits = ESDFS_GROUP_BLOCKS;
+        }
+        uint32_t from = i == 0 ? goal - group_start(g) : 0;
+
+        void *bc;
+        uint32_t *bits = io->map(io->ctx, groups[g].bitmap, &bc);
+        uint32_t len;
+        uint32_t bit = bitmap_find(bits, from, nbits, want, &len);
+        if (len == 0 && from > 0) {
+            bit = bitmap_find(bits, 0, from, want, &len);
+        }
+
+        if (len > 0) {
+            for (uint32_t b = bit; b < bit + len; b++) {
+                bits[b / 32] |= 1u << (b & 31);
+            }
+            groups[g].free -= len;
+            sb->free_blocks -= len;
+            *got = len;
+            result = group_start(g) + bit;
+        }
+        io->unmap(io->ctx, bc, len > 0);
+    }
+
+    io->unmap(io->ctx, gc, result != 0);
+    io->unmap(io->ctx, sc, result != 0);
+    return result;
+}
+
+void esdfs_free_blocks(esdfs_io_t *io, uint32_t start, uint32_t count) {
+    void *sc, *gc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    esdfs_group_t *groups = io->map(io->ctx, ESDFS_GROUP_TABLE, &gc);
+
+    while (count > 0) {
+        uint32_t g = start / ESDFS_GROUP_BLOCKS;
+        uint32_t bit = start - group_start(g);
+        uint32_t n = ESDFS_GROUP_BLOCKS - bit;
+        if (n > count) {
+            n = count;
+        }
+
+        void *bc;
+        uint32_t *bits = io->map(io->ctx, groups[g].bitmap, &bc);
+        for (uint32_t b = bit; b < bit + n; b++) {
+            bits[b / 32] &= ~(1u << (b & 31));
+        }
+        io->unmap(io->ctx, bc, 1);
+
+        groups[g].free += n;
+        sb->free_blocks += n;
+        start += n;
+        count -= n;
+    }
+
+    io->unmap(io->ctx, gc, 1);
+    io->unmap(io->ctx, sc, 1);
+}
+
+esdfs_inode_t *esdfs_map_inode(esdfs_io_t *io, uint32_t ino, void **cookie) {
+    esdfs_inode_t *table = io->map(io->ctx, ESDFS_INODE_TABLE + ino / ESDFS_INODES_PER_BLOCK, cookie);
+    return table == NULL ? NULL : &table[ino % ESDFS_INODES_PER_BLOCK];
+}
+
+uint32_t esdfs_alloc_inode(esdfs_io_t *io, uint16_t type) {
+    void *sc, *bc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    uint32_t *bits = io->map(io->ctx, ESDFS_INODE_BITMAP, &bc);
+    uint32_t ino = 0;
+
+    for (uint32_t i = 1; i < sb->inode_count; i++) {
+        if (!(bits[i / 32] & (1u << (i & 31)))) {
+            bits[i / 32] |= 1u << (i & 31);
+            sb->free_inodes--;
+            ino = i;
+            break;
+        }
+    }
+    io->unmap(io->ctx, bc, ino != 0);
+    io->unmap(io->ctx, sc, ino != 0);
+
+    if (ino != 0) {
+        void *ic;
+        esdfs_inode_t *inode = esdfs_map_inode(io, ino, &ic);
+        if (inode != NULL) {
+            memset(inode, 0, sizeof(*inode));
+            inode->type = type;
+            io->unmap(io->ctx, ic, 1);
+        }
+    }
+    return ino;
+}
+
+void esdfs_free_inode(esdfs_io_t *io, uint32_t ino) {
+    void *sc, *bc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    uint32_t *bits = io->map(io->ctx, ESDFS_INODE_BITMAP, &bc);
+
+    bits[ino / 32] &= ~(1u << (ino & 31));
+    sb->free_inodes++;
+
+    io->unmap(io->ctx, bc, 1);
+    io->unmap(io->ctx, sc, 1);
+}
+
+// Extents live inline until they overflow, then all of them move to one
+// block; either way they are sorted by file block for binary search
+static esdfs_extent_t *map_extents(esdfs_io_t *io, esdfs_inode_t *inode, void **cookie) {
+    if (inode->extent_count <= ESDFS_INLINE_EXTENTS) {
+        *cookie = NULL;
+        return inode->extents;
+    }
+    return io->map(io->ctx, inode->extent_block, cookie);
+}
+
+static void unmap_extents(esdfs_io_t *io, void *cookie, int dirty) {
+    if (cookie != NULL) {
+        io->unmap(io->ctx, cookie, dirty);
+    }
+}
+
+// Disk block backing file_block (0 if none); *run is how many blocks
+// after it stay contiguous on disk
+uint32_t esdfs_bmap(esdfs_io_t *io, esdfs_inode_t *inode, uint32_t file_block, uint32_t *run) {
+    void *cookie;
+    esdfs_extent_t *ext = map_extents(io, inode, &cookie);
+    uint32_t result = 0;
+    int lo = 0, hi = (int)inode->extent_count - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (ext[mid].file_block > file_block) {
+            hi = mid - 1;
+        } else if (file_block >= ext[mid].file_block + ext[mid].length) {
+            lo = mid + 1;
+        } else {
+            uint32_t off = file_block - ext[mid].file_block;
+            result = ext[mid].start + off;
+            if (run != NULL) {
+                *run = ext[mid].length - off;
+            }
+            break;
+        }
+    }
+
+    unmap_extents(io, cookie, 0);
+    return result;
+}
+
+static int append_extent(esdfs_io_t *io, esdfs_inode_t *inode,
+                         uint32_t file_block, uint32_t start, uint32_t length) {
+    void *cookie;
+    esdfs_extent_t *ext = map_extents(io, inode, &cookie);
+    uint32_t n = inode->extent_count;
+
+    if (n > 0 && ext[n - 1].start + ext[n - 1].length == start) {
+        ext[n - 1].length += length;
+        unmap_extents(io, cookie, 1);
+        return 0;
+    }
+
+    if (n == ESDFS_INLINE_EXTENTS) {
+        uint32_t got;
+        uint32_t block = esdfs_alloc_blocks(io, ext[n - 1].start + ext[n - 1].length, 1, &got);
+        if (block == 0) {
+            return -1;
+        }
+        esdfs_extent_t *moved = io->map(io->ctx, block, &cookie);
+        memcpy(moved, inode->extents, sizeof(inode->extents));
+        inode->extent_block = block;
+        ext = moved;
+    } else if (n >= ESDFS_BLOCK_EXTENTS) {
+        unmap_extents(io, cookie, 0);
+        return -1;
+    }
+
+    ext[n].file_block = file_block;
+    ext[n].start = start;
+    ext[n].length = length;
+    inode->extent_count++;
+    unmap_extents(io, cookie, 1);
+    return 0;
+}
+
+// Grow the allocation to cover blocks file blocks, asking the allocator
+// for the whole remainder at once so large files get long extents
+int esdfs_extend(esdfs_io_t *io, uint32_t ino, esdfs_inode_t *inode, uint32_t blocks) {
+    void *sc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    uint32_t groups = sb->group_count;
+    io->unmap(io->ctx, sc, 0);
+
+    while (inode->blocks < blocks) {
+        uint32_t goal = group_start(ino % groups);
+        if (inode->blocks > 0) {
+            uint32_t run;
+            goal = esdfs_bmap(io, inode, inode->blocks - 1, &run) + 1;
+        }
+
+        uint32_t got;
+        uint32_t start = esdfs_alloc_blocks(io, goal, blocks - inode->blocks, &got);
+        if (start == 0) {
+            return -1;
+        }
+        if (append_extent(io, inode, inode->blocks, start, got) != 0) {
+            esdfs_free_blocks(io, start, got);
+            return -1;
+        }
+        inode->blocks += got;
+    }
+    return 0;
+}
+
+void esdfs_release_blocks(esdfs_io_t *io, esdfs_inode_t *inode) {
+    void *cookie;
+    esdfs_extent_t *ext = map_extents(io, inode, &cookie);
+
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        esdfs_free_blocks(io, ext[i].start, ext[i].length);
+    }
+    unmap_extents(io, cookie, 0);
+
+    if (inode->extent_count > ESDFS_INLINE_EXTENTS) {
+        esdfs_free_blocks(io, inode->extent_block, 1);
+    }
+    inode->extent_count = 0;
+    inode->extent_block = 0;
+    inode->blocks = 0;
+    inode->size = 0;
+}
+
+static int name_cmp(const char *a, uint32_t alen, const char *b, uint32_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0) {
+        return c;
+    }
+    return (int)alen - (int)blen;
+}
+
+static inline esdfs_dirent_t *node_entries(esdfs_node_t *node) {
+    return (esdfs_dirent_t *)(node + 1);
+}
+
+// Interior: last child whose smallest key is <= name
+static int child_index(esdfs_node_t *node, const char *name, uint32_t len) {
+    esdfs_dirent_t *e = node_entries(node);
+    int lo = 1, hi = node->count - 1, result = 0;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (name_cmp(e[mid].name, e[mid].name_len, name, len) <= 0) {
+            result = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return result;
+}
+
+// Leaf: first entry whose name is >= name
+static int leaf_index(esdfs_node_t *node, const char *name, uint32_t len) {
+    esdfs_dirent_t *e = node_entries(node);
+    int lo = 0, hi = node->count;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (name_cmp(e[mid].name, e[mid].name_len, name, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static uint32_t new_node(esdfs_io_t *io, uint32_t goal, uint16_t level) {
+    uint32_t got;
+    uint32_t block = esdfs_alloc_blocks(io, goal, 1, &got);
+    if (block == 0) {
+        return 0;
+    }
+
+    void *cookie;
+    esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+    memset(node, 0, ESDFS_BLOCK_SIZE);
+    node->magic = ESDFS_NODE_MAGIC;
+    node->level = level;
+    io->unmap(io->ctx, cookie, 1);
+    return block;
+}
+
+// Returns -1 on failure or duplicate, 0 when done, 1 when block split and
+// *split holds the new right sibling (inode) and its smallest key
+static int btree_insert(esdfs_io_t *io, uint32_t block, const esdfs_dirent_t *ent, esdfs_dirent_t *split) {
+    void *cookie;
+    esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+    esdfs_dirent_t *e = node_entries(node);
+    esdfs_dirent_t up;
+    const esdfs_dirent_t *ins = ent;
+    int pos;
+
+    if (node->level > 0) {
+        int i = child_index(node, ent->name, ent->name_len);
+        int r = btree_insert(io, e[i].inode, ent, &up);
+        if (r <= 0) {
+            io->unmap(io->ctx, cookie, 0);
+            return r;
+        }
+        ins = &up;
+        pos = i + 1;
+    } else {
+        pos = leaf_index(node, ent->name, ent->name_len);
+        if (pos < node->count && name_cmp(e[pos].name, e[pos].name_len, ent->name, ent->name_len) == 0) {
+            io->unmap(io->ctx, cookie, 0);
+            return -1;
+        }
+    }
+
+    if (node->count < ESDFS_NODE_ENTRIES) {
+        memmove(&e[pos + 1], &e[pos], (node->count - pos) * sizeof(*e));
+        e[pos] = *ins;
+        node->count++;
+        io->unmap(io->ctx, cookie, 1);
+        return 0;
+    }
+
+    uint32_t right_block = new_node(io, block, node->level);
+    if (right_block == 0) {
+        io->unmap(io->ctx, cookie, 0);
+        return -1;
+    }
+
+    void *rcookie;
+    esdfs_node_t *right = io->map(io->ctx, right_block, &rcookie);
+    esdfs_dirent_t *re = node_entries(right);
+    int half = (node->count + 1) / 2;
+
+    right->count = node->count - half;
+    memcpy(re, &e[half], right->count * sizeof(*e));
+    node->count = half;
+    if (node->level == 0) {
+        right->next = node->next;
+        node->next = right_block;
+    }
+
+    esdfs_node_t *target = pos <= half ? node : right;
+    esdfs_dirent_t *te = node_entries(target);
+    int tpos = pos <= half ? pos : pos - half;
+    memmove(&te[tpos + 1], &te[tpos], (target->count - tpos) * sizeof(*e));
+    te[tpos] = *ins;
+    target->count++;
+
+    *split = re[0];
+    split->inode = right_block;
+
+    io->unmap(io->ctx, rcookie, 1);
+    io->unmap(io->ctx, cookie, 1);
+    return 1;
+}
+
+int esdfs_dir_init(esdfs_io_t *io, uint32_t ino, esdfs_inode_t *dir, uint32_t parent) {
+    void *sc;
+    esdfs_super_t *sb = io->map(io->ctx, ESDFS_SUPER_BLOCK, &sc);
+    uint32_t goal = group_start(ino % sb->group_count);
+    io->unmap(io->ctx, sc, 0);
+
+    dir->type = ESDFS_TYPE_DIR;
+    dir->size = 0;
+    dir->dir_root = new_node(io, goal, 0);
+    if (dir->dir_root == 0) {
+        return -1;
+    }
+    if (esdfs_dir_insert(io, dir, ".", 1, ino, ESDFS_TYPE_DIR) != 0 ||
+        esdfs_dir_insert(io, dir, "..", 2, parent, ESDFS_TYPE_DIR) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int esdfs_dir_lookup(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len, esdfs_dirent_t *out) {
+    uint32_t block = dir->dir_root;
+
+    for (;;) {
+        void *cookie;
+        esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+        esdfs_dirent_t *e = node_entries(node);
+
+        if (node->level > 0) {
+            block = e[child_index(node, name, len)].inode;
+            io->unmap(io->ctx, cookie, 0);
+            continue;
+        }
+
+        int pos = leaf_index(node, name, len);
+        int found = pos < node->count && name_cmp(e[pos].name, e[pos].name_len, name, len) == 0;
+        if (found && out != NULL) {
+            *out = e[pos];
+        }
+        io->unmap(io->ctx, cookie, 0);
+        return found ? 0 : -1;
+    }
+}
+
+int esdfs_dir_insert(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len,
+                     uint32_t child, uint8_t type) {
+    esdfs_dirent_t ent, split;
+
+    if (len == 0 || len > ESDFS_NAME_MAX) {
+        return -1;
+    }
+    memset(&ent, 0, sizeof(ent));
+    ent.inode = child;
+    ent.type = type;
+    ent.name_len = len;
+    memcpy(ent.name, name, len);
+
+    int r = btree_insert(io, dir->dir_root, &ent, &split);
+    if (r < 0) {
+        return -1;
+    }
+    if (r == 1) {
+        // Root split: grow the tree by one level
+        void *cookie;
+        esdfs_node_t *old = io->map(io->ctx, dir->dir_root, &cookie);
+        uint16_t level = old->level + 1;
+        io->unmap(io->ctx, cookie, 0);
+
+        uint32_t root = new_node(io, dir->dir_root, level);
+        if (root == 0) {
+            return -1;
+        }
+        esdfs_node_t *node = io->map(io->ctx, root, &cookie);
+        esdfs_dirent_t *e = node_entries(node);
+        memset(&e[0], 0, sizeof(e[0]));
+        e[0].inode = dir->dir_root;
+        e[1] = split;
+        node->count = 2;
+        io->unmap(io->ctx, cookie, 1);
+        dir->dir_root = root;
+    }
+    dir->size++;
+    return 0;
+}
+
+static void btree_free(esdfs_io_t *io, uint32_t block) {
+    void *cookie;
+    esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+
+    if (node->level > 0) {
+        for (int i = 0; i < node->count; i++) {
+            btree_free(io, node_entries(node)[i].inode);
+        }
+    }
+    io->unmap(io->ctx, cookie, 0);
+    esdfs_free_blocks(io, block, 1);
+}
+
+void esdfs_dir_release(esdfs_io_t *io, esdfs_inode_t *dir) {
+    if (dir->dir_root != 0) {
+        btree_free(io, dir->dir_root);
+    }
+    dir->dir_root = 0;
+    dir->size = 0;
+}
+
+// Leaves are not merged back; interior keys stay valid lower bounds
+int esdfs_dir_remove(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len) {
+    uint32_t block = dir->dir_root;
+
+    for (;;) {
+        void *cookie;
+        esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+        esdfs_dirent_t *e = node_entries(node);
+
+        if (node->level > 0) {
+            block = e[child_index(node, name, len)].inode;
+            io->unmap(io->ctx, cookie, 0);
+            continue;
+        }
+
+        int pos = leaf_index(node, name, len);
+        if (pos >= node->count || name_cmp(e[pos].name, e[pos].name_len, name, len) != 0) {
+            io->unmap(io->ctx, cookie, 0);
+            return -1;
+        }
+        memmove(&e[pos], &e[pos + 1], (node->count - pos - 1) * sizeof(*e));
+        node->count--;
+        io->unmap(io->ctx, cookie, 1);
+        dir->size--;
+        return 0;
+    }
+}
+
+// Visit entries in name order; fn returning nonzero stops the walk
+int esdfs_dir_iterate(esdfs_io_t *io, esdfs_inode_t *dir,
+                      int (*fn)(void *arg, const esdfs_dirent_t *ent), void *arg) {
+    uint32_t block = dir->dir_root;
+    void *cookie;
+    esdfs_node_t *node = io->map(io->ctx, block, &cookie);
+
+    while (node->level > 0) {
+        block = node_entries(node)[0].inode;
+        io->unmap(io->ctx, cookie, 0);
+        node = io->map(io->ctx, block, &cookie);
+    }
+
+    for (;;) {
+        esdfs_dirent_t *e = node_entries(node);
+        for (int i = 0; i < node->count; i++) {
+            int r = fn(arg, &e[i]);
+            if (r != 0) {
+                io->unmap(io->ctx, cookie, 0);
+                return r;
+            }
+        }
+        block = node->next;
+        io->unmap(io->ctx, cookie, 0);
+        if (block == 0) {
+            return 0;
+        }
+        node = io->map(io->ctx, block, &cookie);
+    }
+}
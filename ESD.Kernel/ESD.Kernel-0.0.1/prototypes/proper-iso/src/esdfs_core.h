@@ -0,0 +1,37 @@
+#ifndef ESDFS_CORE_H
+#define ESDFS_CORE_H
+
+#include <stdint.h>
+#include "esdfs_format.h"
+
+// Filesystem logic shared by the kernel driver and the host mkfs tool.
+// Blocks are reached through map/unmap so the kernel can go through the
+// block cache and the host tool through an mmap of the image.
+
+typedef struct esdfs_io {
+    void *ctx;
+    void *(*map)(void *ctx, uint32_t block, void **cookie);
+    void (*unmap)(void *ctx, void *cookie, int dirty);
+} esdfs_io_t;
+
+uint32_t esdfs_alloc_blocks(esdfs_io_t *io, uint32_t goal, uint32_t want, uint32_t *got);
+void esdfs_free_blocks(esdfs_io_t *io, uint32_t start, uint32_t count);
+
+uint32_t esdfs_alloc_inode(esdfs_io_t *io, uint16_t type);
+void esdfs_free_inode(esdfs_io_t *io, uint32_t ino);
+esdfs_inode_t *esdfs_map_inode(esdfs_io_t *io, uint32_t ino, void **cookie);
+
+uint32_t esdfs_bmap(esdfs_io_t *io, esdfs_inode_t *inode, uint32_t file_block, uint32_t *run);
+int esdfs_extend(esdfs_io_t *io, uint32_t ino, esdfs_inode_t *inode, uint32_t blocks);
+void esdfs_release_blocks(esdfs_io_t *io, esdfs_inode_t *inode);
+
+int esdfs_dir_init(esdfs_io_t *io, uint32_t ino, esdfs_inode_t *dir, uint32_t parent);
+int esdfs_dir_lookup(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len, esdfs_dirent_t *out);
+int esdfs_dir_insert(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len,
+                     uint32_t child, uint8_t type);
+int esdfs_dir_remove(esdfs_io_t *io, esdfs_inode_t *dir, const char *name, uint32_t len);
+void esdfs_dir_release(esdfs_io_t *io, esdfs_inode_t *dir);
+int esdfs_dir_iterate(esdfs_io_t *io, esdfs_inode_t *dir,
+                      int (*fn)(void *arg, const esdfs_dirent_t *ent), void *arg);
+
+#endif
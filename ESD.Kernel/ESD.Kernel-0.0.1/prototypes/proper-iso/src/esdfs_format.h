@@ -0,0 +1,100 @@
+#ifndef ESDFS_FORMAT_H
+#define ESDFS_FORMAT_H
+
+#include <stdint.h>
+
+// On-disk layout of the native filesystem, shared with tools/mkfs_esdfs.c.
+//
+//   block 0        superblock
+//   block 1        allocation group descriptors
+//   block 2        inode bitmap
+//   block 3..      inode table
+//   then           data; each allocation group of ESDFS_GROUP_BLOCKS
+//                  blocks has a one-block free-space bitmap (group 0's
+//                  follows the inode table, the others open their group)
+//
+// Files map their data with extents sorted by file block. Directories are
+// B+trees of fixed-size entries ordered by name.
+
+#define ESDFS_MAGIC        0x53464445   // "EDFS"
+#define ESDFS_VERSION      1
+#define ESDFS_BLOCK_SIZE   4096
+#define ESDFS_GROUP_BLOCKS (ESDFS_BLOCK_SIZE * 8)
+#define ESDFS_MAX_GROUPS   (ESDFS_BLOCK_SIZE / sizeof(esdfs_group_t))
+#define ESDFS_MAX_INODES   (ESDFS_BLOCK_SIZE * 8)
+
+#define ESDFS_SUPER_BLOCK  0
+#define ESDFS_GROUP_TABLE  1
+#define ESDFS_INODE_BITMAP 2
+#define ESDFS_INODE_TABLE  3
+
+#define ESDFS_ROOT_INODE   1            // inode 0 is never used
+
+#define ESDFS_TYPE_FILE 1
+#define ESDFS_TYPE_DIR  2
+
+#define ESDFS_INLINE_EXTENTS 8
+#define ESDFS_BLOCK_EXTENTS  (ESDFS_BLOCK_SIZE / sizeof(esdfs_extent_t))
+
+#define ESDFS_NAME_MAX     57
+#define ESDFS_NODE_MAGIC   0xB7EE
+#define ESDFS_NODE_ENTRIES ((ESDFS_BLOCK_SIZE - sizeof(esdfs_node_t)) / sizeof(esdfs_dirent_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t group_count;
+    uint32_t inode_count;
+    uint32_t inode_blocks;
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+    uint32_t mtime;
+} __attribute__((packed)) esdfs_super_t;
+
+typedef struct {
+    uint32_t bitmap;                    // block holding this group's bitmap
+    uint32_t free;
+} __attribute__((packed)) esdfs_group_t;
+
+typedef struct {
+    uint32_t file_block;
+    uint32_t start;
+    uint32_t length;
+} __attribute__((packed)) esdfs_extent_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t links;
+    uint32_t size;                      // bytes, or entries for a directory
+    uint32_t blocks;                    // data blocks allocated
+    uint32_t mtime;
+    uint32_t extent_count;
+    uint32_t extent_block;              // holds every extent once inline ones overflow
+    uint32_t dir_root;                  // B+tree root for directories
+    uint32_t reserved;
+    esdfs_extent_t extents[ESDFS_INLINE_EXTENTS];
+} __attribute__((packed)) esdfs_inode_t;
+
+#define ESDFS_INODES_PER_BLOCK (ESDFS_BLOCK_SIZE / sizeof(esdfs_inode_t))
+
+// Leaves hold directory entries; interior nodes reuse the layout with
+// inode naming the child block and name its smallest key
+typedef struct {
+    uint32_t inode;
+    uint8_t type;
+    uint8_t name_len;
+    char name[ESDFS_NAME_MAX + 1];
+} __attribute__((packed)) esdfs_dirent_t;
+
+typedef struct {
+    uint16_t magic;
+    uint16_t count;
+    uint16_t level;                     // 0 for leaves
+    uint16_t reserved;
+    uint32_t next;                      // right sibling leaf, 0 at the end
+    uint32_t reserved2;
+} __attribute__((packed)) esdfs_node_t;
+
+#endif
@@ -0,0 +1,427 @@
+#include "fat32.h"
+#include "bcache.h"
+#include "mem.h"
+#include <stddef.h>
+
+// Read-only FAT32 with long file names. Inode numbers are the byte offset
+// of a file's short directory entry; the root directory has no entry and
+// uses FAT_ROOT_INO instead.
+
+static fat32_fs_t mounts[FAT_MAX_MOUNTS];
+static int mount_count = 0;
+
+typedef int (*fat_visit_t)(void *arg, const char *name, uint32_t len, uint32_t ino, const fat_dirent_t *ent);
+
+static uint16_t le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t fat_next(fat32_fs_t *fs, uint32_t cluster) {
+    uint32_t next;
+
+    if (cluster < 2 || cluster >= fs->cluster_count + 2 ||
+        bcache_read(fs->dev, fs->fat_offset + cluster * 4, &next, 4) != 0) {
+        return 0;
+    }
+    next &= FAT_MASK;
+    if (next < 2 || next >= FAT_BAD) {
+        return 0;
+    }
+    return next;
+}
+
+// Walk a chain once and remember it as runs of consecutive clusters
+static fat_chain_t *fat_chain_get(fat32_fs_t *fs, uint32_t first) {
+    fat_chain_t *victim = &fs->chains[0];
+
+    for (int i = 0; i < FAT_CHAIN_SLOTS; i++) {
+        fat_chain_t *chain = &fs->chains[i];
+        if (chain->first == first) {
+            chain->last_use = ++fs->chain_clock;
+            fs->chain_hits++;
+            return chain;
+        }
+        if (chain->last_use < victim->last_use) {
+            victim = chain;
+        }
+    }
+
+    fs->chain_misses++;
+    victim->first = first;
+    victim->last_use = ++fs->chain_clock;
+    victim->nruns = 0;
+    victim->covered = 0;
+    victim->complete = 0;
+
+    uint32_t cluster = first;
+    while (victim->nruns < FAT_CHAIN_RUNS) {
+        fat_run_t *run = &victim->runs[victim->nruns++];
+        run->index = victim->covered;
+        run->cluster = cluster;
+        run->length = 1;
+
+        uint32_t next;
+        while ((next = fat_next(fs, cluster)) == cluster + 1) {
+            cluster = next;
+            run->length++;
+        }
+        victim->covered += run->length;
+        if (next == 0) {
+            victim->complete = 1;
+            break;
+        }
+        cluster = next;
+    }
+    return victim;
+}
+
+// Cluster holding file cluster `index`, and how many follow it contiguously
+static uint32_t fat_cluster_at(fat32_fs_t *fs, uint32_t first, uint32_t index, uint32_t *avail) {
+    if (first < 2) {
+        return 0;
+    }
+
+    fat_chain_t *chain = fat_chain_get(fs, first);
+    if (index < chain->covered) {
+        uint32_t lo = 0, hi = chain->nruns;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (chain->runs[mid].index <= index) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        fat_run_t *run = &chain->runs[lo];
+        *avail = run->length - (index - run->index);
+        return run->cluster + (index - run->index);
+    }
+    if (chain->complete) {
+        return 0;
+    }
+
+    // Badly fragmented: follow the FAT past the runs we kept
+    fat_run_t *last = &chain->runs[chain->nruns - 1];
+    uint32_t cluster = last->cluster + last->length - 1;
+    for (uint32_t i = chain->covered - 1; i < index && cluster; i++) {
+        cluster = fat_next(fs, cluster);
+    }
+    *avail = 1;
+    return cluster;
+}
+
+static uint32_t fat_cluster_offset(fat32_fs_t *fs, uint32_t cluster) {
+    return fs->data_offset + (cluster - 2) * fs->cluster_size;
+}
+
+static uint32_t fat_entry_cluster(const fat_dirent_t *ent) {
+    return ((uint32_t)ent->cluster_hi << 16) | ent->cluster_lo;
+}
+
+static uint8_t fat_checksum(const uint8_t *name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    }
+    return sum;
+}
+
+static int fat_short_name(const fat_dirent_t *ent, char *name) {
+    int len = 0;
+
+    for (int i = 0; i < 8 && ent->name[i] != ' '; i++) {
+        char c = (i == 0 && ent->name[0] == 0x05) ? (char)0xE5 : ent->name[i];
+        name[len++] = ((ent->nt_case & 0x08) && c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (ent->name[8] != ' ') {
+        name[len++] = '.';
+        for (int i = 8; i < 11 && ent->name[i] != ' '; i++) {
+            char c = ent->name[i];
+            name[len++] = ((ent->nt_case & 0x10) && c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+    }
+    return len;
+}
+
+static const uint8_t lfn_offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static int fat_iterate(fat32_fs_t *fs, uint32_t first, fat_visit_t fn, void *arg) {
+    uint8_t sector[FAT_SECTOR_SIZE];
+    char lfn[20 * 13];
+    uint32_t lfn_len = 0;
+    uint8_t lfn_seq = 0, lfn_sum = 0;
+    char name[13];
+
+    for (uint32_t index = 0;; index++) {
+        uint32_t avail;
+        uint32_t cluster = fat_cluster_at(fs, first, index, &avail);
+        if (!cluster) {
+            return 0;
+        }
+
+        uint32_t base = fat_cluster_offset(fs, cluster);
+        for (uint32_t off = 0; off < fs->cluster_size; off += FAT_SECTOR_SIZE) {
+            if (bcache_read(fs->dev, base + off, sector, FAT_SECTOR_SIZE) != 0) {
+                return -1;
+            }
+
+            for (uint32_t pos = 0; pos < FAT_SECTOR_SIZE; pos += FAT_ENTRY_SIZE) {
+                fat_dirent_t *ent = (fat_dirent_t *)(sector + pos);
+                uint8_t *raw = sector + pos;
+
+                if (ent->name[0] == 0) {
+                    return 0;
+                }
+                if (ent->name[0] == 0xE5) {
+                    lfn_seq = 0;
+                    continue;
+                }
+
+                // Long name fragments arrive last-first, each carrying 13 UCS-2 characters
+                if (ent->attr == FAT_ATTR_LFN) {
+                    uint8_t seq = raw[0] & 0x1F;
+                    if (raw[0] & 0x40) {
+                        lfn_sum = raw[13];
+                        lfn_len = seq * 13;
+                    } else if (seq != lfn_seq - 1 || raw[13] != lfn_sum) {
+                        seq = 0;
+                    }
+                    lfn_seq = (seq > 0 && seq <= 20) ? seq : 0;
+                    if (!lfn_seq) {
+                        continue;
+                    }
+                    for (int k = 0; k < 13; k++) {
+                        uint32_t at = (lfn_seq - 1) * 13 + k;
+                        uint16_t ch = le16(raw + lfn_offsets[k]);
+                        if (ch == 0) {
+                            if (at < lfn_len) {
+                                lfn_len = at;
+                            }
+                            break;
+                        }
+                        lfn[at] = ch < 0x80 ? (char)ch : '?';
+                    }
+                    continue;
+                }
+                if (ent->attr & FAT_ATTR_VOLUME) {
+                    lfn_seq = 0;
+                    continue;
+                }
+
+                int result;
+                uint32_t ino = base + off + pos;
+                if (lfn_seq == 1 && lfn_sum == fat_checksum(ent->name)) {
+                    result = fn(arg, lfn, lfn_len, ino, ent);
+                } else {
+                    result = fn(arg, name, fat_short_name(ent, name), ino, ent);
+                }
+                lfn_seq = 0;
+                if (result != 0) {
+                    return result;
+                }
+            }
+        }
+    }
+}
+
+static int fat_bpb_ok(const uint8_t *b) {
+    uint8_t spc = b[13];
+
+    return b[510] == 0x55 && b[511] == 0xAA &&
+           le16(b + 11) == FAT_SECTOR_SIZE &&
+           spc != 0 && (spc & (spc - 1)) == 0 &&
+           le16(b + 14) != 0 && b[16] != 0 &&
+           le16(b + 17) == 0 && le16(b + 22) == 0 && le32(b + 36) != 0;
+}
+
+static void *fat32_mount(block_device_t *dev, uint32_t *root) {
+    uint8_t b[FAT_SECTOR_SIZE];
+    uint32_t base = 0;
+
+    if (mount_count >= FAT_MAX_MOUNTS || dev->sector_size != FAT_SECTOR_SIZE ||
+        bcache_read(dev, 0, b, sizeof(b)) != 0) {
+        return NULL;
+    }
+
+    // Either a bare volume or the first FAT32 partition of an MBR disk
+    if (!fat_bpb_ok(b)) {
+        if (b[510] != 0x55 || b[511] != 0xAA) {
+            return NULL;
+        }
+        for (int i = 0; i < 4 && !base; i++) {
+            const uint8_t *part = b + 446 + i * 16;
+            uint32_t lba = le32(part + 8);
+            if ((part[4] == 0x0B || part[4] == 0x0C) && lba != 0 && lba < dev->sector_count) {
+                base = lba;
+            }
+        }
+        if (!base || bcache_read(dev, base * FAT_SECTOR_SIZE, b, sizeof(b)) != 0 || !fat_bpb_ok(b)) {
+            return NULL;
+        }
+    }
+
+    uint32_t reserved = le16(b + 14);
+    uint32_t fat_size = le32(b + 36);
+    uint32_t total = le16(b + 19) ? le16(b + 19) : le32(b + 32);
+    uint32_t meta = reserved + b[16] * fat_size;
+
+    // Byte offsets are 32-bit, so the volume has to end below 4 GiB
+    if (total <= meta || (uint64_t)(base + total) * FAT_SECTOR_SIZE > 0xFFFFFFFFULL) {
+        return NULL;
+    }
+
+    fat32_fs_t *fs = &mounts[mount_count++];
+    memset(fs, 0, sizeof(*fs));
+    fs->dev = dev;
+    fs->cluster_size = b[13] * FAT_SECTOR_SIZE;
+    fs->fat_offset = (base + reserved) * FAT_SECTOR_SIZE;
+    fs->data_offset = (base + meta) * FAT_SECTOR_SIZE;
+    fs->cluster_count = (total - meta) / b[13];
+    fs->root_cluster = le32(b + 44);
+
+    *root = FAT_ROOT_INO;
+    return fs;
+}
+
+static int fat_read_entry(fat32_fs_t *fs, uint32_t ino, fat_dirent_t *ent) {
+    return bcache_read(fs->dev, ino, ent, sizeof(*ent));
+}
+
+static uint32_t fat_dir_cluster(fat32_fs_t *fs, uint32_t dir) {
+    fat_dirent_t ent;
+
+    if (dir == FAT_ROOT_INO) {
+        return fs->root_cluster;
+    }
+    if (fat_read_entry(fs, dir, &ent) != 0 || !(ent.attr & FAT_ATTR_DIR)) {
+        return 0;
+    }
+    // ".." entries point at cluster 0 when the parent is the root
+    return fat_entry_cluster(&ent) ? fat_entry_cluster(&ent) : fs->root_cluster;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t len;
+    uint32_t ino;
+} fat_lookup_t;
+
+static int fat_match(void *arg, const char *name, uint32_t len, uint32_t ino, const fat_dirent_t *ent) {
+    fat_lookup_t *l = arg;
+    (void)ent;
+
+    if (len != l->len) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        char a = (name[i] >= 'A' && name[i] <= 'Z') ? name[i] - 'A' + 'a' : name[i];
+        char b = (l->name[i] >= 'A' && l->name[i] <= 'Z') ? l->name[i] - 'A' + 'a' : l->name[i];
+        if (a != b) {
+            return 0;
+        }
+    }
+    l->ino = ino;
+    return 1;
+}
+
+static int fat32_lookup(void *fs, uint32_t dir, const char *name, uint32_t len, uint32_t *ino) {
+    fat_lookup_t l = { name, len, 0 };
+    uint32_t cluster = fat_dir_cluster(fs, dir);
+
+    if (!cluster || fat_iterate(fs, cluster, fat_match, &l) != 1) {
+        return -1;
+    }
+    *ino = l.ino;
+    return 0;
+}
+
+static int fat32_stat(void *fs, uint32_t ino, vfs_stat_t *st) {
+    fat_dirent_t ent;
+
+    st->ino = ino;
+    if (ino == FAT_ROOT_INO) {
+        st->type = VFS_TYPE_DIR;
+        st->size = 0;
+        return 0;
+    }
+    if (fat_read_entry(fs, ino, &ent) != 0) {
+        return -1;
+    }
+    st->type = (ent.attr & FAT_ATTR_DIR) ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    st->size = (ent.attr & FAT_ATTR_DIR) ? 0 : ent.size;
+    return 0;
+}
+
+static int fat32_read(void *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len) {
+    fat32_fs_t *fat = fs;
+    fat_dirent_t ent;
+    uint32_t done = 0;
+
+    if (ino == FAT_ROOT_INO || fat_read_entry(fat, ino, &ent) != 0 || (ent.attr & FAT_ATTR_DIR)) {
+        return -1;
+    }
+    if (offset >= ent.size) {
+        return 0;
+    }
+    if (len > ent.size - offset) {
+        len = ent.size - offset;
+    }
+
+    // One bcache request per contiguous run of clusters
+    while (done < len) {
+        uint32_t pos = offset + done;
+        uint32_t avail;
+        uint32_t cluster = fat_cluster_at(fat, fat_entry_cluster(&ent), pos / fat->cluster_size, &avail);
+        if (!cluster) {
+            break;
+        }
+
+        uint32_t within = pos % fat->cluster_size;
+        uint32_t chunk = avail * fat->cluster_size - within;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        if (bcache_read(fat->dev, fat_cluster_offset(fat, cluster) + within, (uint8_t *)buf + done, chunk) != 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+typedef struct {
+    vfs_filldir_t fn;
+    void *arg;
+} fat_filldir_t;
+
+static int fat_fill(void *arg, const char *name, uint32_t len, uint32_t ino, const fat_dirent_t *ent) {
+    fat_filldir_t *fill = arg;
+    return fill->fn(fill->arg, name, len, ino, (ent->attr & FAT_ATTR_DIR) ? VFS_TYPE_DIR : VFS_TYPE_FILE);
+}
+
+static int fat32_readdir(void *fs, uint32_t dir, vfs_filldir_t fn, void *arg) {
+    fat_filldir_t fill = { fn, arg };
+    uint32_t cluster = fat_dir_cluster(fs, dir);
+
+    if (!cluster) {
+        return -1;
+    }
+    return fat_iterate(fs, cluster, fat_fill, &fill);
+}
+
+const vfs_fs_type_t fat32_vfs_type = {
+    "fat32",
+    fat32_mount,
+    fat32_lookup,
+    fat32_stat,
+    fat32_read,
+    NULL,
+    fat32_readdir,
+    NULL,
+    NULL,
+    NULL,
+};
@@ -0,0 +1,69 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include <stdint.h>
+#include "blk.h"
+#include "vfs.h"
+
+#define FAT_SECTOR_SIZE  512
+#define FAT_ROOT_INO     1              // other inodes are byte offsets of short entries
+#define FAT_ENTRY_SIZE   32
+#define FAT_EOC          0x0FFFFFF8
+#define FAT_BAD          0x0FFFFFF7
+#define FAT_MASK         0x0FFFFFFF
+
+#define FAT_ATTR_VOLUME  0x08
+#define FAT_ATTR_DIR     0x10
+#define FAT_ATTR_LFN     0x0F
+
+#define FAT_MAX_MOUNTS   2
+#define FAT_CHAIN_SLOTS  16             // cached cluster chains per mount
+#define FAT_CHAIN_RUNS   32             // contiguous runs remembered per chain
+
+typedef struct {
+    uint8_t name[11];
+    uint8_t attr;
+    uint8_t nt_case;
+    uint8_t ctime_tenth;
+    uint16_t ctime;
+    uint16_t cdate;
+    uint16_t adate;
+    uint16_t cluster_hi;
+    uint16_t mtime;
+    uint16_t mdate;
+    uint16_t cluster_lo;
+    uint32_t size;
+} __attribute__((packed)) fat_dirent_t;
+
+typedef struct {
+    uint32_t index;                     // first file cluster index in the run
+    uint32_t cluster;
+    uint32_t length;
+} fat_run_t;
+
+// Extent-style view of a cluster chain so seeks don't walk the FAT
+typedef struct {
+    uint32_t first;                     // 0 marks a free slot
+    uint32_t last_use;
+    uint32_t nruns;
+    uint32_t covered;                   // clusters described by runs[]
+    int complete;                       // chain ends inside runs[]
+    fat_run_t runs[FAT_CHAIN_RUNS];
+} fat_chain_t;
+
+typedef struct {
+    block_device_t *dev;
+    uint32_t cluster_size;
+    uint32_t fat_offset;                // byte offsets on the device
+    uint32_t data_offset;
+    uint32_t cluster_count;
+    uint32_t root_cluster;
+    uint32_t chain_clock;
+    uint32_t chain_hits;
+    uint32_t chain_misses;
+    fat_chain_t chains[FAT_CHAIN_SLOTS];
+} fat32_fs_t;
+
+extern const vfs_fs_type_t fat32_vfs_type;
+
+#endif
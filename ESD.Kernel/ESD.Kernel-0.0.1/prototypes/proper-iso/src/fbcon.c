@@ -0,0 +1,378 @@
+#include "fbcon.h"
+#include "font.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "mem.h"
+#include "pmm.h"
+#include "paging.h"
+#include "memtype.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+// Text console on a linear framebuffer. Cells are drawn into a shadow
+// copy in RAM and only dirty text rows are pushed to video memory, with
+// full-line streaming stores into a write-combining mapping. The shadow
+// is a ring of text rows, so scrolling moves `top` instead of copying
+// pixels.
+
+static struct {
+    int active;
+    uint8_t *fb;
+    uint32_t fb_phys;
+    uint32_t fb_size;
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t *shadow;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t top;                       // ring index of screen row 0
+    uint32_t cursor_x;
+    uint32_t cursor_y;
+    int cursor_shown;
+    int suspended;                      // screen handed to the window manager
+    int streaming;                      // SSE2 and 16-byte aligned lines
+} con;
+
+static uint16_t cells[FBCON_MAX_ROWS * FBCON_MAX_COLS];
+static uint8_t dirty[FBCON_MAX_ROWS];
+static uint32_t palette[16];
+static fbcon_glyph_t glyphs[FBCON_GLYPH_SLOTS];
+static fbcon_stats_t stats;
+
+// The standard VGA text palette
+static const uint8_t vga_rgb[16][3] = {
+    { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xAA }, { 0x00, 0xAA, 0x00 }, { 0x00, 0xAA, 0xAA },
+    { 0xAA, 0x00, 0x00 }, { 0xAA, 0x00, 0xAA }, { 0xAA, 0x55, 0x00 }, { 0xAA, 0xAA, 0xAA },
+    { 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xFF }, { 0x55, 0xFF, 0x55 }, { 0x55, 0xFF, 0xFF },
+    { 0xFF, 0x55, 0x55 }, { 0xFF, 0x55, 0xFF }, { 0xFF, 0xFF, 0x55 }, { 0xFF, 0xFF, 0xFF },
+};
+
+static uint8_t color_info[6];
+
+static inline uint32_t *shadow_line(uint32_t row) {
+    return con.shadow + ((con.top + row) % con.rows) * FONT_HEIGHT * con.width;
+}
+
+static inline uint16_t *cell_at(uint32_t x, uint32_t y) {
+    return &cells[((con.top + y) % con.rows) * FBCON_MAX_COLS + x];
+}
+
+static void fill_pixels(uint32_t *dst, uint32_t value, uint32_t count) {
+    if (!cpu_features.sse2 || count < 64 || ((uintptr_t)dst & 15)) {
+        asm volatile ( "rep stosl" : "+D"(dst), "+c"(count) : "a"(value) : "memory" );
+        return;
+    }
+
+    kernel_fpu_begin();
+    asm volatile ( "movd %0, %%xmm0\n\t"
+                   "pshufd $0, %%xmm0, %%xmm0"
+                   : : "r"(value) );
+    for (; count >= 16; count -= 16, dst += 16) {
+        asm volatile ( "movdqa %%xmm0,   (%0)\n\t"
+                       "movdqa %%xmm0, 16(%0)\n\t"
+                       "movdqa %%xmm0, 32(%0)\n\t"
+                       "movdqa %%xmm0, 48(%0)"
+                       : : "r"(dst) : "memory" );
+    }
+    kernel_fpu_end();
+
+    asm volatile ( "rep stosl" : "+D"(dst), "+c"(count) : "a"(value) : "memory" );
+}
+
+// Non-temporal copy of one scanline; the caller brackets the FPU section
+// and fences once per flush
+static void stream_line(uint8_t *dst, const uint8_t *src, uint32_t bytes) {
+    for (; bytes >= 64; bytes -= 64, dst += 64, src += 64) {
+        asm volatile ( "movdqu   (%1), %%xmm0\n\t"
+                       "movdqu 16(%1), %%xmm1\n\t"
+                       "movdqu 32(%1), %%xmm2\n\t"
+                       "movdqu 48(%1), %%xmm3\n\t"
+                       "movntdq %%xmm0,   (%0)\n\t"
+                       "movntdq %%xmm1, 16(%0)\n\t"
+                       "movntdq %%xmm2, 32(%0)\n\t"
+                       "movntdq %%xmm3, 48(%0)"
+                       : : "r"(dst), "r"(src) : "memory" );
+    }
+    for (; bytes >= 4; bytes -= 4, dst += 4, src += 4) {
+        asm volatile ( "movnti %1, (%0)" : : "r"(dst), "r"(*(const uint32_t *)src) : "memory" );
+    }
+}
+
+static fbcon_glyph_t *glyph_get(char c, uint8_t attr) {
+    if ((uint8_t)c < FONT_FIRST) {
+        c = ' ';
+    }
+
+    uint16_t key = (uint8_t)c | (attr << 8);
+    fbcon_glyph_t *glyph = &glyphs[(((key ^ (key >> 9)) * 2654435761u) >> 16) % FBCON_GLYPH_SLOTS];
+    if (glyph->key == key) {
+        stats.glyph_hits++;
+        return glyph;
+    }
+
+    stats.glyph_misses++;
+    uint32_t fg = palette[attr & 0x0F];
+    uint32_t bg = palette[attr >> 4];
+    uint32_t *px = glyph->pixels;
+    for (int y = 0; y < FONT_HEIGHT; y++) {
+        uint8_t bits = font_row(c, y);
+        for (int x = 0; x < FONT_WIDTH; x++) {
+            *px++ = (bits & (0x80 >> x)) ? fg : bg;
+        }
+    }
+    glyph->key = key;
+    return glyph;
+}
+
+static void draw_cell(uint32_t x, uint32_t y) {
+    uint16_t cell = *cell_at(x, y);
+    const uint32_t *src = glyph_get(cell & 0xFF, cell >> 8)->pixels;
+    uint32_t *dst = shadow_line(y) + x * FONT_WIDTH;
+
+    for (int line = 0; line < FONT_HEIGHT; line++) {
+        for (int i = 0; i < FONT_WIDTH; i++) {
+            dst[i] = src[i];
+        }
+        src += FONT_WIDTH;
+        dst += con.width;
+    }
+    dirty[y] = 1;
+}
+
+static void cursor_hide() {
+    if (con.cursor_shown) {
+        con.cursor_shown = 0;
+        draw_cell(con.cursor_x, con.cursor_y);
+    }
+}
+
+static void cursor_show() {
+    uint8_t attr = *cell_at(con.cursor_x, con.cursor_y) >> 8;
+    uint32_t *dst = shadow_line(con.cursor_y) + (FONT_HEIGHT - FBCON_CURSOR_LINES) * con.width +
+                    con.cursor_x * FONT_WIDTH;
+
+    for (int line = 0; line < FBCON_CURSOR_LINES; line++, dst += con.width) {
+        for (int i = 0; i < FONT_WIDTH; i++) {
+            dst[i] = palette[attr & 0x0F];
+        }
+    }
+    con.cursor_shown = 1;
+    dirty[con.cursor_y] = 1;
+}
+
+int fbcon_init(multiboot_info_t *mbi) {
+    if (mbi == NULL || !(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER) ||
+        mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB || mbi->framebuffer_bpp != 32 ||
+        (mbi->framebuffer_addr >> 32) != 0) {
+        return -1;
+    }
+
+    con.fb_phys = (uint32_t)mbi->framebuffer_addr;
+    con.pitch = mbi->framebuffer_pitch;
+    con.width = mbi->framebuffer_width;
+    con.fb_size = con.pitch * mbi->framebuffer_height;
+    con.cols = con.width / FONT_WIDTH;
+    con.rows = mbi->framebuffer_height / FONT_HEIGHT;
+    if (con.cols > FBCON_MAX_COLS) {
+        con.cols = FBCON_MAX_COLS;
+    }
+    if (con.rows > FBCON_MAX_ROWS) {
+        con.rows = FBCON_MAX_ROWS;
+    }
+    if (con.cols == 0 || con.rows == 0) {
+        return -1;
+    }
+
+    uint32_t shadow_bytes = con.rows * FONT_HEIGHT * con.width * 4;
+    uint32_t shadow = pmm_alloc_frames((shadow_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    con.fb = paging_map_mmio(con.fb_phys, con.fb_size);
+    if (shadow == 0 || con.fb == NULL) {
+        return -1;
+    }
+    con.shadow = (uint32_t *)shadow;
+    memtype_set((uint32_t)con.fb, con.fb_size, MEMTYPE_WC);
+    con.streaming = cpu_features.sse2 && !(con.fb_phys & 15) && !(con.pitch & 15);
+
+    // Colour channel layout comes from the loader
+    memcpy(color_info, mbi->color_info, sizeof(color_info));
+    for (int i = 0; i < 16; i++) {
+        palette[i] = fbcon_rgb(vga_rgb[i][0], vga_rgb[i][1], vga_rgb[i][2]);
+    }
+
+    con.active = 1;
+    fbcon_clear(DEFAULT_ATTR);
+    fbcon_flush();
+    return 0;
+}
+
+int fbcon_active() {
+    return con.active;
+}
+
+uint32_t fbcon_cols() {
+    return con.cols;
+}
+
+uint32_t fbcon_rows() {
+    return con.rows;
+}
+
+uint32_t fbcon_framebuffer(uint32_t *size) {
+    *size = con.fb_size;
+    return con.fb_phys;
+}
+
+int fbcon_get_surface(fbcon_surface_t *out) {
+    if (!con.active) {
+        return -1;
+    }
+    out->pixels = con.fb;
+    out->pitch = con.pitch;
+    out->width = con.width;
+    out->height = con.fb_size / con.pitch;
+    return 0;
+}
+
+uint32_t fbcon_color(uint8_t vga) {
+    return palette[vga & 0x0F];
+}
+
+uint32_t fbcon_rgb(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)(r >> (8 - color_info[1])) << color_info[0]) |
+           ((uint32_t)(g >> (8 - color_info[3])) << color_info[2]) |
+           ((uint32_t)(b >> (8 - color_info[5])) << color_info[4]);
+}
+
+// While suspended the console keeps drawing into its shadow only; resuming
+// repaints the whole screen from it
+void fbcon_suspend(int suspend) {
+    con.suspended = suspend;
+    if (!suspend) {
+        memset(dirty, 1, con.rows);
+        fbcon_flush();
+    }
+}
+
+void fbcon_put_cell(uint32_t x, uint32_t y, char c, uint8_t attr) {
+    if (x >= con.cols || y >= con.rows) {
+        return;
+    }
+    if (con.cursor_shown && x == con.cursor_x && y == con.cursor_y) {
+        con.cursor_shown = 0;
+    }
+    *cell_at(x, y) = (uint8_t)c | (attr << 8);
+    draw_cell(x, y);
+}
+
+void fbcon_scroll(uint8_t attr) {
+    cursor_hide();
+    con.top = (con.top + 1) % con.rows;
+
+    uint32_t last = con.rows - 1;
+    uint16_t *cell = cell_at(0, last);
+    for (uint32_t x = 0; x < con.cols; x++) {
+        cell[x] = ' ' | (attr << 8);
+    }
+    fill_pixels(shadow_line(last), palette[attr >> 4], FONT_HEIGHT * con.width);
+
+    // Every row now shows different text
+    memset(dirty, 1, con.rows);
+    stats.scrolls++;
+}
+
+void fbcon_clear(uint8_t attr) {
+    con.top = 0;
+    con.cursor_shown = 0;
+    for (uint32_t y = 0; y < con.rows; y++) {
+        uint16_t *cell = cell_at(0, y);
+        for (uint32_t x = 0; x < con.cols; x++) {
+            cell[x] = ' ' | (attr << 8);
+        }
+    }
+    fill_pixels(con.shadow, palette[attr >> 4], con.rows * FONT_HEIGHT * con.width);
+    memset(dirty, 1, con.rows);
+}
+
+void fbcon_set_cursor(uint32_t x, uint32_t y) {
+    if (x >= con.cols || y >= con.rows) {
+        return;
+    }
+    if (con.cursor_shown && x == con.cursor_x && y == con.cursor_y) {
+        return;
+    }
+    cursor_hide();
+    con.cursor_x = x;
+    con.cursor_y = y;
+    cursor_show();
+}
+
+void fbcon_flush() {
+    uint32_t flushed = 0;
+    uint32_t line_bytes = con.width * 4;
+
+    if (!con.active || con.suspended) {
+        return;
+    }
+
+    if (con.streaming) {
+        kernel_fpu_begin();
+    }
+    for (uint32_t y = 0; y < con.rows; y++) {
+        if (!dirty[y]) {
+            continue;
+        }
+        const uint32_t *src = shadow_line(y);
+        uint8_t *dst = con.fb + y * FONT_HEIGHT * con.pitch;
+        for (int line = 0; line < FONT_HEIGHT; line++) {
+            if (con.streaming) {
+                stream_line(dst, (const uint8_t *)src, line_bytes);
+            } else {
+                memcpy(dst, src, line_bytes);
+            }
+            src += con.width;
+            dst += con.pitch;
+        }
+        dirty[y] = 0;
+        flushed++;
+    }
+    if (con.streaming) {
+        asm volatile ( "sfence" : : : "memory" );
+        kernel_fpu_end();
+    }
+
+    if (flushed) {
+        stats.flushes++;
+        stats.rows_flushed += flushed;
+    }
+}
+
+void fbcon_get_stats(fbcon_stats_t *out) {
+    *out = stats;
+}
+
+void fbcon_print_stats() {
+    fbcon_stats_t s = stats;
+    uint32_t lookups = s.glyph_hits + s.glyph_misses;
+
+    if (!con.active) {
+        k_print_string("fbcon: inactive, using VGA text mode\n");
+        return;
+    }
+    k_print_string("fbcon: ");
+    k_print_dec(con.cols);
+    k_print_string("x");
+    k_print_dec(con.rows);
+    k_print_string(con.streaming ? " cells, streaming\n  glyphs hits=" : " cells\n  glyphs hits=");
+    k_print_dec(s.glyph_hits);
+    k_print_string(" (");
+    k_print_dec(lookups ? s.glyph_hits * 100 / lookups : 0);
+    k_print_string("%) misses=");
+    k_print_dec(s.glyph_misses);
+    k_print_string(" scrolls=");
+    k_print_dec(s.scrolls);
+    k_print_string(" flushes=");
+    k_print_dec(s.flushes);
+    k_print_string(" rows=");
+    k_print_dec(s.rows_flushed);
+    k_print_string("\n");
+}
@@ -0,0 +1,53 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+#define FBCON_MAX_COLS     256
+#define FBCON_MAX_ROWS     128
+#define FBCON_GLYPH_SLOTS  256          // pre-rasterised (char, attribute) cells
+#define FBCON_CURSOR_LINES 2
+
+typedef struct {
+    uint16_t key;                       // char | attr << 8, 0 when empty
+    uint32_t pixels[16 * 8];
+} fbcon_glyph_t;
+
+// Raw access for the window manager
+typedef struct {
+    uint8_t *pixels;
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+} fbcon_surface_t;
+
+typedef struct {
+    uint32_t glyph_hits;
+    uint32_t glyph_misses;
+    uint32_t scrolls;
+    uint32_t flushes;
+    uint32_t rows_flushed;
+} fbcon_stats_t;
+
+int fbcon_init(multiboot_info_t *mbi);
+int fbcon_active();
+uint32_t fbcon_cols();
+uint32_t fbcon_rows();
+uint32_t fbcon_framebuffer(uint32_t *size);
+int fbcon_get_surface(fbcon_surface_t *out);
+uint32_t fbcon_color(uint8_t vga);
+uint32_t fbcon_rgb(uint8_t r, uint8_t g, uint8_t b);
+void fbcon_suspend(int suspend);
+
+// Text-mode style interface used by the console; callers serialise
+void fbcon_put_cell(uint32_t x, uint32_t y, char c, uint8_t attr);
+void fbcon_scroll(uint8_t attr);
+void fbcon_clear(uint8_t attr);
+void fbcon_set_cursor(uint32_t x, uint32_t y);
+void fbcon_flush();
+
+void fbcon_get_stats(fbcon_stats_t *out);
+void fbcon_print_stats();
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+
+#define FONT_FIRST      0x20
+#define FONT_GLYPHS     95
+#define FONT_SRC_WIDTH  5
+#define FONT_SRC_HEIGHT 7
+
+// Cell size of the rasterised font
+#define FONT_WIDTH      8
+#define FONT_HEIGHT     16
+
+extern const uint8_t font_5x7[FONT_GLYPHS][FONT_SRC_HEIGHT];
+
+// Row y (0..FONT_HEIGHT-1) of the cell for c, as 8 bits with bit 7 leftmost
+static inline uint8_t font_row(char c, int y) {
+    uint8_t index = (uint8_t)c - FONT_FIRST;
+    int src = (y - 1) / 2;
+
+    if (index >= FONT_GLYPHS || y < 1 || src >= FONT_SRC_HEIGHT) {
+        return 0;
+    }
+    return font_5x7[index][src] << 2;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "isr.h"
+#include <stddef.h>
+
+// Lazy switching: the registers hold fpu_owner's state, fpu_current is the
+// state of whoever runs now. When they differ CR0.TS is set and the first
+// FPU/SSE instruction raises #NM, where the swap actually happens.
+static fpu_state_t boot_fpu_state;
+static fpu_state_t *fpu_current = &boot_fpu_state;
+static fpu_state_t *fpu_owner = &boot_fpu_state;
+
+// XCR0 components we enable: x87, SSE and AVX (YMM upper halves)
+#define XSTATE_MASK 0x7
+
+static int fpu_use_xsave = 0;
+static int kernel_fpu_depth = 0;
+static uint32_t kernel_fpu_flags;
+
+static inline void fpu_save(fpu_state_t *state) {
+    if (fpu_use_xsave) {
+        asm volatile ( "xsave (%0)" : : "r"(state->data), "a"(XSTATE_MASK), "d"(0) : "memory" );
+    } else if (cpu_features.fxsr) {
+        asm volatile ( "fxsave (%0)" : : "r"(state->data) : "memory" );
+    } else {
+        asm volatile ( "fnsave (%0)\n\tfwait" : : "r"(state->data) : "memory" );
+    }
+}
+
+static inline void fpu_restore(fpu_state_t *state) {
+    if (fpu_use_xsave) {
+        asm volatile ( "xrstor (%0)" : : "r"(state->data), "a"(XSTATE_MASK), "d"(0) : "memory" );
+    } else if (cpu_features.fxsr) {
+        asm volatile ( "fxrstor (%0)" : : "r"(state->data) : "memory" );
+    } else {
+        asm volatile ( "frstor (%0)" : : "r"(state->data) : "memory" );
+    }
+}
+
+static void fpu_nm_handler(registers_t *regs) {
+    (void)regs;
+
+    clts();
+    if (fpu_owner == fpu_current) {
+        return;
+    }
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_owner);
+    }
+    fpu_restore(fpu_current);
+    fpu_owner = fpu_current;
+}
+
+// Build a clean register image for a new task
+void fpu_state_init(fpu_state_t *state) {
+    uint32_t flags = irq_save();
+
+    // XRSTOR faults unless the reserved XSAVE header bytes are zero
+    for (int i = 0; i < FPU_STATE_SIZE; i++) {
+        state->data[i] = 0;
+    }
+
+    clts();
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_owner);
+        fpu_owner = NULL;
+    }
+    asm volatile ( "fninit" );
+    fpu_save(state);
+    if (fpu_current != NULL) {
+        stts();
+    }
+
+    irq_restore(flags);
+}
+
+// Called on task switch. Nothing is saved here; the next FPU use faults.
+void fpu_switch_to(fpu_state_t *state) {
+    fpu_current = state;
+    if (fpu_current == fpu_owner) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+void kernel_fpu_begin() {
+    uint32_t flags = irq_save();
+
+    if (kernel_fpu_depth++ > 0) {
+        return;
+    }
+    kernel_fpu_flags = flags;
+
+    clts();
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_owner);
+        fpu_owner = NULL;
+    }
+}
+
+void kernel_fpu_end() {
+    if (--kernel_fpu_depth > 0) {
+        return;
+    }
+
+    // Registers now hold kernel scratch values, make the task reload
+    if (fpu_current != NULL) {
+        stts();
+    }
+    irq_restore(kernel_fpu_flags);
+}
+
+void fpu_init() {
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (cpu_features.fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (cpu_features.sse) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    // AVX needs XSAVE so the YMM upper halves survive a task switch.
+    // Without it, hide AVX from the rest of the kernel.
+    if (cpu_features.xsave && cpu_features.avx && cpu_features.fxsr) {
+        write_cr4(read_cr4() | CR4_OSXSAVE);
+        asm volatile ( "xsetbv" : : "c"(0), "a"(XSTATE_MASK), "d"(0) );
+        fpu_use_xsave = 1;
+    } else {
+        cpu_features.avx = 0;
+        cpu_features.avx2 = 0;
+    }
+
+    asm volatile ( "fninit" );
+    fpu_save(&boot_fpu_state);
+    fpu_owner = &boot_fpu_state;
+
+    isr_install_handler(7, fpu_nm_handler);
+}
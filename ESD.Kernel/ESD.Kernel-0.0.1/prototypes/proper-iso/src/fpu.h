@@ -0,0 +1,23 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// Saved x87/SSE/AVX register image. Big enough for an XSAVE area holding
+// x87+SSE+AVX state, and used with FXSAVE or FNSAVE on older CPUs.
+#define FPU_STATE_SIZE 1024
+
+typedef struct {
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(64))) fpu_state_t;
+
+void fpu_init();
+void fpu_state_init(fpu_state_t *state);
+void fpu_switch_to(fpu_state_t *state);
+
+// Bracket kernel code that touches x87/SSE registers. Interrupts stay off
+// for the whole section; sections may nest.
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif
@@ -0,0 +1,379 @@
+#include "initrd.h"
+#include "mem.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+// Boot modules holding a ustar or cpio (newc) archive are indexed in place
+// and mounted read-only. Inode numbers index the shared node table; 0 is
+// never used so it can mean "no node" in the tree links.
+
+static initrd_node_t nodes[INITRD_MAX_NODES];
+static uint32_t node_count = 1;
+static initrd_t initrds[INITRD_MAX_MOUNTS];
+static int initrd_count = 0;
+
+static uint32_t initrd_new_node(uint32_t parent, const char *name, uint32_t len, uint16_t type) {
+    if (node_count >= INITRD_MAX_NODES) {
+        return 0;
+    }
+
+    uint32_t ino = node_count++;
+    initrd_node_t *node = &nodes[ino];
+    node->name = name;
+    node->name_len = len;
+    node->type = type;
+    node->parent = parent;
+    node->first_child = 0;
+    node->data = NULL;
+    node->size = 0;
+    if (parent) {
+        node->next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = ino;
+    } else {
+        node->next_sibling = 0;
+    }
+    return ino;
+}
+
+static uint32_t initrd_child(uint32_t dir, const char *name, uint32_t len) {
+    for (uint32_t ino = nodes[dir].first_child; ino; ino = nodes[ino].next_sibling) {
+        if (nodes[ino].name_len == len && memcmp(nodes[ino].name, name, len) == 0) {
+            return ino;
+        }
+    }
+    return 0;
+}
+
+// Walk one path fragment from dir, creating directories on the way. The
+// last component gets `type`; "." components and empty ones are skipped.
+static uint32_t initrd_walk(uint32_t dir, const char *path, uint32_t len, uint16_t type) {
+    uint32_t pos = 0;
+
+    while (pos < len && dir) {
+        while (pos < len && path[pos] == '/') {
+            pos++;
+        }
+        uint32_t end = pos;
+        while (end < len && path[end] != '/' && path[end] != '\0') {
+            end++;
+        }
+        if (end == pos) {
+            break;
+        }
+
+        int last = 1;
+        for (uint32_t i = end; i < len && path[i] != '\0'; i++) {
+            if (path[i] != '/') {
+                last = 0;
+                break;
+            }
+        }
+
+        if (!(end - pos == 1 && path[pos] == '.')) {
+            uint16_t want = last ? type : VFS_TYPE_DIR;
+            uint32_t child = initrd_child(dir, path + pos, end - pos);
+            if (child && nodes[child].type != want) {
+                return 0;
+            }
+            dir = child ? child : initrd_new_node(dir, path + pos, end - pos, want);
+        }
+        if (last) {
+            break;
+        }
+        pos = end;
+    }
+    return dir;
+}
+
+static uint32_t parse_octal(const char *s, uint32_t len) {
+    uint32_t val = 0;
+
+    for (uint32_t i = 0; i < len && s[i] >= '0' && s[i] <= '7'; i++) {
+        val = val * 8 + (s[i] - '0');
+    }
+    return val;
+}
+
+static int parse_hex(const char *s, uint32_t *out) {
+    uint32_t val = 0;
+
+    for (int i = 0; i < 8; i++) {
+        char c = s[i];
+        if (c >= '0' && c <= '9') {
+            val = val * 16 + (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            val = val * 16 + (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            val = val * 16 + (c - 'A' + 10);
+        } else {
+            return -1;
+        }
+    }
+    *out = val;
+    return 0;
+}
+
+static uint32_t field_len(const char *s, uint32_t max) {
+    uint32_t len = 0;
+    while (len < max && s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+static int initrd_add(initrd_t *rd, const char *prefix, uint32_t prefix_len,
+                      const char *name, uint32_t name_len, uint16_t type,
+                      const uint8_t *data, uint32_t size) {
+    uint32_t dir = rd->root;
+
+    if (prefix_len > 0) {
+        dir = initrd_walk(dir, prefix, prefix_len, VFS_TYPE_DIR);
+    }
+    uint32_t ino = initrd_walk(dir, name, name_len, type);
+    if (!ino || nodes[ino].type != type) {
+        return -1;
+    }
+    if (type == VFS_TYPE_FILE) {
+        nodes[ino].data = data;
+        nodes[ino].size = size;
+        rd->files++;
+    }
+    return 0;
+}
+
+static int initrd_parse_tar(initrd_t *rd) {
+    uint32_t off = 0;
+
+    while (off + TAR_BLOCK_SIZE <= rd->size) {
+        const char *hdr = (const char *)rd->start + off;
+        if (hdr[0] == '\0') {
+            return 0;
+        }
+
+        uint32_t size = parse_octal(hdr + 124, 12);
+        const uint8_t *data = rd->start + off + TAR_BLOCK_SIZE;
+        if (size > rd->size - off - TAR_BLOCK_SIZE) {
+            return -1;
+        }
+
+        // ustar splits long paths into a directory prefix and a name
+        uint32_t prefix_len = memcmp(hdr + 257, "ustar", 5) == 0 ? field_len(hdr + 345, 155) : 0;
+        char kind = hdr[156];
+        if (kind == '0' || kind == '\0' || kind == '5') {
+            if (initrd_add(rd, hdr + 345, prefix_len, hdr, field_len(hdr, 100),
+                           kind == '5' ? VFS_TYPE_DIR : VFS_TYPE_FILE, data, size) != 0) {
+                return -1;
+            }
+        }
+        off += TAR_BLOCK_SIZE + ((size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+    }
+    return 0;
+}
+
+static int initrd_parse_cpio(initrd_t *rd) {
+    uint32_t off = 0;
+
+    while (off + CPIO_HEADER_SIZE <= rd->size) {
+        const char *hdr = (const char *)rd->start + off;
+        uint32_t mode, size, name_size;
+        if (memcmp(hdr, "070701", 6) != 0 && memcmp(hdr, "070702", 6) != 0) {
+            return -1;
+        }
+        if (parse_hex(hdr + 14, &mode) != 0 || parse_hex(hdr + 54, &size) != 0 ||
+            parse_hex(hdr + 94, &name_size) != 0) {
+            return -1;
+        }
+
+        // Name and data are each padded to four bytes
+        uint32_t data_off = (off + CPIO_HEADER_SIZE + name_size + 3) & ~3;
+        if (name_size == 0 || data_off > rd->size || size > rd->size - data_off) {
+            return -1;
+        }
+        const char *name = hdr + CPIO_HEADER_SIZE;
+        if (name_size == 11 && memcmp(name, "TRAILER!!!", 10) == 0) {
+            return 0;
+        }
+
+        uint32_t kind = mode & 0170000;
+        if (kind == 0100000 || kind == 0040000) {
+            if (initrd_add(rd, NULL, 0, name, name_size - 1,
+                           kind == 0040000 ? VFS_TYPE_DIR : VFS_TYPE_FILE,
+                           rd->start + data_off, size) != 0) {
+                return -1;
+            }
+        }
+        off = (data_off + size + 3) & ~3;
+    }
+    return 0;
+}
+
+int initrd_mount(const void *start, uint32_t size, const char *path) {
+    if (initrd_count >= INITRD_MAX_MOUNTS) {
+        return -1;
+    }
+
+    initrd_t *rd = &initrds[initrd_count];
+    uint32_t first = node_count;
+    rd->start = start;
+    rd->size = size;
+    rd->files = 0;
+    rd->root = initrd_new_node(0, "", 0, VFS_TYPE_DIR);
+    if (!rd->root) {
+        return -1;
+    }
+
+    int result;
+    if (size >= CPIO_HEADER_SIZE && memcmp(start, "0707", 4) == 0) {
+        result = initrd_parse_cpio(rd);
+    } else if (size >= TAR_BLOCK_SIZE && memcmp((const char *)start + 257, "ustar", 5) == 0) {
+        result = initrd_parse_tar(rd);
+    } else {
+        result = -1;
+    }
+    if (result != 0 || vfs_mount(path, &initrd_vfs_type, rd, rd->root, NULL) != 0) {
+        node_count = first;
+        return -1;
+    }
+
+    initrd_count++;
+    return 0;
+}
+
+// A module's command line may name its mount point as the last word,
+// e.g. "module /boot/initrd.tar /initrd"
+static void initrd_mount_path(const char *cmdline, int index, char *path) {
+    const char *word = NULL;
+    uint32_t len = 0;
+    int words = 0;
+
+    for (const char *p = cmdline; p != NULL && *p != '\0';) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char *end = p;
+        while (*end != '\0' && *end != ' ') {
+            end++;
+        }
+        word = p;
+        len = end - p;
+        words++;
+        p = end;
+    }
+
+    if (words >= 2 && word[0] == '/' && len < VFS_PATH_MAX) {
+        memcpy(path, word, len);
+        path[len] = '\0';
+        return;
+    }
+    len = strlen(INITRD_MOUNT_PATH);
+    memcpy(path, INITRD_MOUNT_PATH, len + 1);
+    if (index > 0) {
+        path[len] = '0' + index;
+        path[len + 1] = '\0';
+    }
+}
+
+void initrd_init(multiboot_info_t *mbi) {
+    if (mbi == NULL || !(mbi->flags & MULTIBOOT_INFO_MODS)) {
+        return;
+    }
+
+    multiboot_module_t *mods = (multiboot_module_t *)mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count && i < 10; i++) {
+        char path[VFS_PATH_MAX];
+        initrd_mount_path((const char *)mods[i].cmdline, initrd_count, path);
+        if (initrd_mount((const void *)mods[i].mod_start, mods[i].mod_end - mods[i].mod_start, path) != 0) {
+            continue;
+        }
+
+        k_print_string("initrd: ");
+        k_print_dec(initrds[initrd_count - 1].files);
+        k_print_string(" files (");
+        k_print_dec((mods[i].mod_end - mods[i].mod_start) / 1024);
+        k_print_string(" KiB) on ");
+        k_print_string(path);
+        k_print_string("\n");
+    }
+}
+
+static void *initrd_vfs_mount(block_device_t *dev, uint32_t *root) {
+    (void)dev;
+    (void)root;
+    return NULL;
+}
+
+static int initrd_vfs_lookup(void *fs, uint32_t dir, const char *name, uint32_t len, uint32_t *ino) {
+    (void)fs;
+
+    if (len == 1 && name[0] == '.') {
+        *ino = dir;
+        return 0;
+    }
+    if (len == 2 && name[0] == '.' && name[1] == '.') {
+        *ino = nodes[dir].parent ? nodes[dir].parent : dir;
+        return 0;
+    }
+    *ino = initrd_child(dir, name, len);
+    return *ino ? 0 : -1;
+}
+
+static int initrd_vfs_stat(void *fs, uint32_t ino, vfs_stat_t *st) {
+    (void)fs;
+
+    if (ino == 0 || ino >= node_count) {
+        return -1;
+    }
+    st->ino = ino;
+    st->type = nodes[ino].type;
+    st->size = nodes[ino].size;
+    return 0;
+}
+
+static int initrd_vfs_read(void *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len) {
+    initrd_node_t *node = &nodes[ino];
+    (void)fs;
+
+    if (offset >= node->size) {
+        return 0;
+    }
+    if (len > node->size - offset) {
+        len = node->size - offset;
+    }
+    memcpy(buf, node->data + offset, len);
+    return len;
+}
+
+static const void *initrd_vfs_map(void *fs, uint32_t ino, uint32_t *size) {
+    (void)fs;
+
+    *size = nodes[ino].size;
+    return nodes[ino].data;
+}
+
+static int initrd_vfs_readdir(void *fs, uint32_t dir, vfs_filldir_t fn, void *arg) {
+    (void)fs;
+
+    for (uint32_t ino = nodes[dir].first_child; ino; ino = nodes[ino].next_sibling) {
+        int result = fn(arg, nodes[ino].name, nodes[ino].name_len, ino, nodes[ino].type);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+const vfs_fs_type_t initrd_vfs_type = {
+    "initrd",
+    initrd_vfs_mount,
+    initrd_vfs_lookup,
+    initrd_vfs_stat,
+    initrd_vfs_read,
+    NULL,
+    initrd_vfs_readdir,
+    initrd_vfs_map,
+    NULL,
+    NULL,
+};
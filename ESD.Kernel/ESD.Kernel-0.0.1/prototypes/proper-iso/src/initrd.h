@@ -0,0 +1,40 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include "multiboot.h"
+#include "vfs.h"
+
+#define INITRD_MAX_NODES   1024         // shared by all mounted archives
+#define INITRD_MAX_MOUNTS  4
+#define INITRD_MOUNT_PATH  "/initrd"
+
+#define TAR_BLOCK_SIZE     512
+#define CPIO_HEADER_SIZE   110
+
+// Files and directories of an archive, linked as a tree. Names and data
+// point straight into the module, nothing is copied out of it.
+typedef struct {
+    const char *name;
+    uint16_t name_len;
+    uint16_t type;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    const uint8_t *data;
+    uint32_t size;
+} initrd_node_t;
+
+typedef struct {
+    const uint8_t *start;
+    uint32_t size;
+    uint32_t root;
+    uint32_t files;
+} initrd_t;
+
+void initrd_init(multiboot_info_t *mbi);
+int initrd_mount(const void *start, uint32_t size, const char *path);
+
+extern const vfs_fs_type_t initrd_vfs_type;
+
+#endif
@@ -0,0 +1,251 @@
+#include "input.h"
+#include "keyboard.h"
+#include "timer.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+// Drivers post events from IRQ context and every interested consumer gets
+// its own copy, so a slow consumer never holds up another. The producers
+// (keyboard, mouse and the repeat timer) are interrupt handlers that the
+// PIC delivers to the boot CPU with interrupts off, so they never
+// interleave and each ring stays single-producer.
+
+// Queued stand-in for coalesced motion; code holds motion_seq
+#define INPUT_MOTION 0x80
+
+static input_consumer_t *consumers;
+
+static uint8_t mods;
+static uint8_t buttons;
+static uint8_t keys_down[32];
+
+static ktimer_t repeat_timer;
+static uint8_t repeat_code;
+
+void input_register(input_consumer_t *c, const char *name, uint32_t mask) {
+    c->name = name;
+    c->mask = mask;
+    c->head = c->tail = 0;
+    c->dx = c->dy = c->dz = 0;
+    c->motion_seq = 0;
+    c->motion_queued = 0;
+    c->posted = c->dropped = c->coalesced = 0;
+
+    uint32_t flags = irq_save();
+    c->next = consumers;
+    consumers = c;
+    irq_restore(flags);
+}
+
+void input_unregister(input_consumer_t *c) {
+    uint32_t flags = irq_save();
+    for (input_consumer_t **pos = &consumers; *pos != NULL; pos = &(*pos)->next) {
+        if (*pos == c) {
+            *pos = c->next;
+            break;
+        }
+    }
+    irq_restore(flags);
+}
+
+static int ring_push(input_consumer_t *c, const input_event_t *ev) {
+    if (c->head - c->tail == INPUT_QUEUE_SIZE) {
+        c->dropped++;
+        return -1;
+    }
+    c->ring[c->head & (INPUT_QUEUE_SIZE - 1)] = *ev;
+    barrier();
+    c->head = c->head + 1;
+    c->posted++;
+    return 0;
+}
+
+static void stamp(input_event_t *ev) {
+    ev->time = timer_ticks() * (1000 / TIMER_HZ);
+    ev->mods = mods;
+    ev->buttons = buttons;
+}
+
+static void post(input_event_t *ev) {
+    stamp(ev);
+    for (input_consumer_t *c = consumers; c != NULL; c = c->next) {
+        if (c->mask & INPUT_MASK(ev->type)) {
+            ring_push(c, ev);
+        }
+    }
+}
+
+static void repeat_fire(void *ctx) {
+    (void)ctx;
+    input_event_t ev = { 0, INPUT_KEY, repeat_code, INPUT_REPEAT, 0, 0, 0, 0, 0 };
+    post(&ev);
+    timer_add(&repeat_timer, MS_TO_TICKS(INPUT_REPEAT_PERIOD_MS), repeat_fire, NULL);
+}
+
+static uint8_t modifier_bit(uint8_t code) {
+    switch (code) {
+    case KEY_LSHIFT:
+    case KEY_RSHIFT:
+        return KEY_MOD_SHIFT;
+    case KEY_LCTRL:
+    case KEY_RCTRL:
+        return KEY_MOD_CTRL;
+    case KEY_LALT:
+    case KEY_RALT:
+        return KEY_MOD_ALT;
+    }
+    return 0;
+}
+
+void input_post_key(uint8_t code, int pressed) {
+    uint8_t bit = 1 << (code & 7);
+    int was_down = keys_down[code >> 3] & bit;
+    uint8_t mod = modifier_bit(code);
+
+    // Typematic repeats from the keyboard itself are dropped; the repeat
+    // timer paces them instead
+    if (pressed && was_down) {
+        return;
+    }
+    if (pressed) {
+        keys_down[code >> 3] |= bit;
+    } else {
+        keys_down[code >> 3] &= ~bit;
+    }
+
+    if (mod != 0) {
+        mods = pressed ? mods | mod : mods & ~mod;
+    } else if (code == KEY_CAPSLOCK && pressed) {
+        mods ^= KEY_MOD_CAPS;
+    }
+
+    input_event_t ev = { 0, INPUT_KEY, code, pressed ? INPUT_PRESS : INPUT_RELEASE, 0, 0, 0, 0, 0 };
+    post(&ev);
+
+    if (pressed && mod == 0 && code != KEY_CAPSLOCK) {
+        repeat_code = code;
+        timer_add(&repeat_timer, MS_TO_TICKS(INPUT_REPEAT_DELAY_MS), repeat_fire, NULL);
+    } else if (!pressed && code == repeat_code) {
+        timer_cancel(&repeat_timer);
+        repeat_code = 0;
+    }
+}
+
+static int16_t clamp16(int32_t v) {
+    return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+// While a motion event sits in a ring further packets only add to the
+// consumer's accumulator, which it collects on reaching that event. A
+// button change carries the motion so far and bumps motion_seq, which
+// retires the queued stand-in.
+static void post_mouse(input_consumer_t *c, input_event_t *ev, int changed) {
+    c->dx += ev->dx;
+    c->dy += ev->dy;
+    c->dz += ev->dz;
+
+    if (changed) {
+        input_event_t out = *ev;
+        out.dx = clamp16(c->dx);
+        out.dy = clamp16(c->dy);
+        out.dz = clamp16(c->dz);
+        c->dx = c->dy = c->dz = 0;
+        c->motion_seq++;
+        c->motion_queued = 0;
+        ring_push(c, &out);
+        return;
+    }
+
+    if (c->motion_queued) {
+        c->coalesced++;
+        return;
+    }
+    if (c->dx == 0 && c->dy == 0 && c->dz == 0) {
+        return;
+    }
+
+    // The deltas are filled in when the consumer gets here
+    input_event_t out = *ev;
+    out.type = INPUT_MOTION;
+    out.code = c->motion_seq;
+    if (ring_push(c, &out) == 0) {
+        c->motion_queued = 1;
+    }
+}
+
+void input_post_mouse(int dx, int dy, int dz, uint8_t new_buttons) {
+    int changed = new_buttons != buttons;
+    input_event_t ev = { 0, INPUT_MOUSE, 0, 0, 0, 0, dx, dy, dz };
+
+    buttons = new_buttons;
+    stamp(&ev);
+    for (input_consumer_t *c = consumers; c != NULL; c = c->next) {
+        if (c->mask & INPUT_MASK(INPUT_MOUSE)) {
+            post_mouse(c, &ev, changed);
+        }
+    }
+}
+
+// Returns 0 if the event was retired by a later button change
+static int collect_motion(input_consumer_t *c, input_event_t *ev) {
+    uint32_t flags = irq_save();
+    int live = c->motion_queued && ev->code == c->motion_seq;
+
+    if (live) {
+        ev->dx = clamp16(c->dx);
+        ev->dy = clamp16(c->dy);
+        ev->dz = clamp16(c->dz);
+        c->dx = c->dy = c->dz = 0;
+        c->motion_queued = 0;
+    }
+
+    irq_restore(flags);
+    return live;
+}
+
+int input_read(input_consumer_t *c, input_event_t *out, int max) {
+    int n = 0;
+
+    while (n < max && c->tail != c->head) {
+        barrier();
+        out[n] = c->ring[c->tail & (INPUT_QUEUE_SIZE - 1)];
+        barrier();
+        c->tail = c->tail + 1;
+
+        if (out[n].type == INPUT_MOTION) {
+            if (!collect_motion(c, &out[n])) {
+                continue;
+            }
+            out[n].type = INPUT_MOUSE;
+            out[n].code = 0;
+        }
+        n++;
+    }
+    return n;
+}
+
+uint8_t input_mods() {
+    return mods;
+}
+
+void input_print_stats() {
+    uint32_t flags = irq_save();
+
+    for (input_consumer_t *c = consumers; c != NULL; c = c->next) {
+        k_print_string("input ");
+        k_print_string(c->name);
+        k_print_string(": posted=");
+        k_print_dec(c->posted);
+        k_print_string(" dropped=");
+        k_print_dec(c->dropped);
+        k_print_string(" coalesced=");
+        k_print_dec(c->coalesced);
+        k_print_string(" queued=");
+        k_print_dec(c->head - c->tail);
+        k_print_string("\n");
+    }
+
+    irq_restore(flags);
+}
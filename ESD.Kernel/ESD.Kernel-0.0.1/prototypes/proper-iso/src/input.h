@@ -0,0 +1,68 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+
+#define INPUT_QUEUE_SIZE 128            // per consumer, power of two
+
+#define INPUT_REPEAT_DELAY_MS  500
+#define INPUT_REPEAT_PERIOD_MS 33
+
+#define INPUT_KEY   1                   // code is a KEY_* keycode
+#define INPUT_MOUSE 2                   // relative motion and button state
+
+#define INPUT_MASK(type) (1u << (type))
+
+// Key event values
+#define INPUT_RELEASE 0
+#define INPUT_PRESS   1
+#define INPUT_REPEAT  2
+
+#define MOUSE_LEFT   0x01
+#define MOUSE_RIGHT  0x02
+#define MOUSE_MIDDLE 0x04
+
+typedef struct {
+    uint32_t time;                      // ms since boot
+    uint8_t type;
+    uint8_t code;
+    uint8_t value;
+    uint8_t mods;                       // KEY_MOD_* at the time of the event
+    uint8_t buttons;
+    int16_t dx, dy, dz;                 // dy grows downwards, like the screen
+} input_event_t;
+
+// Each consumer owns a single-producer single-consumer ring. head is
+// only written by producers and tail only by the consumer.
+typedef struct input_consumer {
+    const char *name;
+    uint32_t mask;
+    input_event_t ring[INPUT_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    // Mouse motion not yet handed to this consumer
+    int32_t dx, dy, dz;
+    uint8_t motion_seq;
+    int motion_queued;
+
+    uint32_t posted;
+    uint32_t dropped;                   // ring full
+    uint32_t coalesced;                 // mouse packets folded into a queued event
+    struct input_consumer *next;
+} input_consumer_t;
+
+void input_register(input_consumer_t *c, const char *name, uint32_t mask);
+void input_unregister(input_consumer_t *c);
+
+// Producers: IRQ context only
+void input_post_key(uint8_t code, int pressed);
+void input_post_mouse(int dx, int dy, int dz, uint8_t buttons);
+
+// Returns the number of events copied
+int input_read(input_consumer_t *c, input_event_t *out, int max);
+
+uint8_t input_mods();
+void input_print_stats();
+
+#endif
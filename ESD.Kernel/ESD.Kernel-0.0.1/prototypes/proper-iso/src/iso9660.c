@@ -0,0 +1,258 @@
+#include "iso9660.h"
+#include "bcache.h"
+#include "mem.h"
+#include <stddef.h>
+
+// Read-only ISO9660 with Rock Ridge names. A file's inode number is the
+// byte offset of its directory record, which holds everything stat and
+// read need.
+
+static iso9660_fs_t mounts[ISO_MAX_MOUNTS];
+static int mount_count = 0;
+
+typedef int (*iso_visit_t)(void *arg, const char *name, uint32_t len, uint32_t ino, const iso_record_t *rec);
+
+static int iso_read_record(iso9660_fs_t *fs, uint32_t ino, iso_record_t *rec) {
+    if (bcache_read(fs->dev, ino, rec, sizeof(*rec)) != 0 || rec->length < sizeof(*rec)) {
+        return -1;
+    }
+    return 0;
+}
+
+static uint8_t *iso_system_use(const iso_record_t *rec, uint32_t *len) {
+    uint32_t start = sizeof(*rec) + rec->name_len + ((rec->name_len & 1) ? 0 : 1);
+    *len = rec->length > start ? rec->length - start : 0;
+    return (uint8_t *)rec + start;
+}
+
+// Rock Ridge alternate name, possibly split over several NM entries
+static int iso_rr_name(const iso_record_t *rec, char *name) {
+    uint32_t su_len;
+    uint8_t *su = iso_system_use(rec, &su_len);
+    int len = -1;
+
+    while (su_len >= 4) {
+        uint32_t entry_len = su[2];
+        if (entry_len < 4 || entry_len > su_len) {
+            break;
+        }
+        if (su[0] == 'N' && su[1] == 'M' && entry_len >= 5) {
+            uint8_t flags = su[4];
+            if (len < 0) {
+                len = 0;
+            }
+            if (flags & 0x02) {
+                name[len++] = '.';
+            } else if (flags & 0x04) {
+                name[len++] = '.';
+                name[len++] = '.';
+            } else if (len + entry_len - 5 < 256) {
+                memcpy(name + len, su + 5, entry_len - 5);
+                len += entry_len - 5;
+            }
+            if (!(flags & 0x01)) {
+                break;
+            }
+        }
+        su += entry_len;
+        su_len -= entry_len;
+    }
+    return len;
+}
+
+// Plain ISO9660 names: drop ";1" and a trailing dot, show lower case
+static int iso_plain_name(const iso_record_t *rec, char *name) {
+    int len = 0;
+
+    for (int i = 0; i < rec->name_len && rec->name[i] != ';'; i++) {
+        char c = rec->name[i];
+        name[len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    return len;
+}
+
+static int iso_iterate(iso9660_fs_t *fs, uint32_t dir, iso_visit_t fn, void *arg) {
+    iso_record_t rec;
+    uint8_t sector[ISO_SECTOR_SIZE];
+    char name[256];
+
+    if (iso_read_record(fs, dir, &rec) != 0 || !(rec.flags & ISO_FLAG_DIR)) {
+        return -1;
+    }
+
+    uint32_t base = rec.extent * ISO_SECTOR_SIZE;
+    for (uint32_t off = 0; off < rec.size; off += ISO_SECTOR_SIZE) {
+        if (bcache_read(fs->dev, base + off, sector, ISO_SECTOR_SIZE) != 0) {
+            return -1;
+        }
+
+        // Records never span sectors; a zero length pads to the next one
+        uint32_t pos = 0;
+        while (pos + sizeof(iso_record_t) <= ISO_SECTOR_SIZE) {
+            iso_record_t *r = (iso_record_t *)(sector + pos);
+            if (r->length == 0 || pos + r->length > ISO_SECTOR_SIZE) {
+                break;
+            }
+
+            int len;
+            if (r->name_len == 1 && r->name[0] == 0) {
+                name[0] = '.';
+                len = 1;
+            } else if (r->name_len == 1 && r->name[0] == 1) {
+                name[0] = name[1] = '.';
+                len = 2;
+            } else if (!fs->rock_ridge || (len = iso_rr_name(r, name)) < 0) {
+                len = iso_plain_name(r, name);
+            }
+
+            int result = fn(arg, name, len, base + off + pos, r);
+            if (result != 0) {
+                return result;
+            }
+            pos += r->length;
+        }
+    }
+    return 0;
+}
+
+static int iso_has_sp(void *arg, const char *name, uint32_t len, uint32_t ino, const iso_record_t *rec) {
+    uint32_t su_len;
+    uint8_t *su = iso_system_use(rec, &su_len);
+    (void)name;
+    (void)len;
+    (void)ino;
+
+    // SUSP announces itself in the root's "." record
+    *(int *)arg = su_len >= 7 && su[0] == 'S' && su[1] == 'P' && su[4] == 0xBE && su[5] == 0xEF;
+    return 1;
+}
+
+static void *iso9660_mount(block_device_t *dev, uint32_t *root) {
+    uint8_t vd[ISO_SECTOR_SIZE];
+
+    if (mount_count >= ISO_MAX_MOUNTS || ISO_SECTOR_SIZE % dev->sector_size != 0) {
+        return NULL;
+    }
+
+    for (uint32_t sector = ISO_FIRST_VD; sector < ISO_FIRST_VD + 16; sector++) {
+        if (bcache_read(dev, sector * ISO_SECTOR_SIZE, vd, sizeof(vd)) != 0 ||
+            memcmp(vd + 1, "CD001", 5) != 0 || vd[0] == ISO_VD_END) {
+            return NULL;
+        }
+        if (vd[0] != ISO_VD_PRIMARY || (vd[128] | (vd[129] << 8)) != ISO_SECTOR_SIZE) {
+            continue;
+        }
+
+        iso9660_fs_t *fs = &mounts[mount_count];
+        fs->dev = dev;
+        fs->root = sector * ISO_SECTOR_SIZE + ISO_ROOT_RECORD;
+        fs->rock_ridge = 0;
+        iso_iterate(fs, fs->root, iso_has_sp, &fs->rock_ridge);
+
+        mount_count++;
+        *root = fs->root;
+        return fs;
+    }
+    return NULL;
+}
+
+static int iso_name_eq(const char *a, const char *b, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        char x = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] - 'A' + 'a' : a[i];
+        char y = (b[i] >= 'A' && b[i] <= 'Z') ? b[i] - 'A' + 'a' : b[i];
+        if (x != y) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t len;
+    uint32_t ino;
+} iso_lookup_t;
+
+static int iso_match(void *arg, const char *name, uint32_t len, uint32_t ino, const iso_record_t *rec) {
+    iso_lookup_t *l = arg;
+    (void)rec;
+
+    if (len == l->len && iso_name_eq(name, l->name, len)) {
+        l->ino = ino;
+        return 1;
+    }
+    return 0;
+}
+
+static int iso9660_lookup(void *fs, uint32_t dir, const char *name, uint32_t len, uint32_t *ino) {
+    iso_lookup_t l = { name, len, 0 };
+
+    if (iso_iterate(fs, dir, iso_match, &l) != 1) {
+        return -1;
+    }
+    *ino = l.ino;
+    return 0;
+}
+
+static int iso9660_stat(void *fs, uint32_t ino, vfs_stat_t *st) {
+    iso_record_t rec;
+
+    if (iso_read_record(fs, ino, &rec) != 0) {
+        return -1;
+    }
+    st->ino = ino;
+    st->type = (rec.flags & ISO_FLAG_DIR) ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    st->size = rec.size;
+    return 0;
+}
+
+// File data is one contiguous extent
+static int iso9660_read(void *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len) {
+    iso9660_fs_t *iso = fs;
+    iso_record_t rec;
+
+    if (iso_read_record(iso, ino, &rec) != 0 || (rec.flags & ISO_FLAG_DIR)) {
+        return -1;
+    }
+    if (offset >= rec.size) {
+        return 0;
+    }
+    if (len > rec.size - offset) {
+        len = rec.size - offset;
+    }
+    if (bcache_read(iso->dev, rec.extent * ISO_SECTOR_SIZE + offset, buf, len) != 0) {
+        return -1;
+    }
+    return len;
+}
+
+typedef struct {
+    vfs_filldir_t fn;
+    void *arg;
+} iso_filldir_t;
+
+static int iso_fill(void *arg, const char *name, uint32_t len, uint32_t ino, const iso_record_t *rec) {
+    iso_filldir_t *fill = arg;
+    return fill->fn(fill->arg, name, len, ino, (rec->flags & ISO_FLAG_DIR) ? VFS_TYPE_DIR : VFS_TYPE_FILE);
+}
+
+static int iso9660_readdir(void *fs, uint32_t dir, vfs_filldir_t fn, void *arg) {
+    iso_filldir_t fill = { fn, arg };
+    return iso_iterate(fs, dir, iso_fill, &fill);
+}
+
+const vfs_fs_type_t iso9660_vfs_type = {
+    "iso9660",
+    iso9660_mount,
+    iso9660_lookup,
+    iso9660_stat,
+    iso9660_read,
+    NULL,
+    iso9660_readdir,
+    NULL,
+    NULL,
+    NULL,
+};
@@ -0,0 +1,41 @@
+#ifndef ISO9660_H
+#define ISO9660_H
+
+#include <stdint.h>
+#include "blk.h"
+#include "vfs.h"
+
+#define ISO_SECTOR_SIZE   2048
+#define ISO_FIRST_VD      16
+#define ISO_VD_PRIMARY    1
+#define ISO_VD_END        255
+#define ISO_ROOT_RECORD   156           // offset of the root record in the PVD
+#define ISO_FLAG_DIR      0x02
+#define ISO_MAX_MOUNTS    2
+
+typedef struct {
+    uint8_t length;
+    uint8_t ext_length;
+    uint32_t extent;
+    uint32_t extent_be;
+    uint32_t size;
+    uint32_t size_be;
+    uint8_t date[7];
+    uint8_t flags;
+    uint8_t unit_size;
+    uint8_t gap;
+    uint16_t volume_seq;
+    uint16_t volume_seq_be;
+    uint8_t name_len;
+    char name[];
+} __attribute__((packed)) iso_record_t;
+
+typedef struct {
+    block_device_t *dev;
+    uint32_t root;                      // byte offset of the root record
+    int rock_ridge;                     // names come from RRIP NM entries
+} iso9660_fs_t;
+
+extern const vfs_fs_type_t iso9660_vfs_type;
+
+#endif
@@ -1,6 +1,11 @@
 #include "isr.h"
 #include "idt.h"
 #include "simple_kernel.h"
+#include "panic.h"
+#include "trace.h"
+#include "spinlock.h"
+#include "rcu.h"
+#include "tasklet.h"
 #include <stddef.h>
 
 #define PIC1_COMMAND 0x20
@@ -12,39 +17,87 @@
 
 isr_t interrupt_handlers[256] = {NULL};
 
+static uint32_t irq_counts[16];
+
+// Serializes writers of interrupt_handlers. Dispatch reads the table under
+// rcu_read_lock only, so it never waits on a writer.
+static spinlock_t handlers_lock;
+
+static const char *exception_names[32] = {
+    "Division By Zero", "Debug", "Non Maskable Interrupt", "Breakpoint",
+    "Into Detected Overflow", "Out of Bounds", "Invalid Opcode", "No Coprocessor",
+    "Double Fault", "Coprocessor Segment Overrun", "Bad TSS", "Segment Not Present",
+    "Stack Fault", "General Protection Fault", "Page Fault", "Unknown Interrupt",
+    "Coprocessor Fault", "Alignment Check", "Machine Check", "SIMD Floating Point",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved"
+};
+
 void isr_handler_c(registers_t *regs) {
-    if (interrupt_handlers[regs->int_no] != NULL) {
-        isr_t handler = interrupt_handlers[regs->int_no];
+    trace_record(TRACE_EXCEPTION, regs->int_no);
+
+    // Another CPU panicked and sent us the stop NMI
+    if (regs->int_no == 2 && panic_in_progress) {
+        panic_halt();
+    }
+
+    rcu_read_lock();
+    isr_t handler = rcu_dereference(interrupt_handlers[regs->int_no]);
+    if (handler != NULL) {
         handler(regs);
+        rcu_read_unlock();
     } else {
-        k_print_string("Unhandled interrupt: ");
-        k_put_char('\n');
+        // Returning would just re-run the faulting instruction
+        k_panic(exception_names[regs->int_no & 31], regs);
     }
 }
 
 void irq_handler_c(registers_t *regs) {
+    trace_record(TRACE_IRQ, regs->int_no);
+
     if (regs->int_no < 32 || regs->int_no > 47) {
         k_print_string("Invalid IRQ number: ");
         return;
     }
+    irq_counts[regs->int_no - IRQ0]++;
     
     if (regs->int_no >= 40) {
         outb(PIC2_COMMAND, PIC_EOI);
     }
     outb(PIC1_COMMAND, PIC_EOI);
 
-    if (interrupt_handlers[regs->int_no] != NULL) {
-        isr_t handler = interrupt_handlers[regs->int_no];
+    rcu_read_lock();
+    isr_t handler = rcu_dereference(interrupt_handlers[regs->int_no]);
+    if (handler != NULL) {
         handler(regs);
     }
+    rcu_read_unlock();
+
+    tasklet_run();
+}
+
+uint32_t irq_count(int line) {
+    return irq_counts[line & 15];
 }
 
 void isr_install_handler(int isr_number, isr_t handler) {
-    interrupt_handlers[isr_number] = handler;
+    uint32_t flags = spin_lock_irqsave(&handlers_lock);
+    rcu_assign_pointer(interrupt_handlers[isr_number], handler);
+    spin_unlock_irqrestore(&handlers_lock, flags);
 }
 
 void isr_uninstall_handler(int isr_number) {
-    interrupt_handlers[isr_number] = NULL;
+    uint32_t flags = spin_lock_irqsave(&handlers_lock);
+    rcu_assign_pointer(interrupt_handlers[isr_number], NULL);
+    spin_unlock_irqrestore(&handlers_lock, flags);
+}
+
+// Uninstall and wait until no CPU can still be running the old handler,
+// after which the caller may free whatever the handler used
+void isr_uninstall_handler_sync(int isr_number) {
+    isr_uninstall_handler(isr_number);
+    synchronize_rcu();
 }
 
 void pic_remap(int offset1, int offset2) {
@@ -84,6 +137,8 @@ void pic_unmask_irq(unsigned char irq_line) {
 }
 
 void isr_init_gates() {
+    spin_init(&handlers_lock, "isr_handlers");
+
     // Exception handlers
     idt_set_gate(0, (uint32_t)isr0, KERNEL_CS, 0x8E);
     idt_set_gate(1, (uint32_t)isr1, KERNEL_CS, 0x8E);
@@ -135,4 +190,9 @@ void isr_init_gates() {
     idt_set_gate(IRQ13, (uint32_t)irq13, KERNEL_CS, 0x8E);
     idt_set_gate(IRQ14, (uint32_t)irq14, KERNEL_CS, 0x8E);
     idt_set_gate(IRQ15, (uint32_t)irq15, KERNEL_CS, 0x8E);
+
+    // MSI/MSI-X and local APIC vectors
+    for (int i = 0; i < DYN_VECTOR_COUNT; i++) {
+        idt_set_gate(DYN_VECTOR_BASE + i, dyn_stub_table[i], KERNEL_CS, 0x8E);
+    }
 }
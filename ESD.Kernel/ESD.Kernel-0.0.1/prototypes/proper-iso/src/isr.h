@@ -4,12 +4,17 @@
 #include <stdint.h>
 #include "idt.h"
 
+// Layout of the frame built by the stubs in isr_asm.s. useresp and ss are
+// only pushed by the CPU when the interrupt came from a lower privilege level.
 typedef struct {
     uint32_t ds;
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
     uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags, useresp, ss;
 } __attribute__((packed)) registers_t;
 
+#define REGS_FROM_USER(r) (((r)->cs & 3) != 0)
+
 #define IRQ0  32
 #define IRQ1  33
 #define IRQ2  34
@@ -27,14 +32,20 @@ typedef struct {
 #define IRQ14 46
 #define IRQ15 47
 
+// Vectors above the PIC range are handed out at runtime (see msi.h)
+#define DYN_VECTOR_BASE  48
+#define DYN_VECTOR_COUNT 208
+
 typedef void (*isr_t)(registers_t*);
 
 void isr_handler_c(registers_t *regs);
 void irq_handler_c(registers_t *regs);
 void isr_install_handler(int isr_number, isr_t handler);
 void isr_uninstall_handler(int isr_number);
+void isr_uninstall_handler_sync(int isr_number);
 void pic_remap(int offset1, int offset2);
 void pic_unmask_irq(unsigned char irq_line);
+uint32_t irq_count(int line);
 void pic_mask_all();
 void isr_init_gates();
 
@@ -72,6 +83,8 @@ extern void isr29(); // Reserved
 extern void isr30(); // Reserved
 extern void isr31(); // Reserved
 
+extern uint32_t dyn_stub_table[DYN_VECTOR_COUNT];
+
 // IRQ handlers
 extern void irq0();
 extern void irq1();
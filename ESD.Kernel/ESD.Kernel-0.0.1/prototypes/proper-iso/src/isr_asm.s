@@ -3,45 +3,30 @@ section .text
 
 extern irq_handler_c
 extern isr_handler_c
+extern dyn_irq_handler_c
 
-; Exception handler macro
+; Exception handler macros
+; Every stub leaves the same frame on the stack before jumping to the common
+; path, so registers_t always matches: ds, pusha set, int_no, err_code, then
+; the eip/cs/eflags (and useresp/ss on a privilege change) pushed by the CPU.
 %macro ISR_NO_ERR 1
 global isr%1
 isr%1:
-    pusha                   ; Push all registers
-    
-    xor eax, eax
-    mov ax, ds
-    push eax                ; Save data segment
-    
-    mov ax, 0x10            ; Kernel data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    push byte 0             ; Push dummy error code
-    push byte %1            ; Push interrupt number
-    
-    push esp                ; Push pointer to registers struct
-    call isr_handler_c      ; Call C handler
-    add esp, 4              ; Clean up function argument
-    
-    add esp, 8              ; Clean up error code and int number
-    
-    pop eax                 ; Restore data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    popa                    ; Restore registers
-    iret                    ; Return from interrupt
+    push dword 0            ; Push dummy error code
+    push dword %1           ; Push interrupt number
+    jmp isr_common_stub
 %endmacro
 
 %macro ISR_ERR 1
 global isr%1
 isr%1:
+    ; Error code already pushed by processor
+    push dword %1           ; Push interrupt number
+    jmp isr_common_stub
+%endmacro
+
+; Common body for exceptions and IRQs, %1 is the C handler to call
+%macro INT_COMMON 1
     pusha                   ; Push all registers
     
     xor eax, eax
@@ -54,15 +39,10 @@ isr%1:
     mov fs, ax
     mov gs, ax
     
-    ; Error code already pushed by processor
-    push byte %1            ; Push interrupt number
-    
     push esp                ; Push pointer to registers struct
-    call isr_handler_c      ; Call C handler
+    call %1                 ; Call C handler
     add esp, 4              ; Clean up function argument
     
-    add esp, 8              ; Clean up error code and int number
-    
     pop eax                 ; Restore data segment
     mov ds, ax
     mov es, ax
@@ -70,10 +50,19 @@ isr%1:
     mov gs, ax
     
     popa                    ; Restore registers
-    add esp, 4              ; Skip error code
+    add esp, 8              ; Clean up interrupt number and error code
     iret                    ; Return from interrupt
 %endmacro
 
+isr_common_stub:
+    INT_COMMON isr_handler_c
+
+irq_common_stub:
+    INT_COMMON irq_handler_c
+
+dyn_common_stub:
+    INT_COMMON dyn_irq_handler_c
+
 ; CPU exception handlers
 ISR_NO_ERR 0
 ISR_NO_ERR 1
@@ -108,39 +97,13 @@ ISR_NO_ERR 29
 ISR_NO_ERR 30
 ISR_NO_ERR 31
 
-; IRQ handlers (existing code)
+; IRQ handlers
 %macro IRQ 2
 global irq%1
 irq%1:
-    pusha
-    
-    xor eax, eax
-    mov ax, ds
-    push eax
-    
-    mov ax, 0x10
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    push byte %2
-    push byte 0
-    
-    push esp
-    call irq_handler_c
-    add esp, 4
-    
-    add esp, 8
-    
-    pop eax
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    popa
-    iret
+    push dword 0            ; Push dummy error code
+    push dword %2           ; Push interrupt number
+    jmp irq_common_stub
 %endmacro
 
 IRQ  0, 32
@@ -160,6 +123,26 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+; Dynamically allocated vectors (MSI/MSI-X, local APIC), 48-255.
+; Same frame as the IRQ macro, one stub per vector generated with %rep.
+%assign vec 48
+%rep 208
+irq_dyn_%+vec:
+    push dword 0            ; Push dummy error code
+    push dword vec          ; Push interrupt number
+    jmp dyn_common_stub
+%assign vec vec+1
+%endrep
+
+; Stub addresses indexed by (vector - 48), used by isr_init_gates
+global dyn_stub_table
+dyn_stub_table:
+%assign vec 48
+%rep 208
+    dd irq_dyn_%+vec
+%assign vec vec+1
+%endrep
+
 global idt_load
 idt_load:
     mov eax, [esp+4]
@@ -1,15 +1,63 @@
 #include "keyboard.h"
 #include "simple_kernel.h"
+#include "input.h"
 #include "isr.h"
 
+// US layout, set 1 make codes below KEY_CAPSLOCK
+static const char keymap[KEY_CAPSLOCK + 1] =
+    "\0\0331234567890-=\b\tqwertyuiop[]\n\0asdfghjkl;'`\0\\zxcvbnm,./\0*\0 ";
+static const char keymap_shift[KEY_CAPSLOCK + 1] =
+    "\0\033!@#$%^&*()_+\b\tQWERTYUIOP{}\n\0ASDFGHJKL:\"~\0|ZXCVBNM<>?\0*\0 ";
+
+static int extended;
+static int pause_bytes;
+
 void keyboard_handler_main(registers_t *regs) {
-    inb(0x60);
-    k_print_string("KEY ");
+    (void)regs;
+    uint8_t scancode = inb(0x60);
+
+    // Pause sends E1 1D 45 E1 9D C5 and nothing on release
+    if (pause_bytes > 0) {
+        pause_bytes--;
+        return;
+    }
+    if (scancode == 0xE1) {
+        pause_bytes = 5;
+        return;
+    }
+    if (scancode == 0xE0) {
+        extended = 1;
+        return;
+    }
+
+    uint8_t code = (scancode & 0x7F) | (extended ? 0x80 : 0);
+    extended = 0;
+
+    // Fake shifts that bracket some extended keys
+    if (code == (0x80 | KEY_LSHIFT) || code == (0x80 | KEY_RSHIFT)) {
+        return;
+    }
+    input_post_key(code, !(scancode & 0x80));
+}
+
+char keyboard_to_ascii(uint8_t code, uint8_t mods) {
+    if (code >= KEY_CAPSLOCK) {
+        return 0;
+    }
+
+    char c = (mods & KEY_MOD_SHIFT) ? keymap_shift[code] : keymap[code];
+    if ((mods & KEY_MOD_CAPS) && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c ^= 0x20;
+    }
+    if ((mods & KEY_MOD_CTRL) && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+        c &= 0x1F;
+    }
+    return c;
 }
 
 void keyboard_install() {
     k_print_string("Installing keyboard handler...\n");
     isr_install_handler(IRQ1, keyboard_handler_main);
-    pic_mask_all();
+    pic_unmask_irq(1);
     k_print_string("Keyboard handler installed.\n");
 }
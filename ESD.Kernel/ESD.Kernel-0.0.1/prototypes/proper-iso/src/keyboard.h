@@ -1,9 +1,46 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#include <stdint.h>
 #include "isr.h"
 
+// Keycodes are set 1 make codes; E0-prefixed keys get bit 7 set
+#define KEY_ESC       0x01
+#define KEY_BACKSPACE 0x0E
+#define KEY_TAB       0x0F
+#define KEY_ENTER     0x1C
+#define KEY_LCTRL     0x1D
+#define KEY_LSHIFT    0x2A
+#define KEY_RSHIFT    0x36
+#define KEY_LALT      0x38
+#define KEY_SPACE     0x39
+#define KEY_CAPSLOCK  0x3A
+#define KEY_F1        0x3B
+#define KEY_F10       0x44
+#define KEY_F11       0x57
+#define KEY_F12       0x58
+#define KEY_RCTRL     0x9D
+#define KEY_RALT      0xB8
+#define KEY_HOME      0xC7
+#define KEY_UP        0xC8
+#define KEY_PGUP      0xC9
+#define KEY_LEFT      0xCB
+#define KEY_RIGHT     0xCD
+#define KEY_END       0xCF
+#define KEY_DOWN      0xD0
+#define KEY_PGDN      0xD1
+#define KEY_INSERT    0xD2
+#define KEY_DELETE    0xD3
+
+#define KEY_MOD_SHIFT 0x01
+#define KEY_MOD_CTRL  0x02
+#define KEY_MOD_ALT   0x04
+#define KEY_MOD_CAPS  0x08
+
 void keyboard_install();
 void keyboard_handler_main(registers_t *regs);
 
+// Character for a keycode under the given modifiers, 0 if none
+char keyboard_to_ascii(uint8_t code, uint8_t mods);
+
 #endif
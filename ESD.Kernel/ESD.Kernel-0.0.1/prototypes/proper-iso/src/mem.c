@@ -0,0 +1,299 @@
+#include "mem.h"
+#include "cpu.h"
+#include "fpu.h"
+
+// Below this size the cost of kernel_fpu_begin/end outweighs SIMD gains
+#define MEM_SIMD_THRESHOLD 256
+
+typedef void *(*memcpy_fn)(void *dst, const void *src, size_t n);
+typedef void *(*memset_fn)(void *dst, int c, size_t n);
+
+static inline void rep_movsb(void *dst, const void *src, size_t n) {
+    asm volatile ( "rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(n)
+                   : : "memory" );
+}
+
+static inline void rep_stosb(void *dst, uint8_t c, size_t n) {
+    asm volatile ( "rep stosb"
+                   : "+D"(dst), "+c"(n)
+                   : "a"(c) : "memory" );
+}
+
+static void *memcpy_generic(void *dst, const void *src, size_t n) {
+    void *d = dst;
+    size_t dwords = n >> 2;
+
+    asm volatile ( "rep movsl"
+                   : "+D"(d), "+S"(src), "+c"(dwords)
+                   : : "memory" );
+    rep_movsb(d, src, n & 3);
+    return dst;
+}
+
+static void *memset_generic(void *dst, int c, size_t n) {
+    void *d = dst;
+    size_t dwords = n >> 2;
+    uint32_t v = (uint8_t)c * 0x01010101u;
+
+    asm volatile ( "rep stosl"
+                   : "+D"(d), "+c"(dwords)
+                   : "a"(v) : "memory" );
+    rep_stosb(d, (uint8_t)c, n & 3);
+    return dst;
+}
+
+// Enhanced REP MOVSB/STOSB: microcode picks the best chunking itself
+static void *memcpy_erms(void *dst, const void *src, size_t n) {
+    rep_movsb(dst, src, n);
+    return dst;
+}
+
+static void *memset_erms(void *dst, int c, size_t n) {
+    rep_stosb(dst, (uint8_t)c, n);
+    return dst;
+}
+
+static void *memcpy_sse2(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_THRESHOLD) {
+        return memcpy_generic(dst, src, n);
+    }
+
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+    rep_movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    kernel_fpu_begin();
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        asm volatile ( "movdqu   (%1), %%xmm0\n\t"
+                       "movdqu 16(%1), %%xmm1\n\t"
+                       "movdqu 32(%1), %%xmm2\n\t"
+                       "movdqu 48(%1), %%xmm3\n\t"
+                       "movdqa %%xmm0,   (%0)\n\t"
+                       "movdqa %%xmm1, 16(%0)\n\t"
+                       "movdqa %%xmm2, 32(%0)\n\t"
+                       "movdqa %%xmm3, 48(%0)"
+                       : : "r"(d), "r"(s) : "memory" );
+    }
+    kernel_fpu_end();
+
+    rep_movsb(d, s, n);
+    return dst;
+}
+
+static void *memset_sse2(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_THRESHOLD) {
+        return memset_generic(dst, c, n);
+    }
+
+    uint8_t *d = dst;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    uint32_t v = (uint8_t)c * 0x01010101u;
+
+    rep_stosb(d, (uint8_t)c, head);
+    d += head;
+    n -= head;
+
+    kernel_fpu_begin();
+    asm volatile ( "movd %0, %%xmm0\n\t"
+                   "pshufd $0, %%xmm0, %%xmm0"
+                   : : "r"(v) );
+    for (; n >= 64; n -= 64, d += 64) {
+        asm volatile ( "movdqa %%xmm0,   (%0)\n\t"
+                       "movdqa %%xmm0, 16(%0)\n\t"
+                       "movdqa %%xmm0, 32(%0)\n\t"
+                       "movdqa %%xmm0, 48(%0)"
+                       : : "r"(d) : "memory" );
+    }
+    kernel_fpu_end();
+
+    rep_stosb(d, (uint8_t)c, n);
+    return dst;
+}
+
+static void *memcpy_avx2(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_THRESHOLD) {
+        return memcpy_erms(dst, src, n);
+    }
+
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+
+    rep_movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    kernel_fpu_begin();
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        asm volatile ( "vmovdqu   (%1), %%ymm0\n\t"
+                       "vmovdqu 32(%1), %%ymm1\n\t"
+                       "vmovdqu 64(%1), %%ymm2\n\t"
+                       "vmovdqu 96(%1), %%ymm3\n\t"
+                       "vmovdqa %%ymm0,   (%0)\n\t"
+                       "vmovdqa %%ymm1, 32(%0)\n\t"
+                       "vmovdqa %%ymm2, 64(%0)\n\t"
+                       "vmovdqa %%ymm3, 96(%0)"
+                       : : "r"(d), "r"(s) : "memory" );
+    }
+    asm volatile ( "vzeroupper" );
+    kernel_fpu_end();
+
+    rep_movsb(d, s, n);
+    return dst;
+}
+
+static void *memset_avx2(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_THRESHOLD) {
+        return memset_erms(dst, c, n);
+    }
+
+    uint8_t *d = dst;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    uint32_t v = (uint8_t)c * 0x01010101u;
+
+    rep_stosb(d, (uint8_t)c, head);
+    d += head;
+    n -= head;
+
+    kernel_fpu_begin();
+    asm volatile ( "vmovd %0, %%xmm0\n\t"
+                   "vpbroadcastd %%xmm0, %%ymm0"
+                   : : "r"(v) );
+    for (; n >= 128; n -= 128, d += 128) {
+        asm volatile ( "vmovdqa %%ymm0,   (%0)\n\t"
+                       "vmovdqa %%ymm0, 32(%0)\n\t"
+                       "vmovdqa %%ymm0, 64(%0)\n\t"
+                       "vmovdqa %%ymm0, 96(%0)"
+                       : : "r"(d) : "memory" );
+    }
+    asm volatile ( "vzeroupper" );
+    kernel_fpu_end();
+
+    rep_stosb(d, (uint8_t)c, n);
+    return dst;
+}
+
+static memcpy_fn memcpy_impl = memcpy_generic;
+static memset_fn memset_impl = memset_generic;
+static const char *impl_name = "generic";
+
+void mem_init() {
+    if (cpu_features.avx2) {
+        memcpy_impl = memcpy_avx2;
+        memset_impl = memset_avx2;
+        impl_name = "avx2";
+    } else if (cpu_features.erms) {
+        memcpy_impl = memcpy_erms;
+        memset_impl = memset_erms;
+        impl_name = "erms";
+    } else if (cpu_features.sse2) {
+        memcpy_impl = memcpy_sse2;
+        memset_impl = memset_sse2;
+        impl_name = "sse2";
+    }
+}
+
+const char *mem_impl_name() {
+    return impl_name;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    return memcpy_impl(dst, src, n);
+}
+
+void *memset(void *dst, int c, size_t n) {
+    return memset_impl(dst, c, n);
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    if (d + n <= s || s + n <= d) {
+        return memcpy_impl(dst, src, n);
+    }
+
+    // Overlapping: REP MOVSB is defined byte by byte, so it is safe in
+    // either direction once DF is set accordingly
+    if (d < s) {
+        rep_movsb(d, s, n);
+    } else if (d > s) {
+        d += n - 1;
+        s += n - 1;
+        asm volatile ( "std\n\t"
+                       "rep movsb\n\t"
+                       "cld"
+                       : "+D"(d), "+S"(s), "+c"(n)
+                       : : "memory" );
+    }
+    return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *p = a;
+    const uint8_t *q = b;
+
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return p[i] - q[i];
+        }
+    }
+    return 0;
+}
+
+size_t strlen(const char *s) {
+    size_t len = 0;
+    while (s[len] != '\0') len++;
+    return len;
+}
+
+int strcmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i] || a[i] == '\0') {
+            return (uint8_t)a[i] - (uint8_t)b[i];
+        }
+    }
+    return 0;
+}
+
+void *memset16(void *dst, uint16_t val, size_t count) {
+    void *d = dst;
+
+    asm volatile ( "rep stosw"
+                   : "+D"(d), "+c"(count)
+                   : "a"(val) : "memory" );
+    return dst;
+}
+
+void memzero_nt(void *dst, size_t n) {
+    if (!cpu_features.sse2) {
+        memset_impl(dst, 0, n);
+        return;
+    }
+
+    // MOVNTI works on general purpose registers, no FPU section needed
+    uint32_t *d = dst;
+    for (; n >= 16; n -= 16, d += 4) {
+        asm volatile ( "movnti %1,   (%0)\n\t"
+                       "movnti %1,  4(%0)\n\t"
+                       "movnti %1,  8(%0)\n\t"
+                       "movnti %1, 12(%0)"
+                       : : "r"(d), "r"(0) : "memory" );
+    }
+    asm volatile ( "sfence" ::: "memory" );
+}
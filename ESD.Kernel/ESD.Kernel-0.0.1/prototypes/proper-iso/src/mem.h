@@ -0,0 +1,27 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Freestanding memory primitives. The bulk paths are picked once by
+// mem_init() from the CPUID features, so call it after fpu_init().
+void mem_init();
+const char *mem_impl_name();
+
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *a, const char *b);
+int strncmp(const char *a, const char *b, size_t n);
+
+// Zero with non-temporal stores so the cleared memory does not evict
+// hot cache lines. dst and n must be 16-byte aligned.
+void memzero_nt(void *dst, size_t n);
+
+// Fill count 16-bit cells, e.g. VGA character/attribute pairs
+void *memset16(void *dst, uint16_t val, size_t count);
+
+#endif
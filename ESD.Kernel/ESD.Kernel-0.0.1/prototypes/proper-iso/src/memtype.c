@@ -0,0 +1,203 @@
+#include "memtype.h"
+#include "cpu.h"
+#include "paging.h"
+#include "pmm.h"
+#include <stddef.h>
+
+// Memory types per mapping. With PAT the type lives in the page table
+// entry; without it, write-combining falls back to an MTRR over the
+// physical range.
+
+// Entries 0-3 keep their power-on meaning except PA1, which turns
+// PWT-only mappings from write-through into write-combining. PA4 takes
+// over write-through.
+static const uint8_t pat_layout[8] = {
+    MEMTYPE_WB, MEMTYPE_WC, MEMTYPE_UC_MINUS, MEMTYPE_UC,
+    MEMTYPE_WT, MEMTYPE_WP, MEMTYPE_UC_MINUS, MEMTYPE_UC,
+};
+
+// What PWT/PCD select on a CPU without PAT
+static const uint8_t legacy_layout[4] = {
+    MEMTYPE_WB, MEMTYPE_WT, MEMTYPE_UC_MINUS, MEMTYPE_UC,
+};
+
+static int pat_enabled = 0;
+static uint32_t mtrr_used = 0;
+
+static inline void flush_tlb() {
+    uint32_t cr3;
+    asm volatile ( "mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory" );
+}
+
+// SDM 11.11.7.2: caches off and flushed while PAT or MTRRs change
+static uint32_t cache_disable(uint32_t *cr4) {
+    uint32_t flags = irq_save();
+
+    write_cr0((read_cr0() | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    *cr4 = read_cr4();
+    if (*cr4 & CR4_PGE) {
+        write_cr4(*cr4 & ~CR4_PGE);
+    }
+    flush_tlb();
+    return flags;
+}
+
+static void cache_enable(uint32_t cr4, uint32_t flags) {
+    wbinvd();
+    flush_tlb();
+    write_cr0(read_cr0() & ~(CR0_CD | CR0_NW));
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4);
+    }
+    irq_restore(flags);
+}
+
+void memtype_init() {
+    uint64_t pat = 0;
+    uint32_t cr4;
+
+    if (!cpu_features.pat) {
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        pat |= (uint64_t)pat_layout[i] << (i * 8);
+    }
+
+    uint32_t flags = cache_disable(&cr4);
+    wrmsr(IA32_PAT, pat);
+    cache_enable(cr4, flags);
+    pat_enabled = 1;
+}
+
+int memtype_pat_enabled() {
+    return pat_enabled;
+}
+
+// PWT/PCD/PAT bits selecting `type`, or UC when the CPU can't express it
+uint32_t memtype_pte_flags(int type) {
+    const uint8_t *layout = pat_enabled ? pat_layout : legacy_layout;
+    int entries = pat_enabled ? 8 : 4;
+
+    for (int i = 0; i < entries; i++) {
+        if (layout[i] == type) {
+            return ((i & 1) ? PAGE_PWT : 0) | ((i & 2) ? PAGE_PCD : 0) | ((i & 4) ? PAGE_PAT : 0);
+        }
+    }
+    return PAGE_PCD | PAGE_PWT;
+}
+
+static uint32_t phys_address_bits() {
+    uint32_t a, b, c, d;
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a < 0x80000008) {
+        return 36;
+    }
+    cpuid(0x80000008, 0, &a, &b, &c, &d);
+    return a & 0xFF;
+}
+
+static int mtrr_set_fixed(uint64_t cap, uint32_t base, uint32_t size, int type) {
+    uint32_t first = (base - 0xA0000) / 0x4000;
+    uint32_t last = (base + size - 1 - 0xA0000) / 0x4000;
+    uint32_t cr4;
+
+    // The fixed-range MSRs only exist, and only take effect, with FIX and FE
+    if (!(cap & MTRRCAP_FIX) || !(rdmsr(IA32_MTRR_DEF_TYPE) & MTRR_DEF_FIXED_ENABLE)) {
+        return -1;
+    }
+
+    uint32_t flags = cache_disable(&cr4);
+    uint64_t val = rdmsr(IA32_MTRR_FIX16K_A0000);
+    for (uint32_t i = first; i <= last; i++) {
+        val = (val & ~(0xFFULL << (i * 8))) | ((uint64_t)type << (i * 8));
+    }
+    wrmsr(IA32_MTRR_FIX16K_A0000, val);
+    cache_enable(cr4, flags);
+    return 0;
+}
+
+// Largest naturally aligned power-of-two block at base that fits before end
+static uint32_t mtrr_chunk(uint32_t base, uint32_t end) {
+    uint32_t chunk = 1u << (31 - __builtin_clz(end - base));
+    if (base != 0 && (base & -base) < chunk) {
+        chunk = base & -base;
+    }
+    return chunk;
+}
+
+// Cover [base, base+size) with naturally aligned power-of-two MTRRs
+static int mtrr_set_range(uint32_t base, uint32_t size, int type) {
+    if (!cpu_features.mtrr || size == 0) {
+        return -1;
+    }
+
+    uint64_t cap = rdmsr(IA32_MTRRCAP);
+    if (type == MEMTYPE_WC && !(cap & MTRRCAP_WC)) {
+        return -1;
+    }
+
+    // The legacy video window is governed by the fixed-range MTRRs
+    if (base >= 0xA0000 && base + size <= 0xC0000) {
+        return mtrr_set_fixed(cap, base, size, type);
+    }
+
+    uint32_t count = cap & MTRRCAP_VCNT_MASK;
+    uint64_t phys_mask = ((1ULL << phys_address_bits()) - 1) & ~0xFFFULL;
+    uint32_t end = base + ((size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    base &= ~(PAGE_SIZE - 1);
+
+    // A partial cover would leave part of the range with its old type, so
+    // make sure there are enough free registers before touching any
+    uint32_t need = 0;
+    for (uint32_t b = base; b < end; need++) {
+        b += mtrr_chunk(b, end);
+    }
+    uint32_t avail = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        if (!(rdmsr(IA32_MTRR_PHYSMASK(n)) & MTRR_MASK_VALID)) {
+            avail++;
+        }
+    }
+    if (need > avail || mtrr_used + need > MTRR_MAX_RANGES) {
+        return -1;
+    }
+
+    while (base < end) {
+        uint32_t chunk = mtrr_chunk(base, end);
+
+        uint32_t n = 0;
+        while (rdmsr(IA32_MTRR_PHYSMASK(n)) & MTRR_MASK_VALID) {
+            n++;
+        }
+
+        uint32_t cr4;
+        uint32_t flags = cache_disable(&cr4);
+        uint64_t def = rdmsr(IA32_MTRR_DEF_TYPE);
+        wrmsr(IA32_MTRR_DEF_TYPE, def & ~(uint64_t)MTRR_DEF_ENABLE);
+        wrmsr(IA32_MTRR_PHYSBASE(n), base | type);
+        wrmsr(IA32_MTRR_PHYSMASK(n), (phys_mask & ~(uint64_t)(chunk - 1)) | MTRR_MASK_VALID);
+        wrmsr(IA32_MTRR_DEF_TYPE, def);
+        cache_enable(cr4, flags);
+
+        mtrr_used++;
+        base += chunk;
+    }
+    return 0;
+}
+
+// Set the memory type of an existing identity-style mapping
+int memtype_set(uint32_t virt, uint32_t size, int type) {
+    if (pat_enabled || type != MEMTYPE_WC) {
+        return paging_set_cache(virt, size, memtype_pte_flags(type));
+    }
+
+    // A write-back PTE under a WC MTRR resolves to write-combining
+    uint32_t phys = paging_translate(virt);
+    if (phys == 0 || mtrr_set_range(phys, size, MEMTYPE_WC) != 0) {
+        return -1;
+    }
+    return paging_set_cache(virt, size, 0);
+}
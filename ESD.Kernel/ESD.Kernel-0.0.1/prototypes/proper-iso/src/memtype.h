@@ -0,0 +1,35 @@
+#ifndef MEMTYPE_H
+#define MEMTYPE_H
+
+#include <stdint.h>
+
+// Architectural memory type encodings, shared by PAT entries and MTRRs
+#define MEMTYPE_UC       0
+#define MEMTYPE_WC       1
+#define MEMTYPE_WT       4
+#define MEMTYPE_WP       5
+#define MEMTYPE_WB       6
+#define MEMTYPE_UC_MINUS 7
+
+#define IA32_MTRRCAP          0xFE
+#define IA32_MTRR_PHYSBASE(n) (0x200 + 2 * (n))
+#define IA32_MTRR_PHYSMASK(n) (0x201 + 2 * (n))
+#define IA32_MTRR_FIX16K_A0000 0x259
+#define IA32_PAT              0x277
+#define IA32_MTRR_DEF_TYPE    0x2FF
+
+#define MTRRCAP_VCNT_MASK     0xFF
+#define MTRRCAP_FIX           (1 << 8)
+#define MTRRCAP_WC            (1 << 10)
+#define MTRR_DEF_ENABLE       (1 << 11)
+#define MTRR_DEF_FIXED_ENABLE (1 << 10)
+#define MTRR_MASK_VALID       (1 << 11)
+
+#define MTRR_MAX_RANGES       4         // variable MTRRs we are willing to claim
+
+void memtype_init();
+int memtype_pat_enabled();
+uint32_t memtype_pte_flags(int type);
+int memtype_set(uint32_t virt, uint32_t size, int type);
+
+#endif
@@ -0,0 +1,208 @@
+#include "mouse.h"
+#include "input.h"
+#include "isr.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+
+#define I8042_DATA   0x60
+#define I8042_STATUS 0x64
+#define I8042_CMD    0x64
+
+#define I8042_OUT_FULL 0x01
+#define I8042_IN_FULL  0x02
+
+#define I8042_READ_CONFIG  0x20
+#define I8042_WRITE_CONFIG 0x60
+#define I8042_ENABLE_AUX   0xA8
+#define I8042_WRITE_AUX    0xD4
+
+#define I8042_CONFIG_AUX_IRQ   0x02
+#define I8042_CONFIG_AUX_CLOCK 0x20     // set: aux clock disabled
+
+#define MOUSE_SET_DEFAULTS 0xF6
+#define MOUSE_ENABLE       0xF4
+#define MOUSE_SET_RATE     0xF3
+#define MOUSE_GET_ID       0xF2
+#define MOUSE_ACK          0xFA
+
+#define MOUSE_ID_WHEEL 3
+
+// First packet byte
+#define PACKET_ALWAYS1 0x08
+#define PACKET_X_SIGN  0x10
+#define PACKET_Y_SIGN  0x20
+#define PACKET_X_OVF   0x40
+#define PACKET_Y_OVF   0x80
+
+#define I8042_TIMEOUT 100000
+
+static struct {
+    int present;
+    int packet_size;                    // 4 with a scroll wheel
+    int index;
+    uint8_t packet[4];
+} mouse;
+
+static mouse_stats_t stats;
+
+static int i8042_wait_write() {
+    for (int i = 0; i < I8042_TIMEOUT; i++) {
+        if (!(inb(I8042_STATUS) & I8042_IN_FULL)) {
+            return 0;
+        }
+        cpu_relax();
+    }
+    return -1;
+}
+
+static int i8042_read() {
+    for (int i = 0; i < I8042_TIMEOUT; i++) {
+        if (inb(I8042_STATUS) & I8042_OUT_FULL) {
+            return inb(I8042_DATA);
+        }
+        cpu_relax();
+    }
+    return -1;
+}
+
+static int i8042_command(uint8_t cmd) {
+    if (i8042_wait_write() != 0) {
+        return -1;
+    }
+    outb(I8042_CMD, cmd);
+    return 0;
+}
+
+static int i8042_write_data(uint8_t val) {
+    if (i8042_wait_write() != 0) {
+        return -1;
+    }
+    outb(I8042_DATA, val);
+    return 0;
+}
+
+static int mouse_send(uint8_t val) {
+    if (i8042_command(I8042_WRITE_AUX) != 0 || i8042_write_data(val) != 0) {
+        return -1;
+    }
+    return i8042_read() == MOUSE_ACK ? 0 : -1;
+}
+
+static int mouse_set_rate(uint8_t rate) {
+    return mouse_send(MOUSE_SET_RATE) == 0 && mouse_send(rate) == 0 ? 0 : -1;
+}
+
+static void mouse_decode() {
+    uint8_t flags = mouse.packet[0];
+    int dx = mouse.packet[1];
+    int dy = mouse.packet[2];
+    int dz = 0;
+
+    stats.packets++;
+    if (flags & (PACKET_X_OVF | PACKET_Y_OVF)) {
+        // The deltas are garbage; keep the buttons
+        stats.overflows++;
+        dx = dy = 0;
+    } else {
+        if (flags & PACKET_X_SIGN) {
+            dx -= 0x100;
+        }
+        if (flags & PACKET_Y_SIGN) {
+            dy -= 0x100;
+        }
+    }
+    if (mouse.packet_size == 4) {
+        dz = (int8_t)(mouse.packet[3] << 4) >> 4;
+    }
+
+    input_post_mouse(dx, -dy, dz, flags & (MOUSE_LEFT | MOUSE_RIGHT | MOUSE_MIDDLE));
+}
+
+static void mouse_handler(registers_t *regs) {
+    (void)regs;
+    uint8_t byte = inb(I8042_DATA);
+
+    // Bit 3 of the first byte is always set; use it to regain sync after
+    // a lost byte
+    if (mouse.index == 0 && !(byte & PACKET_ALWAYS1)) {
+        stats.resyncs++;
+        return;
+    }
+    mouse.packet[mouse.index++] = byte;
+    if (mouse.index == mouse.packet_size) {
+        mouse.index = 0;
+        mouse_decode();
+    }
+}
+
+int mouse_init() {
+    uint32_t flags = irq_save();
+
+    if (i8042_command(I8042_ENABLE_AUX) != 0 || i8042_command(I8042_READ_CONFIG) != 0) {
+        irq_restore(flags);
+        return -1;
+    }
+    int config = i8042_read();
+    if (config < 0) {
+        irq_restore(flags);
+        return -1;
+    }
+    config = (config | I8042_CONFIG_AUX_IRQ) & ~I8042_CONFIG_AUX_CLOCK;
+    if (i8042_command(I8042_WRITE_CONFIG) != 0 || i8042_write_data(config) != 0 ||
+        mouse_send(MOUSE_SET_DEFAULTS) != 0) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    // IntelliMouse knock sequence switches on the wheel and 4-byte packets
+    mouse.packet_size = 3;
+    if (mouse_set_rate(200) == 0 && mouse_set_rate(100) == 0 && mouse_set_rate(80) == 0 &&
+        mouse_send(MOUSE_GET_ID) == 0 && i8042_read() == MOUSE_ID_WHEEL) {
+        mouse.packet_size = 4;
+    }
+
+    // High report rates are cheap: motion is coalesced in the input queue
+    mouse_set_rate(MOUSE_SAMPLE_RATE);
+    if (mouse_send(MOUSE_ENABLE) != 0) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    mouse.index = 0;
+    mouse.present = 1;
+    isr_install_handler(IRQ12, mouse_handler);
+    pic_unmask_irq(2);
+    pic_unmask_irq(12);
+
+    irq_restore(flags);
+    return 0;
+}
+
+int mouse_present() {
+    return mouse.present;
+}
+
+void mouse_get_stats(mouse_stats_t *out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+void mouse_print_stats() {
+    mouse_stats_t s;
+
+    mouse_get_stats(&s);
+    k_print_string("mouse: ");
+    if (!mouse.present) {
+        k_print_string("not present\n");
+        return;
+    }
+    k_print_dec(mouse.packet_size);
+    k_print_string("-byte packets=");
+    k_print_dec(s.packets);
+    k_print_string(" resyncs=");
+    k_print_dec(s.resyncs);
+    k_print_string(" overflows=");
+    k_print_dec(s.overflows);
+    k_print_string("\n");
+}
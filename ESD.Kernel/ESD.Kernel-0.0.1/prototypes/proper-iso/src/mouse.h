@@ -0,0 +1,19 @@
+#ifndef MOUSE_H
+#define MOUSE_H
+
+#include <stdint.h>
+
+#define MOUSE_SAMPLE_RATE 200           // reports per second
+
+typedef struct {
+    uint32_t packets;
+    uint32_t resyncs;                   // bytes dropped to find a packet start
+    uint32_t overflows;                 // packets with the X/Y overflow bit set
+} mouse_stats_t;
+
+int mouse_init();
+int mouse_present();
+void mouse_get_stats(mouse_stats_t *out);
+void mouse_print_stats();
+
+#endif
@@ -0,0 +1,259 @@
+#include "msi.h"
+#include "apic.h"
+#include "rcu.h"
+#include "tasklet.h"
+#include "spinlock.h"
+#include "trace.h"
+#include <stddef.h>
+
+#define MSI_CONTROL  0x02
+#define MSI_ADDR_LO  0x04
+#define MSI_ADDR_HI  0x08
+
+#define MSI_CONTROL_ENABLE   (1 << 0)
+#define MSI_CONTROL_64BIT    (1 << 7)
+
+#define MSIX_CONTROL       0x02
+#define MSIX_TABLE         0x04
+#define MSIX_CONTROL_ENABLE    (1 << 15)
+#define MSIX_CONTROL_FUNC_MASK (1 << 14)
+
+#define MSIX_ENTRY_SIZE    16
+#define MSIX_ENTRY_ADDR_LO 0
+#define MSIX_ENTRY_ADDR_HI 4
+#define MSIX_ENTRY_DATA    8
+#define MSIX_ENTRY_CTRL    12
+
+typedef struct {
+    vector_handler_t handler;
+    void *ctx;
+} vector_entry_t;
+
+// Read under RCU from interrupt context, written under vector_lock
+static vector_entry_t *vector_table[DYN_VECTOR_COUNT];
+static vector_entry_t vector_slots[DYN_VECTOR_COUNT];
+static uint32_t vector_hits[DYN_VECTOR_COUNT];
+static spinlock_t vector_lock;
+static int vector_lock_ready = 0;
+
+static inline uint32_t msi_address(uint32_t cpu) {
+    return MSI_ADDRESS_BASE | (cpu_apic_id(cpu) << 12);
+}
+
+// Allocate count consecutive vectors aligned to count (multi-message MSI
+// needs that), all routed to handler with ctx[i]. Returns the first.
+int vector_alloc(int count, vector_handler_t handler, void **ctx) {
+    if (!vector_lock_ready) {
+        spin_init(&vector_lock, "vectors");
+        vector_lock_ready = 1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&vector_lock);
+
+    // Leave the spurious vector (0xFF) alone
+    for (int base = 0; base + count <= DYN_VECTOR_COUNT - 1; base++) {
+        if ((DYN_VECTOR_BASE + base) % count != 0) {
+            continue;
+        }
+        int free = 1;
+        for (int i = 0; i < count; i++) {
+            if (vector_slots[base + i].handler != NULL) {
+                free = 0;
+                break;
+            }
+        }
+        if (!free) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            vector_slots[base + i].handler = handler;
+            vector_slots[base + i].ctx = ctx != NULL ? ctx[i] : NULL;
+            vector_hits[base + i] = 0;
+            rcu_assign_pointer(vector_table[base + i], &vector_slots[base + i]);
+        }
+        spin_unlock_irqrestore(&vector_lock, flags);
+        return DYN_VECTOR_BASE + base;
+    }
+
+    spin_unlock_irqrestore(&vector_lock, flags);
+    return -1;
+}
+
+void vector_free(int vector, int count) {
+    uint32_t flags = spin_lock_irqsave(&vector_lock);
+    for (int i = 0; i < count; i++) {
+        rcu_assign_pointer(vector_table[vector - DYN_VECTOR_BASE + i], NULL);
+    }
+    spin_unlock_irqrestore(&vector_lock, flags);
+
+    // The slots may be reused once no CPU can still be dispatching them
+    synchronize_rcu();
+
+    flags = spin_lock_irqsave(&vector_lock);
+    for (int i = 0; i < count; i++) {
+        vector_slots[vector - DYN_VECTOR_BASE + i].handler = NULL;
+    }
+    spin_unlock_irqrestore(&vector_lock, flags);
+}
+
+uint32_t vector_count(int vector) {
+    return vector_hits[vector - DYN_VECTOR_BASE];
+}
+
+void dyn_irq_handler_c(registers_t *regs) {
+    uint32_t index = regs->int_no - DYN_VECTOR_BASE;
+
+    // Spurious interrupts must not be acknowledged
+    if (regs->int_no == APIC_SPURIOUS_VECTOR) {
+        return;
+    }
+    trace_record(TRACE_IRQ, regs->int_no);
+
+    rcu_read_lock();
+    vector_entry_t *entry = rcu_dereference(vector_table[index]);
+    if (entry != NULL) {
+        vector_hits[index]++;
+        entry->handler(entry->ctx, regs);
+    }
+    rcu_read_unlock();
+
+    lapic_eoi();
+    tasklet_run();
+}
+
+// Plain MSI: nvec must be a power of two the device supports
+int msi_enable(pci_device_t *dev, int nvec, vector_handler_t handler, void **ctx, uint32_t cpu) {
+    if (dev->msi_cap == 0 || !lapic_present()) {
+        return -1;
+    }
+
+    uint16_t control = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+    int supported = 1 << ((control >> 1) & 7);
+    if (nvec > supported || (nvec & (nvec - 1)) != 0) {
+        return -1;
+    }
+
+    int vector = vector_alloc(nvec, handler, ctx);
+    if (vector < 0) {
+        return -1;
+    }
+
+    int log2 = 0;
+    while ((1 << log2) < nvec) {
+        log2++;
+    }
+
+    uint16_t data_offset = (control & MSI_CONTROL_64BIT) ? 0x0C : 0x08;
+    pci_write32(dev, dev->msi_cap + MSI_ADDR_LO, msi_address(cpu));
+    if (control & MSI_CONTROL_64BIT) {
+        pci_write32(dev, dev->msi_cap + MSI_ADDR_HI, 0);
+    }
+    pci_write16(dev, dev->msi_cap + data_offset, vector);
+
+    control = (control & ~(7 << 4)) | (log2 << 4) | MSI_CONTROL_ENABLE;
+    pci_write16(dev, dev->msi_cap + MSI_CONTROL, control);
+    pci_enable(dev, PCI_COMMAND_INTX_OFF);
+    return vector;
+}
+
+void msi_disable(pci_device_t *dev) {
+    if (dev->msi_cap != 0) {
+        uint16_t control = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+        pci_write16(dev, dev->msi_cap + MSI_CONTROL, control & ~MSI_CONTROL_ENABLE);
+    }
+}
+
+static volatile uint32_t *msix_entry(pci_device_t *dev, uint16_t entry) {
+    uint32_t table = pci_read32(dev, dev->msix_cap + MSIX_TABLE);
+    uint8_t *base = pci_map_bar(dev, table & 7);
+
+    if (base == NULL || entry >= msix_table_size(dev)) {
+        return NULL;
+    }
+    return (volatile uint32_t *)(base + (table & ~7) + entry * MSIX_ENTRY_SIZE);
+}
+
+int msix_table_size(pci_device_t *dev) {
+    if (dev->msix_cap == 0) {
+        return 0;
+    }
+    return (pci_read16(dev, dev->msix_cap + MSIX_CONTROL) & 0x7FF) + 1;
+}
+
+// Turn MSI-X on with every entry still masked; queues unmask their own
+int msix_enable(pci_device_t *dev) {
+    if (dev->msix_cap == 0 || !lapic_present()) {
+        return -1;
+    }
+
+    // The vector table lives in a memory BAR
+    pci_enable(dev, PCI_COMMAND_MEMORY);
+
+    uint16_t control = pci_read16(dev, dev->msix_cap + MSIX_CONTROL);
+    pci_write16(dev, dev->msix_cap + MSIX_CONTROL, control | MSIX_CONTROL_ENABLE | MSIX_CONTROL_FUNC_MASK);
+
+    for (int i = 0; i < msix_table_size(dev); i++) {
+        msix_mask(dev, i, 1);
+    }
+
+    msi_disable(dev);
+    pci_enable(dev, PCI_COMMAND_INTX_OFF);
+    pci_write16(dev, dev->msix_cap + MSIX_CONTROL, (control | MSIX_CONTROL_ENABLE) & ~MSIX_CONTROL_FUNC_MASK);
+    return 0;
+}
+
+// Give one table entry (typically one device queue) its own vector on cpu
+int msix_setup_vector(pci_device_t *dev, uint16_t entry, vector_handler_t handler, void *ctx, uint32_t cpu) {
+    volatile uint32_t *e = msix_entry(dev, entry);
+    if (e == NULL) {
+        return -1;
+    }
+
+    int vector = vector_alloc(1, handler, &ctx);
+    if (vector < 0) {
+        return -1;
+    }
+
+    e[MSIX_ENTRY_CTRL / 4] = 1;
+    e[MSIX_ENTRY_ADDR_LO / 4] = msi_address(cpu);
+    e[MSIX_ENTRY_ADDR_HI / 4] = 0;
+    e[MSIX_ENTRY_DATA / 4] = vector;
+    e[MSIX_ENTRY_CTRL / 4] = 0;
+    return vector;
+}
+
+// Mask an entry and give its vector back
+void msix_free_vector(pci_device_t *dev, uint16_t entry) {
+    volatile uint32_t *e = msix_entry(dev, entry);
+    if (e == NULL) {
+        return;
+    }
+
+    e[MSIX_ENTRY_CTRL / 4] = 1;
+    int vector = e[MSIX_ENTRY_DATA / 4] & 0xFF;
+    if (vector >= DYN_VECTOR_BASE && vector < DYN_VECTOR_BASE + DYN_VECTOR_COUNT) {
+        vector_free(vector, 1);
+    }
+    e[MSIX_ENTRY_DATA / 4] = 0;
+}
+
+// Retarget an entry; masking around the update avoids a torn message
+int msix_set_affinity(pci_device_t *dev, uint16_t entry, uint32_t cpu) {
+    volatile uint32_t *e = msix_entry(dev, entry);
+    if (e == NULL) {
+        return -1;
+    }
+
+    uint32_t ctrl = e[MSIX_ENTRY_CTRL / 4];
+    e[MSIX_ENTRY_CTRL / 4] = ctrl | 1;
+    e[MSIX_ENTRY_ADDR_LO / 4] = msi_address(cpu);
+    e[MSIX_ENTRY_CTRL / 4] = ctrl;
+    return 0;
+}
+
+void msix_mask(pci_device_t *dev, uint16_t entry, int masked) {
+    volatile uint32_t *e = msix_entry(dev, entry);
+    if (e != NULL) {
+        e[MSIX_ENTRY_CTRL / 4] = masked ? 1 : 0;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MSI_H
+#define MSI_H
+
+#include <stdint.h>
+#include "isr.h"
+#include "pci.h"
+
+#define MSI_ADDRESS_BASE 0xFEE00000
+
+// Handlers for dynamic vectors carry a context, so one handler can serve
+// every queue of a device
+typedef void (*vector_handler_t)(void *ctx, registers_t *regs);
+
+int vector_alloc(int count, vector_handler_t handler, void **ctx);
+void vector_free(int vector, int count);
+uint32_t vector_count(int vector);
+
+int msi_enable(pci_device_t *dev, int nvec, vector_handler_t handler, void **ctx, uint32_t cpu);
+void msi_disable(pci_device_t *dev);
+
+int msix_table_size(pci_device_t *dev);
+int msix_enable(pci_device_t *dev);
+int msix_setup_vector(pci_device_t *dev, uint16_t entry, vector_handler_t handler, void *ctx, uint32_t cpu);
+void msix_free_vector(pci_device_t *dev, uint16_t entry);
+int msix_set_affinity(pci_device_t *dev, uint16_t entry, uint32_t cpu);
+void msix_mask(pci_device_t *dev, uint16_t entry, int masked);
+
+void dyn_irq_handler_c(registers_t *regs);
+
+#endif
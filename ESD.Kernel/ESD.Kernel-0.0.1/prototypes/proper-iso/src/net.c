@@ -0,0 +1,577 @@
+#include "net.h"
+#include "checksum.h"
+#include "udp.h"
+#include "tcp.h"
+#include "timer.h"
+#include "tasklet.h"
+#include "mem.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define ARP_FREE    0
+#define ARP_PENDING 1
+#define ARP_VALID   2
+
+typedef struct {
+    uint32_t ip;
+    uint8_t mac[ETH_ALEN];
+    uint8_t state;
+    uint8_t retries;
+    uint32_t expires;           // VALID: ages out; PENDING: next retry
+    pbuf_t *pending;            // waiting on the reply, linked by ->link
+    int npending;
+} arp_entry_t;
+
+net_stats_t net_stats;
+
+static struct {
+    net_device_t *dev;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint16_t ip_id;
+    ktimer_t timer;
+    tasklet_t tick;
+} netif;
+
+static arp_entry_t arp_cache[ARP_CACHE_SIZE];
+
+static const uint8_t eth_broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// Latest echo reply, for net_ping_reply()
+static volatile int ping_reply_id = -1;
+static volatile int ping_reply_seq = -1;
+
+// Prepend the Ethernet header and hand the frame to the driver. Short
+// single-piece frames are padded to the minimum length.
+static int eth_output(pbuf_t *p, const uint8_t *dst, uint16_t type) {
+    eth_hdr_t *eth = pbuf_push(p, sizeof(eth_hdr_t));
+
+    if (eth == NULL) {
+        pbuf_free(p);
+        return -1;
+    }
+    memcpy(eth->dst, dst, ETH_ALEN);
+    memcpy(eth->src, netif.dev->mac, ETH_ALEN);
+    eth->type = htons(type);
+
+    if (p->next == NULL && p->len < ETH_ZLEN) {
+        uint16_t pad = ETH_ZLEN - p->len;
+        uint8_t *tail = pbuf_put(p, pad);
+        if (tail != NULL) {
+            memset(tail, 0, pad);
+        }
+    }
+    return netdev_xmit(netif.dev, p);
+}
+
+static void arp_send(uint16_t oper, const uint8_t *tha, uint32_t tpa) {
+    pbuf_t *p = pbuf_alloc(PBUF_HEADROOM, sizeof(arp_hdr_t));
+
+    if (p == NULL) {
+        return;
+    }
+    arp_hdr_t *arp = (arp_hdr_t *)p->payload;
+    arp->htype = htons(1);
+    arp->ptype = htons(ETH_TYPE_IP);
+    arp->hlen = ETH_ALEN;
+    arp->plen = 4;
+    arp->oper = htons(oper);
+    memcpy(arp->sha, netif.dev->mac, ETH_ALEN);
+    arp->spa = htonl(netif.ip);
+    memset(arp->tha, 0, ETH_ALEN);
+    if (oper == 2) {
+        memcpy(arp->tha, tha, ETH_ALEN);
+    }
+    arp->tpa = htonl(tpa);
+
+    if (oper == 1) {
+        net_stats.arp_requests++;
+    } else {
+        net_stats.arp_replies++;
+    }
+    eth_output(p, oper == 1 ? eth_broadcast : tha, ETH_TYPE_ARP);
+}
+
+static arp_entry_t *arp_lookup(uint32_t ip) {
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state != ARP_FREE && arp_cache[i].ip == ip) {
+            return &arp_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void arp_drop_pending(arp_entry_t *e) {
+    while (e->pending != NULL) {
+        pbuf_t *p = e->pending;
+        e->pending = p->link;
+        p->link = NULL;
+        pbuf_free(p);
+        net_stats.arp_dropped++;
+    }
+    e->npending = 0;
+}
+
+// Take a free slot, else evict the resolved entry closest to expiring
+static arp_entry_t *arp_alloc(uint32_t ip) {
+    arp_entry_t *victim = NULL;
+
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t *e = &arp_cache[i];
+        if (e->state == ARP_FREE) {
+            victim = e;
+            break;
+        }
+        if (e->state == ARP_VALID && (victim == NULL || time_after(victim->expires, e->expires))) {
+            victim = e;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+    arp_drop_pending(victim);
+    victim->ip = ip;
+    victim->state = ARP_FREE;
+    return victim;
+}
+
+static void arp_update(uint32_t ip, const uint8_t *mac, int create) {
+    arp_entry_t *e = arp_lookup(ip);
+
+    if (e == NULL && create) {
+        e = arp_alloc(ip);
+    }
+    if (e == NULL) {
+        return;
+    }
+    memcpy(e->mac, mac, ETH_ALEN);
+    e->state = ARP_VALID;
+    e->expires = timer_ticks() + MS_TO_TICKS(ARP_TIMEOUT_MS);
+
+    // Packets queued while resolving leave in their original order
+    while (e->pending != NULL) {
+        pbuf_t *p = e->pending;
+        e->pending = p->link;
+        p->link = NULL;
+        eth_output(p, e->mac, ETH_TYPE_IP);
+    }
+    e->npending = 0;
+}
+
+static int arp_output(pbuf_t *p, uint32_t next_hop) {
+    if (next_hop == IP4_BROADCAST || next_hop == (netif.ip | ~netif.netmask)) {
+        return eth_output(p, eth_broadcast, ETH_TYPE_IP);
+    }
+
+    arp_entry_t *e = arp_lookup(next_hop);
+    if (e != NULL && e->state == ARP_VALID) {
+        return eth_output(p, e->mac, ETH_TYPE_IP);
+    }
+
+    if (e == NULL) {
+        e = arp_alloc(next_hop);
+        if (e == NULL) {
+            pbuf_free(p);
+            net_stats.arp_dropped++;
+            return -1;
+        }
+        e->state = ARP_PENDING;
+        e->retries = 1;
+        e->expires = timer_ticks() + MS_TO_TICKS(ARP_RETRY_MS);
+        arp_send(1, NULL, next_hop);
+    }
+    if (e->npending >= ARP_PENDING_MAX) {
+        pbuf_free(p);
+        net_stats.arp_dropped++;
+        return -1;
+    }
+
+    p->link = NULL;
+    pbuf_t **tail = &e->pending;
+    while (*tail != NULL) {
+        tail = &(*tail)->link;
+    }
+    *tail = p;
+    e->npending++;
+    return 0;
+}
+
+static void arp_input(const uint8_t *data, uint32_t len) {
+    const arp_hdr_t *arp = (const arp_hdr_t *)data;
+
+    if (len < sizeof(arp_hdr_t) || ntohs(arp->htype) != 1 || ntohs(arp->ptype) != ETH_TYPE_IP ||
+        arp->hlen != ETH_ALEN || arp->plen != 4) {
+        return;
+    }
+    uint32_t spa = ntohl(arp->spa);
+    uint32_t tpa = ntohl(arp->tpa);
+    int for_us = tpa == netif.ip;
+
+    // Learn the sender when asked directly, refresh it otherwise
+    arp_update(spa, arp->sha, for_us);
+    if (for_us && ntohs(arp->oper) == 1) {
+        arp_send(2, arp->sha, spa);
+    }
+}
+
+static void arp_tick(uint32_t now) {
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t *e = &arp_cache[i];
+        if (e->state == ARP_FREE || time_after(e->expires, now)) {
+            continue;
+        }
+        if (e->state == ARP_PENDING && e->retries < ARP_RETRIES) {
+            e->retries++;
+            e->expires = now + MS_TO_TICKS(ARP_RETRY_MS);
+            arp_send(1, NULL, e->ip);
+            continue;
+        }
+        arp_drop_pending(e);
+        e->state = ARP_FREE;
+    }
+}
+
+uint32_t ip_pseudo_sum(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len) {
+    uint32_t s = htonl(src);
+    uint32_t d = htonl(dst);
+
+    return (s & 0xFFFF) + (s >> 16) + (d & 0xFFFF) + (d >> 16) +
+           htons(proto) + htons(len);
+}
+
+// p->payload is the L4 header. Offloaded, the field holds the folded
+// pseudo-header sum and the NIC adds the rest.
+void ip_l4_csum(pbuf_t *p, uint32_t dst, uint8_t proto, uint16_t csum_offset) {
+    uint32_t sum = ip_pseudo_sum(netif.ip, dst, proto, p->tot_len);
+    uint16_t *field = (uint16_t *)(p->payload + csum_offset);
+
+    if (netif.dev->features & NETDEV_F_TX_CSUM) {
+        *field = csum_fold(sum);
+        p->flags |= PBUF_CSUM_PARTIAL;
+        p->csum_start = 0;
+        p->csum_offset = csum_offset;
+        net_stats.csum_offloaded++;
+        return;
+    }
+
+    *field = 0;
+    uint16_t csum = csum_finish(csum_pbuf(p, 0, p->tot_len, sum));
+    // UDP reserves zero for "no checksum"
+    *field = (csum == 0 && proto == IP_PROTO_UDP) ? 0xFFFF : csum;
+    net_stats.csum_software++;
+}
+
+int ip_l4_verify(const ip_hdr_t *ip, const void *l4, uint16_t len, uint32_t rx_flags) {
+    if (rx_flags & NETDEV_RX_CSUM_VALID) {
+        net_stats.csum_verified_hw++;
+        return 0;
+    }
+    uint32_t sum = ip_pseudo_sum(ntohl(ip->src), ntohl(ip->dst), ip->proto, len);
+    if (csum_fold(csum_partial(l4, len, sum)) != 0xFFFF) {
+        net_stats.csum_bad++;
+        return -1;
+    }
+    return 0;
+}
+
+int ip_output(pbuf_t *p, uint32_t dst, uint8_t proto) {
+    uint64_t start = rdtsc();
+
+    if (netif.dev == NULL || p->tot_len + IP_HLEN > netif.dev->mtu) {
+        pbuf_free(p);
+        return -1;
+    }
+    ip_hdr_t *ip = pbuf_push(p, IP_HLEN);
+    if (ip == NULL) {
+        pbuf_free(p);
+        return -1;
+    }
+    ip->ver_ihl = 0x45;
+    ip->tos = 0;
+    ip->len = htons(p->tot_len);
+    ip->id = htons(netif.ip_id++);
+    ip->frag = htons(0x4000);           // don't fragment
+    ip->ttl = IP_TTL;
+    ip->proto = proto;
+    ip->csum = 0;
+    ip->src = htonl(netif.ip);
+    ip->dst = htonl(dst);
+    ip->csum = csum_finish(csum_partial(ip, IP_HLEN, 0));
+
+    uint32_t next_hop = dst;
+    if (dst != IP4_BROADCAST && (dst & netif.netmask) != (netif.ip & netif.netmask)) {
+        next_hop = netif.gateway;
+    }
+    int ret = arp_output(p, next_hop);
+
+    net_stats.tx_packets++;
+    net_stats.tx_cycles += rdtsc() - start;
+    return ret;
+}
+
+static void icmp_input(const ip_hdr_t *ip, const uint8_t *data, uint32_t len) {
+    const icmp_echo_t *icmp = (const icmp_echo_t *)data;
+
+    if (len < sizeof(icmp_echo_t) || csum_fold(csum_partial(data, len, 0)) != 0xFFFF) {
+        net_stats.csum_bad++;
+        return;
+    }
+
+    if (icmp->type == ICMP_ECHO_REPLY) {
+        ping_reply_seq = ntohs(icmp->seq);
+        ping_reply_id = ntohs(icmp->id);
+        return;
+    }
+    if (icmp->type != ICMP_ECHO_REQUEST || ntohl(ip->dst) != netif.ip) {
+        return;
+    }
+
+    // The receive buffer goes back to the NIC, so the reply is a copy
+    pbuf_t *p = pbuf_alloc(PBUF_HEADROOM, len);
+    if (p == NULL) {
+        return;
+    }
+    memcpy(p->payload, data, len);
+    icmp_echo_t *reply = (icmp_echo_t *)p->payload;
+    reply->type = ICMP_ECHO_REPLY;
+    reply->csum = 0;
+    reply->csum = csum_finish(csum_partial(reply, len, 0));
+    net_stats.icmp_echoes++;
+    ip_output(p, ntohl(ip->src), IP_PROTO_ICMP);
+}
+
+static void ip_input(const uint8_t *data, uint32_t len, uint32_t rx_flags) {
+    const ip_hdr_t *ip = (const ip_hdr_t *)data;
+
+    if (len < IP_HLEN || (ip->ver_ihl >> 4) != 4) {
+        net_stats.ip_bad++;
+        return;
+    }
+    uint32_t hlen = (ip->ver_ihl & 15) * 4;
+    uint32_t total = ntohs(ip->len);
+    if (hlen < IP_HLEN || total < hlen || total > len ||
+        csum_fold(csum_partial(ip, hlen, 0)) != 0xFFFF) {
+        net_stats.ip_bad++;
+        return;
+    }
+
+    uint32_t dst = ntohl(ip->dst);
+    if (dst != netif.ip && dst != IP4_BROADCAST && dst != (netif.ip | ~netif.netmask)) {
+        net_stats.ip_not_ours++;
+        return;
+    }
+    if (ntohs(ip->frag) & (IP_MF | IP_OFFSET)) {
+        net_stats.ip_frags++;
+        return;
+    }
+
+    // Trailing Ethernet padding is not part of the datagram
+    const uint8_t *payload = data + hlen;
+    uint32_t plen = total - hlen;
+    switch (ip->proto) {
+    case IP_PROTO_ICMP:
+        icmp_input(ip, payload, plen);
+        break;
+    case IP_PROTO_UDP:
+        udp_input(ip, payload, plen, rx_flags);
+        break;
+    case IP_PROTO_TCP:
+        tcp_input(ip, payload, plen, rx_flags);
+        break;
+    }
+}
+
+static void net_rx(net_device_t *dev, const void *frame, uint32_t len, uint32_t flags) {
+    const eth_hdr_t *eth = frame;
+    (void)dev;
+
+    uint32_t irq = net_enter();
+    uint64_t start = rdtsc();
+
+    net_stats.rx_frames++;
+    if (ntohs(eth->type) == ETH_TYPE_IP) {
+        ip_input((const uint8_t *)frame + ETH_HLEN, len - ETH_HLEN, flags);
+    } else if (ntohs(eth->type) == ETH_TYPE_ARP) {
+        arp_input((const uint8_t *)frame + ETH_HLEN, len - ETH_HLEN);
+    }
+
+    net_stats.rx_cycles += rdtsc() - start;
+    net_leave(irq);
+}
+
+int net_ping(uint32_t dst, uint16_t id, uint16_t seq, uint16_t size) {
+    if (netif.dev == NULL) {
+        return -1;
+    }
+    pbuf_t *p = pbuf_alloc(PBUF_HEADROOM, sizeof(icmp_echo_t) + size);
+    if (p == NULL) {
+        return -1;
+    }
+    icmp_echo_t *icmp = (icmp_echo_t *)p->payload;
+    icmp->type = ICMP_ECHO_REQUEST;
+    icmp->code = 0;
+    icmp->csum = 0;
+    icmp->id = htons(id);
+    icmp->seq = htons(seq);
+    for (uint16_t i = 0; i < size; i++) {
+        p->payload[sizeof(icmp_echo_t) + i] = (uint8_t)i;
+    }
+    icmp->csum = csum_finish(csum_partial(icmp, p->len, 0));
+
+    uint32_t irq = net_enter();
+    int ret = ip_output(p, dst, IP_PROTO_ICMP);
+    net_leave(irq);
+    return ret;
+}
+
+int net_ping_reply(uint16_t id) {
+    return ping_reply_id == id ? ping_reply_seq : -1;
+}
+
+static void net_tick_timer(void *ctx) {
+    (void)ctx;
+    tasklet_schedule(&netif.tick);
+}
+
+// ARP retries and aging, TCP retransmission and TIME_WAIT
+static void net_tick_work(void *ctx) {
+    (void)ctx;
+    uint32_t now = timer_ticks();
+
+    uint32_t irq = net_enter();
+    arp_tick(now);
+    tcp_tick(now);
+    net_leave(irq);
+
+    timer_add(&netif.timer, MS_TO_TICKS(NET_TICK_MS), net_tick_timer, NULL);
+}
+
+int net_wait(int (*done)(void *ctx), void *ctx, uint32_t timeout_ms) {
+    uint32_t start = timer_ticks();
+
+    for (;;) {
+        tasklet_run();
+        if (done(ctx)) {
+            return 0;
+        }
+        if (timeout_ms != NET_WAIT_FOREVER && timer_ticks() - start >= MS_TO_TICKS(timeout_ms)) {
+            return -1;
+        }
+        cpu_relax();
+    }
+}
+
+void net_init() {
+    net_device_t *dev = netdev_first();
+
+    csum_init();
+    if (dev == NULL) {
+        return;
+    }
+    netif.dev = dev;
+    netif.ip = NET_DEFAULT_IP;
+    netif.netmask = NET_DEFAULT_NETMASK;
+    netif.gateway = NET_DEFAULT_GATEWAY;
+    netif.ip_id = (uint16_t)rdtsc();
+    dev->rx = net_rx;
+
+    tasklet_init(&netif.tick, net_tick_work, NULL);
+    timer_add(&netif.timer, MS_TO_TICKS(NET_TICK_MS), net_tick_timer, NULL);
+
+    // Resolve the gateway up front; most traffic goes through it
+    uint32_t irq = net_enter();
+    arp_send(1, NULL, netif.gateway);
+    net_leave(irq);
+}
+
+int net_up() {
+    return netif.dev != NULL && netif.dev->link_up;
+}
+
+uint32_t net_local_ip() {
+    return netif.ip;
+}
+
+int ip_parse(const char *s, uint32_t *ip) {
+    uint32_t addr = 0;
+
+    for (int part = 0; part < 4; part++) {
+        uint32_t octet = 0;
+        int digits = 0;
+        while (*s >= '0' && *s <= '9' && digits < 3) {
+            octet = octet * 10 + (*s++ - '0');
+            digits++;
+        }
+        if (digits == 0 || octet > 255 || *s != (part < 3 ? '.' : '\0')) {
+            return -1;
+        }
+        s++;
+        addr = (addr << 8) | octet;
+    }
+    *ip = addr;
+    return 0;
+}
+
+void net_print_ip(uint32_t ip) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        k_print_dec((ip >> shift) & 0xFF);
+        if (shift > 0) {
+            k_put_char('.');
+        }
+    }
+}
+
+static void print_avg(uint64_t total, uint32_t count) {
+    k_print_dec(count ? (uint32_t)div_u64(total, count) : 0);
+}
+
+void net_print_stats() {
+    if (netif.dev == NULL) {
+        k_print_string("net: no interface\n");
+        return;
+    }
+    k_print_string("net: ");
+    k_print_string(netif.dev->name);
+    k_put_char(' ');
+    net_print_ip(netif.ip);
+    k_print_string(" gw ");
+    net_print_ip(netif.gateway);
+    k_print_string(", checksum ");
+    k_print_string(csum_impl_name());
+    k_print_string("\n  rx frames=");
+    k_print_dec(net_stats.rx_frames);
+    k_print_string(" cycles/frame=");
+    print_avg(net_stats.rx_cycles, net_stats.rx_frames);
+    k_print_string(" tx packets=");
+    k_print_dec(net_stats.tx_packets);
+    k_print_string(" cycles/packet=");
+    print_avg(net_stats.tx_cycles, net_stats.tx_packets);
+    k_print_string("\n  arp requests=");
+    k_print_dec(net_stats.arp_requests);
+    k_print_string(" replies=");
+    k_print_dec(net_stats.arp_replies);
+    k_print_string(" dropped=");
+    k_print_dec(net_stats.arp_dropped);
+    k_print_string(" ip bad=");
+    k_print_dec(net_stats.ip_bad);
+    k_print_string(" frags=");
+    k_print_dec(net_stats.ip_frags);
+    k_print_string(" other=");
+    k_print_dec(net_stats.ip_not_ours);
+    k_print_string(" echoes=");
+    k_print_dec(net_stats.icmp_echoes);
+    k_print_string("\n  csum tx offload=");
+    k_print_dec(net_stats.csum_offloaded);
+    k_print_string(" tx sw=");
+    k_print_dec(net_stats.csum_software);
+    k_print_string(" rx hw=");
+    k_print_dec(net_stats.csum_verified_hw);
+    k_print_string(" bad=");
+    k_print_dec(net_stats.csum_bad);
+    k_print_string("\n");
+    pbuf_print_stats();
+    udp_print_stats();
+    tcp_print_stats();
+}
@@ -0,0 +1,158 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+#include "netdev.h"
+#include "pbuf.h"
+#include "cpu.h"
+
+// Addresses and ports are kept in host byte order everywhere except
+// inside packet headers
+#define IP4(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+#define IP4_BROADCAST   0xFFFFFFFF
+
+// QEMU user-mode networking defaults
+#define NET_DEFAULT_IP      IP4(10, 0, 2, 15)
+#define NET_DEFAULT_NETMASK IP4(255, 255, 255, 0)
+#define NET_DEFAULT_GATEWAY IP4(10, 0, 2, 2)
+
+#define ETH_TYPE_IP  0x0800
+#define ETH_TYPE_ARP 0x0806
+
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_TCP  6
+#define IP_PROTO_UDP  17
+
+#define IP_HLEN     20
+#define IP_TTL      64
+#define IP_MF       0x2000
+#define IP_OFFSET   0x1FFF
+
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+
+#define ARP_CACHE_SIZE   16
+#define ARP_PENDING_MAX  4      // packets held per unresolved entry
+#define ARP_TIMEOUT_MS   60000
+#define ARP_RETRY_MS     1000
+#define ARP_RETRIES      3
+
+#define NET_TICK_MS 100
+
+// Return values shared by the UDP and TCP APIs
+#define NET_ERR   -1
+#define NET_AGAIN -2
+
+// Readiness bits reported by the poll functions and event callbacks
+#define NET_EV_READABLE 0x01
+#define NET_EV_WRITABLE 0x02
+#define NET_EV_HUP      0x04
+#define NET_EV_ERROR    0x08
+
+typedef struct {
+    uint8_t dst[ETH_ALEN];
+    uint8_t src[ETH_ALEN];
+    uint16_t type;
+} __attribute__((packed)) eth_hdr_t;
+
+typedef struct {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t oper;
+    uint8_t sha[ETH_ALEN];
+    uint32_t spa;
+    uint8_t tha[ETH_ALEN];
+    uint32_t tpa;
+} __attribute__((packed)) arp_hdr_t;
+
+typedef struct {
+    uint8_t ver_ihl;
+    uint8_t tos;
+    uint16_t len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t csum;
+    uint32_t src;
+    uint32_t dst;
+} __attribute__((packed)) ip_hdr_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    uint16_t csum;
+    uint16_t id;
+    uint16_t seq;
+} __attribute__((packed)) icmp_echo_t;
+
+static inline uint16_t htons(uint16_t v) {
+    return __builtin_bswap16(v);
+}
+
+static inline uint32_t htonl(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+
+#define ntohs htons
+#define ntohl htonl
+
+// The stack runs on the BSP only. Entry points just disable interrupts,
+// which nests, so event callbacks may call straight back into the stack.
+static inline uint32_t net_enter() {
+    return irq_save();
+}
+
+static inline void net_leave(uint32_t flags) {
+    irq_restore(flags);
+}
+
+typedef struct {
+    uint32_t rx_frames;
+    uint64_t rx_cycles;
+    uint32_t tx_packets;
+    uint64_t tx_cycles;
+    uint32_t arp_requests;
+    uint32_t arp_replies;
+    uint32_t arp_dropped;
+    uint32_t ip_bad;
+    uint32_t ip_frags;
+    uint32_t ip_not_ours;
+    uint32_t icmp_echoes;
+    uint32_t csum_offloaded;
+    uint32_t csum_software;
+    uint32_t csum_verified_hw;
+    uint32_t csum_bad;
+} net_stats_t;
+
+extern net_stats_t net_stats;
+
+void net_init();
+int net_up();
+uint32_t net_local_ip();
+int ip_parse(const char *s, uint32_t *ip);
+void net_print_ip(uint32_t ip);
+
+// Add the IPv4 pseudo header to a checksum
+uint32_t ip_pseudo_sum(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len);
+// Fill in an L4 checksum over the whole of p, or leave it to the NIC
+void ip_l4_csum(pbuf_t *p, uint32_t dst, uint8_t proto, uint16_t csum_offset);
+// Check a received L4 checksum unless the NIC already did
+int ip_l4_verify(const ip_hdr_t *ip, const void *l4, uint16_t len, uint32_t rx_flags);
+// Prepend IPv4 and Ethernet headers and send; always consumes p
+int ip_output(pbuf_t *p, uint32_t dst, uint8_t proto);
+
+int net_ping(uint32_t dst, uint16_t id, uint16_t seq, uint16_t size);
+// Last echo reply seen for id, or -1
+int net_ping_reply(uint16_t id);
+
+#define NET_WAIT_FOREVER 0xFFFFFFFF
+
+// Run bottom halves until done(ctx) holds or timeout_ms passes
+int net_wait(int (*done)(void *ctx), void *ctx, uint32_t timeout_ms);
+
+void net_print_stats();
+
+#endif
@@ -0,0 +1,578 @@
+#include "netbench.h"
+#include "net.h"
+#include "udp.h"
+#include "tcp.h"
+#include "socket.h"
+#include "timer.h"
+#include "mem.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define ECHO_CONNS       4
+#define PING_ID          0x4553
+#define PING_SIZE        56
+#define PING_TIMEOUT_MS  1000
+#define BENCH_WINDOW     8      // datagrams in flight
+#define BENCH_IDLE_MS    1000   // silence after which in-flight datagrams count as lost
+#define BENCH_TIMEOUT_MS 30000
+#define BENCH_EVENTS     16
+
+typedef struct {
+    tcp_pcb_t *pcb;
+    uint8_t buf[TCP_MSS];
+    uint32_t len;
+    uint32_t off;
+} echo_conn_t;
+
+typedef struct {
+    uint32_t seq;
+    uint64_t tsc;
+} __attribute__((packed)) bench_stamp_t;
+
+typedef struct {
+    udp_pcb_t *pcb;
+    uint32_t ip;
+    uint16_t port;
+    uint32_t count;
+    uint32_t size;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t in_flight;
+    uint32_t last_progress;
+    uint64_t rtt_total;
+    uint64_t rtt_min;
+    uint64_t rtt_max;
+    uint8_t tx[UDP_MAX_PAYLOAD];
+    uint8_t rx[UDP_MAX_PAYLOAD];
+} udp_bench_t;
+
+typedef struct {
+    tcp_pcb_t *pcb;
+    uint32_t total;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t mismatches;
+    int failed;
+    uint8_t buf[TCP_MSS];
+} tcp_bench_t;
+
+// One stream of the multi-connection benchmark
+typedef struct {
+    int sd;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t mismatches;
+    int done;
+    int failed;
+} conn_bench_t;
+
+// Snapshot of the stack's per-packet cost counters
+typedef struct {
+    uint64_t tsc;
+    uint32_t ticks;
+    uint32_t rx_frames;
+    uint64_t rx_cycles;
+    uint32_t tx_packets;
+    uint64_t tx_cycles;
+} bench_mark_t;
+
+static udp_pcb_t *udp_echo;
+static tcp_pcb_t *tcp_echo;
+static echo_conn_t echo_conns[ECHO_CONNS];
+static uint8_t udp_echo_buf[UDP_MAX_PAYLOAD];
+static udp_bench_t udp_bench;
+static tcp_bench_t tcp_bench;
+static conn_bench_t conn_bench[NETBENCH_MAX_CONNS];
+static uint8_t conn_buf[TCP_MSS];
+
+static void udp_echo_event(udp_pcb_t *pcb, uint32_t events, void *arg) {
+    (void)events;
+    (void)arg;
+    uint32_t ip;
+    uint16_t port;
+    int n;
+
+    while ((n = udp_recvfrom(pcb, udp_echo_buf, sizeof(udp_echo_buf), &ip, &port)) >= 0) {
+        udp_sendto(pcb, udp_echo_buf, n, ip, port);
+    }
+}
+
+static void echo_conn_release(echo_conn_t *c) {
+    tcp_close(c->pcb);
+    c->pcb = NULL;
+}
+
+// Whatever was read goes back out before reading more, so a slow peer
+// closes our window instead of growing a buffer
+static void tcp_echo_event(tcp_pcb_t *pcb, uint32_t events, void *arg) {
+    echo_conn_t *c = arg;
+
+    if (events & NET_EV_ERROR) {
+        echo_conn_release(c);
+        return;
+    }
+    for (;;) {
+        while (c->off < c->len) {
+            int n = tcp_write(pcb, c->buf + c->off, c->len - c->off);
+            if (n == NET_AGAIN) {
+                return;
+            }
+            if (n < 0) {
+                echo_conn_release(c);
+                return;
+            }
+            c->off += n;
+        }
+        int n = tcp_read(pcb, c->buf, sizeof(c->buf));
+        if (n == NET_AGAIN) {
+            return;
+        }
+        if (n <= 0) {
+            echo_conn_release(c);
+            return;
+        }
+        c->len = n;
+        c->off = 0;
+    }
+}
+
+static void tcp_echo_accept(tcp_pcb_t *listener, uint32_t events, void *arg) {
+    (void)events;
+    (void)arg;
+    tcp_pcb_t *pcb;
+
+    while ((pcb = tcp_accept(listener)) != NULL) {
+        echo_conn_t *c = NULL;
+        for (int i = 0; i < ECHO_CONNS; i++) {
+            if (echo_conns[i].pcb == NULL) {
+                c = &echo_conns[i];
+                break;
+            }
+        }
+        if (c == NULL) {
+            tcp_abort(pcb);
+            continue;
+        }
+        c->pcb = pcb;
+        c->len = 0;
+        c->off = 0;
+        tcp_set_event(pcb, tcp_echo_event, c);
+        // Data may have arrived along with the handshake
+        tcp_echo_event(pcb, NET_EV_READABLE, c);
+    }
+}
+
+void netbench_init() {
+    if (net_local_ip() == 0) {
+        return;
+    }
+    udp_echo = udp_new();
+    if (udp_echo != NULL && udp_bind(udp_echo, NETBENCH_ECHO_PORT) == 0) {
+        udp_set_event(udp_echo, udp_echo_event, NULL);
+    }
+    tcp_echo = tcp_new();
+    if (tcp_echo != NULL && tcp_bind(tcp_echo, NETBENCH_ECHO_PORT) == 0 &&
+        tcp_listen(tcp_echo, TCP_BACKLOG_MAX) == 0) {
+        tcp_set_event(tcp_echo, tcp_echo_accept, NULL);
+    }
+}
+
+static void bench_mark(bench_mark_t *m) {
+    uint32_t irq = net_enter();
+    m->rx_frames = net_stats.rx_frames;
+    m->rx_cycles = net_stats.rx_cycles;
+    m->tx_packets = net_stats.tx_packets;
+    m->tx_cycles = net_stats.tx_cycles;
+    net_leave(irq);
+    m->ticks = timer_ticks();
+    m->tsc = rdtsc();
+}
+
+// TSC cycles per millisecond, calibrated against the timer over the run
+static uint32_t bench_cycles_per_ms(const bench_mark_t *start, const bench_mark_t *end) {
+    uint32_t ms = end->ticks - start->ticks;
+    return (uint32_t)div_u64(end->tsc - start->tsc, ms ? ms : 1);
+}
+
+static uint32_t cycles_to_us(uint64_t cycles, uint32_t per_ms) {
+    return per_ms ? (uint32_t)div_u64(cycles * 1000, per_ms) : 0;
+}
+
+static void bench_print_cost(const bench_mark_t *start, const bench_mark_t *end) {
+    uint32_t rx = end->rx_frames - start->rx_frames;
+    uint32_t tx = end->tx_packets - start->tx_packets;
+
+    k_print_string("  stack cost: rx ");
+    k_print_dec(rx ? (uint32_t)div_u64(end->rx_cycles - start->rx_cycles, rx) : 0);
+    k_print_string(" cycles/frame (");
+    k_print_dec(rx);
+    k_print_string("), tx ");
+    k_print_dec(tx ? (uint32_t)div_u64(end->tx_cycles - start->tx_cycles, tx) : 0);
+    k_print_string(" cycles/packet (");
+    k_print_dec(tx);
+    k_print_string(")\n");
+}
+
+static int ping_done(void *ctx) {
+    return net_ping_reply(PING_ID) == *(int *)ctx;
+}
+
+int netbench_ping(uint32_t ip, uint32_t count) {
+    uint32_t replies = 0;
+
+    for (uint32_t i = 1; i <= count; i++) {
+        int seq = (uint16_t)i;
+        uint64_t start = rdtsc();
+        uint32_t start_ticks = timer_ticks();
+
+        if (net_ping(ip, PING_ID, seq, PING_SIZE) != 0) {
+            k_print_string("ping: send failed\n");
+            return -1;
+        }
+        if (net_wait(ping_done, &seq, PING_TIMEOUT_MS) != 0) {
+            k_print_string("ping: seq ");
+            k_print_dec(seq);
+            k_print_string(" timed out\n");
+            continue;
+        }
+        uint64_t cycles = rdtsc() - start;
+        uint32_t ms = timer_ticks() - start_ticks;
+        replies++;
+        k_print_string("reply from ");
+        net_print_ip(ip);
+        k_print_string(": seq=");
+        k_print_dec(seq);
+        k_print_string(" cycles=");
+        k_print_dec((uint32_t)cycles);
+        k_print_string(" (");
+        k_print_dec(ms);
+        k_print_string("ms)\n");
+    }
+    return replies > 0 ? 0 : -1;
+}
+
+static int udp_bench_step(void *ctx) {
+    udp_bench_t *b = ctx;
+    bench_stamp_t stamp;
+    int n;
+
+    while ((n = udp_recvfrom(b->pcb, b->rx, sizeof(b->rx), NULL, NULL)) >= 0) {
+        uint64_t now = rdtsc();
+        memcpy(&stamp, b->rx, sizeof(stamp));
+        if ((uint32_t)n != b->size || stamp.seq >= b->sent) {
+            continue;
+        }
+        uint64_t rtt = now - stamp.tsc;
+        b->rtt_total += rtt;
+        if (b->received == 0 || rtt < b->rtt_min) {
+            b->rtt_min = rtt;
+        }
+        if (rtt > b->rtt_max) {
+            b->rtt_max = rtt;
+        }
+        b->received++;
+        if (b->in_flight > 0) {
+            b->in_flight--;
+        }
+        b->last_progress = timer_ticks();
+    }
+
+    if (b->in_flight > 0 && timer_ticks() - b->last_progress >= MS_TO_TICKS(BENCH_IDLE_MS)) {
+        b->lost += b->in_flight;
+        b->in_flight = 0;
+        b->last_progress = timer_ticks();
+    }
+
+    while (b->in_flight < BENCH_WINDOW && b->sent < b->count) {
+        stamp.seq = b->sent;
+        stamp.tsc = rdtsc();
+        memcpy(b->tx, &stamp, sizeof(stamp));
+        if (udp_sendto(b->pcb, b->tx, b->size, b->ip, b->port) < 0) {
+            break;
+        }
+        b->sent++;
+        b->in_flight++;
+    }
+    return b->received + b->lost >= b->count;
+}
+
+int netbench_udp(uint32_t ip, uint16_t port, uint32_t count, uint32_t size) {
+    udp_bench_t *b = &udp_bench;
+    bench_mark_t start, end;
+
+    if (size < sizeof(bench_stamp_t) || size > UDP_MAX_PAYLOAD || count == 0) {
+        k_print_string("netbench: bad size or count\n");
+        return -1;
+    }
+    memset(b, 0, sizeof(*b));
+    b->pcb = udp_new();
+    if (b->pcb == NULL) {
+        return -1;
+    }
+    b->ip = ip;
+    b->port = port;
+    b->count = count;
+    b->size = size;
+    for (uint32_t i = 0; i < size; i++) {
+        b->tx[i] = (uint8_t)i;
+    }
+
+    bench_mark(&start);
+    b->last_progress = start.ticks;
+    int timed_out = net_wait(udp_bench_step, b, BENCH_TIMEOUT_MS);
+    bench_mark(&end);
+    udp_close(b->pcb);
+
+    uint32_t per_ms = bench_cycles_per_ms(&start, &end);
+    uint32_t ms = end.ticks - start.ticks;
+    k_print_string("udp ");
+    net_print_ip(ip);
+    k_put_char(':');
+    k_print_dec(port);
+    k_print_string(": ");
+    k_print_dec(b->received);
+    k_put_char('/');
+    k_print_dec(b->sent);
+    k_print_string(" replies, ");
+    k_print_dec(b->lost);
+    k_print_string(timed_out ? " lost (timed out)\n" : " lost\n");
+    if (b->received > 0) {
+        k_print_string("  rtt us avg/min/max ");
+        k_print_dec(cycles_to_us(div_u64(b->rtt_total, b->received), per_ms));
+        k_put_char('/');
+        k_print_dec(cycles_to_us(b->rtt_min, per_ms));
+        k_put_char('/');
+        k_print_dec(cycles_to_us(b->rtt_max, per_ms));
+        k_print_string(", ");
+        k_print_dec(ms ? b->received * 1000 / ms : 0);
+        k_print_string(" round trips/s\n");
+    }
+    bench_print_cost(&start, &end);
+    return b->received > 0 ? 0 : -1;
+}
+
+static inline uint8_t tcp_bench_pattern(uint32_t offset) {
+    return (uint8_t)(offset + (offset >> 8));
+}
+
+static int tcp_bench_step(void *ctx) {
+    tcp_bench_t *b = ctx;
+    int n;
+
+    if (tcp_poll(b->pcb) & NET_EV_ERROR) {
+        b->failed = 1;
+        return 1;
+    }
+    while (b->sent < b->total) {
+        uint32_t len = b->total - b->sent < sizeof(b->buf) ? b->total - b->sent : sizeof(b->buf);
+        for (uint32_t i = 0; i < len; i++) {
+            b->buf[i] = tcp_bench_pattern(b->sent + i);
+        }
+        n = tcp_write(b->pcb, b->buf, len);
+        if (n <= 0) {
+            break;
+        }
+        b->sent += n;
+    }
+    while ((n = tcp_read(b->pcb, b->buf, sizeof(b->buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (b->buf[i] != tcp_bench_pattern(b->received + i)) {
+                b->mismatches++;
+            }
+        }
+        b->received += n;
+    }
+    if (n == 0) {
+        // The peer closed before echoing everything
+        b->failed = 1;
+        return 1;
+    }
+    return b->received >= b->total;
+}
+
+int netbench_tcp(uint32_t ip, uint16_t port, uint32_t kbytes) {
+    tcp_bench_t *b = &tcp_bench;
+    bench_mark_t start, end;
+
+    memset(b, 0, sizeof(*b));
+    b->total = kbytes * 1024;
+    b->pcb = tcp_new();
+    if (b->pcb == NULL) {
+        return -1;
+    }
+    bench_mark(&start);
+    if (tcp_connect(b->pcb, ip, port) != 0) {
+        tcp_close(b->pcb);
+        k_print_string("netbench: connect failed\n");
+        return -1;
+    }
+    int timed_out = net_wait(tcp_bench_step, b, BENCH_TIMEOUT_MS);
+    bench_mark(&end);
+
+    uint32_t retransmits = b->pcb->retransmits;
+    uint32_t rto = b->pcb->rto;
+    if (b->failed || timed_out) {
+        tcp_abort(b->pcb);
+    } else {
+        tcp_close(b->pcb);
+    }
+
+    uint32_t ms = end.ticks - start.ticks;
+    k_print_string("tcp ");
+    net_print_ip(ip);
+    k_put_char(':');
+    k_print_dec(port);
+    k_print_string(": ");
+    k_print_dec(b->received / 1024);
+    k_put_char('/');
+    k_print_dec(kbytes);
+    k_print_string(" KB echoed in ");
+    k_print_dec(ms);
+    k_print_string("ms, ");
+    k_print_dec(ms ? (uint32_t)div_u64((uint64_t)b->received * 1000 / 1024, ms) : 0);
+    k_print_string(" KB/s");
+    if (b->failed) {
+        k_print_string(", connection failed");
+    } else if (timed_out) {
+        k_print_string(", timed out");
+    }
+    k_print_string("\n  mismatches=");
+    k_print_dec(b->mismatches);
+    k_print_string(" retransmits=");
+    k_print_dec(retransmits);
+    k_print_string(" rto=");
+    k_print_dec(rto);
+    k_print_string("ms\n");
+    bench_print_cost(&start, &end);
+    return b->failed || timed_out || b->mismatches ? -1 : 0;
+}
+
+// Drain a connection in both directions; with edge-triggered readiness
+// each side must be pushed until it would block
+static void conn_bench_run(conn_bench_t *c, uint32_t total, uint32_t events) {
+    int n;
+
+    if (events & EP_ERR) {
+        c->failed = 1;
+        return;
+    }
+    while ((events & EP_OUT) && c->sent < total) {
+        uint32_t len = total - c->sent < sizeof(conn_buf) ? total - c->sent : sizeof(conn_buf);
+        for (uint32_t i = 0; i < len; i++) {
+            conn_buf[i] = tcp_bench_pattern(c->sent + i);
+        }
+        n = sock_send(c->sd, conn_buf, len);
+        if (n <= 0) {
+            break;
+        }
+        c->sent += n;
+    }
+    while ((n = sock_recv(c->sd, conn_buf, sizeof(conn_buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (conn_buf[i] != tcp_bench_pattern(c->received + i)) {
+                c->mismatches++;
+            }
+        }
+        c->received += n;
+    }
+    if (c->received >= total) {
+        c->done = 1;
+    } else if (n == 0 || n == NET_ERR) {
+        c->failed = 1;
+    }
+}
+
+int netbench_conns(uint32_t ip, uint16_t port, uint32_t conns, uint32_t kbytes) {
+    ep_event_t events[BENCH_EVENTS];
+    bench_mark_t start, end;
+    uint32_t total = kbytes * 1024;
+    uint32_t finished = 0;
+    uint32_t received = 0;
+    uint32_t mismatches = 0;
+    uint32_t failed = 0;
+    uint32_t waits = 0;
+
+    if (conns == 0 || conns > NETBENCH_MAX_CONNS) {
+        k_print_string("netbench: 1 to ");
+        k_print_dec(NETBENCH_MAX_CONNS);
+        k_print_string(" connections\n");
+        return -1;
+    }
+    int ep = ep_create();
+    if (ep < 0) {
+        return -1;
+    }
+
+    bench_mark(&start);
+    for (uint32_t i = 0; i < conns; i++) {
+        conn_bench_t *c = &conn_bench[i];
+        memset(c, 0, sizeof(*c));
+        c->sd = sock_socket(SOCK_STREAM);
+        if (c->sd < 0) {
+            c->failed = 1;
+            finished++;
+            continue;
+        }
+        sock_set_nonblock(c->sd, 1);
+        if (sock_connect(c->sd, ip, port) == NET_ERR ||
+            ep_ctl(ep, EP_CTL_ADD, c->sd, EP_IN | EP_OUT | EP_ET, c) != 0) {
+            c->failed = 1;
+            finished++;
+        }
+    }
+
+    while (finished < conns && timer_ticks() - start.ticks < MS_TO_TICKS(BENCH_TIMEOUT_MS)) {
+        int n = ep_wait(ep, events, BENCH_EVENTS, BENCH_IDLE_MS);
+        waits++;
+        for (int i = 0; i < n; i++) {
+            conn_bench_t *c = events[i].data;
+            if (c->done || c->failed) {
+                continue;
+            }
+            conn_bench_run(c, total, events[i].events);
+            if (c->done || c->failed) {
+                ep_ctl(ep, EP_CTL_DEL, c->sd, 0, NULL);
+                finished++;
+            }
+        }
+    }
+    bench_mark(&end);
+
+    for (uint32_t i = 0; i < conns; i++) {
+        conn_bench_t *c = &conn_bench[i];
+        received += c->received;
+        mismatches += c->mismatches;
+        failed += !c->done;
+        if (c->sd >= 0) {
+            sock_close(c->sd);
+        }
+    }
+    ep_close(ep);
+
+    uint32_t ms = end.ticks - start.ticks;
+    k_print_string("tcp x");
+    k_print_dec(conns);
+    k_put_char(' ');
+    net_print_ip(ip);
+    k_put_char(':');
+    k_print_dec(port);
+    k_print_string(": ");
+    k_print_dec(received / 1024);
+    k_put_char('/');
+    k_print_dec(conns * kbytes);
+    k_print_string(" KB echoed in ");
+    k_print_dec(ms);
+    k_print_string("ms, ");
+    k_print_dec(ms ? (uint32_t)div_u64((uint64_t)received * 1000 / 1024, ms) : 0);
+    k_print_string(" KB/s\n  failed=");
+    k_print_dec(failed);
+    k_print_string(" mismatches=");
+    k_print_dec(mismatches);
+    k_print_string(" ep_wait calls=");
+    k_print_dec(waits);
+    k_print_string("\n");
+    bench_print_cost(&start, &end);
+    return failed || mismatches ? -1 : 0;
+}
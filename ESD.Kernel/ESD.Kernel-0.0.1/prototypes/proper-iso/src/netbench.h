@@ -0,0 +1,20 @@
+#ifndef NETBENCH_H
+#define NETBENCH_H
+
+#include <stdint.h>
+
+#define NETBENCH_ECHO_PORT 7
+#define NETBENCH_MAX_CONNS 8
+
+// UDP and TCP echo servers, for load generated from the host
+void netbench_init();
+
+int netbench_ping(uint32_t ip, uint32_t count);
+// Round trips of count datagrams through an echo server
+int netbench_udp(uint32_t ip, uint16_t port, uint32_t count, uint32_t size);
+// Stream kbytes through an echo server and check what comes back
+int netbench_tcp(uint32_t ip, uint16_t port, uint32_t kbytes);
+// The same over several connections at once, driven through ep_wait()
+int netbench_conns(uint32_t ip, uint16_t port, uint32_t conns, uint32_t kbytes);
+
+#endif
@@ -0,0 +1,94 @@
+#include "netdev.h"
+#include "mem.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static net_device_t *net_devices = NULL;
+
+void netdev_register(net_device_t *dev) {
+    dev->rx_packets = dev->rx_bytes = dev->rx_dropped = 0;
+    dev->tx_packets = dev->tx_bytes = dev->tx_dropped = 0;
+    dev->next = net_devices;
+    net_devices = dev;
+}
+
+net_device_t *netdev_find(const char *name) {
+    for (net_device_t *dev = net_devices; dev != NULL; dev = dev->next) {
+        if (strcmp(dev->name, name) == 0) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+net_device_t *netdev_first() {
+    return net_devices;
+}
+
+void netdev_receive(net_device_t *dev, const void *frame, uint32_t len, uint32_t flags) {
+    if (dev->rx == NULL || len < ETH_HLEN) {
+        dev->rx_dropped++;
+        return;
+    }
+    dev->rx_packets++;
+    dev->rx_bytes += len;
+    dev->rx(dev, frame, len, flags);
+}
+
+int netdev_xmit(net_device_t *dev, pbuf_t *p) {
+    uint32_t len = p->tot_len;
+
+    if (len > ETH_HLEN + (uint32_t)dev->mtu || !dev->link_up || dev->xmit(dev, p) != 0) {
+        dev->tx_dropped++;
+        pbuf_free(p);
+        return -1;
+    }
+    dev->tx_packets++;
+    dev->tx_bytes += len;
+    return 0;
+}
+
+static void print_mac(const uint8_t *mac) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[18];
+
+    for (int i = 0; i < ETH_ALEN; i++) {
+        buf[i * 3] = hex[mac[i] >> 4];
+        buf[i * 3 + 1] = hex[mac[i] & 15];
+        buf[i * 3 + 2] = i < ETH_ALEN - 1 ? ':' : '\0';
+    }
+    k_print_string(buf);
+}
+
+void netdev_print_stats() {
+    if (net_devices == NULL) {
+        k_print_string("no network devices\n");
+    }
+    for (net_device_t *dev = net_devices; dev != NULL; dev = dev->next) {
+        k_print_string(dev->name);
+        k_print_string(": ");
+        print_mac(dev->mac);
+        k_print_string(dev->link_up ? " up" : " down");
+        k_print_string(" mtu=");
+        k_print_dec(dev->mtu);
+        if (dev->features & NETDEV_F_TX_CSUM) {
+            k_print_string(" tx-csum");
+        }
+        if (dev->features & NETDEV_F_RX_CSUM) {
+            k_print_string(" rx-csum");
+        }
+        k_print_string("\n  rx packets=");
+        k_print_dec(dev->rx_packets);
+        k_print_string(" bytes=");
+        k_print_dec(dev->rx_bytes);
+        k_print_string(" dropped=");
+        k_print_dec(dev->rx_dropped);
+        k_print_string("\n  tx packets=");
+        k_print_dec(dev->tx_packets);
+        k_print_string(" bytes=");
+        k_print_dec(dev->tx_bytes);
+        k_print_string(" dropped=");
+        k_print_dec(dev->tx_dropped);
+        k_print_string("\n");
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef NETDEV_H
+#define NETDEV_H
+
+#include <stdint.h>
+#include "pbuf.h"
+
+#define ETH_ALEN      6
+#define ETH_HLEN      14
+#define ETH_MTU       1500
+#define ETH_FRAME_MAX (ETH_HLEN + ETH_MTU)
+#define ETH_ZLEN      60        // minimum frame, without FCS
+
+// Offloads the driver can do
+#define NETDEV_F_TX_CSUM 0x01   // finishes PBUF_CSUM_PARTIAL checksums
+#define NETDEV_F_RX_CSUM 0x02   // may flag received frames as verified
+
+// Per received frame
+#define NETDEV_RX_CSUM_VALID 0x01
+
+typedef struct net_device {
+    const char *name;
+    uint8_t mac[ETH_ALEN];
+    uint16_t mtu;
+    int link_up;
+    uint32_t features;
+
+    // Queue a frame. On success the driver owns p until the NIC is done
+    // with it; on failure p is left to the caller.
+    int (*xmit)(struct net_device *dev, pbuf_t *p);
+    // Set by the protocol stack. Runs in bottom-half context and must be
+    // done with the frame when it returns.
+    void (*rx)(struct net_device *dev, const void *frame, uint32_t len, uint32_t flags);
+    void *driver_data;
+
+    uint32_t rx_packets;
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;
+    uint32_t tx_packets;
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;
+    struct net_device *next;
+} net_device_t;
+
+void netdev_register(net_device_t *dev);
+net_device_t *netdev_find(const char *name);
+net_device_t *netdev_first();
+
+// Called by drivers for every received frame
+void netdev_receive(net_device_t *dev, const void *frame, uint32_t len, uint32_t flags);
+// Always consumes p
+int netdev_xmit(net_device_t *dev, pbuf_t *p);
+
+void netdev_print_stats();
+
+#endif
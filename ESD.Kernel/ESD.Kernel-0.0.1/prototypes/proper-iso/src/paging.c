@@ -0,0 +1,163 @@
+#include "paging.h"
+#include "pmm.h"
+#include "zero_pool.h"
+#include "isr.h"
+#include "cpu.h"
+#include "panic.h"
+#include "trace.h"
+
+static uint32_t page_directory[1024] __attribute__((aligned(4096)));
+static uint32_t anon_next = ANON_BASE;
+static uint32_t anon_faults = 0;
+
+static inline uint32_t read_cr2() {
+    uint32_t val;
+    asm volatile ( "mov %%cr2, %0" : "=r"(val) );
+    return val;
+}
+
+static uint32_t *paging_get_table(uint32_t virt, int create) {
+    uint32_t pde = page_directory[virt >> 22];
+
+    if (pde & PAGE_PRESENT) {
+        return (uint32_t *)(pde & ~PAGE_FLAGS_MASK);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    // Page tables come from identity-mapped frames so they are reachable
+    uint32_t table = zero_pool_get();
+    if (table == 0) {
+        return NULL;
+    }
+    page_directory[virt >> 22] = table | PAGE_PRESENT | PAGE_WRITE;
+    return (uint32_t *)table;
+}
+
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t irq = irq_save();
+    uint32_t *table = paging_get_table(virt, 1);
+
+    if (table == NULL) {
+        irq_restore(irq);
+        return -1;
+    }
+    table[(virt >> 12) & 0x3FF] = (phys & ~PAGE_FLAGS_MASK) | (flags & PAGE_FLAGS_MASK) | PAGE_PRESENT;
+    invlpg(virt);
+
+    irq_restore(irq);
+    return 0;
+}
+
+void paging_unmap(uint32_t virt) {
+    uint32_t irq = irq_save();
+    uint32_t *table = paging_get_table(virt, 0);
+
+    if (table != NULL) {
+        table[(virt >> 12) & 0x3FF] = 0;
+        invlpg(virt);
+    }
+
+    irq_restore(irq);
+}
+
+uint32_t paging_translate(uint32_t virt) {
+    uint32_t *table = paging_get_table(virt, 0);
+
+    if (table == NULL || !(table[(virt >> 12) & 0x3FF] & PAGE_PRESENT)) {
+        return 0;
+    }
+    return (table[(virt >> 12) & 0x3FF] & ~PAGE_FLAGS_MASK) | (virt & PAGE_FLAGS_MASK);
+}
+
+// Device memory is identity-mapped uncached
+void *paging_map_mmio(uint32_t phys, uint32_t size) {
+    uint32_t start = phys & ~PAGE_FLAGS_MASK;
+    uint32_t end = phys + size;
+
+    for (uint32_t addr = start; addr < end && addr >= start; addr += PAGE_SIZE) {
+        if (paging_map(addr, addr, PAGE_WRITE | PAGE_PCD | PAGE_PWT) != 0) {
+            return NULL;
+        }
+    }
+    return (void *)phys;
+}
+
+// Replace the caching bits of every page in an existing mapping
+int paging_set_cache(uint32_t virt, uint32_t size, uint32_t cache_flags) {
+    uint32_t irq = irq_save();
+    uint32_t start = virt & ~PAGE_FLAGS_MASK;
+    uint32_t end = virt + size;
+
+    for (uint32_t addr = start; addr < end && addr >= start; addr += PAGE_SIZE) {
+        uint32_t *table = paging_get_table(addr, 0);
+        uint32_t *pte = table != NULL ? &table[(addr >> 12) & 0x3FF] : NULL;
+        if (pte == NULL || !(*pte & PAGE_PRESENT)) {
+            irq_restore(irq);
+            return -1;
+        }
+        *pte = (*pte & ~PAGE_CACHE_MASK) | (cache_flags & PAGE_CACHE_MASK);
+        invlpg(addr);
+    }
+
+    irq_restore(irq);
+    return 0;
+}
+
+// Reserve virtual space only; frames arrive from the zero pool on first touch
+void *vmm_alloc_anon(size_t size) {
+    uint32_t flags = irq_save();
+    uint32_t addr = anon_next;
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    if (size > ANON_END - anon_next) {
+        irq_restore(flags);
+        return NULL;
+    }
+    anon_next += size;
+
+    irq_restore(flags);
+    return (void *)addr;
+}
+
+uint32_t paging_anon_faults() {
+    return anon_faults;
+}
+
+static void page_fault_handler(registers_t *regs) {
+    uint32_t addr = read_cr2();
+
+    trace_record(TRACE_PAGE_FAULT, addr);
+
+    // Not-present fault inside the anonymous window: hand out a zero page
+    if (!(regs->err_code & PAGE_PRESENT) && addr >= ANON_BASE && addr < anon_next) {
+        uint32_t frame = zero_pool_get();
+        if (frame != 0) {
+            if (paging_map(addr & ~PAGE_FLAGS_MASK, frame, PAGE_WRITE) == 0) {
+                anon_faults++;
+                return;
+            }
+            pmm_free_frame(frame);
+        }
+    }
+
+    k_panic("Page fault", regs);
+}
+
+void paging_init() {
+    // Identity-map all managed RAM plus the low megabyte (VGA, BIOS)
+    uint32_t top = pmm_memory_top();
+    if (top < 0x400000) {
+        top = 0x400000;
+    }
+
+    for (uint32_t addr = 0; addr < top; addr += PAGE_SIZE) {
+        paging_map(addr, addr, PAGE_WRITE);
+    }
+
+    isr_install_handler(14, page_fault_handler);
+
+    asm volatile ( "mov %0, %%cr3" : : "r"(page_directory) : "memory" );
+    write_cr0(read_cr0() | 0x80000000);
+}
@@ -0,0 +1,35 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PAGE_PRESENT  (1 << 0)
+#define PAGE_WRITE    (1 << 1)
+#define PAGE_USER     (1 << 2)
+#define PAGE_PWT      (1 << 3)
+#define PAGE_PCD      (1 << 4)
+#define PAGE_PAT      (1 << 7)
+
+#define PAGE_CACHE_MASK (PAGE_PWT | PAGE_PCD | PAGE_PAT)
+
+#define PAGE_FLAGS_MASK 0xFFF
+
+// Demand-zero anonymous memory lives above the identity-mapped RAM
+#define ANON_BASE 0x40000000
+#define ANON_END  0x80000000
+
+void paging_init();
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
+void paging_unmap(uint32_t virt);
+uint32_t paging_translate(uint32_t virt);
+void *paging_map_mmio(uint32_t phys, uint32_t size);
+int paging_set_cache(uint32_t virt, uint32_t size, uint32_t cache_flags);
+void *vmm_alloc_anon(size_t size);
+uint32_t paging_anon_faults();
+
+static inline void invlpg(uint32_t addr) {
+    asm volatile ( "invlpg (%0)" : : "r"(addr) : "memory" );
+}
+
+#endif
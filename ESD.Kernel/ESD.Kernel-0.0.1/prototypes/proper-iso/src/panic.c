@@ -0,0 +1,218 @@
+#include "panic.h"
+#include "serial.h"
+#include "paging.h"
+#include "cpu.h"
+#include "apic.h"
+#include "simple_kernel.h"
+#include "fbcon.h"
+#include <stddef.h>
+
+#define PANIC_ATTR 0x4F
+
+#define APIC_DM_NMI         (4 << 8)
+#define APIC_DEST_ALL_BUT_SELF (3 << 18)
+
+extern uint8_t stack_top[];
+
+volatile int panic_in_progress = 0;
+
+static crash_record_t crash_record;
+static unsigned char *panic_vidmem = (unsigned char *)0xb8000;
+static int panic_row = 0;
+static int panic_col = 0;
+
+// Console output that skips the regular console state entirely
+static void panic_vga_putc(char c) {
+    int width = fbcon_active() ? (int)fbcon_cols() : VGA_WIDTH;
+    int height = fbcon_active() ? (int)fbcon_rows() : VGA_HEIGHT;
+
+    if (c == '\n' || panic_col >= width) {
+        panic_col = 0;
+        if (++panic_row >= height) {
+            panic_row = height - 1;
+        }
+        if (c == '\n') {
+            return;
+        }
+    }
+    if (fbcon_active()) {
+        fbcon_put_cell(panic_col++, panic_row, c, PANIC_ATTR);
+        return;
+    }
+    int offset = (panic_row * VGA_WIDTH + panic_col++) * 2;
+    panic_vidmem[offset] = c;
+    panic_vidmem[offset + 1] = PANIC_ATTR;
+}
+
+static void panic_print(const char *str) {
+    serial_print(str);
+    while (*str) {
+        panic_vga_putc(*str++);
+    }
+}
+
+static void panic_print_hex(uint32_t val) {
+    char buf[11];
+
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        uint32_t nibble = (val >> (28 - i * 4)) & 0xF;
+        buf[2 + i] = nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
+    }
+    buf[10] = '\0';
+    panic_print(buf);
+}
+
+static void panic_print_reg(const char *name, uint32_t val) {
+    panic_print(name);
+    panic_print("=");
+    panic_print_hex(val);
+    panic_print(" ");
+}
+
+static void panic_stop_other_cpus() {
+    if (!cpu_features.apic) {
+        return;
+    }
+
+    uint32_t lo = (uint32_t)rdmsr(IA32_APIC_BASE_MSR);
+    if (!(lo & APIC_BASE_ENABLE)) {
+        return;
+    }
+
+    // Only poke the local APIC if it is already mapped, never allocate here
+    uint32_t base = lo & 0xFFFFF000;
+    if (paging_translate(base) != base) {
+        return;
+    }
+
+    volatile uint32_t *apic = (volatile uint32_t *)base;
+    apic[APIC_ICR_HIGH / 4] = 0;
+    apic[APIC_ICR_LOW / 4] = APIC_DM_NMI | APIC_DEST_ALL_BUT_SELF;
+}
+
+static void panic_fill_record(registers_t *regs) {
+    uint8_t *raw = (uint8_t *)&crash_record;
+    for (size_t i = 0; i < sizeof(crash_record); i++) {
+        raw[i] = 0;
+    }
+
+    crash_record.magic = PANIC_MAGIC;
+    crash_record.size = sizeof(crash_record);
+    if (regs != NULL) {
+        crash_record.regs = *regs;
+    }
+    crash_record.cr0 = read_cr0();
+    asm volatile ( "mov %%cr2, %0" : "=r"(crash_record.cr2) );
+    asm volatile ( "mov %%cr3, %0" : "=r"(crash_record.cr3) );
+    crash_record.cr4 = read_cr4();
+
+    // A kernel-mode interrupt pushes no useresp/ss, so the interrupted
+    // stack starts where useresp would be
+    uint32_t *stack = regs != NULL ? (uint32_t *)regs + offsetof(registers_t, useresp) / 4 : (uint32_t *)&regs;
+    for (int i = 0; i < PANIC_STACK_WORDS && (uint32_t)&stack[i] < (uint32_t)stack_top; i++) {
+        crash_record.stack[i] = stack[i];
+    }
+
+    crash_record.trace_count = trace_tail(crash_record.trace, PANIC_TRACE_ENTRIES);
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < offsetof(crash_record_t, checksum); i++) {
+        sum = (sum << 1 | sum >> 31) ^ raw[i];
+    }
+    crash_record.checksum = sum;
+}
+
+static void panic_dump_text(const char *msg) {
+    registers_t *r = &crash_record.regs;
+
+    panic_print("\n*** MONKE KERNEL PANIC: ");
+    panic_print(msg);
+    panic_print(" ***\n");
+
+    panic_print_reg("INT", r->int_no);
+    panic_print_reg("ERR", r->err_code);
+    panic_print_reg("EIP", r->eip);
+    panic_print_reg("CS", r->cs);
+    panic_print("\n");
+    panic_print_reg("EFL", r->eflags);
+    panic_print_reg("EAX", r->eax);
+    panic_print_reg("EBX", r->ebx);
+    panic_print_reg("ECX", r->ecx);
+    panic_print("\n");
+    panic_print_reg("EDX", r->edx);
+    panic_print_reg("ESI", r->esi);
+    panic_print_reg("EDI", r->edi);
+    panic_print_reg("EBP", r->ebp);
+    panic_print("\n");
+    panic_print_reg("CR0", crash_record.cr0);
+    panic_print_reg("CR2", crash_record.cr2);
+    panic_print_reg("CR3", crash_record.cr3);
+    panic_print_reg("CR4", crash_record.cr4);
+    panic_print("\nSTACK:");
+    for (int i = 0; i < PANIC_STACK_WORDS; i++) {
+        if (i % 6 == 0) {
+            panic_print("\n");
+        }
+        panic_print_hex(crash_record.stack[i]);
+        panic_print(" ");
+    }
+    panic_print("\nTRACE (event:arg):");
+    for (uint32_t i = 0; i < crash_record.trace_count; i++) {
+        if (i % 4 == 0) {
+            panic_print("\n");
+        }
+        panic_print_hex(crash_record.trace[i].event);
+        panic_print(":");
+        panic_print_hex(crash_record.trace[i].arg);
+        panic_print(" ");
+    }
+    panic_print("\n");
+}
+
+void panic_halt() {
+    for (;;) {
+        asm volatile ( "cli; hlt" );
+    }
+}
+
+static void panic_reset() {
+    // Pulse the reset line through the keyboard controller
+    while (inb(0x64) & 0x02);
+    outb(0x64, 0xFE);
+
+    // Still here: triple fault with an empty IDT
+    static const struct { uint16_t limit; uint32_t base; } __attribute__((packed)) null_idt = {0, 0};
+    asm volatile ( "lidt %0; int3" : : "m"(null_idt) );
+    panic_halt();
+}
+
+void k_panic(const char *msg, registers_t *regs) {
+    asm volatile ( "cli" );
+
+    // A fault while dumping must not recurse into another dump
+    if (panic_in_progress++) {
+        panic_halt();
+    }
+
+    panic_stop_other_cpus();
+    // Take the screen back from the window manager; the dump below only
+    // dirties rows, flushed once it is complete
+    fbcon_suspend(0);
+    panic_fill_record(regs);
+    panic_dump_text(msg);
+    fbcon_flush();
+
+    // Framed binary copy for host-side tooling: marker, record, marker
+    serial_print("ESDP-BIN-BEGIN\n");
+    serial_write(&crash_record, sizeof(crash_record));
+    serial_print("\nESDP-BIN-END\n");
+
+    if (PANIC_REBOOT) {
+        panic_reset();
+    }
+    panic_print("System halted. Press BIG RED BUTTON.\n");
+    fbcon_flush();
+    panic_halt();
+}
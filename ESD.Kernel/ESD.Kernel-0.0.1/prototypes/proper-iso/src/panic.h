@@ -0,0 +1,32 @@
+#ifndef PANIC_H
+#define PANIC_H
+
+#include <stdint.h>
+#include "isr.h"
+#include "trace.h"
+
+// Set to 1 to reset the machine after the crash record instead of halting
+#define PANIC_REBOOT 0
+
+#define PANIC_MAGIC 0x50445345   // "ESDP"
+#define PANIC_STACK_WORDS 16
+#define PANIC_TRACE_ENTRIES 8
+
+// Binary crash record sent on serial after the text dump
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    registers_t regs;
+    uint32_t cr0, cr2, cr3, cr4;
+    uint32_t stack[PANIC_STACK_WORDS];
+    uint32_t trace_count;
+    trace_entry_t trace[PANIC_TRACE_ENTRIES];
+    uint32_t checksum;
+} __attribute__((packed)) crash_record_t;
+
+extern volatile int panic_in_progress;
+
+void k_panic(const char *msg, registers_t *regs) __attribute__((noreturn));
+void panic_halt() __attribute__((noreturn));
+
+#endif
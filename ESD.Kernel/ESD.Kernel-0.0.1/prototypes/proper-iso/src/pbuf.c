@@ -0,0 +1,242 @@
+#include "pbuf.h"
+#include "pmm.h"
+#include "mem.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+_Static_assert(sizeof(pbuf_t) <= PBUF_HDR_SIZE, "struct pbuf outgrew PBUF_HDR_SIZE");
+
+// Slab of pool buffers, grown a page at a time and never shrunk
+static pbuf_t *pool_free = NULL;
+static uint32_t pool_pages = 0;
+static uint32_t pool_in_use = 0;
+static uint32_t pool_peak = 0;
+static uint32_t pool_failures = 0;
+
+// Reference pieces carry no storage of their own
+static pbuf_t ref_pieces[PBUF_REF_COUNT];
+static pbuf_t *ref_free = NULL;
+static int ref_ready = 0;
+static uint32_t ref_in_use = 0;
+static uint32_t ref_failures = 0;
+
+static inline uint8_t *pbuf_storage(const pbuf_t *p) {
+    return (uint8_t *)p + PBUF_HDR_SIZE;
+}
+
+// Caller has interrupts off
+static int pool_grow() {
+    if (pool_pages >= PBUF_MAX_PAGES) {
+        return -1;
+    }
+    uint8_t *page = (uint8_t *)pmm_alloc_frames(1);
+    if (page == NULL) {
+        return -1;
+    }
+    pool_pages++;
+
+    for (uint32_t off = 0; off < PAGE_SIZE; off += PBUF_OBJ_SIZE) {
+        pbuf_t *p = (pbuf_t *)(page + off);
+        p->link = pool_free;
+        pool_free = p;
+    }
+    return 0;
+}
+
+static pbuf_t *pbuf_get(int type) {
+    pbuf_t *p = NULL;
+    uint32_t flags = irq_save();
+
+    if (type == PBUF_POOL) {
+        if (pool_free != NULL || pool_grow() == 0) {
+            p = pool_free;
+            pool_free = p->link;
+            if (++pool_in_use > pool_peak) {
+                pool_peak = pool_in_use;
+            }
+        } else {
+            pool_failures++;
+        }
+    } else {
+        if (!ref_ready) {
+            for (int i = 0; i < PBUF_REF_COUNT; i++) {
+                ref_pieces[i].link = ref_free;
+                ref_free = &ref_pieces[i];
+            }
+            ref_ready = 1;
+        }
+        if (ref_free != NULL) {
+            p = ref_free;
+            ref_free = p->link;
+            ref_in_use++;
+        } else {
+            ref_failures++;
+        }
+    }
+
+    irq_restore(flags);
+    if (p != NULL) {
+        p->next = NULL;
+        p->link = NULL;
+        p->ref = 1;
+        p->type = type;
+        p->flags = 0;
+        p->csum_start = 0;
+        p->csum_offset = 0;
+        p->owner = NULL;
+    }
+    return p;
+}
+
+// Caller has interrupts off
+static void pbuf_put_piece(pbuf_t *p) {
+    if (p->type == PBUF_POOL) {
+        p->link = pool_free;
+        pool_free = p;
+        pool_in_use--;
+    } else {
+        p->link = ref_free;
+        ref_free = p;
+        ref_in_use--;
+    }
+}
+
+pbuf_t *pbuf_alloc(uint16_t headroom, uint16_t len) {
+    if ((uint32_t)headroom + len > PBUF_DATA_SIZE) {
+        return NULL;
+    }
+    pbuf_t *p = pbuf_get(PBUF_POOL);
+    if (p != NULL) {
+        p->payload = pbuf_storage(p) + headroom;
+        p->len = len;
+        p->tot_len = len;
+    }
+    return p;
+}
+
+pbuf_t *pbuf_alloc_ref(pbuf_t *owner, uint16_t offset, uint16_t len) {
+    if (owner->type != PBUF_POOL || (uint32_t)offset + len > owner->len) {
+        return NULL;
+    }
+    pbuf_t *p = pbuf_get(PBUF_REF);
+    if (p != NULL) {
+        pbuf_ref(owner);
+        p->owner = owner;
+        p->payload = owner->payload + offset;
+        p->len = len;
+        p->tot_len = len;
+    }
+    return p;
+}
+
+void pbuf_ref(pbuf_t *p) {
+    uint32_t flags = irq_save();
+    p->ref++;
+    irq_restore(flags);
+}
+
+void pbuf_free(pbuf_t *p) {
+    uint32_t flags = irq_save();
+
+    while (p != NULL && --p->ref == 0) {
+        pbuf_t *next = p->next;
+        if (p->type == PBUF_REF && --p->owner->ref == 0) {
+            pbuf_put_piece(p->owner);
+        }
+        pbuf_put_piece(p);
+        p = next;
+    }
+
+    irq_restore(flags);
+}
+
+void *pbuf_push(pbuf_t *p, uint16_t size) {
+    if (p->type != PBUF_POOL || p->payload - size < pbuf_storage(p)) {
+        return NULL;
+    }
+    p->payload -= size;
+    p->len += size;
+    p->tot_len += size;
+    p->csum_start += size;
+    return p->payload;
+}
+
+void *pbuf_pull(pbuf_t *p, uint16_t size) {
+    if (size > p->len) {
+        return NULL;
+    }
+    p->payload += size;
+    p->len -= size;
+    p->tot_len -= size;
+    p->csum_start -= size;
+    return p->payload;
+}
+
+uint16_t pbuf_tailroom(const pbuf_t *p) {
+    if (p->type != PBUF_POOL) {
+        return 0;
+    }
+    return pbuf_storage(p) + PBUF_DATA_SIZE - (p->payload + p->len);
+}
+
+void *pbuf_put(pbuf_t *p, uint16_t size) {
+    if (p->next != NULL || size > pbuf_tailroom(p)) {
+        return NULL;
+    }
+    uint8_t *end = p->payload + p->len;
+    p->len += size;
+    p->tot_len += size;
+    return end;
+}
+
+void pbuf_chain(pbuf_t *head, pbuf_t *tail) {
+    pbuf_t *p = head;
+
+    for (;;) {
+        p->tot_len += tail->tot_len;
+        if (p->next == NULL) {
+            break;
+        }
+        p = p->next;
+    }
+    p->next = tail;
+}
+
+uint32_t pbuf_copy_out(const pbuf_t *p, uint32_t offset, void *dst, uint32_t len) {
+    uint8_t *d = dst;
+    uint32_t copied = 0;
+
+    for (; p != NULL && copied < len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint32_t chunk = p->len - offset;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        memcpy(d + copied, p->payload + offset, chunk);
+        copied += chunk;
+        offset = 0;
+    }
+    return copied;
+}
+
+void pbuf_print_stats() {
+    k_print_string("pbuf: pool ");
+    k_print_dec(pool_in_use);
+    k_print_string("/");
+    k_print_dec(pool_pages * (PAGE_SIZE / PBUF_OBJ_SIZE));
+    k_print_string(" (peak ");
+    k_print_dec(pool_peak);
+    k_print_string(", failed ");
+    k_print_dec(pool_failures);
+    k_print_string(") refs ");
+    k_print_dec(ref_in_use);
+    k_print_string("/");
+    k_print_dec(PBUF_REF_COUNT);
+    k_print_string(" (failed ");
+    k_print_dec(ref_failures);
+    k_print_string(")\n");
+}
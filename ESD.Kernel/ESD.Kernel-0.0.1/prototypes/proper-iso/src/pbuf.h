@@ -0,0 +1,58 @@
+#ifndef PBUF_H
+#define PBUF_H
+
+#include <stdint.h>
+
+// Pool buffers are carved two to a page, so a buffer's bytes are always
+// physically contiguous and can be handed to a NIC as one descriptor
+#define PBUF_OBJ_SIZE   2048
+#define PBUF_HDR_SIZE   64      // struct pbuf, rounded for alignment
+#define PBUF_DATA_SIZE  (PBUF_OBJ_SIZE - PBUF_HDR_SIZE)
+#define PBUF_MAX_PAGES  256     // 2 MB of packet memory at most
+#define PBUF_REF_COUNT  256
+
+// Room for Ethernet + IPv4 + TCP headers with options
+#define PBUF_HEADROOM   64
+
+#define PBUF_POOL 0             // owns its storage
+#define PBUF_REF  1             // points into a pool buffer's storage
+
+#define PBUF_CSUM_PARTIAL 0x01  // L4 checksum left for the NIC to finish
+
+typedef struct pbuf {
+    struct pbuf *next;          // next piece of the same packet
+    struct pbuf *link;          // next packet on a queue
+    uint8_t *payload;
+    uint16_t len;               // bytes in this piece
+    uint16_t tot_len;           // bytes in this piece and all that follow
+    uint16_t ref;
+    uint8_t type;
+    uint8_t flags;
+    // With PBUF_CSUM_PARTIAL: the checksum covers payload + csum_start to
+    // the end of the packet and is stored at csum_start + csum_offset
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    struct pbuf *owner;         // PBUF_REF only
+} pbuf_t;
+
+pbuf_t *pbuf_alloc(uint16_t headroom, uint16_t len);
+// A piece referencing len bytes at offset in a single-piece pool buffer
+pbuf_t *pbuf_alloc_ref(pbuf_t *owner, uint16_t offset, uint16_t len);
+void pbuf_ref(pbuf_t *p);
+// Drop one reference from each piece, stopping at a piece still in use
+void pbuf_free(pbuf_t *p);
+
+// Grow at the front into headroom, returning the new start (NULL if no room)
+void *pbuf_push(pbuf_t *p, uint16_t size);
+void *pbuf_pull(pbuf_t *p, uint16_t size);
+// Grow at the back, returning the old end (NULL if no room)
+void *pbuf_put(pbuf_t *p, uint16_t size);
+uint16_t pbuf_tailroom(const pbuf_t *p);
+
+// Append tail's chain; the caller's reference to tail moves to head
+void pbuf_chain(pbuf_t *head, pbuf_t *tail);
+uint32_t pbuf_copy_out(const pbuf_t *p, uint32_t offset, void *dst, uint32_t len);
+
+void pbuf_print_stats();
+
+#endif
@@ -0,0 +1,324 @@
+#include "pci.h"
+#include "acpi.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+// Enumerated once at boot; lookups never touch config space again
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static int pci_count = 0;
+
+// Sorted indexes into pci_devices for binary search
+static uint8_t by_id[PCI_MAX_DEVICES];
+static uint8_t by_class[PCI_MAX_DEVICES];
+
+static spinlock_t pci_lock;
+
+// ECAM window (PCIe memory-mapped config space) from the ACPI MCFG table
+static uint8_t *ecam_base = NULL;
+static uint8_t ecam_start_bus = 0;
+static uint8_t ecam_end_bus = 0;
+
+static uint32_t pci_raw_read32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset) {
+    if (ecam_base != NULL && bus >= ecam_start_bus && bus <= ecam_end_bus) {
+        uint32_t off = ((bus - ecam_start_bus) << 20) | (slot << 15) | (func << 12) | (offset & 0xFFC);
+        return *(volatile uint32_t *)(ecam_base + off);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC));
+    uint32_t val = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return val;
+}
+
+static void pci_raw_write32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset, uint32_t val) {
+    if (ecam_base != NULL && bus >= ecam_start_bus && bus <= ecam_end_bus) {
+        uint32_t off = ((bus - ecam_start_bus) << 20) | (slot << 15) | (func << 12) | (offset & 0xFFC);
+        *(volatile uint32_t *)(ecam_base + off) = val;
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC));
+    outl(PCI_CONFIG_DATA, val);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+uint32_t pci_read32(pci_device_t *dev, uint16_t offset) {
+    return pci_raw_read32(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(pci_device_t *dev, uint16_t offset) {
+    return pci_read32(dev, offset & ~3) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_read8(pci_device_t *dev, uint16_t offset) {
+    return pci_read32(dev, offset & ~3) >> ((offset & 3) * 8);
+}
+
+void pci_write32(pci_device_t *dev, uint16_t offset, uint32_t val) {
+    pci_raw_write32(dev->bus, dev->slot, dev->func, offset, val);
+}
+
+void pci_write16(pci_device_t *dev, uint16_t offset, uint16_t val) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t old = pci_read32(dev, offset & ~3);
+    pci_write32(dev, offset & ~3, (old & ~(0xFFFF << shift)) | ((uint32_t)val << shift));
+}
+
+static void pci_size_bars(pci_device_t *dev) {
+    int count = (dev->header_type & 0x7F) == 0 ? 6 : 2;
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+
+    // Stop decoding while the BARs temporarily hold all-ones
+    pci_write16(dev, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (int i = 0; i < count; i++) {
+        uint16_t reg = PCI_BAR0 + i * 4;
+        uint32_t orig = pci_read32(dev, reg);
+        pci_bar_t *bar = &dev->bars[i];
+
+        pci_write32(dev, reg, 0xFFFFFFFF);
+        uint32_t mask = pci_read32(dev, reg);
+        pci_write32(dev, reg, orig);
+
+        if (mask == 0 || mask == 0xFFFFFFFF) {
+            continue;
+        }
+
+        if (orig & 1) {
+            bar->is_io = 1;
+            bar->base = orig & ~0x3;
+            bar->size = (~(mask & ~0x3) + 1) & 0xFFFF;
+        } else {
+            bar->base = orig & ~0xF;
+            bar->size = ~(mask & ~0xF) + 1;
+            bar->is_prefetch = (orig >> 3) & 1;
+            if (((orig >> 1) & 3) == 2) {
+                // 64-bit BAR: we only use it if the upper half is zero
+                bar->is_64 = 1;
+                if (i + 1 < count && pci_read32(dev, reg + 4) != 0) {
+                    bar->base = 0;
+                    bar->size = 0;
+                }
+                i++;
+            }
+        }
+    }
+
+    pci_write16(dev, PCI_COMMAND, command);
+}
+
+static void pci_find_caps(pci_device_t *dev) {
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return;
+    }
+
+    uint8_t ptr = pci_read8(dev, PCI_CAP_POINTER) & 0xFC;
+    for (int guard = 0; ptr != 0 && guard < 48; guard++) {
+        uint8_t id = pci_read8(dev, ptr);
+        if (id == PCI_CAP_ID_MSI) {
+            dev->msi_cap = ptr;
+        } else if (id == PCI_CAP_ID_MSIX) {
+            dev->msix_cap = ptr;
+        }
+        ptr = pci_read8(dev, ptr + 1) & 0xFC;
+    }
+}
+
+static void pci_scan_bus(uint8_t bus);
+
+static void pci_scan_function(uint8_t bus, uint8_t slot, uint8_t func) {
+    uint32_t id = pci_raw_read32(bus, slot, func, PCI_VENDOR_ID);
+    if ((id & 0xFFFF) == 0xFFFF || pci_count >= PCI_MAX_DEVICES) {
+        return;
+    }
+
+    pci_device_t *dev = &pci_devices[pci_count++];
+    uint32_t class_reg = pci_raw_read32(bus, slot, func, PCI_REVISION_ID);
+    uint32_t irq_reg = pci_raw_read32(bus, slot, func, PCI_INTERRUPT_LINE);
+
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = id & 0xFFFF;
+    dev->device_id = id >> 16;
+    dev->revision = class_reg & 0xFF;
+    dev->prog_if = (class_reg >> 8) & 0xFF;
+    dev->subclass = (class_reg >> 16) & 0xFF;
+    dev->class_code = class_reg >> 24;
+    dev->header_type = (pci_raw_read32(bus, slot, func, 0x0C) >> 16) & 0xFF;
+    dev->irq_line = irq_reg & 0xFF;
+    dev->irq_pin = (irq_reg >> 8) & 0xFF;
+
+    pci_size_bars(dev);
+    pci_find_caps(dev);
+
+    // PCI-to-PCI bridge: walk the bus behind it
+    if (dev->class_code == PCI_CLASS_BRIDGE && dev->subclass == 0x04) {
+        uint8_t secondary = pci_read8(dev, PCI_SECONDARY_BUS);
+        if (secondary > bus) {
+            pci_scan_bus(secondary);
+        }
+    }
+}
+
+static void pci_scan_bus(uint8_t bus) {
+    for (uint8_t slot = 0; slot < 32; slot++) {
+        uint32_t id = pci_raw_read32(bus, slot, 0, PCI_VENDOR_ID);
+        if ((id & 0xFFFF) == 0xFFFF) {
+            continue;
+        }
+        uint8_t header = (pci_raw_read32(bus, slot, 0, 0x0C) >> 16) & 0xFF;
+        int funcs = (header & 0x80) ? 8 : 1;
+        for (uint8_t func = 0; func < funcs; func++) {
+            pci_scan_function(bus, slot, func);
+        }
+    }
+}
+
+static uint32_t id_key(int i) {
+    return ((uint32_t)pci_devices[i].vendor_id << 16) | pci_devices[i].device_id;
+}
+
+static uint32_t class_key(int i) {
+    return ((uint32_t)pci_devices[i].class_code << 8) | pci_devices[i].subclass;
+}
+
+static void pci_sort_index(uint8_t *index, uint32_t (*key)(int)) {
+    for (int i = 0; i < pci_count; i++) {
+        index[i] = i;
+    }
+    // Insertion sort, the table is tiny; stable so bus order is kept
+    for (int i = 1; i < pci_count; i++) {
+        uint8_t v = index[i];
+        int j = i - 1;
+        while (j >= 0 && key(index[j]) > key(v)) {
+            index[j + 1] = index[j];
+            j--;
+        }
+        index[j + 1] = v;
+    }
+}
+
+// First position in index whose key is >= wanted
+static int pci_lower_bound(uint8_t *index, uint32_t (*key)(int), uint32_t wanted) {
+    int lo = 0, hi = pci_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (key(index[mid]) < wanted) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void pci_init() {
+    spin_init(&pci_lock, "pci_config");
+
+    acpi_mcfg_entry_t *mcfg_entry = NULL;
+    acpi_sdt_header_t *mcfg = acpi_find_table("MCFG");
+    if (mcfg != NULL && mcfg->length >= sizeof(acpi_sdt_header_t) + 8 + sizeof(acpi_mcfg_entry_t)) {
+        mcfg_entry = (acpi_mcfg_entry_t *)((uint8_t *)mcfg + sizeof(acpi_sdt_header_t) + 8);
+    }
+    if (mcfg_entry != NULL && mcfg_entry->segment == 0 && mcfg_entry->base < 0x100000000ULL) {
+        uint32_t buses = mcfg_entry->end_bus - mcfg_entry->start_bus + 1;
+        ecam_base = paging_map_mmio((uint32_t)mcfg_entry->base, buses << 20);
+        ecam_start_bus = mcfg_entry->start_bus;
+        ecam_end_bus = mcfg_entry->end_bus;
+    }
+
+    // Host bridge with several functions means several root buses
+    uint8_t header = (pci_raw_read32(0, 0, 0, 0x0C) >> 16) & 0xFF;
+    if (header & 0x80) {
+        for (uint8_t func = 0; func < 8; func++) {
+            if ((pci_raw_read32(0, 0, func, PCI_VENDOR_ID) & 0xFFFF) != 0xFFFF) {
+                pci_scan_bus(func);
+            }
+        }
+    } else {
+        pci_scan_bus(0);
+    }
+
+    pci_sort_index(by_id, id_key);
+    pci_sort_index(by_class, class_key);
+}
+
+int pci_device_count() {
+    return pci_count;
+}
+
+pci_device_t *pci_get_device(int index) {
+    if (index < 0 || index >= pci_count) {
+        return NULL;
+    }
+    return &pci_devices[index];
+}
+
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+    uint32_t wanted = ((uint32_t)vendor_id << 16) | device_id;
+    int pos = pci_lower_bound(by_id, id_key, wanted);
+
+    if (pos < pci_count && id_key(by_id[pos]) == wanted) {
+        return &pci_devices[by_id[pos]];
+    }
+    return NULL;
+}
+
+// Iterate devices of a class: pass the previous result as after, or NULL
+pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *after) {
+    uint32_t wanted = ((uint32_t)class_code << 8) | subclass;
+    int pos = pci_lower_bound(by_class, class_key, wanted);
+
+    if (after != NULL) {
+        while (pos < pci_count && &pci_devices[by_class[pos]] != after) {
+            pos++;
+        }
+        pos++;
+    }
+    if (pos < pci_count && class_key(by_class[pos]) == wanted) {
+        return &pci_devices[by_class[pos]];
+    }
+    return NULL;
+}
+
+void *pci_map_bar(pci_device_t *dev, int bar) {
+    pci_bar_t *b = &dev->bars[bar];
+
+    if (b->is_io || b->base == 0 || b->size == 0) {
+        return NULL;
+    }
+    if (b->virt == NULL) {
+        b->virt = paging_map_mmio(b->base, b->size);
+    }
+    return b->virt;
+}
+
+void pci_enable(pci_device_t *dev, uint16_t command_bits) {
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | command_bits);
+}
+
+void pci_print_devices() {
+    for (int i = 0; i < pci_count; i++) {
+        pci_device_t *dev = &pci_devices[i];
+        k_print_dec(dev->bus);
+        k_print_string(":");
+        k_print_dec(dev->slot);
+        k_print_string(".");
+        k_print_dec(dev->func);
+        k_print_string(" ");
+        k_print_hex((dev->vendor_id << 16) | dev->device_id);
+        k_print_string(" class ");
+        k_print_hex((dev->class_code << 16) | (dev->subclass << 8) | dev->prog_if);
+        if (dev->msix_cap) {
+            k_print_string(" msix");
+        } else if (dev->msi_cap) {
+            k_print_string(" msi");
+        }
+        k_print_string("\n");
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_REVISION_ID    0x08
+#define PCI_PROG_IF        0x09
+#define PCI_SUBCLASS       0x0A
+#define PCI_CLASS          0x0B
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_SECONDARY_BUS  0x19
+#define PCI_CAP_POINTER    0x34
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+#define PCI_COMMAND_IO         (1 << 0)
+#define PCI_COMMAND_MEMORY     (1 << 1)
+#define PCI_COMMAND_BUS_MASTER (1 << 2)
+#define PCI_COMMAND_INTX_OFF   (1 << 10)
+
+#define PCI_STATUS_CAP_LIST (1 << 4)
+
+#define PCI_CAP_ID_MSI  0x05
+#define PCI_CAP_ID_MSIX 0x11
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_CLASS_NETWORK 0x02
+#define PCI_CLASS_DISPLAY 0x03
+#define PCI_CLASS_BRIDGE  0x06
+
+#define PCI_MAX_DEVICES 64
+#define PCI_MAX_BARS 6
+
+typedef struct {
+    uint32_t base;
+    uint32_t size;
+    uint8_t is_io;
+    uint8_t is_64;
+    uint8_t is_prefetch;
+    void *virt;
+} pci_bar_t;
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t header_type;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+    uint8_t irq_line;
+    uint8_t irq_pin;
+    uint8_t msi_cap;     // config offset of the capability, 0 if absent
+    uint8_t msix_cap;
+    pci_bar_t bars[PCI_MAX_BARS];
+} pci_device_t;
+
+void pci_init();
+int pci_device_count();
+pci_device_t *pci_get_device(int index);
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id);
+pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *after);
+void *pci_map_bar(pci_device_t *dev, int bar);
+void pci_enable(pci_device_t *dev, uint16_t command_bits);
+void pci_print_devices();
+
+uint32_t pci_read32(pci_device_t *dev, uint16_t offset);
+uint16_t pci_read16(pci_device_t *dev, uint16_t offset);
+uint8_t pci_read8(pci_device_t *dev, uint16_t offset);
+void pci_write32(pci_device_t *dev, uint16_t offset, uint32_t val);
+void pci_write16(pci_device_t *dev, uint16_t offset, uint16_t val);
+
+#endif
@@ -0,0 +1,178 @@
+#include "pmm.h"
+#include "cpu.h"
+#include <stddef.h>
+
+extern uint8_t kernel_end[];
+
+// One bit per 4 KiB frame, set = used. Frame 0 doubles as the failure value.
+static uint32_t frame_bitmap[PMM_MAX_FRAMES / 32];
+static uint32_t total_frames = 0;
+static uint32_t free_frames = 0;
+static uint32_t memory_top = 0;
+static uint32_t search_hint = 0;
+
+static inline void frame_set(uint32_t frame) {
+    frame_bitmap[frame / 32] |= 1u << (frame % 32);
+}
+
+static inline void frame_clear(uint32_t frame) {
+    frame_bitmap[frame / 32] &= ~(1u << (frame % 32));
+}
+
+static inline int frame_test(uint32_t frame) {
+    return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+static void pmm_add_region(uint64_t base, uint64_t len) {
+    uint64_t end = base + len;
+
+    if (base >= PMM_MAX_MEMORY) {
+        return;
+    }
+    if (end > PMM_MAX_MEMORY) {
+        end = PMM_MAX_MEMORY;
+    }
+
+    uint32_t first = (uint32_t)((base + PAGE_SIZE - 1) / PAGE_SIZE);
+    uint32_t last = (uint32_t)(end / PAGE_SIZE);
+
+    for (uint32_t frame = first; frame < last; frame++) {
+        if (frame_test(frame)) {
+            frame_clear(frame);
+            free_frames++;
+            total_frames++;
+        }
+    }
+    if (last * PAGE_SIZE > memory_top) {
+        memory_top = last * PAGE_SIZE;
+    }
+}
+
+static void pmm_reserve(uint32_t base, uint32_t end) {
+    for (uint32_t frame = base / PAGE_SIZE; frame < (end + PAGE_SIZE - 1) / PAGE_SIZE; frame++) {
+        if (!frame_test(frame)) {
+            frame_set(frame);
+            free_frames--;
+        }
+    }
+}
+
+void pmm_init(multiboot_info_t *mbi) {
+    for (uint32_t i = 0; i < PMM_MAX_FRAMES / 32; i++) {
+        frame_bitmap[i] = 0xFFFFFFFF;
+    }
+
+    if (mbi != NULL && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        uint32_t addr = mbi->mmap_addr;
+        while (addr < mbi->mmap_addr + mbi->mmap_length) {
+            multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                pmm_add_region(entry->addr, entry->len);
+            }
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi != NULL && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+        pmm_add_region(0x100000, (uint64_t)mbi->mem_upper * 1024);
+    } else {
+        // No information from the loader, assume the 16 MiB everyone has
+        pmm_add_region(0x100000, 15 * 1024 * 1024);
+    }
+
+    // Real mode area, the kernel image and the multiboot structures
+    pmm_reserve(0, 0x100000);
+    pmm_reserve(0x100000, (uint32_t)kernel_end);
+    if (mbi != NULL) {
+        pmm_reserve((uint32_t)mbi, (uint32_t)mbi + sizeof(multiboot_info_t));
+        if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+            pmm_reserve(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+        }
+        if (mbi->flags & MULTIBOOT_INFO_MODS) {
+            multiboot_module_t *mods = (multiboot_module_t *)mbi->mods_addr;
+            pmm_reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+            for (uint32_t i = 0; i < mbi->mods_count; i++) {
+                pmm_reserve(mods[i].mod_start, mods[i].mod_end);
+                if (mods[i].cmdline) {
+                    pmm_reserve(mods[i].cmdline, mods[i].cmdline + 1);
+                }
+            }
+        }
+    }
+
+    search_hint = 0x100000 / PAGE_SIZE;
+}
+
+uint32_t pmm_alloc_frame() {
+    uint32_t flags = irq_save();
+    uint32_t words = (memory_top / PAGE_SIZE + 31) / 32;
+
+    for (uint32_t n = 0; n < words; n++) {
+        uint32_t w = (search_hint / 32 + n) % words;
+        if (frame_bitmap[w] != 0xFFFFFFFF) {
+            uint32_t bit = __builtin_ctz(~frame_bitmap[w]);
+            uint32_t frame = w * 32 + bit;
+            frame_set(frame);
+            free_frames--;
+            search_hint = frame;
+            irq_restore(flags);
+            return frame * PAGE_SIZE;
+        }
+    }
+
+    irq_restore(flags);
+    return 0;
+}
+
+// Physically contiguous run, for DMA buffers and framebuffers
+uint32_t pmm_alloc_frames(uint32_t count) {
+    uint32_t flags = irq_save();
+    uint32_t limit = memory_top / PAGE_SIZE;
+    uint32_t run = 0;
+
+    for (uint32_t frame = 0x100000 / PAGE_SIZE; frame < limit; frame++) {
+        if (frame_test(frame)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            uint32_t first = frame + 1 - count;
+            for (uint32_t f = first; f <= frame; f++) {
+                frame_set(f);
+            }
+            free_frames -= count;
+            irq_restore(flags);
+            return first * PAGE_SIZE;
+        }
+    }
+
+    irq_restore(flags);
+    return 0;
+}
+
+void pmm_free_frame(uint32_t addr) {
+    pmm_free_frames(addr, 1);
+}
+
+void pmm_free_frames(uint32_t addr, uint32_t count) {
+    uint32_t flags = irq_save();
+
+    for (uint32_t frame = addr / PAGE_SIZE; frame < addr / PAGE_SIZE + count; frame++) {
+        if (frame_test(frame)) {
+            frame_clear(frame);
+            free_frames++;
+        }
+    }
+
+    irq_restore(flags);
+}
+
+uint32_t pmm_free_count() {
+    return free_frames;
+}
+
+uint32_t pmm_total_count() {
+    return total_frames;
+}
+
+uint32_t pmm_memory_top() {
+    return memory_top;
+}
@@ -0,0 +1,23 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+#define PAGE_SIZE 4096
+
+// Only memory below this limit is managed so every frame stays reachable
+// through the kernel identity map.
+#define PMM_MAX_MEMORY 0x40000000
+#define PMM_MAX_FRAMES (PMM_MAX_MEMORY / PAGE_SIZE)
+
+void pmm_init(multiboot_info_t *mbi);
+uint32_t pmm_alloc_frame();
+uint32_t pmm_alloc_frames(uint32_t count);
+void pmm_free_frame(uint32_t addr);
+void pmm_free_frames(uint32_t addr, uint32_t count);
+uint32_t pmm_free_count();
+uint32_t pmm_total_count();
+uint32_t pmm_memory_top();
+
+#endif
@@ -0,0 +1,132 @@
+#include "rcu.h"
+#include "cpu.h"
+#include <stddef.h>
+
+typedef struct {
+    volatile uint32_t read_depth;
+    rcu_head_t *cb_head;
+    rcu_head_t *cb_tail;
+} __attribute__((aligned(64))) rcu_cpu_t;
+
+static rcu_cpu_t rcu_cpus[MAX_CPUS];
+static uint32_t rcu_online_mask = 1;
+
+// gp_started == gp_completed means no grace period is running
+static volatile uint32_t gp_started = 0;
+static volatile uint32_t gp_completed = 0;
+// Highest grace period anyone is waiting for
+static uint32_t gp_requested = 0;
+static volatile uint32_t gp_pending_mask = 0;
+static spinlock_t rcu_gp_lock;
+
+void rcu_init() {
+    spin_init(&rcu_gp_lock, "rcu_gp");
+}
+
+void rcu_read_lock() {
+    rcu_cpus[cpu_id()].read_depth++;
+    barrier();
+}
+
+void rcu_read_unlock() {
+    barrier();
+    rcu_cpus[cpu_id()].read_depth--;
+}
+
+// Caller holds rcu_gp_lock
+static void rcu_start_gp() {
+    if (gp_started == gp_completed) {
+        gp_started++;
+        gp_pending_mask = rcu_online_mask;
+    }
+}
+
+// Ask for grace period gp to complete, starting one now if none is
+// running; otherwise the running one starts the next as it completes.
+// Returns gp. Caller holds rcu_gp_lock.
+static uint32_t rcu_request_gp(uint32_t gp) {
+    if ((int32_t)(gp - gp_requested) > 0) {
+        gp_requested = gp;
+    }
+    rcu_start_gp();
+    return gp;
+}
+
+static void rcu_run_callbacks(rcu_cpu_t *rc) {
+    uint32_t flags = irq_save();
+    uint32_t completed = gp_completed;
+
+    while (rc->cb_head != NULL && (int32_t)(completed - rc->cb_head->gp) >= 0) {
+        rcu_head_t *head = rc->cb_head;
+        rc->cb_head = head->next;
+        if (rc->cb_head == NULL) {
+            rc->cb_tail = NULL;
+        }
+        irq_restore(flags);
+        head->func(head);
+        flags = irq_save();
+    }
+    irq_restore(flags);
+}
+
+// Report that this CPU holds no references obtained in earlier read
+// sections. Called from the idle loop.
+void rcu_quiescent_state() {
+    uint32_t cpu = cpu_id();
+    rcu_cpu_t *rc = &rcu_cpus[cpu];
+
+    if (rc->read_depth != 0) {
+        return;
+    }
+
+    if (gp_pending_mask & (1u << cpu)) {
+        uint32_t flags = spin_lock_irqsave(&rcu_gp_lock);
+        gp_pending_mask &= ~(1u << cpu);
+        if (gp_pending_mask == 0 && gp_started != gp_completed) {
+            gp_completed = gp_started;
+            // Requests made during this grace period need another one
+            if ((int32_t)(gp_requested - gp_completed) > 0) {
+                rcu_start_gp();
+            }
+        }
+        spin_unlock_irqrestore(&rcu_gp_lock, flags);
+    }
+
+    rcu_run_callbacks(rc);
+}
+
+// Queue func to run once every CPU has passed a quiescent state
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head)) {
+    rcu_cpu_t *rc = &rcu_cpus[cpu_id()];
+    uint32_t flags = spin_lock_irqsave(&rcu_gp_lock);
+
+    head->func = func;
+    head->next = NULL;
+    head->gp = gp_started + 1;
+    if (rc->cb_tail != NULL) {
+        rc->cb_tail->next = head;
+    } else {
+        rc->cb_head = head;
+    }
+    rc->cb_tail = head;
+    rcu_request_gp(head->gp);
+
+    spin_unlock_irqrestore(&rcu_gp_lock, flags);
+}
+
+// Wait for a full grace period. Not callable from interrupt context or
+// inside a read-side section.
+void synchronize_rcu() {
+    uint32_t flags = spin_lock_irqsave(&rcu_gp_lock);
+    uint32_t target = rcu_request_gp(gp_started + 1);
+    spin_unlock_irqrestore(&rcu_gp_lock, flags);
+
+    while ((int32_t)(gp_completed - target) < 0) {
+        rcu_quiescent_state();
+        cpu_relax();
+    }
+}
+
+uint32_t rcu_completed_gps() {
+    return gp_completed;
+}
@@ -0,0 +1,33 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+// Read-copy-update for read-mostly data. Readers run without locks or
+// atomics; a CPU passes a quiescent state whenever it goes through the
+// idle loop (rcu_quiescent_state), which cannot happen inside a read-side
+// section because the kernel is not preemptible.
+
+typedef struct rcu_head {
+    struct rcu_head *next;
+    uint32_t gp;
+    void (*func)(struct rcu_head *head);
+} rcu_head_t;
+
+#define rcu_dereference(p) (*(__typeof__(p) volatile *)&(p))
+
+#define rcu_assign_pointer(p, v) do { \
+        barrier(); \
+        *(__typeof__(p) volatile *)&(p) = (v); \
+    } while (0)
+
+void rcu_init();
+void rcu_read_lock();
+void rcu_read_unlock();
+void rcu_quiescent_state();
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head));
+void synchronize_rcu();
+uint32_t rcu_completed_gps();
+
+#endif
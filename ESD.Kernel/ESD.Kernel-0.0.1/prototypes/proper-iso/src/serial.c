@@ -0,0 +1,35 @@
+#include "serial.h"
+#include "simple_kernel.h"
+
+// Polled 16550 on COM1, 115200 8N1. No locks and no interrupts so it can
+// be used from the panic path.
+void serial_init() {
+    outb(COM1_PORT + 1, 0x00);    // Disable interrupts
+    outb(COM1_PORT + 3, 0x80);    // DLAB on
+    outb(COM1_PORT + 0, 0x01);    // Divisor 1 = 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + 3, 0x03);    // 8N1, DLAB off
+    outb(COM1_PORT + 2, 0xC7);    // FIFO on, cleared, 14 byte threshold
+    outb(COM1_PORT + 4, 0x03);    // DTR + RTS
+}
+
+void serial_putc(char c) {
+    while (!(inb(COM1_PORT + 5) & 0x20));
+    outb(COM1_PORT, c);
+}
+
+void serial_write(const void *buf, size_t len) {
+    const char *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        serial_putc(p[i]);
+    }
+}
+
+void serial_print(const char *str) {
+    while (*str) {
+        if (*str == '\n') {
+            serial_putc('\r');
+        }
+        serial_putc(*str++);
+    }
+}
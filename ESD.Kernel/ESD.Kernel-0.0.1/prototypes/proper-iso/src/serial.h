@@ -0,0 +1,13 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stddef.h>
+
+#define COM1_PORT 0x3F8
+
+void serial_init();
+void serial_putc(char c);
+void serial_write(const void *buf, size_t len);
+void serial_print(const char *str);
+
+#endif
@@ -0,0 +1,607 @@
+#include "shell.h"
+#include "keyboard.h"
+#include "simple_kernel.h"
+#include "mem.h"
+#include "pmm.h"
+#include "paging.h"
+#include "zero_pool.h"
+#include "cpu.h"
+#include "isr.h"
+#include "msi.h"
+#include "timer.h"
+#include "trace.h"
+#include "spinlock.h"
+#include "pci.h"
+#include "bcache.h"
+#include "vfs.h"
+#include "fbcon.h"
+#include "wm.h"
+#include "netdev.h"
+#include "virtio_net.h"
+#include "net.h"
+#include "netbench.h"
+#include "socket.h"
+#include <stddef.h>
+
+#define PROMPT "\033[95m> \033[0m"
+
+#define BENCH_BYTES  (64 * 1024)
+#define BENCH_ROUNDS 16
+
+typedef struct {
+    const char *name;
+    const char *help;
+    void (*fn)(int argc, char **argv);
+} shell_cmd_t;
+
+static struct {
+    char line[SHELL_LINE_MAX + 1];
+    int len;
+    int pos;
+    char history[SHELL_HISTORY][SHELL_LINE_MAX + 1];
+    int history_count;                  // total lines ever entered
+    int browse;                         // history_count when not browsing
+} sh;
+
+static void cmd_help(int argc, char **argv);
+
+static void print_padded(uint32_t val, int width) {
+    char buf[11];
+    int i = 10;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    for (int pad = width - (10 - i); pad > 0; pad--) {
+        k_put_char(' ');
+    }
+    k_print_string(&buf[i]);
+}
+
+static void cmd_mem(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    uint32_t total = pmm_total_count();
+    uint32_t free = pmm_free_count();
+
+    k_print_string("frames: ");
+    k_print_dec(total - free);
+    k_print_string(" used, ");
+    k_print_dec(free);
+    k_print_string(" free of ");
+    k_print_dec(total);
+    k_print_string(" (");
+    k_print_dec(total * (PAGE_SIZE / 1024));
+    k_print_string(" KB)\nzero pool: ");
+    k_print_dec(zero_pool_count());
+    k_print_string(" pages\nanonymous faults: ");
+    k_print_dec(paging_anon_faults());
+    k_print_string("\nmemcpy/memset: ");
+    k_print_string(mem_impl_name());
+    k_put_char('\n');
+}
+
+static void cmd_irq(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    k_print_string("IRQ   count\n");
+    for (int line = 0; line < 16; line++) {
+        if (irq_count(line) != 0) {
+            print_padded(line, 3);
+            print_padded(irq_count(line), 8);
+            k_put_char('\n');
+        }
+    }
+    for (int vec = DYN_VECTOR_BASE; vec < DYN_VECTOR_BASE + DYN_VECTOR_COUNT; vec++) {
+        if (vector_count(vec) != 0) {
+            k_print_string("vector ");
+            k_print_dec(vec);
+            k_print_string(": ");
+            k_print_dec(vector_count(vec));
+            k_put_char('\n');
+        }
+    }
+}
+
+// There are no threads; the idle loop drives timers and tasklets
+static void cmd_sched(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    uint32_t ticks = timer_ticks();
+
+    k_print_string("uptime: ");
+    k_print_dec(ticks / TIMER_HZ);
+    k_print_string(".");
+    print_padded(ticks % TIMER_HZ, 3);
+    k_print_string(" s, ");
+    k_print_dec(TIMER_HZ);
+    k_print_string(" Hz tick\ntimers pending: ");
+    k_print_dec(timer_pending());
+    k_print_string("\ncpu: ");
+    k_print_dec(cpu_id());
+    k_print_string(", single idle loop (no threads)\n");
+}
+
+static void cmd_trace(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    static const char *names[] = { "?", "irq", "exception", "page fault" };
+    trace_entry_t entries[16];
+    int count = trace_tail(entries, 16);
+
+    for (int i = 0; i < count; i++) {
+        uint16_t ev = entries[i].event;
+        print_padded(i > 0 ? entries[i].tsc_lo - entries[i - 1].tsc_lo : 0, 10);
+        k_print_string(" cpu");
+        k_print_dec(entries[i].cpu);
+        k_put_char(' ');
+        k_print_string(ev < 4 ? names[ev] : names[0]);
+        k_put_char(' ');
+        k_print_hex(entries[i].arg);
+        k_put_char('\n');
+    }
+}
+
+static void bench_report(const char *name, uint64_t cycles) {
+    k_print_string(name);
+    k_print_string(": ");
+    k_print_dec((uint32_t)div_u64(cycles, BENCH_ROUNDS * (BENCH_BYTES / 1024)));
+    k_print_string(" cycles/KB\n");
+}
+
+static void cmd_bench(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    uint32_t frames = 2 * BENCH_BYTES / PAGE_SIZE;
+    uint32_t mem = pmm_alloc_frames(frames);
+    uint8_t *src = (uint8_t *)mem;
+    uint8_t *dst = src + BENCH_BYTES;
+    uint64_t start;
+
+    if (mem == 0) {
+        k_print_string("bench: out of memory\n");
+        return;
+    }
+    k_print_string("64 KB x 16, ");
+    k_print_string(mem_impl_name());
+    k_put_char('\n');
+
+    start = rdtsc();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memset(src, i, BENCH_BYTES);
+    }
+    bench_report("memset", rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memcpy(dst, src, BENCH_BYTES);
+    }
+    bench_report("memcpy", rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memmove(src + 64, src, BENCH_BYTES - 64);
+    }
+    bench_report("memmove", rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        memzero_nt(dst, BENCH_BYTES);
+    }
+    bench_report("memzero_nt", rdtsc() - start);
+
+    pmm_free_frames(mem, frames);
+}
+
+static int ls_entry(void *arg, const char *name, uint32_t len, uint32_t ino, uint16_t type) {
+    (void)arg;
+    (void)ino;
+    k_write(name, len);
+    if (type == VFS_TYPE_DIR) {
+        k_put_char('/');
+    }
+    k_put_char('\n');
+    return 0;
+}
+
+static void cmd_ls(int argc, char **argv) {
+    vfs_file_t *dir = vfs_open(argc > 1 ? argv[1] : "/");
+
+    if (dir == NULL || vfs_file_readdir(dir, ls_entry, NULL) < 0) {
+        k_print_string("ls: cannot list directory\n");
+    }
+    if (dir != NULL) {
+        vfs_close(dir);
+    }
+}
+
+static void cmd_cat(int argc, char **argv) {
+    char buf[256];
+    int n;
+
+    if (argc < 2) {
+        k_print_string("usage: cat <path>\n");
+        return;
+    }
+    vfs_file_t *file = vfs_open(argv[1]);
+    if (file == NULL) {
+        k_print_string("cat: no such file\n");
+        return;
+    }
+    while ((n = vfs_file_read(file, buf, sizeof(buf))) > 0) {
+        k_write(buf, n);
+    }
+    vfs_close(file);
+}
+
+// Demo windows, gone again once the window manager stops
+static wm_window_t *wm_demo[2];
+
+static void cmd_wm(int argc, char **argv) {
+    if (argc < 2) {
+        wm_print_stats();
+    } else if (strcmp(argv[1], "start") == 0) {
+        if (wm_start() != 0) {
+            k_print_string(wm_running() ? "wm: already running\n" : "wm: needs a linear framebuffer\n");
+            return;
+        }
+        wm_demo[0] = wm_create(80, 60, 320, 200, "console");
+        wm_demo[1] = wm_create(240, 160, 360, 240, "stats");
+        if (wm_demo[0] != NULL) {
+            wm_text(wm_demo[0], 8, 28, "drag the title bars", fbcon_color(0x00), fbcon_color(0x07));
+        }
+        if (wm_demo[1] != NULL) {
+            wm_text(wm_demo[1], 8, 28, "type 'wm stop' to return", fbcon_color(0x00), fbcon_color(0x07));
+        }
+    } else if (strcmp(argv[1], "stop") == 0) {
+        wm_stop();
+        for (int i = 0; i < 2; i++) {
+            if (wm_demo[i] != NULL) {
+                wm_destroy(wm_demo[i]);
+                wm_demo[i] = NULL;
+            }
+        }
+    } else {
+        k_print_string("usage: wm [start|stop]\n");
+    }
+}
+
+static void cmd_net(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    netdev_print_stats();
+    virtio_net_print_stats();
+    net_print_stats();
+    sock_print_stats();
+}
+
+static int parse_uint(const char *s, uint32_t *out) {
+    uint32_t v = 0;
+
+    if (*s == '\0') {
+        return -1;
+    }
+    for (; *s != '\0'; s++) {
+        if (*s < '0' || *s > '9' || v > 429496729) {
+            return -1;
+        }
+        v = v * 10 + (*s - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+static void cmd_ping(int argc, char **argv) {
+    uint32_t ip;
+    uint32_t count = 4;
+
+    if (argc < 2 || ip_parse(argv[1], &ip) != 0 ||
+        (argc > 2 && parse_uint(argv[2], &count) != 0)) {
+        k_print_string("usage: ping <ip> [count]\n");
+        return;
+    }
+    netbench_ping(ip, count);
+}
+
+// Defaults aim at an echo server on the host, reached through QEMU's
+// user-mode gateway
+static void cmd_netbench(int argc, char **argv) {
+    uint32_t ip = NET_DEFAULT_GATEWAY;
+    uint32_t port = NETBENCH_ECHO_PORT;
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    if (argc < 2 || (argc > 2 && ip_parse(argv[2], &ip) != 0) ||
+        (argc > 3 && (parse_uint(argv[3], &port) != 0 || port == 0 || port > 65535)) ||
+        (argc > 4 && parse_uint(argv[4], &a) != 0) ||
+        (argc > 5 && parse_uint(argv[5], &b) != 0)) {
+        argc = 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "udp") == 0) {
+        netbench_udp(ip, port, argc > 4 ? a : 1000, argc > 5 ? b : 64);
+    } else if (argc >= 2 && strcmp(argv[1], "tcp") == 0) {
+        netbench_tcp(ip, port, argc > 4 ? a : 1024);
+    } else if (argc >= 2 && strcmp(argv[1], "conns") == 0) {
+        netbench_conns(ip, port, argc > 4 ? a : 4, argc > 5 ? b : 256);
+    } else {
+        k_print_string("usage: netbench udp [ip] [port] [count] [size]\n"
+                       "       netbench tcp [ip] [port] [KB]\n"
+                       "       netbench conns [ip] [port] [connections] [KB each]\n");
+    }
+}
+
+static void cmd_history(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    int first = sh.history_count > SHELL_HISTORY ? sh.history_count - SHELL_HISTORY : 0;
+
+    for (int i = first; i < sh.history_count; i++) {
+        print_padded(i + 1, 4);
+        k_print_string("  ");
+        k_print_string(sh.history[i % SHELL_HISTORY]);
+        k_put_char('\n');
+    }
+}
+
+static void cmd_clear(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    k_print_string("\033[2J\033[H");
+}
+
+#define SIMPLE_CMD(fn) \
+    static void cmd_##fn(int argc, char **argv) { (void)argc; (void)argv; fn(); }
+
+SIMPLE_CMD(lock_stats_print)
+SIMPLE_CMD(pci_print_devices)
+SIMPLE_CMD(bcache_print_stats)
+SIMPLE_CMD(vfs_print_stats)
+SIMPLE_CMD(fbcon_print_stats)
+SIMPLE_CMD(input_print_stats)
+
+static const shell_cmd_t commands[] = {
+    { "help",    "list commands",                   cmd_help },
+    { "mem",     "physical memory and pools",       cmd_mem },
+    { "irq",     "interrupt counters",              cmd_irq },
+    { "sched",   "uptime, timers and CPU",          cmd_sched },
+    { "trace",   "recent events with TSC deltas",   cmd_trace },
+    { "locks",   "spinlock contention profile",     cmd_lock_stats_print },
+    { "bench",   "memcpy/memset throughput",        cmd_bench },
+    { "pci",     "PCI devices",                     cmd_pci_print_devices },
+    { "bcache",  "block cache statistics",          cmd_bcache_print_stats },
+    { "vfs",     "VFS cache statistics",            cmd_vfs_print_stats },
+    { "fb",      "framebuffer console statistics",  cmd_fbcon_print_stats },
+    { "input",   "input consumers",                 cmd_input_print_stats },
+    { "net",     "network devices and stack",       cmd_net },
+    { "ping",    "ICMP echo <ip> [count]",          cmd_ping },
+    { "netbench", "UDP/TCP echo benchmark",         cmd_netbench },
+    { "ls",      "list a directory",                cmd_ls },
+    { "cat",     "print a file",                    cmd_cat },
+    { "wm",      "window manager [start|stop]",     cmd_wm },
+    { "history", "previous command lines",          cmd_history },
+    { "clear",   "clear the screen",                cmd_clear },
+};
+static const int command_count = sizeof(commands) / sizeof(commands[0]);
+
+static void cmd_help(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    for (int i = 0; i < command_count; i++) {
+        k_print_string("  ");
+        k_print_string(commands[i].name);
+        for (int pad = 10 - (int)strlen(commands[i].name); pad > 0; pad--) {
+            k_put_char(' ');
+        }
+        k_print_string(commands[i].help);
+        k_put_char('\n');
+    }
+}
+
+static void run_line(char *line) {
+    char *argv[SHELL_MAX_ARGS];
+    int argc = 0;
+
+    while (*line != '\0' && argc < SHELL_MAX_ARGS) {
+        while (*line == ' ') {
+            *line++ = '\0';
+        }
+        if (*line == '\0') {
+            break;
+        }
+        argv[argc++] = line;
+        while (*line != '\0' && *line != ' ') {
+            line++;
+        }
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    for (int i = 0; i < command_count; i++) {
+        if (strcmp(argv[0], commands[i].name) == 0) {
+            commands[i].fn(argc, argv);
+            return;
+        }
+    }
+    k_print_string(argv[0]);
+    k_print_string(": unknown command, try help\n");
+}
+
+// Rewrites the current row in one console write
+static void refresh() {
+    char buf[SHELL_LINE_MAX + 32];
+    int n = 0;
+
+    buf[n++] = '\r';
+    memcpy(buf + n, PROMPT, sizeof(PROMPT) - 1);
+    n += sizeof(PROMPT) - 1;
+    memcpy(buf + n, sh.line, sh.len);
+    n += sh.len;
+    memcpy(buf + n, "\033[K", 3);
+    n += 3;
+    if (sh.pos < sh.len) {
+        int back = sh.len - sh.pos;
+        buf[n++] = '\033';
+        buf[n++] = '[';
+        if (back >= 10) {
+            buf[n++] = '0' + back / 10;
+        }
+        buf[n++] = '0' + back % 10;
+        buf[n++] = 'D';
+    }
+    k_write(buf, n);
+}
+
+void shell_redraw() {
+    k_put_char('\n');
+    refresh();
+}
+
+static void set_line(const char *text) {
+    sh.len = strlen(text);
+    memcpy(sh.line, text, sh.len + 1);
+    sh.pos = sh.len;
+}
+
+static void history_browse(int dir) {
+    int oldest = sh.history_count > SHELL_HISTORY ? sh.history_count - SHELL_HISTORY : 0;
+    int next = sh.browse + dir;
+
+    if (next < oldest || next > sh.history_count) {
+        return;
+    }
+    sh.browse = next;
+    set_line(next == sh.history_count ? "" : sh.history[next % SHELL_HISTORY]);
+}
+
+// Completes the command name under the cursor; lists candidates if the
+// prefix is ambiguous
+static void complete() {
+    const char *match = NULL;
+    int matches = 0;
+
+    for (int i = 0; i < sh.pos; i++) {
+        if (sh.line[i] == ' ') {
+            return;
+        }
+    }
+    for (int i = 0; i < command_count; i++) {
+        if (strncmp(commands[i].name, sh.line, sh.pos) == 0) {
+            match = commands[i].name;
+            matches++;
+        }
+    }
+
+    if (matches == 1) {
+        int add = strlen(match) - sh.pos;
+        if (sh.len + add + 1 > SHELL_LINE_MAX) {
+            return;
+        }
+        memmove(sh.line + sh.pos + add + 1, sh.line + sh.pos, sh.len - sh.pos + 1);
+        memcpy(sh.line + sh.pos, match + sh.pos, add);
+        sh.line[sh.pos + add] = ' ';
+        sh.len += add + 1;
+        sh.pos += add + 1;
+    } else if (matches > 1) {
+        k_put_char('\n');
+        for (int i = 0; i < command_count; i++) {
+            if (strncmp(commands[i].name, sh.line, sh.pos) == 0) {
+                k_print_string(commands[i].name);
+                k_print_string("  ");
+            }
+        }
+        k_put_char('\n');
+    }
+}
+
+static void submit() {
+    k_put_char('\n');
+    if (sh.len > 0) {
+        memcpy(sh.history[sh.history_count % SHELL_HISTORY], sh.line, sh.len + 1);
+        sh.history_count++;
+        run_line(sh.line);
+    }
+    sh.len = sh.pos = 0;
+    sh.line[0] = '\0';
+    sh.browse = sh.history_count;
+    refresh();
+}
+
+void shell_key(const input_event_t *ev) {
+    if (ev->type != INPUT_KEY || ev->value == INPUT_RELEASE) {
+        return;
+    }
+
+    char c = keyboard_to_ascii(ev->code, ev->mods);
+
+    switch (ev->code) {
+    case KEY_LEFT:
+        if (sh.pos > 0) {
+            sh.pos--;
+        }
+        break;
+    case KEY_RIGHT:
+        if (sh.pos < sh.len) {
+            sh.pos++;
+        }
+        break;
+    case KEY_HOME:
+        sh.pos = 0;
+        break;
+    case KEY_END:
+        sh.pos = sh.len;
+        break;
+    case KEY_UP:
+        history_browse(-1);
+        break;
+    case KEY_DOWN:
+        history_browse(1);
+        break;
+    case KEY_DELETE:
+        if (sh.pos < sh.len) {
+            memmove(sh.line + sh.pos, sh.line + sh.pos + 1, sh.len - sh.pos);
+            sh.len--;
+        }
+        break;
+    default:
+        if (c == '\n') {
+            submit();
+            return;
+        } else if (c == '\b') {
+            if (sh.pos > 0) {
+                memmove(sh.line + sh.pos - 1, sh.line + sh.pos, sh.len - sh.pos + 1);
+                sh.pos--;
+                sh.len--;
+            }
+        } else if (c == '\t') {
+            complete();
+        } else if (c == 3) {
+            // Ctrl+C drops the line
+            k_print_string("^C\n");
+            sh.len = sh.pos = 0;
+            sh.line[0] = '\0';
+            sh.browse = sh.history_count;
+        } else if (c == 12) {
+            // Ctrl+L
+            k_print_string("\033[2J\033[H");
+        } else if (c >= ' ' && c < 0x7F && sh.len < SHELL_LINE_MAX) {
+            memmove(sh.line + sh.pos + 1, sh.line + sh.pos, sh.len - sh.pos + 1);
+            sh.line[sh.pos++] = c;
+            sh.len++;
+        } else {
+            return;
+        }
+        break;
+    }
+    refresh();
+}
+
+void shell_init() {
+    sh.len = sh.pos = 0;
+    sh.line[0] = '\0';
+    sh.history_count = 0;
+    sh.browse = 0;
+    refresh();
+}
@@ -0,0 +1,16 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include "input.h"
+
+#define SHELL_LINE_MAX 76               // one 80-column row with the prompt
+#define SHELL_HISTORY  16
+#define SHELL_MAX_ARGS 8
+
+void shell_init();
+void shell_key(const input_event_t *ev);
+
+// Prints the prompt and the line being edited on a fresh row
+void shell_redraw();
+
+#endif
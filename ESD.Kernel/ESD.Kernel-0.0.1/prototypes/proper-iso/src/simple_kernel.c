@@ -2,19 +2,73 @@
 #include "idt.h"
 #include "isr.h"
 #include "keyboard.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "mem.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "paging.h"
+#include "zero_pool.h"
+#include "serial.h"
+#include "spinlock.h"
+#include "rcu.h"
+#include "acpi.h"
+#include "pci.h"
+#include "apic.h"
+#include "timer.h"
+#include "ata.h"
+#include "tasklet.h"
+#include "virtio_blk.h"
+#include "virtio_net.h"
+#include "net.h"
+#include "netbench.h"
+#include "bcache.h"
+#include "vfs.h"
+#include "initrd.h"
+#include "fbcon.h"
+#include "memtype.h"
+#include "wm.h"
+#include "input.h"
+#include "mouse.h"
+#include "term.h"
+#include "shell.h"
 
 unsigned char *vidmem = (unsigned char *)0xb8000;
 unsigned char current_attr = DEFAULT_ATTR;
 int cursor_x = 0;
 int cursor_y = 0;
 
-#define KEY_BACKSPACE 0x0E
-#define KEY_CTRL      0x1D
-#define KEY_LEFT_ALT  0x38
-#define KEY_ENTER     0x1C
-#define KEY_SPACE     0x39
+// Text grid size; larger when the framebuffer console is in use
+int console_width = VGA_WIDTH;
+int console_height = VGA_HEIGHT;
 
+// Guards vidmem, the cursor and current_attr against interrupt context
+spinlock_t console_lock;
+
+// Keyboard events for the console
+static input_consumer_t console_input;
+
+// F1.. dump kernel statistics
+static void (*const debug_keys[])() = {
+    lock_stats_print,
+    pci_print_devices,
+    bcache_print_stats,
+    vfs_print_stats,
+    fbcon_print_stats,
+    wm_print_stats,
+    input_print_stats,
+    mouse_print_stats,
+};
+#define DEBUG_KEY_COUNT (sizeof(debug_keys) / sizeof(debug_keys[0]))
+
+// Also pushes pending framebuffer console updates to the screen
 void k_update_cursor(int x, int y) {
+    if (fbcon_active()) {
+        fbcon_set_cursor(x, y);
+        fbcon_flush();
+        return;
+    }
+
     unsigned short pos = y * VGA_WIDTH + x;
     outb(0x3D4, 0x0F);
     outb(0x3D5, (unsigned char)(pos & 0xFF));
@@ -22,173 +76,206 @@ void k_update_cursor(int x, int y) {
     outb(0x3D5, (unsigned char)((pos >> 8) & 0xFF));
 }
 
+// Caller holds console_lock
 void k_scroll() {
-    for (int y = 1; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            int offset_src = (y * VGA_WIDTH + x) * 2;
-            int offset_dst = ((y - 1) * VGA_WIDTH + x) * 2;
-            vidmem[offset_dst] = vidmem[offset_src];
-            vidmem[offset_dst + 1] = vidmem[offset_src + 1];
-        }
+    if (fbcon_active()) {
+        fbcon_scroll(current_attr);
+        cursor_y = console_height - 1;
+        return;
     }
 
+    memmove(vidmem, vidmem + VGA_WIDTH * 2, (VGA_HEIGHT - 1) * VGA_WIDTH * 2);
+
     int offset_last_line = ((VGA_HEIGHT - 1) * VGA_WIDTH) * 2;
-    for (int x = 0; x < VGA_WIDTH; x++) {
-        vidmem[offset_last_line + x * 2] = ' ';
-        vidmem[offset_last_line + x * 2 + 1] = current_attr;
-    }
+    memset16(vidmem + offset_last_line, (current_attr << 8) | ' ', VGA_WIDTH);
     cursor_y = VGA_HEIGHT - 1; 
-    k_update_cursor(cursor_x, cursor_y);
 }
 
 void k_clear_screen() {
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            int offset = (y * VGA_WIDTH + x) * 2;
-            vidmem[offset] = ' ';
-            vidmem[offset + 1] = DEFAULT_ATTR;
-        }
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    if (fbcon_active()) {
+        fbcon_clear(DEFAULT_ATTR);
+    } else {
+        memset16(vidmem, (DEFAULT_ATTR << 8) | ' ', VGA_WIDTH * VGA_HEIGHT);
     }
     cursor_x = 0;
     cursor_y = 0;
     k_update_cursor(cursor_x, cursor_y);
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
-void k_put_char(char c) {
+// Caller holds console_lock
+void console_set_cell(int x, int y, char c, unsigned char attr) {
+    if (fbcon_active()) {
+        fbcon_put_cell(x, y, c, attr);
+        return;
+    }
+
+    int offset = (y * VGA_WIDTH + x) * 2;
+    vidmem[offset] = c;
+    vidmem[offset + 1] = attr;
+}
+
+// Caller holds console_lock and updates the hardware cursor afterwards
+void console_put_char(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
     } else if (c >= ' ') {
-        int offset = (cursor_y * VGA_WIDTH + cursor_x) * 2;
-        vidmem[offset] = c;
-        vidmem[offset + 1] = current_attr;
+        console_set_cell(cursor_x, cursor_y, c, current_attr);
         cursor_x++;
     }
 
-    if (cursor_x >= VGA_WIDTH) {
+    if (cursor_x >= console_width) {
         cursor_x = 0;
         cursor_y++;
     }
 
-    if (cursor_y >= VGA_HEIGHT) {
+    if (cursor_y >= console_height) {
         k_scroll();
     }
+}
+
+// A whole buffer goes through the terminal parser under one lock hold
+// and reaches the screen with a single cursor update and flush
+void k_write(const char *buf, uint32_t len) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    term_feed(buf, len);
     k_update_cursor(cursor_x, cursor_y);
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
-void k_print_string(const char *str) {
-    int i = 0;
-    while (str[i] != '\0') {
-        k_put_char(str[i]);
-        i++;
-    }
+void k_put_char(char c) {
+    k_write(&c, 1);
 }
 
-void k_set_text_attr(unsigned char attr) {
-    current_attr = attr;
+void k_print_string(const char *str) {
+    k_write(str, strlen(str));
 }
 
-char scancode_to_char(unsigned char scancode) {
-    if (scancode == KEY_BACKSPACE) return '\b';
-    if (scancode == KEY_CTRL) return 0;
-    if (scancode == KEY_LEFT_ALT) return 0;
-    
-    if (scancode == 0x1E) return 'a';
-    if (scancode == 0x30) return 'b';
-    if (scancode == 0x2E) return 'c';
-    if (scancode == 0x20) return 'd';
-    if (scancode == 0x12) return 'e';
-    if (scancode == 0x21) return 'f';
-    if (scancode == 0x22) return 'g';
-    if (scancode == 0x23) return 'h';
-    if (scancode == 0x17) return 'i';
-    if (scancode == 0x24) return 'j';
-    if (scancode == 0x25) return 'k';
-    if (scancode == 0x26) return 'l';
-    if (scancode == 0x32) return 'm';
-    if (scancode == 0x31) return 'n';
-    if (scancode == 0x18) return 'o';
-    if (scancode == 0x19) return 'p';
-    if (scancode == 0x10) return 'q';
-    if (scancode == 0x13) return 'r';
-    if (scancode == 0x1F) return 's';
-    if (scancode == 0x14) return 't';
-    if (scancode == 0x16) return 'u';
-    if (scancode == 0x2F) return 'v';
-    if (scancode == 0x11) return 'w';
-    if (scancode == 0x2D) return 'x';
-    if (scancode == 0x15) return 'y';
-    if (scancode == 0x2C) return 'z';
-    if (scancode == KEY_SPACE) return ' ';
-    if (scancode == KEY_ENTER) return '\n';
-    return 0;
+void k_print_dec(uint32_t val) {
+    char buf[11];
+    int i = 10;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    k_print_string(&buf[i]);
 }
 
-void handle_backspace() {
-    if (cursor_x > 2) {
-        cursor_x--;
-        
-        int offset = (cursor_y * VGA_WIDTH + cursor_x) * 2;
-        vidmem[offset] = ' ';
-        
-        k_update_cursor(cursor_x, cursor_y);
+void k_print_hex(uint32_t val) {
+    char buf[11];
+
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        uint32_t nibble = (val >> (28 - i * 4)) & 0xF;
+        buf[2 + i] = nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
     }
+    buf[10] = '\0';
+    k_print_string(buf);
+}
+
+void k_set_text_attr(unsigned char attr) {
+    term_set_attr(attr);
 }
 
+// F-keys dump statistics; everything else goes to the shell
 void poll_keyboard() {
-    if (inb(0x64) & 1) {
-        unsigned char scancode = inb(0x60);
-        
-        if (!(scancode & 0x80)) {
-            char c = scancode_to_char(scancode);
-            
-            if (c == '\b') {
-                handle_backspace();
-            } else if (c) {
-                k_put_char(c);
-            } else if (scancode != KEY_CTRL && scancode != KEY_LEFT_ALT) {
-                k_print_string("0x");
-                char hex[3];
-                hex[0] = ((scancode >> 4) & 0xF) + (((scancode >> 4) & 0xF) < 10 ? '0' : 'A' - 10);
-                hex[1] = (scancode & 0xF) + ((scancode & 0xF) < 10 ? '0' : 'A' - 10);
-                hex[2] = '\0';
-                k_print_string(hex);
-                k_print_string(" ");
-            }
+    input_event_t events[16];
+    int count = input_read(&console_input, events, 16);
+
+    for (int i = 0; i < count; i++) {
+        uint8_t code = events[i].code;
+
+        if (events[i].value == INPUT_PRESS && code >= KEY_F1 && code < KEY_F1 + DEBUG_KEY_COUNT) {
+            k_put_char('\n');
+            debug_keys[code - KEY_F1]();
+            shell_redraw();
+        } else {
+            shell_key(&events[i]);
         }
     }
 }
 
 void display_watermark() {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
     unsigned char prev_attr = current_attr;
     
     int orig_x = cursor_x;
     int orig_y = cursor_y;
     
     const char* version = "ESD.OS Kernel v0.0.1 (03-keyboard-input)";
-    int version_len = 0;
-    while(version[version_len] != '\0') version_len++;
+    int version_len = strlen(version);
     
-    cursor_x = VGA_WIDTH - version_len - 1;
-    cursor_y = VGA_HEIGHT - 1;
+    cursor_x = console_width - version_len - 1;
+    cursor_y = console_height - 1;
     
-    k_set_text_attr(0x1B);
+    current_attr = 0x1B;
     
-    k_print_string(version);
+    for (int i = 0; i < version_len; i++) {
+        console_put_char(version[i]);
+    }
     
     cursor_x = orig_x;
     cursor_y = orig_y;
-    k_set_text_attr(prev_attr);
+    current_attr = prev_attr;
     
     k_update_cursor(cursor_x, cursor_y);
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Work done while waiting for input. Pre-zeroing one page per pass keeps
+// the keyboard poll latency low. The idle loop holds no RCU references,
+// so every pass is a quiescent state.
+void k_idle() {
+    poll_keyboard();
+    zero_pool_refill(1);
+    tasklet_run();
+    rcu_quiescent_state();
 }
 
-void k_main() {
+void k_main(uint32_t magic, multiboot_info_t *mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        mbi = NULL;
+    }
+    
     // Initialize core components
+    spin_init(&console_lock, "console");
+    serial_init();
+    rcu_init();
     idt_init();
     isr_init_gates();
     pic_remap(0x20, 0x28);
     pic_mask_all();
+    cpu_detect();
+    fpu_init();
+    mem_init();
+    pmm_init(mbi);
+    paging_init();
+    memtype_init();
+    memtype_set((uint32_t)vidmem, 0x8000, MEMTYPE_WC);
+    if (fbcon_init(mbi) == 0) {
+        console_width = fbcon_cols();
+        console_height = fbcon_rows();
+    }
+    acpi_init();
+    lapic_init();
+    pci_init();
+    timer_init();
+    input_register(&console_input, "console", INPUT_MASK(INPUT_KEY));
+    keyboard_install();
+    mouse_init();
+    asm volatile ( "sti" );
+    ata_init();
+    virtio_blk_init();
+    virtio_net_init();
+    net_init();
+    netbench_init();
+    bcache_init();
+    vfs_init();
     
     k_clear_screen();
     
@@ -202,14 +289,14 @@ void k_main() {
     k_print_string("OOGA BOOGA! TYPE SOMETHING, MONKE!\n");
     k_print_string("===========================\n\n");
     
-    k_set_text_attr(0x0D);
-    k_print_string("> ");
-    
     k_set_text_attr(DEFAULT_ATTR);
+    vfs_mount_all();
+    initrd_init(mbi);
     
+    shell_init();
     display_watermark();
     
     for (;;) {
-        poll_keyboard();
+        k_idle();
     }
 }
@@ -7,8 +7,11 @@ void k_update_cursor(int x, int y);
 void k_scroll();
 void k_clear_screen();
 void k_put_char(char c);
+void k_write(const char *buf, uint32_t len);
 void k_print_string(const char *str);
 void k_set_text_attr(unsigned char attr);
+void k_print_dec(uint32_t val);
+void k_print_hex(uint32_t val);
 
 static inline void outb(unsigned short port, unsigned char val) {
     asm volatile ( "outb %0, %1" : : "a"(val), "Nd"(port) );
@@ -20,6 +23,26 @@ static inline unsigned char inb(unsigned short port) {
     return ret;
 }
 
+static inline void outw(unsigned short port, unsigned short val) {
+    asm volatile ( "outw %0, %1" : : "a"(val), "Nd"(port) );
+}
+
+static inline unsigned short inw(unsigned short port) {
+    unsigned short ret;
+    asm volatile ( "inw %1, %0" : "=a"(ret) : "Nd"(port) );
+    return ret;
+}
+
+static inline void outl(unsigned short port, uint32_t val) {
+    asm volatile ( "outl %0, %1" : : "a"(val), "Nd"(port) );
+}
+
+static inline uint32_t inl(unsigned short port) {
+    uint32_t ret;
+    asm volatile ( "inl %1, %0" : "=a"(ret) : "Nd"(port) );
+    return ret;
+}
+
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 #define DEFAULT_ATTR 0x0F
@@ -0,0 +1,558 @@
+#include "socket.h"
+#include "timer.h"
+#include "mem.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static sock_t sockets[SOCK_MAX];
+static ep_t eps[EP_MAX];
+static ep_watch_t ep_watches[EP_WATCH_MAX];
+static ep_watch_t *watch_free = NULL;
+static int watches_ready = 0;
+
+static sock_t *sock_get(int sd) {
+    if (sd < 0 || sd >= SOCK_MAX || !sockets[sd].used) {
+        return NULL;
+    }
+    return &sockets[sd];
+}
+
+static ep_t *ep_get(int epd) {
+    if (epd < 0 || epd >= EP_MAX || !eps[epd].used) {
+        return NULL;
+    }
+    return &eps[epd];
+}
+
+static uint32_t sock_state(sock_t *s) {
+    if (s->type == SOCK_STREAM) {
+        return s->tcp->state == TCP_CLOSED && !s->tcp->error ? 0 : tcp_poll(s->tcp);
+    }
+    return udp_poll(s->udp);
+}
+
+static void ep_queue(ep_watch_t *w) {
+    ep_t *ep = w->ep;
+
+    if (w->queued || w->disabled) {
+        return;
+    }
+    w->queued = 1;
+    w->ready_next = NULL;
+    if (ep->ready_tail != NULL) {
+        ep->ready_tail->ready_next = w;
+    } else {
+        ep->ready_head = w;
+    }
+    ep->ready_tail = w;
+    ep->wakeups++;
+}
+
+static void ep_unqueue(ep_watch_t *w) {
+    ep_t *ep = w->ep;
+    ep_watch_t *prev = NULL;
+
+    if (!w->queued) {
+        return;
+    }
+    for (ep_watch_t *it = ep->ready_head; it != NULL; prev = it, it = it->ready_next) {
+        if (it == w) {
+            if (prev != NULL) {
+                prev->ready_next = w->ready_next;
+            } else {
+                ep->ready_head = w->ready_next;
+            }
+            if (ep->ready_tail == w) {
+                ep->ready_tail = prev;
+            }
+            break;
+        }
+    }
+    w->queued = 0;
+}
+
+// Called by the protocols as state changes. Only the watches on this
+// socket are touched, so the cost of a wakeup does not depend on how many
+// sockets are being watched.
+static void sock_event(sock_t *s, uint32_t events) {
+    for (ep_watch_t *w = s->watches; w != NULL; w = w->sock_next) {
+        if (events & (w->interest | EP_HUP | EP_ERR)) {
+            ep_queue(w);
+        }
+    }
+}
+
+static void sock_udp_event(udp_pcb_t *pcb, uint32_t events, void *arg) {
+    (void)pcb;
+    sock_event(arg, events);
+}
+
+static void sock_tcp_event(tcp_pcb_t *pcb, uint32_t events, void *arg) {
+    (void)pcb;
+    sock_event(arg, events);
+}
+
+static int sock_alloc() {
+    for (int sd = 0; sd < SOCK_MAX; sd++) {
+        if (!sockets[sd].used) {
+            memset(&sockets[sd], 0, sizeof(sockets[sd]));
+            sockets[sd].used = 1;
+            return sd;
+        }
+    }
+    return NET_ERR;
+}
+
+int sock_socket(int type) {
+    uint32_t irq = net_enter();
+    int sd = sock_alloc();
+
+    if (sd < 0) {
+        net_leave(irq);
+        return NET_ERR;
+    }
+    sock_t *s = &sockets[sd];
+    s->type = type;
+    if (type == SOCK_STREAM && (s->tcp = tcp_new()) != NULL) {
+        tcp_set_event(s->tcp, sock_tcp_event, s);
+    } else if (type == SOCK_DGRAM && (s->udp = udp_new()) != NULL) {
+        udp_set_event(s->udp, sock_udp_event, s);
+    } else {
+        s->used = 0;
+        sd = NET_ERR;
+    }
+
+    net_leave(irq);
+    return sd;
+}
+
+int sock_set_nonblock(int sd, int on) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    s->nonblock = on;
+    return 0;
+}
+
+int sock_bind(int sd, uint16_t port) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    return s->type == SOCK_STREAM ? tcp_bind(s->tcp, port) : udp_bind(s->udp, port);
+}
+
+int sock_listen(int sd, int backlog) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL || s->type != SOCK_STREAM) {
+        return NET_ERR;
+    }
+    return tcp_listen(s->tcp, backlog);
+}
+
+static int sock_readable(void *ctx) {
+    return (sock_state(ctx) & (EP_IN | EP_HUP | EP_ERR)) != 0;
+}
+
+static int sock_writable(void *ctx) {
+    return (sock_state(ctx) & (EP_OUT | EP_HUP | EP_ERR)) != 0;
+}
+
+int sock_accept(int sd, uint32_t *ip, uint16_t *port) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL || s->type != SOCK_STREAM || s->tcp->state != TCP_LISTEN) {
+        return NET_ERR;
+    }
+    for (;;) {
+        uint32_t irq = net_enter();
+        tcp_pcb_t *pcb = tcp_accept(s->tcp);
+        if (pcb != NULL) {
+            int child = sock_alloc();
+            if (child < 0) {
+                tcp_abort(pcb);
+                net_leave(irq);
+                return NET_ERR;
+            }
+            sock_t *c = &sockets[child];
+            c->type = SOCK_STREAM;
+            c->tcp = pcb;
+            tcp_set_event(pcb, sock_tcp_event, c);
+            if (ip != NULL) {
+                *ip = pcb->remote_ip;
+            }
+            if (port != NULL) {
+                *port = pcb->remote_port;
+            }
+            net_leave(irq);
+            return child;
+        }
+        net_leave(irq);
+        if (s->nonblock) {
+            return NET_AGAIN;
+        }
+        net_wait(sock_readable, s, NET_WAIT_FOREVER);
+    }
+}
+
+int sock_connect(int sd, uint32_t ip, uint16_t port) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    if (s->type == SOCK_DGRAM) {
+        s->peer_ip = ip;
+        s->peer_port = port;
+        return 0;
+    }
+    if (tcp_connect(s->tcp, ip, port) != 0) {
+        return NET_ERR;
+    }
+    if (s->nonblock) {
+        return NET_AGAIN;
+    }
+    net_wait(sock_writable, s, NET_WAIT_FOREVER);
+    return s->tcp->error ? NET_ERR : 0;
+}
+
+// A blocking stream send returns once everything is queued; a
+// non-blocking one queues what fits
+int sock_send(int sd, const void *buf, uint32_t len) {
+    sock_t *s = sock_get(sd);
+    const uint8_t *src = buf;
+    uint32_t done = 0;
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    if (s->type == SOCK_DGRAM) {
+        if (s->peer_port == 0) {
+            return NET_ERR;
+        }
+        return udp_sendto(s->udp, buf, len, s->peer_ip, s->peer_port);
+    }
+    while (done < len) {
+        int n = tcp_write(s->tcp, src + done, len - done);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n != NET_AGAIN || s->nonblock) {
+            return done > 0 ? (int)done : n;
+        }
+        net_wait(sock_writable, s, NET_WAIT_FOREVER);
+    }
+    return done;
+}
+
+int sock_recv(int sd, void *buf, uint32_t len) {
+    return sock_recvfrom(sd, buf, len, NULL, NULL);
+}
+
+int sock_sendto(int sd, const void *buf, uint32_t len, uint32_t ip, uint16_t port) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL || s->type != SOCK_DGRAM) {
+        return NET_ERR;
+    }
+    return udp_sendto(s->udp, buf, len, ip, port);
+}
+
+int sock_recvfrom(int sd, void *buf, uint32_t len, uint32_t *ip, uint16_t *port) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    for (;;) {
+        int n;
+        if (s->type == SOCK_STREAM) {
+            n = tcp_read(s->tcp, buf, len);
+            if (ip != NULL) {
+                *ip = s->tcp->remote_ip;
+            }
+            if (port != NULL) {
+                *port = s->tcp->remote_port;
+            }
+        } else {
+            n = udp_recvfrom(s->udp, buf, len, ip, port);
+        }
+        if (n != NET_AGAIN || s->nonblock) {
+            return n;
+        }
+        net_wait(sock_readable, s, NET_WAIT_FOREVER);
+    }
+}
+
+uint32_t sock_poll(int sd) {
+    sock_t *s = sock_get(sd);
+
+    return s != NULL ? sock_state(s) : EP_ERR;
+}
+
+static void watch_release(ep_watch_t *w) {
+    ep_unqueue(w);
+    w->ep->watches--;
+    w->ep = NULL;
+    w->sock_next = watch_free;
+    watch_free = w;
+}
+
+int sock_close(int sd) {
+    sock_t *s = sock_get(sd);
+
+    if (s == NULL) {
+        return NET_ERR;
+    }
+    uint32_t irq = net_enter();
+    while (s->watches != NULL) {
+        ep_watch_t *w = s->watches;
+        s->watches = w->sock_next;
+        watch_release(w);
+    }
+    if (s->type == SOCK_STREAM) {
+        tcp_close(s->tcp);
+    } else {
+        udp_close(s->udp);
+    }
+    s->used = 0;
+    net_leave(irq);
+    return 0;
+}
+
+int ep_create() {
+    uint32_t irq = net_enter();
+
+    for (int epd = 0; epd < EP_MAX; epd++) {
+        if (!eps[epd].used) {
+            memset(&eps[epd], 0, sizeof(eps[epd]));
+            eps[epd].used = 1;
+            net_leave(irq);
+            return epd;
+        }
+    }
+    net_leave(irq);
+    return NET_ERR;
+}
+
+static ep_watch_t **watch_find(sock_t *s, ep_t *ep) {
+    ep_watch_t **link = &s->watches;
+
+    while (*link != NULL && (*link)->ep != ep) {
+        link = &(*link)->sock_next;
+    }
+    return link;
+}
+
+int ep_ctl(int epd, int op, int sd, uint32_t events, void *data) {
+    ep_t *ep = ep_get(epd);
+    sock_t *s = sock_get(sd);
+    int ret = 0;
+
+    if (ep == NULL || s == NULL) {
+        return NET_ERR;
+    }
+    uint32_t irq = net_enter();
+    ep_watch_t **link = watch_find(s, ep);
+    ep_watch_t *w = *link;
+
+    switch (op) {
+    case EP_CTL_ADD:
+        if (w != NULL) {
+            ret = NET_ERR;
+            break;
+        }
+        if (!watches_ready) {
+            for (int i = 0; i < EP_WATCH_MAX; i++) {
+                ep_watches[i].sock_next = watch_free;
+                watch_free = &ep_watches[i];
+            }
+            watches_ready = 1;
+        }
+        w = watch_free;
+        if (w == NULL) {
+            ret = NET_ERR;
+            break;
+        }
+        watch_free = w->sock_next;
+        memset(w, 0, sizeof(*w));
+        w->ep = ep;
+        w->sd = sd;
+        w->sock_next = s->watches;
+        s->watches = w;
+        ep->watches++;
+        // fall through
+    case EP_CTL_MOD:
+        if (w == NULL) {
+            ret = NET_ERR;
+            break;
+        }
+        w->interest = events;
+        w->data = data;
+        w->disabled = 0;
+        // Already ready: report it without waiting for the next change
+        if (sock_state(s) & (events | EP_HUP | EP_ERR)) {
+            ep_queue(w);
+        }
+        break;
+    case EP_CTL_DEL:
+        if (w == NULL) {
+            ret = NET_ERR;
+            break;
+        }
+        *link = w->sock_next;
+        watch_release(w);
+        break;
+    default:
+        ret = NET_ERR;
+        break;
+    }
+
+    net_leave(irq);
+    return ret;
+}
+
+static int ep_has_ready(void *ctx) {
+    return ((ep_t *)ctx)->ready_head != NULL;
+}
+
+// Only queued watches are looked at. Each is checked against the socket's
+// current state, so stale wakeups are dropped; level-triggered watches
+// that are still ready go back on the queue for the next call.
+static int ep_collect(ep_t *ep, ep_event_t *events, int max) {
+    ep_watch_t *again_head = NULL;
+    ep_watch_t *again_tail = NULL;
+    int n = 0;
+
+    uint32_t irq = net_enter();
+    while (n < max && ep->ready_head != NULL) {
+        ep_watch_t *w = ep->ready_head;
+        ep->ready_head = w->ready_next;
+        if (ep->ready_head == NULL) {
+            ep->ready_tail = NULL;
+        }
+        w->queued = 0;
+
+        uint32_t ready = sock_state(&sockets[w->sd]) & (w->interest | EP_HUP | EP_ERR);
+        if (ready == 0 || w->disabled) {
+            continue;
+        }
+        events[n].events = ready;
+        events[n].sd = w->sd;
+        events[n].data = w->data;
+        n++;
+
+        if (w->interest & EP_ONESHOT) {
+            w->disabled = 1;
+        } else if (!(w->interest & EP_ET)) {
+            w->queued = 1;
+            w->ready_next = NULL;
+            if (again_tail != NULL) {
+                again_tail->ready_next = w;
+            } else {
+                again_head = w;
+            }
+            again_tail = w;
+        }
+    }
+    if (again_head != NULL) {
+        if (ep->ready_tail != NULL) {
+            ep->ready_tail->ready_next = again_head;
+        } else {
+            ep->ready_head = again_head;
+        }
+        ep->ready_tail = again_tail;
+    }
+    ep->reported += n;
+    net_leave(irq);
+    return n;
+}
+
+int ep_wait(int epd, ep_event_t *events, int max, int timeout_ms) {
+    ep_t *ep = ep_get(epd);
+    uint32_t start = timer_ticks();
+
+    if (ep == NULL || max <= 0) {
+        return NET_ERR;
+    }
+    for (;;) {
+        if (ep->ready_head == NULL && timeout_ms != 0) {
+            uint32_t left = NET_WAIT_FOREVER;
+            if (timeout_ms > 0) {
+                uint32_t elapsed = timer_ticks() - start;
+                left = elapsed < (uint32_t)timeout_ms ? (uint32_t)timeout_ms - elapsed : 0;
+            }
+            net_wait(ep_has_ready, ep, left);
+        }
+        int n = ep_collect(ep, events, max);
+        // Every wakeup may have been stale; keep waiting out the timeout
+        if (n > 0 || timeout_ms == 0 ||
+            (timeout_ms > 0 && timer_ticks() - start >= MS_TO_TICKS((uint32_t)timeout_ms))) {
+            return n;
+        }
+    }
+}
+
+int ep_close(int epd) {
+    ep_t *ep = ep_get(epd);
+
+    if (ep == NULL) {
+        return NET_ERR;
+    }
+    uint32_t irq = net_enter();
+    for (int sd = 0; sd < SOCK_MAX; sd++) {
+        if (!sockets[sd].used) {
+            continue;
+        }
+        ep_watch_t **link = watch_find(&sockets[sd], ep);
+        if (*link != NULL) {
+            ep_watch_t *w = *link;
+            *link = w->sock_next;
+            watch_release(w);
+        }
+    }
+    ep->used = 0;
+    net_leave(irq);
+    return 0;
+}
+
+void sock_print_stats() {
+    for (int sd = 0; sd < SOCK_MAX; sd++) {
+        sock_t *s = &sockets[sd];
+        if (!s->used) {
+            continue;
+        }
+        k_print_string("sock ");
+        k_print_dec(sd);
+        if (s->type == SOCK_STREAM) {
+            k_print_string(": tcp :");
+            k_print_dec(s->tcp->local_port);
+        } else {
+            k_print_string(": udp :");
+            k_print_dec(s->udp->local_port);
+        }
+        k_print_string(" ready=");
+        k_print_hex(sock_state(s));
+        k_print_string(s->nonblock ? " nonblock\n" : "\n");
+    }
+    for (int epd = 0; epd < EP_MAX; epd++) {
+        ep_t *ep = &eps[epd];
+        if (!ep->used) {
+            continue;
+        }
+        k_print_string("ep ");
+        k_print_dec(epd);
+        k_print_string(": watches=");
+        k_print_dec(ep->watches);
+        k_print_string(" wakeups=");
+        k_print_dec(ep->wakeups);
+        k_print_string(" reported=");
+        k_print_dec(ep->reported);
+        k_print_string("\n");
+    }
+}
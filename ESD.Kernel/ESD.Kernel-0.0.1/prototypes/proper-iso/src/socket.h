@@ -0,0 +1,93 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <stdint.h>
+#include "udp.h"
+#include "tcp.h"
+
+// BSD-style sockets over the UDP and TCP pcbs, named by small integer
+// descriptors. Calls block unless the socket is non-blocking, in which
+// case they return NET_AGAIN instead.
+
+#define SOCK_MAX    32
+#define SOCK_STREAM 1
+#define SOCK_DGRAM  2
+
+#define EP_MAX       4
+#define EP_WATCH_MAX 64
+
+// Interest and readiness bits; HUP and ERR are always reported
+#define EP_IN      NET_EV_READABLE
+#define EP_OUT     NET_EV_WRITABLE
+#define EP_HUP     NET_EV_HUP
+#define EP_ERR     NET_EV_ERROR
+#define EP_ET      0x100    // report on transitions only
+#define EP_ONESHOT 0x200    // disarm after one report until EP_CTL_MOD
+
+#define EP_CTL_ADD 1
+#define EP_CTL_MOD 2
+#define EP_CTL_DEL 3
+
+typedef struct {
+    uint32_t events;
+    int sd;
+    void *data;
+} ep_event_t;
+
+typedef struct ep_watch {
+    struct ep *ep;
+    int sd;
+    uint32_t interest;
+    void *data;
+    int queued;
+    int disabled;               // EP_ONESHOT already fired
+    struct ep_watch *sock_next; // other watches on the same socket
+    struct ep_watch *ready_next;
+} ep_watch_t;
+
+typedef struct ep {
+    int used;
+    // Sockets whose state changed since the last ep_wait(), in order
+    ep_watch_t *ready_head;
+    ep_watch_t *ready_tail;
+    uint32_t watches;
+    uint32_t wakeups;
+    uint32_t reported;
+} ep_t;
+
+typedef struct {
+    int used;
+    int type;
+    int nonblock;
+    udp_pcb_t *udp;
+    tcp_pcb_t *tcp;
+    uint32_t peer_ip;           // connected datagram socket
+    uint16_t peer_port;
+    ep_watch_t *watches;
+} sock_t;
+
+int sock_socket(int type);
+int sock_set_nonblock(int sd, int on);
+// Port 0 picks an ephemeral port
+int sock_bind(int sd, uint16_t port);
+int sock_listen(int sd, int backlog);
+int sock_accept(int sd, uint32_t *ip, uint16_t *port);
+// Non-blocking stream sockets return NET_AGAIN while the handshake runs;
+// EP_OUT reports completion
+int sock_connect(int sd, uint32_t ip, uint16_t port);
+int sock_send(int sd, const void *buf, uint32_t len);
+int sock_recv(int sd, void *buf, uint32_t len);
+int sock_sendto(int sd, const void *buf, uint32_t len, uint32_t ip, uint16_t port);
+int sock_recvfrom(int sd, void *buf, uint32_t len, uint32_t *ip, uint16_t *port);
+uint32_t sock_poll(int sd);
+int sock_close(int sd);
+
+int ep_create();
+int ep_ctl(int epd, int op, int sd, uint32_t events, void *data);
+// Up to max ready sockets; timeout_ms < 0 waits forever, 0 never waits
+int ep_wait(int epd, ep_event_t *events, int max, int timeout_ms);
+int ep_close(int epd);
+
+void sock_print_stats();
+
+#endif
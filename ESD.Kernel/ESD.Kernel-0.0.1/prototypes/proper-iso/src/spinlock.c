@@ -0,0 +1,196 @@
+#include "spinlock.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static lock_stats_t *stats_list = NULL;
+static volatile uint32_t stats_list_lock = 0;
+
+static inline uint64_t lock_clock() {
+    return cpu_features.tsc ? rdtsc() : 0;
+}
+
+static void lock_stats_register(lock_stats_t *stats, const char *name) {
+    stats->name = name;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->spins = 0;
+    stats->hold_cycles = 0;
+    stats->max_hold_cycles = 0;
+    stats->acquired_at = 0;
+
+    uint32_t flags = irq_save();
+    while (atomic_xchg(&stats_list_lock, 1)) {
+        cpu_relax();
+    }
+    stats->next = stats_list;
+    stats_list = stats;
+    stats_list_lock = 0;
+    irq_restore(flags);
+}
+
+static inline void lock_stats_acquired(lock_stats_t *stats, int contended, uint32_t spins) {
+#if LOCK_STATS
+    stats->acquisitions++;
+    if (contended) {
+        stats->contended++;
+        stats->spins += spins;
+    }
+    stats->acquired_at = lock_clock();
+#else
+    (void)stats;
+    (void)contended;
+    (void)spins;
+#endif
+}
+
+static inline void lock_stats_released(lock_stats_t *stats) {
+#if LOCK_STATS
+    uint64_t held = lock_clock() - stats->acquired_at;
+    stats->hold_cycles += held;
+    if (held > stats->max_hold_cycles) {
+        stats->max_hold_cycles = held;
+    }
+#else
+    (void)stats;
+#endif
+}
+
+void spin_init(spinlock_t *lock, const char *name) {
+    lock->locked = 0;
+    lock_stats_register(&lock->stats, name);
+}
+
+void spin_lock(spinlock_t *lock) {
+    uint32_t spins = 0;
+    int contended = 0;
+
+    while (atomic_xchg(&lock->locked, 1)) {
+        contended = 1;
+        // Spin on a plain read so the line stays shared until it frees up
+        while (lock->locked) {
+            cpu_relax();
+            spins++;
+        }
+    }
+    lock_stats_acquired(&lock->stats, contended, spins);
+}
+
+int spin_trylock(spinlock_t *lock) {
+    if (atomic_xchg(&lock->locked, 1)) {
+        return 0;
+    }
+    lock_stats_acquired(&lock->stats, 0, 0);
+    return 1;
+}
+
+void spin_unlock(spinlock_t *lock) {
+    lock_stats_released(&lock->stats);
+    barrier();
+    lock->locked = 0;
+}
+
+uint32_t spin_lock_irqsave(spinlock_t *lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void ticket_init(ticket_lock_t *lock, const char *name) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock_stats_register(&lock->stats, name);
+}
+
+void ticket_lock(ticket_lock_t *lock) {
+    uint16_t ticket;
+    uint32_t spins = 0;
+
+    asm volatile ( "lock xaddw %0, %1"
+                   : "=r"(ticket), "+m"(lock->next)
+                   : "0"((uint16_t)1)
+                   : "memory" );
+    while (lock->owner != ticket) {
+        cpu_relax();
+        spins++;
+    }
+    lock_stats_acquired(&lock->stats, spins != 0, spins);
+}
+
+void ticket_unlock(ticket_lock_t *lock) {
+    lock_stats_released(&lock->stats);
+    barrier();
+    lock->owner++;
+}
+
+uint32_t ticket_lock_irqsave(ticket_lock_t *lock) {
+    uint32_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+void ticket_unlock_irqrestore(ticket_lock_t *lock, uint32_t flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+void mcs_init(mcs_lock_t *lock, const char *name) {
+    lock->tail = NULL;
+    lock_stats_register(&lock->stats, name);
+}
+
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node) {
+    uint32_t spins = 0;
+
+    node->next = NULL;
+    node->locked = 1;
+
+    mcs_node_t *prev = atomic_xchg_ptr((void *volatile *)&lock->tail, node);
+    if (prev != NULL) {
+        prev->next = node;
+        while (node->locked) {
+            cpu_relax();
+            spins++;
+        }
+    }
+    lock_stats_acquired(&lock->stats, prev != NULL, spins);
+}
+
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node) {
+    lock_stats_released(&lock->stats);
+
+    if (node->next == NULL) {
+        // No known successor: try to swing the tail back to empty
+        if (atomic_cmpxchg((volatile uint32_t *)&lock->tail, (uint32_t)node, 0) == (uint32_t)node) {
+            return;
+        }
+        // A successor is between its xchg and linking itself in
+        while (node->next == NULL) {
+            cpu_relax();
+        }
+    }
+    node->next->locked = 0;
+}
+
+void lock_stats_print() {
+    k_print_string("Lock statistics (hold times in TSC cycles):\n");
+    for (lock_stats_t *s = stats_list; s != NULL; s = s->next) {
+        k_print_string(s->name);
+        k_print_string(": acq=");
+        k_print_dec(s->acquisitions);
+        k_print_string(" contended=");
+        k_print_dec(s->contended);
+        k_print_string(" spins=");
+        k_print_dec(s->spins);
+        k_print_string(" avg_hold=");
+        k_print_dec(s->acquisitions ? (uint32_t)div_u64(s->hold_cycles, s->acquisitions) : 0);
+        k_print_string(" max_hold=");
+        k_print_dec((uint32_t)s->max_hold_cycles);
+        k_print_string("\n");
+    }
+}
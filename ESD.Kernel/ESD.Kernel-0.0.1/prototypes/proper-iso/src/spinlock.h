@@ -0,0 +1,95 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+
+// Contention counters cost a few TSC reads per acquisition. Build with
+// -DLOCK_STATS=0 to compile them out.
+#ifndef LOCK_STATS
+#define LOCK_STATS 1
+#endif
+
+typedef struct lock_stats {
+    const char *name;
+    uint32_t acquisitions;
+    uint32_t contended;
+    uint32_t spins;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+    uint64_t acquired_at;
+    struct lock_stats *next;
+} lock_stats_t;
+
+// Test-and-test-and-set lock
+typedef struct {
+    volatile uint32_t locked;
+    lock_stats_t stats;
+} spinlock_t;
+
+// FIFO-fair ticket lock
+typedef struct {
+    volatile uint16_t next;
+    volatile uint16_t owner;
+    lock_stats_t stats;
+} ticket_lock_t;
+
+// MCS queue lock: each waiter spins on its own node's cache line
+typedef struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile uint32_t locked;
+} __attribute__((aligned(64))) mcs_node_t;
+
+typedef struct {
+    mcs_node_t *volatile tail;
+    lock_stats_t stats;
+} mcs_lock_t;
+
+void spin_init(spinlock_t *lock, const char *name);
+void spin_lock(spinlock_t *lock);
+int spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+uint32_t spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags);
+
+void ticket_init(ticket_lock_t *lock, const char *name);
+void ticket_lock(ticket_lock_t *lock);
+void ticket_unlock(ticket_lock_t *lock);
+uint32_t ticket_lock_irqsave(ticket_lock_t *lock);
+void ticket_unlock_irqrestore(ticket_lock_t *lock, uint32_t flags);
+
+void mcs_init(mcs_lock_t *lock, const char *name);
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node);
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node);
+
+void lock_stats_print();
+
+static inline uint32_t atomic_xchg(volatile uint32_t *ptr, uint32_t val) {
+    asm volatile ( "xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory" );
+    return val;
+}
+
+static inline void *atomic_xchg_ptr(void *volatile *ptr, void *val) {
+    asm volatile ( "xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory" );
+    return val;
+}
+
+static inline uint32_t atomic_cmpxchg(volatile uint32_t *ptr, uint32_t old, uint32_t val) {
+    uint32_t prev;
+    asm volatile ( "lock cmpxchgl %2, %1"
+                   : "=a"(prev), "+m"(*ptr)
+                   : "r"(val), "0"(old)
+                   : "memory" );
+    return prev;
+}
+
+static inline uint32_t atomic_add_return(volatile uint32_t *ptr, uint32_t val) {
+    uint32_t old = val;
+    asm volatile ( "lock xaddl %0, %1" : "+r"(old), "+m"(*ptr) : : "memory" );
+    return old + val;
+}
+
+static inline void barrier() {
+    asm volatile ( "" ::: "memory" );
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include "tasklet.h"
+#include "cpu.h"
+#include <stddef.h>
+
+static tasklet_t *pending_head = NULL;
+static tasklet_t *pending_tail = NULL;
+static volatile int tasklet_running = 0;
+
+void tasklet_init(tasklet_t *t, void (*fn)(void *ctx), void *ctx) {
+    t->fn = fn;
+    t->ctx = ctx;
+    t->scheduled = 0;
+    t->next = NULL;
+}
+
+void tasklet_schedule(tasklet_t *t) {
+    uint32_t flags = irq_save();
+
+    if (!t->scheduled) {
+        t->scheduled = 1;
+        t->next = NULL;
+        if (pending_tail != NULL) {
+            pending_tail->next = t;
+        } else {
+            pending_head = t;
+        }
+        pending_tail = t;
+    }
+
+    irq_restore(flags);
+}
+
+// Nested IRQs that arrive while tasklets run leave their work on the
+// pending list for the outer loop instead of recursing
+void tasklet_run() {
+    uint32_t flags = irq_save();
+
+    if (tasklet_running || pending_head == NULL) {
+        irq_restore(flags);
+        return;
+    }
+    tasklet_running = 1;
+
+    while (pending_head != NULL) {
+        tasklet_t *list = pending_head;
+        pending_head = NULL;
+        pending_tail = NULL;
+
+        asm volatile ( "sti" ::: "memory" );
+        while (list != NULL) {
+            tasklet_t *t = list;
+            list = t->next;
+            t->scheduled = 0;
+            t->fn(t->ctx);
+        }
+        asm volatile ( "cli" ::: "memory" );
+    }
+
+    tasklet_running = 0;
+    irq_restore(flags);
+}
@@ -0,0 +1,22 @@
+#ifndef TASKLET_H
+#define TASKLET_H
+
+#include <stdint.h>
+
+// Deferred interrupt work. A handler acknowledges the device and
+// schedules a tasklet; pending tasklets run with interrupts enabled on the
+// way out of the IRQ (and from the idle loop). A tasklet never runs
+// concurrently with itself.
+
+typedef struct tasklet {
+    void (*fn)(void *ctx);
+    void *ctx;
+    volatile int scheduled;
+    struct tasklet *next;
+} tasklet_t;
+
+void tasklet_init(tasklet_t *t, void (*fn)(void *ctx), void *ctx);
+void tasklet_schedule(tasklet_t *t);
+void tasklet_run();
+
+#endif
@@ -0,0 +1,1068 @@
+#include "tcp.h"
+#include "timer.h"
+#include "mem.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static tcp_pcb_t tcp_pcbs[TCP_MAX_PCBS];
+static tcp_seg_t tcp_segs[TCP_SEGS];
+static tcp_seg_t *seg_free = NULL;
+static int segs_ready = 0;
+static uint16_t tcp_next_port = TCP_EPHEMERAL_BASE;
+
+static struct {
+    uint32_t bad;
+    uint32_t no_pcb;
+    uint32_t resets;
+    uint32_t out_of_order;
+    uint32_t backlog_full;
+    uint32_t no_memory;
+} tcp_stats;
+
+static const char *state_names[] = {
+    "CLOSED", "LISTEN", "SYN_SENT", "SYN_RCVD", "ESTABLISHED", "FIN_WAIT_1",
+    "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK", "TIME_WAIT"
+};
+
+static inline int seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline int seq_leq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+static inline int seq_gt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+#define TCP_SEG_NEXT  0
+#define TCP_SEG_OLD   1
+#define TCP_SEG_AHEAD 2
+
+// Place a segment against rcv_nxt: nothing new in it, starting past a
+// hole, or next in line once its first *dup bytes are dropped
+static int tcp_seg_where(uint32_t rcv_nxt, uint32_t seq, uint32_t dlen, uint8_t flags, uint32_t *dup) {
+    *dup = 0;
+    if (seq_gt(seq, rcv_nxt)) {
+        return TCP_SEG_AHEAD;
+    }
+    if (seq_lt(seq, rcv_nxt)) {
+        *dup = rcv_nxt - seq;
+        // A FIN right after the old bytes is still new
+        if (*dup > dlen || (*dup == dlen && !(flags & TCP_FIN))) {
+            return TCP_SEG_OLD;
+        }
+    }
+    return TCP_SEG_NEXT;
+}
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+static inline uint32_t max_u32(uint32_t a, uint32_t b) {
+    return a > b ? a : b;
+}
+
+static tcp_seg_t *seg_alloc() {
+    if (!segs_ready) {
+        for (int i = 0; i < TCP_SEGS; i++) {
+            tcp_segs[i].next = seg_free;
+            seg_free = &tcp_segs[i];
+        }
+        segs_ready = 1;
+    }
+    tcp_seg_t *seg = seg_free;
+    if (seg == NULL) {
+        tcp_stats.no_memory++;
+        return NULL;
+    }
+    seg_free = seg->next;
+    memset(seg, 0, sizeof(*seg));
+    return seg;
+}
+
+static void seg_release(tcp_seg_t *seg) {
+    if (seg->p != NULL) {
+        pbuf_free(seg->p);
+    }
+    seg->next = seg_free;
+    seg_free = seg;
+}
+
+static void seg_release_list(tcp_seg_t *seg) {
+    while (seg != NULL) {
+        tcp_seg_t *next = seg->next;
+        seg_release(seg);
+        seg = next;
+    }
+}
+
+// Sequence space a segment takes up; SYN and FIN count as one each
+static inline uint32_t seg_space(const tcp_seg_t *seg) {
+    return seg->len + ((seg->flags & TCP_SYN) ? 1 : 0) + ((seg->flags & TCP_FIN) ? 1 : 0);
+}
+
+static void seg_append(tcp_seg_t **list, tcp_seg_t *seg) {
+    seg->next = NULL;
+    while (*list != NULL) {
+        list = &(*list)->next;
+    }
+    *list = seg;
+}
+
+static tcp_seg_t *seg_last(tcp_seg_t *seg) {
+    while (seg != NULL && seg->next != NULL) {
+        seg = seg->next;
+    }
+    return seg;
+}
+
+static uint32_t tcp_rcv_window(const tcp_pcb_t *pcb) {
+    return min_u32(TCP_RCV_BUF - pcb->rcv_count, 0xFFFF);
+}
+
+static int tcp_port_used(uint16_t port, int listeners_only) {
+    for (int i = 0; i < TCP_MAX_PCBS; i++) {
+        tcp_pcb_t *pcb = &tcp_pcbs[i];
+        if (pcb->used && pcb->local_port == port && (!listeners_only || pcb->remote_port == 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static tcp_pcb_t *tcp_pcb_alloc() {
+    for (int i = 0; i < TCP_MAX_PCBS; i++) {
+        tcp_pcb_t *pcb = &tcp_pcbs[i];
+        if (!pcb->used) {
+            memset(pcb, 0, sizeof(*pcb));
+            pcb->used = 1;
+            pcb->mss = TCP_DEFAULT_MSS;
+            pcb->rto = MS_TO_TICKS(TCP_RTO_INITIAL_MS);
+            return pcb;
+        }
+    }
+    tcp_stats.no_memory++;
+    return NULL;
+}
+
+static void tcp_pcb_free(tcp_pcb_t *pcb) {
+    seg_release_list(pcb->unsent);
+    seg_release_list(pcb->unacked);
+    pcb->unsent = NULL;
+    pcb->unacked = NULL;
+
+    // Not yet accepted: leave the listener's queue
+    tcp_pcb_t *parent = pcb->parent;
+    if (parent != NULL) {
+        tcp_pcb_t **link = &parent->accept_queue;
+        while (*link != NULL && *link != pcb) {
+            link = &(*link)->accept_next;
+        }
+        if (*link == pcb) {
+            *link = pcb->accept_next;
+        }
+        parent->pending--;
+    }
+    pcb->used = 0;
+    pcb->event = NULL;
+}
+
+static void tcp_notify(tcp_pcb_t *pcb, uint32_t events) {
+    if (events != 0 && pcb->used && pcb->event != NULL && !pcb->detached) {
+        pcb->event(pcb, events, pcb->arg);
+    }
+}
+
+// Build and send one segment: a header piece with headroom for IP and
+// Ethernet, followed by a reference to the queued data
+static int tcp_emit(uint16_t local_port, uint32_t remote_ip, uint16_t remote_port,
+                    uint32_t seq, uint32_t ack, uint8_t flags, uint16_t wnd,
+                    pbuf_t *data, uint16_t dlen) {
+    uint16_t optlen = (flags & TCP_SYN) ? 4 : 0;
+    pbuf_t *p = pbuf_alloc(PBUF_HEADROOM, TCP_HLEN + optlen);
+
+    if (p == NULL) {
+        tcp_stats.no_memory++;
+        return -1;
+    }
+    if (dlen > 0) {
+        pbuf_t *ref = pbuf_alloc_ref(data, 0, dlen);
+        if (ref == NULL) {
+            pbuf_free(p);
+            tcp_stats.no_memory++;
+            return -1;
+        }
+        pbuf_chain(p, ref);
+        flags |= TCP_PSH;
+    }
+
+    tcp_hdr_t *th = (tcp_hdr_t *)p->payload;
+    th->sport = htons(local_port);
+    th->dport = htons(remote_port);
+    th->seq = htonl(seq);
+    th->ack = (flags & TCP_ACK) ? htonl(ack) : 0;
+    th->off = ((TCP_HLEN + optlen) / 4) << 4;
+    th->flags = flags;
+    th->wnd = htons(wnd);
+    th->csum = 0;
+    th->urg = 0;
+    if (optlen) {
+        // Maximum segment size
+        uint8_t *opt = p->payload + TCP_HLEN;
+        opt[0] = 2;
+        opt[1] = 4;
+        opt[2] = TCP_MSS >> 8;
+        opt[3] = TCP_MSS & 0xFF;
+    }
+
+    ip_l4_csum(p, remote_ip, IP_PROTO_TCP, 16);
+    // A frame lost on the way out is recovered like any other loss
+    ip_output(p, remote_ip, IP_PROTO_TCP);
+    return 0;
+}
+
+static int tcp_send(tcp_pcb_t *pcb, uint32_t seq, uint8_t flags, pbuf_t *data, uint16_t dlen) {
+    if (pcb->state != TCP_SYN_SENT) {
+        flags |= TCP_ACK;
+    }
+    pcb->rcv_adv = tcp_rcv_window(pcb);
+    pcb->segs_out++;
+    return tcp_emit(pcb->local_port, pcb->remote_ip, pcb->remote_port,
+                    seq, pcb->rcv_nxt, flags, pcb->rcv_adv, data, dlen);
+}
+
+static void tcp_send_ack(tcp_pcb_t *pcb) {
+    tcp_send(pcb, pcb->snd_nxt, 0, NULL, 0);
+}
+
+// Answer a segment that belongs to no connection
+static void tcp_reset_reply(uint32_t ip, uint16_t remote_port, uint16_t local_port,
+                            uint32_t seq, uint32_t ack, uint8_t flags, uint32_t dlen) {
+    tcp_stats.resets++;
+    if (flags & TCP_ACK) {
+        tcp_emit(local_port, ip, remote_port, ack, 0, TCP_RST, 0, NULL, 0);
+    } else {
+        uint32_t end = seq + dlen + ((flags & TCP_SYN) ? 1 : 0) + ((flags & TCP_FIN) ? 1 : 0);
+        tcp_emit(local_port, ip, remote_port, 0, end, TCP_RST | TCP_ACK, 0, NULL, 0);
+    }
+}
+
+static void tcp_arm(tcp_pcb_t *pcb) {
+    pcb->rtx_deadline = timer_ticks() + pcb->rto;
+    pcb->rtx_armed = 1;
+}
+
+// Zero-window probes back off like retransmissions but never give up:
+// the receiver may keep its window shut for as long as it likes
+static void tcp_persist_arm(tcp_pcb_t *pcb) {
+    uint32_t timeout = min_u32(pcb->rto << pcb->persist_backoff, MS_TO_TICKS(TCP_RTO_MAX_MS));
+
+    pcb->persist = 1;
+    pcb->rtx_deadline = timer_ticks() + timeout;
+    pcb->rtx_armed = 1;
+}
+
+// Move the head of the unsent queue onto the wire and into unacked
+static int tcp_send_head(tcp_pcb_t *pcb) {
+    tcp_seg_t *seg = pcb->unsent;
+
+    if (tcp_send(pcb, seg->seq, seg->flags, seg->p, seg->len) != 0) {
+        // Out of buffers: the timer tries again
+        if (!pcb->rtx_armed) {
+            tcp_arm(pcb);
+        }
+        return -1;
+    }
+    pcb->unsent = seg->next;
+    seg_append(&pcb->unacked, seg);
+    seg->sent_at = timer_ticks();
+    if (seq_gt(seg->seq + seg_space(seg), pcb->snd_nxt)) {
+        pcb->snd_nxt = seg->seq + seg_space(seg);
+    }
+    if (!pcb->rtx_armed) {
+        tcp_arm(pcb);
+    }
+    return 0;
+}
+
+// Send whatever the peer's window and our congestion window allow
+static int tcp_output(tcp_pcb_t *pcb) {
+    uint32_t wnd = min_u32(pcb->snd_wnd, pcb->cwnd);
+    int sent = 0;
+
+    while (pcb->unsent != NULL) {
+        tcp_seg_t *seg = pcb->unsent;
+        if (seg->len > 0 && seq_gt(seg->seq + seg->len, pcb->snd_una + wnd)) {
+            // Closed window and nothing in flight: the timer will probe
+            if (pcb->unacked == NULL && !pcb->rtx_armed) {
+                tcp_persist_arm(pcb);
+            }
+            break;
+        }
+        if (tcp_send_head(pcb) != 0) {
+            break;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+// The receiver keeps nothing past a hole, so everything from the lost
+// segment on goes again, as far as the congestion window allows
+static void tcp_retransmit(tcp_pcb_t *pcb) {
+    tcp_seg_t *last = pcb->unacked;
+
+    if (last == NULL) {
+        return;
+    }
+    for (;;) {
+        last->rexmit = 1;
+        if (last->next == NULL) {
+            break;
+        }
+        last = last->next;
+    }
+    last->next = pcb->unsent;
+    pcb->unsent = pcb->unacked;
+    pcb->unacked = NULL;
+    pcb->rtx_armed = 0;
+    pcb->retransmits++;
+    tcp_output(pcb);
+}
+
+static int tcp_queue_ctl(tcp_pcb_t *pcb, uint8_t flags) {
+    tcp_seg_t *seg = seg_alloc();
+
+    if (seg == NULL) {
+        return -1;
+    }
+    seg->seq = pcb->snd_end;
+    seg->flags = flags;
+    seg_append(&pcb->unsent, seg);
+    pcb->snd_end += seg_space(seg);
+    return 0;
+}
+
+// Pick an initial sequence number and queue our SYN
+static int tcp_start(tcp_pcb_t *pcb) {
+    pcb->iss = (uint32_t)rdtsc();
+    pcb->snd_una = pcb->iss;
+    pcb->snd_nxt = pcb->iss;
+    pcb->snd_end = pcb->iss;
+    pcb->ssthresh = 0xFFFF;
+    pcb->cwnd = min_u32(4 * pcb->mss, max_u32(2 * pcb->mss, 4380));
+    return tcp_queue_ctl(pcb, TCP_SYN);
+}
+
+static uint16_t tcp_parse_mss(const uint8_t *data, uint32_t off) {
+    uint32_t i = TCP_HLEN;
+
+    while (i < off) {
+        uint8_t kind = data[i];
+        if (kind == 0) {
+            break;
+        }
+        if (kind == 1) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= off || data[i + 1] < 2) {
+            break;
+        }
+        if (kind == 2 && data[i + 1] == 4 && i + 4 <= off) {
+            uint16_t mss = (data[i + 2] << 8) | data[i + 3];
+            return mss == 0 ? TCP_DEFAULT_MSS : min_u32(mss, TCP_MSS);
+        }
+        i += data[i + 1];
+    }
+    return TCP_DEFAULT_MSS;
+}
+
+static void tcp_rtt_sample(tcp_pcb_t *pcb, uint32_t rtt) {
+    if (pcb->srtt == 0 && pcb->rttvar == 0) {
+        pcb->srtt = rtt;
+        pcb->rttvar = rtt / 2;
+    } else {
+        uint32_t delta = rtt > pcb->srtt ? rtt - pcb->srtt : pcb->srtt - rtt;
+        pcb->rttvar = (3 * pcb->rttvar + delta) / 4;
+        pcb->srtt = (7 * pcb->srtt + rtt) / 8;
+    }
+    uint32_t rto = pcb->srtt + max_u32(4 * pcb->rttvar, MS_TO_TICKS(NET_TICK_MS));
+    pcb->rto = min_u32(max_u32(rto, MS_TO_TICKS(TCP_RTO_MIN_MS)), MS_TO_TICKS(TCP_RTO_MAX_MS));
+}
+
+// The connection is gone. Returns the events to report, or 0 if the pcb
+// was freed because nobody holds it.
+static uint32_t tcp_fail(tcp_pcb_t *pcb) {
+    pcb->state = TCP_CLOSED;
+    pcb->error = 1;
+    pcb->rtx_armed = 0;
+    pcb->persist = 0;
+    seg_release_list(pcb->unsent);
+    seg_release_list(pcb->unacked);
+    pcb->unsent = NULL;
+    pcb->unacked = NULL;
+    pcb->snd_queued = 0;
+
+    if (pcb->detached || pcb->parent != NULL) {
+        tcp_pcb_free(pcb);
+        return 0;
+    }
+    return NET_EV_READABLE | NET_EV_ERROR | NET_EV_HUP;
+}
+
+static uint32_t tcp_ack(tcp_pcb_t *pcb, uint32_t ack, uint32_t wnd, uint32_t dlen) {
+    uint32_t events = 0;
+    uint32_t now = timer_ticks();
+
+    if (seq_gt(ack, pcb->snd_nxt)) {
+        // Acknowledges something we never sent
+        tcp_send_ack(pcb);
+        return 0;
+    }
+
+    // The peer is alive even if it acknowledges nothing new
+    pcb->retries = 0;
+
+    if (seq_gt(ack, pcb->snd_una)) {
+        pcb->snd_una = ack;
+        while (pcb->unacked != NULL && seq_leq(pcb->unacked->seq + seg_space(pcb->unacked), ack)) {
+            tcp_seg_t *seg = pcb->unacked;
+            pcb->unacked = seg->next;
+            if (!seg->rexmit) {
+                tcp_rtt_sample(pcb, now - seg->sent_at);
+            }
+            pcb->snd_queued -= seg->len;
+            seg_release(seg);
+        }
+        pcb->dupacks = 0;
+
+        // Slow start below ssthresh, then one segment per window
+        if (pcb->cwnd < pcb->ssthresh) {
+            pcb->cwnd += pcb->mss;
+        } else {
+            pcb->cwnd += max_u32(pcb->mss * pcb->mss / pcb->cwnd, 1);
+        }
+        pcb->cwnd = min_u32(pcb->cwnd, 0xFFFF);
+
+        if (pcb->unacked != NULL) {
+            tcp_arm(pcb);
+        } else {
+            pcb->rtx_armed = 0;
+        }
+        if (pcb->snd_full && pcb->snd_queued < TCP_SND_BUF) {
+            pcb->snd_full = 0;
+            events |= NET_EV_WRITABLE;
+        }
+    } else if (ack == pcb->snd_una && dlen == 0 && pcb->unacked != NULL && wnd == pcb->snd_wnd &&
+               !pcb->persist) {
+        // Third duplicate: the head was lost, resend without waiting
+        if (++pcb->dupacks == 3) {
+            pcb->ssthresh = max_u32((pcb->snd_nxt - pcb->snd_una) / 2, 2 * pcb->mss);
+            pcb->cwnd = pcb->ssthresh;
+            tcp_retransmit(pcb);
+        }
+    }
+
+    pcb->snd_wnd = wnd;
+
+    // An open window ends probing; whatever the probe carried is now
+    // ordinary data in flight
+    if (pcb->persist && wnd > 0) {
+        pcb->persist = 0;
+        pcb->persist_backoff = 0;
+        if (pcb->unacked != NULL) {
+            tcp_arm(pcb);
+        } else {
+            pcb->rtx_armed = 0;
+        }
+    }
+    return events;
+}
+
+static tcp_pcb_t *tcp_lookup(uint32_t ip, uint16_t remote_port, uint16_t local_port) {
+    tcp_pcb_t *listener = NULL;
+
+    for (int i = 0; i < TCP_MAX_PCBS; i++) {
+        tcp_pcb_t *pcb = &tcp_pcbs[i];
+        if (!pcb->used || pcb->local_port != local_port) {
+            continue;
+        }
+        if (pcb->state == TCP_LISTEN) {
+            listener = pcb;
+        } else if (pcb->state != TCP_CLOSED && pcb->remote_ip == ip && pcb->remote_port == remote_port) {
+            return pcb;
+        }
+    }
+    return listener;
+}
+
+static void tcp_listen_input(tcp_pcb_t *l, uint32_t ip, uint16_t port, uint32_t seq, uint32_t ack,
+                             uint8_t flags, uint32_t wnd, const uint8_t *data, uint32_t off, uint32_t dlen) {
+    if (flags & TCP_RST) {
+        return;
+    }
+    if (flags & TCP_ACK) {
+        tcp_reset_reply(ip, port, l->local_port, seq, ack, flags, dlen);
+        return;
+    }
+    if (!(flags & TCP_SYN)) {
+        return;
+    }
+    if (l->pending >= l->backlog) {
+        tcp_stats.backlog_full++;
+        return;
+    }
+
+    tcp_pcb_t *c = tcp_pcb_alloc();
+    if (c == NULL) {
+        return;
+    }
+    c->state = TCP_SYN_RCVD;
+    c->local_port = l->local_port;
+    c->remote_ip = ip;
+    c->remote_port = port;
+    c->parent = l;
+    l->pending++;
+    c->rcv_nxt = seq + 1;
+    c->snd_wnd = wnd;
+    c->mss = tcp_parse_mss(data, off);
+    if (tcp_start(c) != 0) {
+        tcp_pcb_free(c);
+        return;
+    }
+    tcp_output(c);
+}
+
+static void tcp_syn_sent_input(tcp_pcb_t *pcb, uint32_t seq, uint32_t ack, uint8_t flags,
+                               uint32_t wnd, const uint8_t *data, uint32_t off) {
+    uint32_t events = 0;
+
+    if ((flags & TCP_ACK) && (seq_leq(ack, pcb->iss) || seq_gt(ack, pcb->snd_nxt))) {
+        if (!(flags & TCP_RST)) {
+            tcp_reset_reply(pcb->remote_ip, pcb->remote_port, pcb->local_port, seq, ack, flags, 0);
+        }
+        return;
+    }
+    if (flags & TCP_RST) {
+        if (flags & TCP_ACK) {
+            tcp_notify(pcb, tcp_fail(pcb));
+        }
+        return;
+    }
+    // Simultaneous open is not supported; the peer retries its SYN
+    if (!(flags & TCP_SYN) || !(flags & TCP_ACK)) {
+        return;
+    }
+
+    pcb->rcv_nxt = seq + 1;
+    pcb->mss = tcp_parse_mss(data, off);
+    pcb->cwnd = min_u32(4 * pcb->mss, max_u32(2 * pcb->mss, 4380));
+    pcb->state = TCP_ESTABLISHED;
+    events |= tcp_ack(pcb, ack, wnd, 0);
+    if (tcp_output(pcb) == 0) {
+        tcp_send_ack(pcb);
+    }
+    tcp_notify(pcb, events | NET_EV_WRITABLE);
+}
+
+void tcp_input(const ip_hdr_t *ip, const uint8_t *data, uint32_t len, uint32_t rx_flags) {
+    const tcp_hdr_t *th = (const tcp_hdr_t *)data;
+
+    if (len < TCP_HLEN || (th->off >> 4) * 4u < TCP_HLEN || (th->off >> 4) * 4u > len) {
+        tcp_stats.bad++;
+        return;
+    }
+    if (ip_l4_verify(ip, data, len, rx_flags) != 0) {
+        return;
+    }
+
+    uint32_t src = ntohl(ip->src);
+    uint16_t sport = ntohs(th->sport);
+    uint16_t dport = ntohs(th->dport);
+    uint32_t seq = ntohl(th->seq);
+    uint32_t ack = ntohl(th->ack);
+    uint32_t wnd = ntohs(th->wnd);
+    uint8_t flags = th->flags;
+    uint32_t off = (th->off >> 4) * 4;
+    const uint8_t *payload = data + off;
+    uint32_t dlen = len - off;
+
+    tcp_pcb_t *pcb = tcp_lookup(src, sport, dport);
+    if (pcb == NULL) {
+        tcp_stats.no_pcb++;
+        if (!(flags & TCP_RST)) {
+            tcp_reset_reply(src, sport, dport, seq, ack, flags, dlen);
+        }
+        return;
+    }
+    pcb->segs_in++;
+
+    if (pcb->state == TCP_LISTEN) {
+        tcp_listen_input(pcb, src, sport, seq, ack, flags, wnd, data, off, dlen);
+        return;
+    }
+    if (pcb->state == TCP_SYN_SENT) {
+        tcp_syn_sent_input(pcb, seq, ack, flags, wnd, data, off);
+        return;
+    }
+
+    // A repeated SYN means the peer missed our ACK
+    if (flags & TCP_SYN) {
+        if (!(flags & TCP_RST)) {
+            tcp_send_ack(pcb);
+        }
+        return;
+    }
+
+    // Trim bytes we already have; no reassembly queue, so anything past
+    // a hole is dropped and the duplicate ACK asks for the hole again
+    uint32_t dup;
+    int where = tcp_seg_where(pcb->rcv_nxt, seq, dlen, flags, &dup);
+    if (where == TCP_SEG_OLD) {
+        // Wholly old: a retransmission, a keepalive, or a FIN whose ACK
+        // was lost. Each gets our current ACK.
+        if (!(flags & TCP_RST)) {
+            if (pcb->state == TCP_TIME_WAIT && (flags & TCP_FIN)) {
+                pcb->tw_deadline = timer_ticks() + MS_TO_TICKS(TCP_TIME_WAIT_MS);
+            }
+            tcp_send_ack(pcb);
+        }
+        return;
+    }
+    if (where == TCP_SEG_AHEAD) {
+        tcp_stats.out_of_order++;
+        if (!(flags & TCP_RST)) {
+            tcp_send_ack(pcb);
+        }
+        return;
+    }
+    payload += dup;
+    dlen -= dup;
+    seq += dup;
+
+    if (flags & TCP_RST) {
+        tcp_notify(pcb, tcp_fail(pcb));
+        return;
+    }
+    if (!(flags & TCP_ACK)) {
+        return;
+    }
+
+    uint32_t events = 0;
+    tcp_pcb_t *accepted_by = NULL;
+    int need_ack = 0;
+
+    if (pcb->state == TCP_SYN_RCVD) {
+        if (seq_leq(ack, pcb->snd_una) || seq_gt(ack, pcb->snd_nxt)) {
+            tcp_reset_reply(src, sport, dport, seq, ack, flags, dlen);
+            return;
+        }
+        pcb->state = TCP_ESTABLISHED;
+        tcp_pcb_t **link = &pcb->parent->accept_queue;
+        while (*link != NULL) {
+            link = &(*link)->accept_next;
+        }
+        *link = pcb;
+        pcb->accept_next = NULL;
+        accepted_by = pcb->parent;
+    }
+
+    events |= tcp_ack(pcb, ack, wnd, dlen);
+
+    // Our FIN is the last thing queued; it is acknowledged once
+    // everything is
+    if (pcb->snd_una == pcb->snd_end) {
+        if (pcb->state == TCP_FIN_WAIT_1) {
+            pcb->state = TCP_FIN_WAIT_2;
+        } else if (pcb->state == TCP_CLOSING) {
+            pcb->state = TCP_TIME_WAIT;
+            pcb->tw_deadline = timer_ticks() + MS_TO_TICKS(TCP_TIME_WAIT_MS);
+        } else if (pcb->state == TCP_LAST_ACK) {
+            pcb->state = TCP_CLOSED;
+            tcp_pcb_free(pcb);
+            return;
+        }
+    }
+
+    if (dlen > 0) {
+        if (pcb->state == TCP_ESTABLISHED || pcb->state == TCP_FIN_WAIT_1 ||
+            pcb->state == TCP_FIN_WAIT_2) {
+            uint32_t n = min_u32(dlen, TCP_RCV_BUF - pcb->rcv_count);
+            uint32_t tail = (pcb->rcv_head + pcb->rcv_count) % TCP_RCV_BUF;
+            uint32_t first = min_u32(n, TCP_RCV_BUF - tail);
+            memcpy(pcb->rcv_buf + tail, payload, first);
+            memcpy(pcb->rcv_buf, payload + first, n - first);
+            pcb->rcv_count += n;
+            pcb->rcv_nxt += n;
+            if (n > 0) {
+                events |= NET_EV_READABLE;
+            }
+            // The FIN sits after bytes that did not fit
+            if (n < dlen) {
+                flags &= ~TCP_FIN;
+            }
+        }
+        need_ack = 1;
+    }
+
+    if ((flags & TCP_FIN) && !pcb->fin_received) {
+        pcb->rcv_nxt++;
+        pcb->fin_received = 1;
+        need_ack = 1;
+        events |= NET_EV_READABLE;
+        if (pcb->state == TCP_ESTABLISHED || pcb->state == TCP_SYN_RCVD) {
+            pcb->state = TCP_CLOSE_WAIT;
+        } else if (pcb->state == TCP_FIN_WAIT_1) {
+            pcb->state = TCP_CLOSING;
+        } else if (pcb->state == TCP_FIN_WAIT_2) {
+            pcb->state = TCP_TIME_WAIT;
+            pcb->tw_deadline = timer_ticks() + MS_TO_TICKS(TCP_TIME_WAIT_MS);
+        }
+    }
+
+    // Data going out carries the ACK; otherwise send a bare one
+    if (tcp_output(pcb) == 0 && need_ack) {
+        tcp_send_ack(pcb);
+    }
+
+    // Callbacks may close or reuse the pcb, so they come last
+    if (accepted_by != NULL) {
+        tcp_notify(accepted_by, NET_EV_READABLE);
+    }
+    tcp_notify(pcb, events);
+}
+
+void tcp_tick(uint32_t now) {
+    for (int i = 0; i < TCP_MAX_PCBS; i++) {
+        tcp_pcb_t *pcb = &tcp_pcbs[i];
+        if (!pcb->used) {
+            continue;
+        }
+        if (pcb->state == TCP_TIME_WAIT && !time_after(pcb->tw_deadline, now)) {
+            tcp_pcb_free(pcb);
+            continue;
+        }
+        if (!pcb->rtx_armed || time_after(pcb->rtx_deadline, now)) {
+            continue;
+        }
+        pcb->rtx_armed = 0;
+
+        if (pcb->persist) {
+            // Push the head segment past the closed window; the reply
+            // carries the window whether or not the data fits
+            tcp_seg_t *probe = pcb->unacked;
+            if (probe != NULL) {
+                probe->rexmit = 1;
+                tcp_send(pcb, probe->seq, probe->flags, probe->p, probe->len);
+            } else if (pcb->unsent != NULL) {
+                tcp_send_head(pcb);
+            } else {
+                pcb->persist = 0;
+                continue;
+            }
+            if ((pcb->rto << pcb->persist_backoff) < MS_TO_TICKS(TCP_RTO_MAX_MS)) {
+                pcb->persist_backoff++;
+            }
+            tcp_persist_arm(pcb);
+        } else if (pcb->unacked != NULL) {
+            int syn = pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RCVD;
+            if (++pcb->retries > (syn ? TCP_SYN_RETRIES : TCP_MAX_RETRIES)) {
+                tcp_notify(pcb, tcp_fail(pcb));
+                continue;
+            }
+            // Loss: back off and restart from one segment
+            pcb->ssthresh = max_u32((pcb->snd_nxt - pcb->snd_una) / 2, 2 * pcb->mss);
+            pcb->cwnd = pcb->mss;
+            pcb->rto = min_u32(pcb->rto * 2, MS_TO_TICKS(TCP_RTO_MAX_MS));
+            tcp_retransmit(pcb);
+        } else if (pcb->unsent != NULL) {
+            // A send that earlier ran out of buffers
+            tcp_send_head(pcb);
+        }
+    }
+}
+
+tcp_pcb_t *tcp_new() {
+    uint32_t irq = net_enter();
+    tcp_pcb_t *pcb = tcp_pcb_alloc();
+    net_leave(irq);
+    return pcb;
+}
+
+int tcp_bind(tcp_pcb_t *pcb, uint16_t port) {
+    uint32_t irq = net_enter();
+
+    if (port == 0) {
+        for (int tries = 0; tries < 65536 - TCP_EPHEMERAL_BASE; tries++) {
+            uint16_t candidate = tcp_next_port;
+            tcp_next_port = tcp_next_port == 65535 ? TCP_EPHEMERAL_BASE : tcp_next_port + 1;
+            if (!tcp_port_used(candidate, 0)) {
+                port = candidate;
+                break;
+            }
+        }
+    }
+    if (port == 0 || tcp_port_used(port, 1)) {
+        net_leave(irq);
+        return NET_ERR;
+    }
+    pcb->local_port = port;
+
+    net_leave(irq);
+    return 0;
+}
+
+int tcp_listen(tcp_pcb_t *pcb, int backlog) {
+    if (pcb->state != TCP_CLOSED || pcb->local_port == 0) {
+        return NET_ERR;
+    }
+    uint32_t irq = net_enter();
+    pcb->backlog = backlog < 1 ? 1 : backlog > TCP_BACKLOG_MAX ? TCP_BACKLOG_MAX : backlog;
+    pcb->state = TCP_LISTEN;
+    net_leave(irq);
+    return 0;
+}
+
+tcp_pcb_t *tcp_accept(tcp_pcb_t *listener) {
+    uint32_t irq = net_enter();
+    tcp_pcb_t *c = listener->accept_queue;
+
+    if (c != NULL) {
+        listener->accept_queue = c->accept_next;
+        listener->pending--;
+        c->accept_next = NULL;
+        c->parent = NULL;
+    }
+
+    net_leave(irq);
+    return c;
+}
+
+int tcp_connect(tcp_pcb_t *pcb, uint32_t ip, uint16_t port) {
+    if (pcb->state != TCP_CLOSED || pcb->error) {
+        return NET_ERR;
+    }
+    if (pcb->local_port == 0 && tcp_bind(pcb, 0) != 0) {
+        return NET_ERR;
+    }
+
+    uint32_t irq = net_enter();
+    pcb->remote_ip = ip;
+    pcb->remote_port = port;
+    pcb->state = TCP_SYN_SENT;
+    pcb->snd_wnd = TCP_DEFAULT_MSS;
+    if (tcp_start(pcb) != 0) {
+        pcb->state = TCP_CLOSED;
+        net_leave(irq);
+        return NET_ERR;
+    }
+    tcp_output(pcb);
+    net_leave(irq);
+    return 0;
+}
+
+// Data is copied once into segment-sized pbufs; small writes fill up the
+// tail segment while it is still unsent
+int tcp_write(tcp_pcb_t *pcb, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+    uint32_t done = 0;
+    uint32_t irq = net_enter();
+
+    if (pcb->state != TCP_ESTABLISHED && pcb->state != TCP_CLOSE_WAIT) {
+        int ret = pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RCVD ? NET_AGAIN : NET_ERR;
+        net_leave(irq);
+        return ret;
+    }
+
+    while (done < len && pcb->snd_queued < TCP_SND_BUF) {
+        uint32_t room = TCP_SND_BUF - pcb->snd_queued;
+        tcp_seg_t *tail = seg_last(pcb->unsent);
+        uint32_t n;
+
+        if (tail != NULL && tail->p != NULL && !(tail->flags & TCP_FIN) && tail->len < pcb->mss) {
+            n = min_u32(min_u32(pcb->mss - tail->len, len - done), room);
+            memcpy(pbuf_put(tail->p, n), src + done, n);
+            tail->len += n;
+        } else {
+            tcp_seg_t *seg = seg_alloc();
+            pbuf_t *p = seg != NULL ? pbuf_alloc(0, 0) : NULL;
+            if (p == NULL) {
+                if (seg != NULL) {
+                    seg_release(seg);
+                }
+                break;
+            }
+            n = min_u32(min_u32(pcb->mss, len - done), room);
+            memcpy(pbuf_put(p, n), src + done, n);
+            seg->p = p;
+            seg->len = n;
+            seg->seq = pcb->snd_end;
+            seg_append(&pcb->unsent, seg);
+        }
+        pcb->snd_end += n;
+        pcb->snd_queued += n;
+        done += n;
+    }
+    if (done < len) {
+        pcb->snd_full = 1;
+    }
+    tcp_output(pcb);
+
+    net_leave(irq);
+    return done > 0 ? (int)done : NET_AGAIN;
+}
+
+int tcp_read(tcp_pcb_t *pcb, void *buf, uint32_t len) {
+    uint8_t *dst = buf;
+    uint32_t irq = net_enter();
+
+    if (pcb->rcv_count == 0) {
+        int ret = pcb->fin_received ? 0 : pcb->error ? NET_ERR : NET_AGAIN;
+        net_leave(irq);
+        return ret;
+    }
+
+    uint32_t n = min_u32(len, pcb->rcv_count);
+    uint32_t first = min_u32(n, TCP_RCV_BUF - pcb->rcv_head);
+    memcpy(dst, pcb->rcv_buf + pcb->rcv_head, first);
+    memcpy(dst + first, pcb->rcv_buf, n - first);
+    pcb->rcv_head = (pcb->rcv_head + n) % TCP_RCV_BUF;
+    pcb->rcv_count -= n;
+
+    // Tell the peer once a useful amount of window has opened up
+    uint32_t wnd = tcp_rcv_window(pcb);
+    if (pcb->state >= TCP_ESTABLISHED && !pcb->fin_received && wnd > pcb->rcv_adv &&
+        wnd - pcb->rcv_adv >= min_u32(TCP_RCV_BUF / 2, 2 * pcb->mss)) {
+        tcp_send_ack(pcb);
+    }
+
+    net_leave(irq);
+    return n;
+}
+
+uint32_t tcp_poll(tcp_pcb_t *pcb) {
+    uint32_t events = 0;
+
+    if (pcb->state == TCP_LISTEN) {
+        return pcb->accept_queue != NULL ? NET_EV_READABLE : 0;
+    }
+    if (pcb->rcv_count > 0 || pcb->fin_received || pcb->error) {
+        events |= NET_EV_READABLE;
+    }
+    if ((pcb->state == TCP_ESTABLISHED || pcb->state == TCP_CLOSE_WAIT) &&
+        pcb->snd_queued < TCP_SND_BUF) {
+        events |= NET_EV_WRITABLE;
+    }
+    if (pcb->error) {
+        events |= NET_EV_ERROR | NET_EV_HUP;
+    }
+    return events;
+}
+
+void tcp_set_event(tcp_pcb_t *pcb, tcp_event_fn fn, void *arg) {
+    uint32_t irq = net_enter();
+    pcb->event = fn;
+    pcb->arg = arg;
+    net_leave(irq);
+}
+
+void tcp_close(tcp_pcb_t *pcb) {
+    uint32_t irq = net_enter();
+
+    pcb->event = NULL;
+    switch (pcb->state) {
+    case TCP_SYN_RCVD:
+    case TCP_ESTABLISHED:
+    case TCP_CLOSE_WAIT:
+        if (tcp_queue_ctl(pcb, TCP_FIN) != 0) {
+            tcp_send(pcb, pcb->snd_nxt, TCP_RST, NULL, 0);
+            tcp_pcb_free(pcb);
+            break;
+        }
+        pcb->state = pcb->state == TCP_CLOSE_WAIT ? TCP_LAST_ACK : TCP_FIN_WAIT_1;
+        pcb->detached = 1;
+        tcp_output(pcb);
+        break;
+    case TCP_LISTEN:
+        // Connections nobody accepted go down with the listener
+        for (int i = 0; i < TCP_MAX_PCBS; i++) {
+            tcp_pcb_t *c = &tcp_pcbs[i];
+            if (c->used && c->parent == pcb) {
+                tcp_send(c, c->snd_nxt, TCP_RST, NULL, 0);
+                tcp_pcb_free(c);
+            }
+        }
+        tcp_pcb_free(pcb);
+        break;
+    case TCP_CLOSED:
+    case TCP_SYN_SENT:
+        tcp_pcb_free(pcb);
+        break;
+    default:
+        pcb->detached = 1;
+        break;
+    }
+
+    net_leave(irq);
+}
+
+void tcp_abort(tcp_pcb_t *pcb) {
+    uint32_t irq = net_enter();
+
+    if (pcb->state >= TCP_SYN_RCVD && pcb->state != TCP_TIME_WAIT) {
+        tcp_stats.resets++;
+        tcp_send(pcb, pcb->snd_nxt, TCP_RST, NULL, 0);
+    }
+    tcp_pcb_free(pcb);
+
+    net_leave(irq);
+}
+
+void tcp_print_stats() {
+    k_print_string("tcp: bad=");
+    k_print_dec(tcp_stats.bad);
+    k_print_string(" no-pcb=");
+    k_print_dec(tcp_stats.no_pcb);
+    k_print_string(" resets=");
+    k_print_dec(tcp_stats.resets);
+    k_print_string(" out-of-order=");
+    k_print_dec(tcp_stats.out_of_order);
+    k_print_string(" backlog-full=");
+    k_print_dec(tcp_stats.backlog_full);
+    k_print_string(" no-memory=");
+    k_print_dec(tcp_stats.no_memory);
+    k_print_string("\n");
+
+    for (int i = 0; i < TCP_MAX_PCBS; i++) {
+        tcp_pcb_t *pcb = &tcp_pcbs[i];
+        if (!pcb->used) {
+            continue;
+        }
+        k_print_string("  :");
+        k_print_dec(pcb->local_port);
+        if (pcb->remote_port != 0) {
+            k_print_string(" -> ");
+            net_print_ip(pcb->remote_ip);
+            k_put_char(':');
+            k_print_dec(pcb->remote_port);
+        }
+        k_put_char(' ');
+        k_print_string(state_names[pcb->state]);
+        k_print_string(" in=");
+        k_print_dec(pcb->segs_in);
+        k_print_string(" out=");
+        k_print_dec(pcb->segs_out);
+        k_print_string(" rexmit=");
+        k_print_dec(pcb->retransmits);
+        k_print_string(" cwnd=");
+        k_print_dec(pcb->cwnd);
+        k_print_string(" rto=");
+        k_print_dec(pcb->rto);
+        k_print_string("ms\n");
+    }
+}
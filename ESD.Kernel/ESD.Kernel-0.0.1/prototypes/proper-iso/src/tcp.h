@@ -0,0 +1,149 @@
+#ifndef TCP_H
+#define TCP_H
+
+#include <stdint.h>
+#include "net.h"
+
+#define TCP_HLEN           20
+#define TCP_MSS            (ETH_MTU - IP_HLEN - TCP_HLEN)
+#define TCP_DEFAULT_MSS    536
+#define TCP_MAX_PCBS       16
+#define TCP_RCV_BUF        8192
+#define TCP_SND_BUF        16384
+#define TCP_SEGS           256  // segment descriptors shared by all connections
+#define TCP_BACKLOG_MAX    8
+#define TCP_EPHEMERAL_BASE 49152
+
+#define TCP_RTO_INITIAL_MS 1000
+#define TCP_RTO_MIN_MS     200
+#define TCP_RTO_MAX_MS     60000
+#define TCP_SYN_RETRIES    5
+#define TCP_MAX_RETRIES    8
+#define TCP_TIME_WAIT_MS   2000
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+#define TCP_CLOSED      0
+#define TCP_LISTEN      1
+#define TCP_SYN_SENT    2
+#define TCP_SYN_RCVD    3
+#define TCP_ESTABLISHED 4
+#define TCP_FIN_WAIT_1  5
+#define TCP_FIN_WAIT_2  6
+#define TCP_CLOSE_WAIT  7
+#define TCP_CLOSING     8
+#define TCP_LAST_ACK    9
+#define TCP_TIME_WAIT   10
+
+typedef struct {
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t off;
+    uint8_t flags;
+    uint16_t wnd;
+    uint16_t csum;
+    uint16_t urg;
+} __attribute__((packed)) tcp_hdr_t;
+
+// Queued or in-flight sequence space. Data lives in a single-piece pbuf
+// that each transmission references rather than copies.
+typedef struct tcp_seg {
+    pbuf_t *p;                  // NULL for a bare SYN or FIN
+    uint32_t seq;
+    uint16_t len;               // data bytes
+    uint8_t flags;              // TCP_SYN and/or TCP_FIN
+    uint8_t rexmit;             // no RTT sample once retransmitted
+    uint32_t sent_at;
+    struct tcp_seg *next;
+} tcp_seg_t;
+
+typedef struct tcp_pcb tcp_pcb_t;
+typedef void (*tcp_event_fn)(tcp_pcb_t *pcb, uint32_t events, void *arg);
+
+struct tcp_pcb {
+    int used;
+    int state;
+    int detached;               // closed by its owner, freed by the stack
+    int error;                  // reset or timed out
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint32_t remote_ip;
+
+    // Send side
+    uint32_t iss;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t snd_end;           // after the last byte queued
+    uint32_t snd_wnd;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint16_t mss;
+    uint8_t dupacks;
+    uint8_t retries;
+    int snd_full;               // a write came up short
+    uint32_t snd_queued;        // data bytes unsent or unacked
+    tcp_seg_t *unsent;
+    tcp_seg_t *unacked;
+
+    // Retransmission, in timer ticks
+    uint32_t rto;
+    uint32_t srtt;
+    uint32_t rttvar;
+    int rtx_armed;
+    uint32_t rtx_deadline;
+    uint32_t tw_deadline;
+    int persist;                // the timer is probing a zero window
+    uint8_t persist_backoff;
+
+    // Receive side
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;           // window last advertised
+    int fin_received;
+    uint32_t rcv_head;
+    uint32_t rcv_count;
+    uint8_t rcv_buf[TCP_RCV_BUF];
+
+    // Listening: connections waiting for tcp_accept()
+    tcp_pcb_t *parent;
+    tcp_pcb_t *accept_next;
+    tcp_pcb_t *accept_queue;
+    int backlog;
+    int pending;
+
+    tcp_event_fn event;
+    void *arg;
+
+    uint32_t segs_in;
+    uint32_t segs_out;
+    uint32_t retransmits;
+};
+
+tcp_pcb_t *tcp_new();
+// Port 0 picks an ephemeral port
+int tcp_bind(tcp_pcb_t *pcb, uint16_t port);
+int tcp_listen(tcp_pcb_t *pcb, int backlog);
+tcp_pcb_t *tcp_accept(tcp_pcb_t *listener);
+// Completes asynchronously; NET_EV_WRITABLE reports the connection is up
+int tcp_connect(tcp_pcb_t *pcb, uint32_t ip, uint16_t port);
+// Queue what fits in the send buffer; NET_AGAIN if nothing does
+int tcp_write(tcp_pcb_t *pcb, const void *data, uint32_t len);
+// 0 at end of stream, NET_AGAIN if nothing has arrived yet
+int tcp_read(tcp_pcb_t *pcb, void *buf, uint32_t len);
+uint32_t tcp_poll(tcp_pcb_t *pcb);
+// Called from the stack, with events as they happen
+void tcp_set_event(tcp_pcb_t *pcb, tcp_event_fn fn, void *arg);
+// Orderly shutdown; the pcb must not be used afterwards
+void tcp_close(tcp_pcb_t *pcb);
+void tcp_abort(tcp_pcb_t *pcb);
+
+void tcp_input(const ip_hdr_t *ip, const uint8_t *data, uint32_t len, uint32_t rx_flags);
+void tcp_tick(uint32_t now);
+void tcp_print_stats();
+
+#endif
@@ -0,0 +1,286 @@
+#include "term.h"
+#include "simple_kernel.h"
+
+// Handles the subset of ECMA-48 that console programs use: cursor
+// movement, erase in line/display, SGR colours and DEC cursor save. Runs
+// of printable text skip the state machine entirely; rendering is left
+// to the caller, which updates the screen once per buffer.
+
+enum {
+    STATE_GROUND,
+    STATE_ESCAPE,
+    STATE_CSI,
+};
+
+static struct {
+    int state;
+    int private;                        // CSI ? ... sequences, ignored
+    int params[TERM_MAX_PARAMS];
+    int nparams;
+    int reverse;
+    int saved_x, saved_y;
+    unsigned char saved_attr;
+} term = { STATE_GROUND, 0, { 0 }, 0, 0, 0, 0, DEFAULT_ATTR };
+
+// ANSI colour order to VGA palette order
+static const uint8_t ansi_to_vga[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+void term_reset() {
+    term.state = STATE_GROUND;
+    term.reverse = 0;
+    term.saved_x = term.saved_y = 0;
+    term.saved_attr = DEFAULT_ATTR;
+}
+
+// An explicit attribute replaces whatever SGR state produced the old one
+void term_set_attr(unsigned char attr) {
+    term.reverse = 0;
+    current_attr = attr;
+}
+
+static int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Missing and zero parameters both mean the default
+static int param(int i, int def) {
+    return i < term.nparams && term.params[i] > 0 ? term.params[i] : def;
+}
+
+static void erase(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y <= y1; y++) {
+        int from = y == y0 ? x0 : 0;
+        int to = y == y1 ? x1 : console_width - 1;
+        for (int x = from; x <= to; x++) {
+            console_set_cell(x, y, ' ', current_attr);
+        }
+    }
+}
+
+static void sgr() {
+    if (term.nparams == 0) {
+        term.nparams = 1;
+        term.params[0] = 0;
+    }
+
+    for (int i = 0; i < term.nparams; i++) {
+        int p = term.params[i];
+        unsigned char attr = current_attr;
+
+        // Colour changes apply to the unswapped attribute
+        if (term.reverse) {
+            attr = (attr << 4) | (attr >> 4);
+        }
+
+        if (p == 0) {
+            attr = DEFAULT_ATTR;
+            term.reverse = 0;
+        } else if (p == 1) {
+            attr |= 0x08;
+        } else if (p == 22) {
+            attr &= ~0x08;
+        } else if (p == 7) {
+            term.reverse = 1;
+        } else if (p == 27) {
+            term.reverse = 0;
+        } else if (p >= 30 && p <= 37) {
+            attr = (attr & 0xF8) | ansi_to_vga[p - 30];
+        } else if (p == 39) {
+            attr = (attr & 0xF0) | (DEFAULT_ATTR & 0x0F);
+        } else if (p >= 40 && p <= 47) {
+            attr = (attr & 0x8F) | (ansi_to_vga[p - 40] << 4);
+        } else if (p == 49) {
+            attr = (attr & 0x0F) | (DEFAULT_ATTR & 0xF0);
+        } else if (p >= 90 && p <= 97) {
+            attr = (attr & 0xF0) | ansi_to_vga[p - 90] | 0x08;
+        } else if (p >= 100 && p <= 107) {
+            attr = (attr & 0x0F) | ((ansi_to_vga[p - 100] | 0x08) << 4);
+        }
+
+        current_attr = term.reverse ? (attr << 4) | (attr >> 4) : attr;
+    }
+}
+
+static void csi_dispatch(char final) {
+    int max_x = console_width - 1;
+    int max_y = console_height - 1;
+
+    if (term.private) {
+        return;
+    }
+
+    switch (final) {
+    case 'A':
+        cursor_y = clamp(cursor_y - param(0, 1), 0, max_y);
+        break;
+    case 'B':
+        cursor_y = clamp(cursor_y + param(0, 1), 0, max_y);
+        break;
+    case 'C':
+        cursor_x = clamp(cursor_x + param(0, 1), 0, max_x);
+        break;
+    case 'D':
+        cursor_x = clamp(cursor_x - param(0, 1), 0, max_x);
+        break;
+    case 'E':
+        cursor_y = clamp(cursor_y + param(0, 1), 0, max_y);
+        cursor_x = 0;
+        break;
+    case 'F':
+        cursor_y = clamp(cursor_y - param(0, 1), 0, max_y);
+        cursor_x = 0;
+        break;
+    case 'G':
+        cursor_x = clamp(param(0, 1) - 1, 0, max_x);
+        break;
+    case 'd':
+        cursor_y = clamp(param(0, 1) - 1, 0, max_y);
+        break;
+    case 'H':
+    case 'f':
+        cursor_y = clamp(param(0, 1) - 1, 0, max_y);
+        cursor_x = clamp(param(1, 1) - 1, 0, max_x);
+        break;
+    case 'J':
+        switch (term.nparams > 0 ? term.params[0] : 0) {
+        case 0:
+            erase(cursor_x, cursor_y, max_x, max_y);
+            break;
+        case 1:
+            erase(0, 0, cursor_x, cursor_y);
+            break;
+        default:
+            erase(0, 0, max_x, max_y);
+            break;
+        }
+        break;
+    case 'K':
+        switch (term.nparams > 0 ? term.params[0] : 0) {
+        case 0:
+            erase(cursor_x, cursor_y, max_x, cursor_y);
+            break;
+        case 1:
+            erase(0, cursor_y, cursor_x, cursor_y);
+            break;
+        default:
+            erase(0, cursor_y, max_x, cursor_y);
+            break;
+        }
+        break;
+    case 'm':
+        sgr();
+        break;
+    case 's':
+        term.saved_x = cursor_x;
+        term.saved_y = cursor_y;
+        break;
+    case 'u':
+        cursor_x = clamp(term.saved_x, 0, max_x);
+        cursor_y = clamp(term.saved_y, 0, max_y);
+        break;
+    }
+}
+
+static void control(char c) {
+    switch (c) {
+    case '\n':
+        console_put_char('\n');
+        break;
+    case '\r':
+        cursor_x = 0;
+        break;
+    case '\b':
+        if (cursor_x > 0) {
+            cursor_x--;
+        }
+        break;
+    case '\t':
+        do {
+            console_put_char(' ');
+        } while (cursor_x % TERM_TAB_WIDTH != 0);
+        break;
+    case 0x1B:
+        term.state = STATE_ESCAPE;
+        break;
+    }
+}
+
+static void escape(char c) {
+    term.state = STATE_GROUND;
+
+    switch (c) {
+    case '[':
+        term.state = STATE_CSI;
+        term.private = 0;
+        term.nparams = 0;
+        term.params[0] = 0;
+        break;
+    case '7':
+        term.saved_x = cursor_x;
+        term.saved_y = cursor_y;
+        term.saved_attr = current_attr;
+        break;
+    case '8':
+        cursor_x = clamp(term.saved_x, 0, console_width - 1);
+        cursor_y = clamp(term.saved_y, 0, console_height - 1);
+        current_attr = term.saved_attr;
+        break;
+    case 'c':
+        term_reset();
+        current_attr = DEFAULT_ATTR;
+        erase(0, 0, console_width - 1, console_height - 1);
+        cursor_x = cursor_y = 0;
+        break;
+    }
+}
+
+static void csi(char c) {
+    if (c >= '0' && c <= '9') {
+        if (term.nparams == 0) {
+            term.nparams = 1;
+        }
+        int *p = &term.params[term.nparams - 1];
+        if (*p < 10000) {
+            *p = *p * 10 + (c - '0');
+        }
+    } else if (c == ';') {
+        if (term.nparams == 0) {
+            term.nparams = 1;
+        }
+        if (term.nparams < TERM_MAX_PARAMS) {
+            term.params[term.nparams++] = 0;
+        }
+    } else if (c == '?' || c == '>' || c == '=') {
+        term.private = 1;
+    } else if (c >= 0x40 && c <= 0x7E) {
+        csi_dispatch(c);
+        term.state = STATE_GROUND;
+    } else if (c == 0x1B) {
+        term.state = STATE_ESCAPE;
+    } else if ((unsigned char)c < ' ') {
+        // C0 controls take effect inside a sequence too
+        control(c);
+    }
+}
+
+void term_feed(const char *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        char c = buf[i];
+
+        if (term.state == STATE_GROUND) {
+            // Plain text is the common case
+            while ((unsigned char)c >= ' ' && c != 0x7F) {
+                console_put_char(c);
+                if (++i == len) {
+                    return;
+                }
+                c = buf[i];
+            }
+            control(c);
+        } else if (term.state == STATE_ESCAPE) {
+            escape(c);
+        } else {
+            csi(c);
+        }
+    }
+}
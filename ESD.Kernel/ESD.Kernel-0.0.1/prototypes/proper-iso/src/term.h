@@ -0,0 +1,24 @@
+#ifndef TERM_H
+#define TERM_H
+
+#include <stdint.h>
+
+#define TERM_MAX_PARAMS 8
+#define TERM_TAB_WIDTH  8
+
+// Runs bytes through the VT100/ANSI parser onto the console. Caller holds
+// console_lock and updates the cursor once afterwards.
+void term_feed(const char *buf, uint32_t len);
+void term_reset();
+void term_set_attr(unsigned char attr);
+
+// Console back end in simple_kernel.c; caller holds console_lock
+extern int cursor_x;
+extern int cursor_y;
+extern int console_width;
+extern int console_height;
+extern unsigned char current_attr;
+void console_put_char(char c);
+void console_set_cell(int x, int y, char c, unsigned char attr);
+
+#endif
@@ -0,0 +1,97 @@
+#include "timer.h"
+#include "isr.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND  0x43
+#define PIT_BASE_HZ  1193182
+
+static volatile uint32_t ticks = 0;
+
+// Pending timers sorted by expiry
+static ktimer_t *timer_list = NULL;
+
+static void timer_irq(registers_t *regs) {
+    (void)regs;
+
+    ticks++;
+
+    while (timer_list != NULL && !time_after(timer_list->expires, ticks)) {
+        ktimer_t *t = timer_list;
+        timer_list = t->next;
+        t->active = 0;
+        t->fn(t->ctx);
+    }
+}
+
+void timer_init() {
+    uint16_t divisor = PIT_BASE_HZ / TIMER_HZ;
+
+    outb(PIT_COMMAND, 0x36);    // Channel 0, lo/hi byte, square wave
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    isr_install_handler(IRQ0, timer_irq);
+    pic_unmask_irq(0);
+}
+
+uint32_t timer_ticks() {
+    return ticks;
+}
+
+void timer_add(ktimer_t *timer, uint32_t delay, timer_fn_t fn, void *ctx) {
+    uint32_t flags = irq_save();
+
+    if (timer->active) {
+        timer_cancel(timer);
+    }
+    timer->expires = ticks + (delay ? delay : 1);
+    timer->fn = fn;
+    timer->ctx = ctx;
+    timer->active = 1;
+
+    ktimer_t **pos = &timer_list;
+    while (*pos != NULL && !time_after((*pos)->expires, timer->expires)) {
+        pos = &(*pos)->next;
+    }
+    timer->next = *pos;
+    *pos = timer;
+
+    irq_restore(flags);
+}
+
+void timer_cancel(ktimer_t *timer) {
+    uint32_t flags = irq_save();
+
+    for (ktimer_t **pos = &timer_list; *pos != NULL; pos = &(*pos)->next) {
+        if (*pos == timer) {
+            *pos = timer->next;
+            break;
+        }
+    }
+    timer->active = 0;
+
+    irq_restore(flags);
+}
+
+uint32_t timer_pending() {
+    uint32_t flags = irq_save();
+    uint32_t count = 0;
+
+    for (ktimer_t *t = timer_list; t != NULL; t = t->next) {
+        count++;
+    }
+
+    irq_restore(flags);
+    return count;
+}
+
+// Halts between ticks, needs interrupts enabled
+void timer_sleep(uint32_t ms) {
+    uint32_t until = ticks + MS_TO_TICKS(ms);
+    while (time_after(until, ticks)) {
+        asm volatile ( "hlt" );
+    }
+}
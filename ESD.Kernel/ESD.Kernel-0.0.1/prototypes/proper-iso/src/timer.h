@@ -0,0 +1,31 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_HZ 1000
+#define MS_TO_TICKS(ms) (((ms) * TIMER_HZ + 999) / 1000)
+
+typedef void (*timer_fn_t)(void *ctx);
+
+// One-shot timer, callbacks run in IRQ0 context
+typedef struct ktimer {
+    uint32_t expires;
+    timer_fn_t fn;
+    void *ctx;
+    int active;
+    struct ktimer *next;
+} ktimer_t;
+
+void timer_init();
+uint32_t timer_ticks();
+void timer_add(ktimer_t *timer, uint32_t delay, timer_fn_t fn, void *ctx);
+void timer_cancel(ktimer_t *timer);
+uint32_t timer_pending();
+void timer_sleep(uint32_t ms);
+
+static inline int time_after(uint32_t a, uint32_t b) {
+    return (int32_t)(b - a) < 0;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#include "trace.h"
+#include "cpu.h"
+
+// Lossy ring of recent kernel events, read back by the panic path
+static trace_entry_t trace_ring[TRACE_SIZE];
+static uint32_t trace_head = 0;
+
+void trace_record(uint16_t event, uint32_t arg) {
+    uint32_t flags = irq_save();
+    trace_entry_t *entry = &trace_ring[trace_head++ % TRACE_SIZE];
+
+    entry->tsc_lo = cpu_features.tsc ? (uint32_t)rdtsc() : 0;
+    entry->event = event;
+    entry->cpu = cpu_id();
+    entry->arg = arg;
+
+    irq_restore(flags);
+}
+
+// Copy the newest count entries, oldest first
+int trace_tail(trace_entry_t *out, int count) {
+    uint32_t available = trace_head < TRACE_SIZE ? trace_head : TRACE_SIZE;
+
+    if ((uint32_t)count > available) {
+        count = available;
+    }
+    for (int i = 0; i < count; i++) {
+        out[i] = trace_ring[(trace_head - count + i) % TRACE_SIZE];
+    }
+    return count;
+}
@@ -0,0 +1,22 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_SIZE 64
+
+#define TRACE_IRQ        1
+#define TRACE_EXCEPTION  2
+#define TRACE_PAGE_FAULT 3
+
+typedef struct {
+    uint32_t tsc_lo;
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t arg;
+} __attribute__((packed)) trace_entry_t;
+
+void trace_record(uint16_t event, uint32_t arg);
+int trace_tail(trace_entry_t *out, int count);
+
+#endif
@@ -0,0 +1,197 @@
+#include "udp.h"
+#include "mem.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static udp_pcb_t udp_pcbs[UDP_MAX_PCBS];
+static uint16_t udp_next_port = UDP_EPHEMERAL_BASE;
+static uint32_t udp_no_port = 0;
+
+static udp_pcb_t *udp_lookup(uint16_t port) {
+    for (int i = 0; i < UDP_MAX_PCBS; i++) {
+        if (udp_pcbs[i].used && udp_pcbs[i].local_port == port) {
+            return &udp_pcbs[i];
+        }
+    }
+    return NULL;
+}
+
+udp_pcb_t *udp_new() {
+    udp_pcb_t *pcb = NULL;
+    uint32_t irq = net_enter();
+
+    for (int i = 0; i < UDP_MAX_PCBS; i++) {
+        if (!udp_pcbs[i].used) {
+            pcb = &udp_pcbs[i];
+            memset(pcb, 0, sizeof(*pcb));
+            pcb->used = 1;
+            break;
+        }
+    }
+
+    net_leave(irq);
+    return pcb;
+}
+
+int udp_bind(udp_pcb_t *pcb, uint16_t port) {
+    uint32_t irq = net_enter();
+
+    if (port == 0) {
+        for (int tries = 0; tries < 65536 - UDP_EPHEMERAL_BASE; tries++) {
+            uint16_t candidate = udp_next_port;
+            udp_next_port = udp_next_port == 65535 ? UDP_EPHEMERAL_BASE : udp_next_port + 1;
+            if (udp_lookup(candidate) == NULL) {
+                port = candidate;
+                break;
+            }
+        }
+    }
+    if (port == 0 || udp_lookup(port) != NULL) {
+        net_leave(irq);
+        return NET_ERR;
+    }
+    pcb->local_port = port;
+
+    net_leave(irq);
+    return 0;
+}
+
+// The payload is copied once, behind enough headroom that the UDP, IP and
+// Ethernet headers are prepended in place
+int udp_sendto(udp_pcb_t *pcb, const void *data, uint32_t len, uint32_t ip, uint16_t port) {
+    if (len > UDP_MAX_PAYLOAD) {
+        return NET_ERR;
+    }
+    if (pcb->local_port == 0 && udp_bind(pcb, 0) != 0) {
+        return NET_ERR;
+    }
+    pbuf_t *p = pbuf_alloc(PBUF_HEADROOM, len);
+    if (p == NULL) {
+        return NET_AGAIN;
+    }
+    memcpy(p->payload, data, len);
+
+    udp_hdr_t *udp = pbuf_push(p, UDP_HLEN);
+    udp->sport = htons(pcb->local_port);
+    udp->dport = htons(port);
+    udp->len = htons(p->tot_len);
+
+    uint32_t irq = net_enter();
+    ip_l4_csum(p, ip, IP_PROTO_UDP, 6);
+    int ret = ip_output(p, ip, IP_PROTO_UDP);
+    pcb->tx_datagrams++;
+    net_leave(irq);
+    return ret == 0 ? (int)len : NET_ERR;
+}
+
+int udp_recvfrom(udp_pcb_t *pcb, void *buf, uint32_t len, uint32_t *ip, uint16_t *port) {
+    uint32_t irq = net_enter();
+
+    if (pcb->rx_count == 0) {
+        net_leave(irq);
+        return NET_AGAIN;
+    }
+    pbuf_t *p = pcb->rxq[pcb->rx_head].p;
+    if (ip != NULL) {
+        *ip = pcb->rxq[pcb->rx_head].ip;
+    }
+    if (port != NULL) {
+        *port = pcb->rxq[pcb->rx_head].port;
+    }
+    pcb->rx_head = (pcb->rx_head + 1) % UDP_RX_QUEUE;
+    pcb->rx_count--;
+    net_leave(irq);
+
+    uint32_t n = pbuf_copy_out(p, 0, buf, len);
+    pbuf_free(p);
+    return n;
+}
+
+uint32_t udp_poll(udp_pcb_t *pcb) {
+    return NET_EV_WRITABLE | (pcb->rx_count > 0 ? NET_EV_READABLE : 0);
+}
+
+void udp_set_event(udp_pcb_t *pcb, udp_event_fn fn, void *arg) {
+    uint32_t irq = net_enter();
+    pcb->event = fn;
+    pcb->arg = arg;
+    net_leave(irq);
+}
+
+void udp_close(udp_pcb_t *pcb) {
+    uint32_t irq = net_enter();
+
+    while (pcb->rx_count > 0) {
+        pbuf_free(pcb->rxq[pcb->rx_head].p);
+        pcb->rx_head = (pcb->rx_head + 1) % UDP_RX_QUEUE;
+        pcb->rx_count--;
+    }
+    pcb->used = 0;
+    pcb->event = NULL;
+
+    net_leave(irq);
+}
+
+void udp_input(const ip_hdr_t *ip, const uint8_t *data, uint32_t len, uint32_t rx_flags) {
+    const udp_hdr_t *udp = (const udp_hdr_t *)data;
+
+    if (len < UDP_HLEN || ntohs(udp->len) < UDP_HLEN || ntohs(udp->len) > len) {
+        net_stats.ip_bad++;
+        return;
+    }
+    len = ntohs(udp->len);
+    // A zero checksum means the sender did not compute one
+    if (udp->csum != 0 && ip_l4_verify(ip, data, len, rx_flags) != 0) {
+        return;
+    }
+
+    udp_pcb_t *pcb = udp_lookup(ntohs(udp->dport));
+    if (pcb == NULL) {
+        udp_no_port++;
+        return;
+    }
+    if (pcb->rx_count == UDP_RX_QUEUE) {
+        pcb->rx_dropped++;
+        return;
+    }
+
+    // The NIC reuses its buffer as soon as we return
+    pbuf_t *p = pbuf_alloc(0, len - UDP_HLEN);
+    if (p == NULL) {
+        pcb->rx_dropped++;
+        return;
+    }
+    memcpy(p->payload, data + UDP_HLEN, len - UDP_HLEN);
+
+    int slot = (pcb->rx_head + pcb->rx_count) % UDP_RX_QUEUE;
+    pcb->rxq[slot].p = p;
+    pcb->rxq[slot].ip = ntohl(ip->src);
+    pcb->rxq[slot].port = ntohs(udp->sport);
+    pcb->rx_count++;
+    pcb->rx_datagrams++;
+
+    if (pcb->event != NULL) {
+        pcb->event(pcb, NET_EV_READABLE, pcb->arg);
+    }
+}
+
+void udp_print_stats() {
+    k_print_string("udp:");
+    for (int i = 0; i < UDP_MAX_PCBS; i++) {
+        udp_pcb_t *pcb = &udp_pcbs[i];
+        if (!pcb->used) {
+            continue;
+        }
+        k_print_string(" :");
+        k_print_dec(pcb->local_port);
+        k_print_string(" rx=");
+        k_print_dec(pcb->rx_datagrams);
+        k_print_string("/");
+        k_print_dec(pcb->rx_dropped);
+        k_print_string(" tx=");
+        k_print_dec(pcb->tx_datagrams);
+    }
+    k_print_string(" no-port=");
+    k_print_dec(udp_no_port);
+    k_print_string("\n");
+}
@@ -0,0 +1,55 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdint.h>
+#include "net.h"
+
+#define UDP_HLEN           8
+#define UDP_MAX_PCBS       16
+#define UDP_RX_QUEUE       32   // datagrams held per socket
+#define UDP_MAX_PAYLOAD    (ETH_MTU - IP_HLEN - UDP_HLEN)
+#define UDP_EPHEMERAL_BASE 49152
+
+typedef struct {
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t len;
+    uint16_t csum;
+} __attribute__((packed)) udp_hdr_t;
+
+typedef struct udp_pcb udp_pcb_t;
+typedef void (*udp_event_fn)(udp_pcb_t *pcb, uint32_t events, void *arg);
+
+struct udp_pcb {
+    int used;
+    uint16_t local_port;
+    // Received datagrams, copied out of the NIC's buffers
+    struct {
+        pbuf_t *p;
+        uint32_t ip;
+        uint16_t port;
+    } rxq[UDP_RX_QUEUE];
+    int rx_head;
+    int rx_count;
+    udp_event_fn event;
+    void *arg;
+    uint32_t rx_datagrams;
+    uint32_t rx_dropped;
+    uint32_t tx_datagrams;
+};
+
+udp_pcb_t *udp_new();
+// Port 0 picks an ephemeral port
+int udp_bind(udp_pcb_t *pcb, uint16_t port);
+int udp_sendto(udp_pcb_t *pcb, const void *data, uint32_t len, uint32_t ip, uint16_t port);
+// Dequeue one datagram, truncated to len; NET_AGAIN if none is queued
+int udp_recvfrom(udp_pcb_t *pcb, void *buf, uint32_t len, uint32_t *ip, uint16_t *port);
+uint32_t udp_poll(udp_pcb_t *pcb);
+// Called from the stack, with events as they happen
+void udp_set_event(udp_pcb_t *pcb, udp_event_fn fn, void *arg);
+void udp_close(udp_pcb_t *pcb);
+
+void udp_input(const ip_hdr_t *ip, const uint8_t *data, uint32_t len, uint32_t rx_flags);
+void udp_print_stats();
+
+#endif
@@ -0,0 +1,662 @@
+#include "vfs.h"
+#include "esdfs.h"
+#include "iso9660.h"
+#include "fat32.h"
+#include "mem.h"
+#include "spinlock.h"
+#include "cpu.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static vfs_mount_t mounts[VFS_MAX_MOUNTS];
+static int mount_count = 0;
+
+// Probed in order on every block device
+static const vfs_fs_type_t *fs_types[] = {
+    &esdfs_vfs_type,
+    &iso9660_vfs_type,
+    &fat32_vfs_type,
+};
+
+// Both caches keep their entries on an LRU list headed by a sentinel,
+// most recently used first. Unused entries sit at the tail.
+static vfs_dentry_t dentries[VFS_DCACHE_SIZE];
+static vfs_dentry_t *dentry_hash[VFS_DCACHE_HASH];
+static vfs_dentry_t dentry_lru;
+static vfs_inode_t inodes[VFS_ICACHE_SIZE];
+static vfs_inode_t *inode_hash[VFS_ICACHE_HASH];
+static vfs_inode_t inode_lru;
+static vfs_file_t files[VFS_MAX_FILES];
+static vfs_stats_t stats;
+static spinlock_t vfs_lock;
+
+static int vfs_reg_read(vfs_file_t *file, void *buf, uint32_t len);
+static int vfs_reg_write(vfs_file_t *file, const void *buf, uint32_t len);
+static int vfs_dir_readdir(vfs_file_t *file, vfs_filldir_t fn, void *arg);
+
+static const vfs_file_ops_t reg_fops = { vfs_reg_read, vfs_reg_write, NULL };
+static const vfs_file_ops_t dir_fops = { NULL, NULL, vfs_dir_readdir };
+
+void vfs_init() {
+    spin_init(&vfs_lock, "vfs");
+
+    dentry_lru.lru_next = dentry_lru.lru_prev = &dentry_lru;
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        vfs_dentry_t *d = &dentries[i];
+        d->lru_prev = dentry_lru.lru_prev;
+        d->lru_next = &dentry_lru;
+        dentry_lru.lru_prev->lru_next = d;
+        dentry_lru.lru_prev = d;
+    }
+
+    inode_lru.lru_next = inode_lru.lru_prev = &inode_lru;
+    for (int i = 0; i < VFS_ICACHE_SIZE; i++) {
+        vfs_inode_t *inode = &inodes[i];
+        inode->lru_prev = inode_lru.lru_prev;
+        inode->lru_next = &inode_lru;
+        inode_lru.lru_prev->lru_next = inode;
+        inode_lru.lru_prev = inode;
+    }
+}
+
+int vfs_mount(const char *path, const vfs_fs_type_t *type, void *fs, uint32_t root, block_device_t *dev) {
+    uint32_t len = strlen(path);
+
+    if (mount_count >= VFS_MAX_MOUNTS || len >= VFS_PATH_MAX) {
+        return -1;
+    }
+    // Mount points are kept without a trailing slash; "/" becomes ""
+    while (len > 0 && path[len - 1] == '/') {
+        len--;
+    }
+
+    vfs_mount_t *mnt = &mounts[mount_count++];
+    memcpy(mnt->path, path, len);
+    mnt->path[len] = '\0';
+    mnt->path_len = len;
+    mnt->type = type;
+    mnt->fs = fs;
+    mnt->root = root;
+    mnt->dev = dev;
+    return 0;
+}
+
+// Mount every recognised block device at /<device name>
+void vfs_mount_all() {
+    for (block_device_t *dev = blk_first(); dev != NULL; dev = dev->next) {
+        for (uint32_t i = 0; i < sizeof(fs_types) / sizeof(fs_types[0]); i++) {
+            uint32_t root;
+            void *fs = fs_types[i]->mount(dev, &root);
+            if (fs == NULL) {
+                continue;
+            }
+
+            char path[VFS_PATH_MAX];
+            uint32_t len = strlen(dev->name);
+            path[0] = '/';
+            memcpy(path + 1, dev->name, len + 1);
+            vfs_mount(path, fs_types[i], fs, root, dev);
+
+            k_print_string(fs_types[i]->name);
+            k_print_string(": mounted ");
+            k_print_string(dev->name);
+            k_print_string(" on ");
+            k_print_string(path);
+            k_print_string("\n");
+            break;
+        }
+    }
+}
+
+int vfs_mount_count() {
+    return mount_count;
+}
+
+vfs_mount_t *vfs_get_mount(int index) {
+    return index < mount_count ? &mounts[index] : NULL;
+}
+
+// Longest mount point that is a whole-component prefix of path
+static vfs_mount_t *vfs_find_mount(const char *path, const char **rest) {
+    vfs_mount_t *best = NULL;
+
+    for (int i = 0; i < mount_count; i++) {
+        vfs_mount_t *mnt = &mounts[i];
+        if (strncmp(path, mnt->path, mnt->path_len) != 0 ||
+            (path[mnt->path_len] != '/' && path[mnt->path_len] != '\0')) {
+            continue;
+        }
+        if (best == NULL || mnt->path_len > best->path_len) {
+            best = mnt;
+        }
+    }
+    if (best != NULL) {
+        *rest = path + best->path_len;
+    }
+    return best;
+}
+
+static inline void lru_unlink_dentry(vfs_dentry_t *d) {
+    d->lru_prev->lru_next = d->lru_next;
+    d->lru_next->lru_prev = d->lru_prev;
+}
+
+static inline void lru_front_dentry(vfs_dentry_t *d) {
+    lru_unlink_dentry(d);
+    d->lru_next = dentry_lru.lru_next;
+    d->lru_prev = &dentry_lru;
+    dentry_lru.lru_next->lru_prev = d;
+    dentry_lru.lru_next = d;
+}
+
+static inline void lru_unlink_inode(vfs_inode_t *inode) {
+    inode->lru_prev->lru_next = inode->lru_next;
+    inode->lru_next->lru_prev = inode->lru_prev;
+}
+
+static inline void lru_front_inode(vfs_inode_t *inode) {
+    lru_unlink_inode(inode);
+    inode->lru_next = inode_lru.lru_next;
+    inode->lru_prev = &inode_lru;
+    inode_lru.lru_next->lru_prev = inode;
+    inode_lru.lru_next = inode;
+}
+
+static uint32_t dentry_hash_of(vfs_mount_t *mnt, uint32_t dir, const char *name, uint32_t len) {
+    uint32_t h = 2166136261u ^ ((uint32_t)mnt >> 4) ^ (dir * 0x9E3779B1u);
+
+    for (uint32_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h % VFS_DCACHE_HASH;
+}
+
+static inline uint32_t inode_hash_of(vfs_mount_t *mnt, uint32_t ino) {
+    return (((uint32_t)mnt >> 4) ^ ino ^ (ino >> 7)) % VFS_ICACHE_HASH;
+}
+
+static vfs_dentry_t *d_lookup(vfs_mount_t *mnt, uint32_t dir, const char *name, uint32_t len) {
+    for (vfs_dentry_t *d = dentry_hash[dentry_hash_of(mnt, dir, name, len)]; d != NULL; d = d->hash_next) {
+        if (d->mnt == mnt && d->dir == dir && d->name_len == len && memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static void d_unhash(vfs_dentry_t *d) {
+    vfs_dentry_t **pos = &dentry_hash[dentry_hash_of(d->mnt, d->dir, d->name, d->name_len)];
+
+    while (*pos != d) {
+        pos = &(*pos)->hash_next;
+    }
+    *pos = d->hash_next;
+    d->mnt = NULL;
+}
+
+// Drop every entry looked up inside a removed directory, ".." included, so
+// a later directory that reuses the inode number starts empty
+static void d_prune_dir(vfs_mount_t *mnt, uint32_t dir) {
+    spin_lock(&vfs_lock);
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        vfs_dentry_t *d = &dentries[i];
+        if (d->mnt == mnt && d->dir == dir) {
+            d_unhash(d);
+        }
+    }
+    spin_unlock(&vfs_lock);
+}
+
+// Record a lookup result, positive or negative, recycling the LRU entry
+static void d_add(vfs_mount_t *mnt, uint32_t dir, const char *name, uint32_t len, uint32_t ino, int negative) {
+    if (len > VFS_NAME_MAX) {
+        return;
+    }
+
+    spin_lock(&vfs_lock);
+    vfs_dentry_t *d = d_lookup(mnt, dir, name, len);
+    if (d == NULL) {
+        d = dentry_lru.lru_prev;
+        if (d->mnt != NULL) {
+            d_unhash(d);
+            stats.dcache_evictions++;
+        }
+        d->mnt = mnt;
+        d->dir = dir;
+        d->name_len = len;
+        memcpy(d->name, name, len);
+
+        uint32_t h = dentry_hash_of(mnt, dir, name, len);
+        d->hash_next = dentry_hash[h];
+        dentry_hash[h] = d;
+    }
+    d->ino = ino;
+    d->negative = negative;
+    lru_front_dentry(d);
+    spin_unlock(&vfs_lock);
+}
+
+// Resolve one component. Hits, negative ones included, skip the filesystem.
+static int vfs_walk(vfs_mount_t *mnt, uint32_t dir, const char *name, uint32_t len, uint32_t *ino) {
+    if (len == 1 && name[0] == '.') {
+        *ino = dir;
+        return 0;
+    }
+
+    spin_lock(&vfs_lock);
+    stats.lookups++;
+    vfs_dentry_t *d = len <= VFS_NAME_MAX ? d_lookup(mnt, dir, name, len) : NULL;
+    if (d != NULL) {
+        int negative = d->negative;
+        *ino = d->ino;
+        stats.dcache_hits++;
+        if (negative) {
+            stats.dcache_negative++;
+        }
+        lru_front_dentry(d);
+        spin_unlock(&vfs_lock);
+        return negative ? -1 : 0;
+    }
+    spin_unlock(&vfs_lock);
+
+    if (mnt->type->lookup(mnt->fs, dir, name, len, ino) != 0) {
+        d_add(mnt, dir, name, len, 0, 1);
+        return -1;
+    }
+    d_add(mnt, dir, name, len, *ino, 0);
+    return 0;
+}
+
+static vfs_inode_t *i_find(vfs_mount_t *mnt, uint32_t ino) {
+    for (vfs_inode_t *inode = inode_hash[inode_hash_of(mnt, ino)]; inode != NULL; inode = inode->hash_next) {
+        if (inode->mnt == mnt && inode->ino == ino) {
+            return inode;
+        }
+    }
+    return NULL;
+}
+
+static void i_unhash(vfs_inode_t *inode) {
+    vfs_inode_t **pos = &inode_hash[inode_hash_of(inode->mnt, inode->ino)];
+
+    while (*pos != inode) {
+        pos = &(*pos)->hash_next;
+    }
+    *pos = inode->hash_next;
+    inode->mnt = NULL;
+}
+
+// Drop an unpinned inode so the next lookup stats it again
+static void i_forget(vfs_mount_t *mnt, uint32_t ino) {
+    spin_lock(&vfs_lock);
+    vfs_inode_t *inode = i_find(mnt, ino);
+    if (inode != NULL && inode->refs == 0) {
+        i_unhash(inode);
+    }
+    spin_unlock(&vfs_lock);
+}
+
+// Cached inode; only pinned ones (refs > 0) stay valid across later calls
+static vfs_inode_t *vfs_iget(vfs_mount_t *mnt, uint32_t ino) {
+    vfs_stat_t st;
+
+    spin_lock(&vfs_lock);
+    stats.icache_lookups++;
+    vfs_inode_t *inode = i_find(mnt, ino);
+    if (inode != NULL) {
+        stats.icache_hits++;
+        lru_front_inode(inode);
+        spin_unlock(&vfs_lock);
+        return inode;
+    }
+    spin_unlock(&vfs_lock);
+
+    if (mnt->type->stat(mnt->fs, ino, &st) != 0) {
+        return NULL;
+    }
+
+    spin_lock(&vfs_lock);
+    inode = inode_lru.lru_prev;
+    while (inode != &inode_lru && inode->refs != 0) {
+        inode = inode->lru_prev;
+    }
+    if (inode == &inode_lru) {
+        spin_unlock(&vfs_lock);
+        return NULL;
+    }
+    if (inode->mnt != NULL) {
+        i_unhash(inode);
+        stats.icache_evictions++;
+    }
+
+    inode->mnt = mnt;
+    inode->ino = ino;
+    inode->type = st.type;
+    inode->size = st.size;
+    inode->fops = st.type == VFS_TYPE_DIR ? &dir_fops : &reg_fops;
+
+    uint32_t h = inode_hash_of(mnt, ino);
+    inode->hash_next = inode_hash[h];
+    inode_hash[h] = inode;
+    lru_front_inode(inode);
+    spin_unlock(&vfs_lock);
+    return inode;
+}
+
+static void vfs_size_changed(vfs_mount_t *mnt, uint32_t ino, uint32_t end) {
+    spin_lock(&vfs_lock);
+    vfs_inode_t *inode = i_find(mnt, ino);
+    if (inode != NULL && end > inode->size) {
+        inode->size = end;
+    }
+    spin_unlock(&vfs_lock);
+}
+
+// Walk path to (mount, inode). With want_parent set the last component
+// is returned unresolved in name/len and *ino is its directory.
+static int vfs_resolve(const char *path, int want_parent, vfs_mount_t **mntp, uint32_t *ino,
+                       const char **name, uint32_t *len) {
+    const char *rest;
+    vfs_mount_t *mnt = vfs_find_mount(path, &rest);
+
+    if (mnt == NULL) {
+        return -1;
+    }
+
+    uint32_t cur = mnt->root;
+    for (;;) {
+        while (*rest == '/') {
+            rest++;
+        }
+        if (*rest == '\0') {
+            break;
+        }
+        const char *end = rest;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+        if (want_parent) {
+            const char *after = end;
+            while (*after == '/') {
+                after++;
+            }
+            if (*after == '\0') {
+                // Creating or removing a name needs a directory to do it in
+                vfs_inode_t *parent = vfs_iget(mnt, cur);
+                if (parent == NULL || parent->type != VFS_TYPE_DIR) {
+                    return -1;
+                }
+                *mntp = mnt;
+                *ino = cur;
+                *name = rest;
+                *len = end - rest;
+                return 0;
+            }
+        }
+        if (vfs_walk(mnt, cur, rest, end - rest, &cur) != 0) {
+            return -1;
+        }
+        rest = end;
+    }
+
+    // A mount point has no parent inside its own filesystem
+    if (want_parent) {
+        return -1;
+    }
+    *mntp = mnt;
+    *ino = cur;
+    return 0;
+}
+
+int vfs_lookup(const char *path, vfs_node_t *node) {
+    vfs_mount_t *mnt;
+    uint32_t ino;
+
+    if (vfs_resolve(path, 0, &mnt, &ino, NULL, NULL) != 0) {
+        return -1;
+    }
+    vfs_inode_t *inode = vfs_iget(mnt, ino);
+    if (inode == NULL) {
+        return -1;
+    }
+    node->mnt = mnt;
+    node->ino = ino;
+    node->type = inode->type;
+    node->size = inode->size;
+    return 0;
+}
+
+int vfs_read(vfs_node_t *node, uint32_t offset, void *buf, uint32_t len) {
+    if (node->type != VFS_TYPE_FILE) {
+        return -1;
+    }
+    return node->mnt->type->read(node->mnt->fs, node->ino, offset, buf, len);
+}
+
+int vfs_write(vfs_node_t *node, uint32_t offset, const void *buf, uint32_t len) {
+    if (node->type != VFS_TYPE_FILE || node->mnt->type->write == NULL) {
+        return -1;
+    }
+    int n = node->mnt->type->write(node->mnt->fs, node->ino, offset, buf, len);
+    if (n > 0 && offset + n > node->size) {
+        node->size = offset + n;
+        vfs_size_changed(node->mnt, node->ino, node->size);
+    }
+    return n;
+}
+
+int vfs_readdir(vfs_node_t *dir, vfs_filldir_t fn, void *arg) {
+    if (dir->type != VFS_TYPE_DIR) {
+        return -1;
+    }
+    return dir->mnt->type->readdir(dir->mnt->fs, dir->ino, fn, arg);
+}
+
+// Direct pointer to file contents, for filesystems that live in memory
+const void *vfs_map(vfs_node_t *node, uint32_t *size) {
+    if (node->type != VFS_TYPE_FILE || node->mnt->type->map == NULL) {
+        return NULL;
+    }
+    return node->mnt->type->map(node->mnt->fs, node->ino, size);
+}
+
+// Read a whole file (up to max bytes); returns the byte count or -1
+int vfs_read_file(const char *path, void *buf, uint32_t max) {
+    vfs_node_t node;
+
+    if (vfs_lookup(path, &node) != 0) {
+        return -1;
+    }
+    return vfs_read(&node, 0, buf, node.size < max ? node.size : max);
+}
+
+int vfs_create(const char *path, uint16_t type) {
+    vfs_mount_t *mnt;
+    uint32_t dir, ino;
+    const char *name;
+    uint32_t len;
+
+    if (vfs_resolve(path, 1, &mnt, &dir, &name, &len) != 0 || mnt->type->create == NULL) {
+        return -1;
+    }
+    if (mnt->type->create(mnt->fs, dir, name, len, type, &ino) != 0) {
+        return -1;
+    }
+    // Replaces any negative entry for the name
+    d_add(mnt, dir, name, len, ino, 0);
+    i_forget(mnt, dir);
+    return 0;
+}
+
+int vfs_unlink(const char *path) {
+    vfs_mount_t *mnt;
+    uint32_t dir, ino;
+    const char *name;
+    uint32_t len;
+
+    if (vfs_resolve(path, 1, &mnt, &dir, &name, &len) != 0 || mnt->type->unlink == NULL ||
+        vfs_walk(mnt, dir, name, len, &ino) != 0) {
+        return -1;
+    }
+
+    // Open files keep their inode
+    spin_lock(&vfs_lock);
+    vfs_inode_t *inode = i_find(mnt, ino);
+    int busy = inode != NULL && inode->refs != 0;
+    spin_unlock(&vfs_lock);
+    if (busy || mnt->type->unlink(mnt->fs, dir, name, len) != 0) {
+        return -1;
+    }
+
+    d_add(mnt, dir, name, len, 0, 1);
+    d_prune_dir(mnt, ino);
+    i_forget(mnt, ino);
+    i_forget(mnt, dir);
+    return 0;
+}
+
+vfs_file_t *vfs_open(const char *path) {
+    vfs_mount_t *mnt;
+    uint32_t ino;
+
+    if (vfs_resolve(path, 0, &mnt, &ino, NULL, NULL) != 0) {
+        return NULL;
+    }
+    vfs_inode_t *inode = vfs_iget(mnt, ino);
+    if (inode == NULL) {
+        return NULL;
+    }
+
+    spin_lock(&vfs_lock);
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        vfs_file_t *file = &files[i];
+        if (!file->in_use) {
+            file->in_use = 1;
+            file->inode = inode;
+            file->ops = inode->fops;
+            file->pos = 0;
+            inode->refs++;
+            spin_unlock(&vfs_lock);
+            return file;
+        }
+    }
+    spin_unlock(&vfs_lock);
+    return NULL;
+}
+
+void vfs_close(vfs_file_t *file) {
+    spin_lock(&vfs_lock);
+    file->inode->refs--;
+    file->inode = NULL;
+    file->in_use = 0;
+    spin_unlock(&vfs_lock);
+}
+
+int vfs_file_read(vfs_file_t *file, void *buf, uint32_t len) {
+    return file->ops->read != NULL ? file->ops->read(file, buf, len) : -1;
+}
+
+int vfs_file_write(vfs_file_t *file, const void *buf, uint32_t len) {
+    return file->ops->write != NULL ? file->ops->write(file, buf, len) : -1;
+}
+
+int vfs_file_readdir(vfs_file_t *file, vfs_filldir_t fn, void *arg) {
+    return file->ops->readdir != NULL ? file->ops->readdir(file, fn, arg) : -1;
+}
+
+static int vfs_reg_read(vfs_file_t *file, void *buf, uint32_t len) {
+    vfs_inode_t *inode = file->inode;
+    int n = inode->mnt->type->read(inode->mnt->fs, inode->ino, file->pos, buf, len);
+
+    if (n > 0) {
+        file->pos += n;
+    }
+    return n;
+}
+
+static int vfs_reg_write(vfs_file_t *file, const void *buf, uint32_t len) {
+    vfs_inode_t *inode = file->inode;
+
+    if (inode->mnt->type->write == NULL) {
+        return -1;
+    }
+    int n = inode->mnt->type->write(inode->mnt->fs, inode->ino, file->pos, buf, len);
+    if (n > 0) {
+        file->pos += n;
+        if (file->pos > inode->size) {
+            inode->size = file->pos;
+        }
+    }
+    return n;
+}
+
+static int vfs_dir_readdir(vfs_file_t *file, vfs_filldir_t fn, void *arg) {
+    vfs_inode_t *inode = file->inode;
+    return inode->mnt->type->readdir(inode->mnt->fs, inode->ino, fn, arg);
+}
+
+void vfs_get_stats(vfs_stats_t *out) {
+    spin_lock(&vfs_lock);
+    *out = stats;
+    spin_unlock(&vfs_lock);
+}
+
+static void vfs_print_rate(uint32_t hits, uint32_t total) {
+    k_print_dec(total ? div_u64((uint64_t)hits * 100, total) : 0);
+    k_print_string("%)");
+}
+
+void vfs_print_stats() {
+    vfs_stats_t s;
+    uint32_t dentries_used = 0, negative = 0, inodes_used = 0, pinned = 0;
+
+    vfs_get_stats(&s);
+    spin_lock(&vfs_lock);
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        if (dentries[i].mnt != NULL) {
+            dentries_used++;
+            negative += dentries[i].negative;
+        }
+    }
+    for (int i = 0; i < VFS_ICACHE_SIZE; i++) {
+        if (inodes[i].mnt != NULL) {
+            inodes_used++;
+            pinned += inodes[i].refs != 0;
+        }
+    }
+    spin_unlock(&vfs_lock);
+
+    k_print_string("vfs: ");
+    k_print_dec(mount_count);
+    k_print_string(" mounts\n  dcache ");
+    k_print_dec(dentries_used);
+    k_print_string("/");
+    k_print_dec(VFS_DCACHE_SIZE);
+    k_print_string(" (");
+    k_print_dec(negative);
+    k_print_string(" negative) lookups=");
+    k_print_dec(s.lookups);
+    k_print_string(" hits=");
+    k_print_dec(s.dcache_hits);
+    k_print_string(" (");
+    vfs_print_rate(s.dcache_hits, s.lookups);
+    k_print_string(" neg=");
+    k_print_dec(s.dcache_negative);
+    k_print_string(" evict=");
+    k_print_dec(s.dcache_evictions);
+    k_print_string("\n  icache ");
+    k_print_dec(inodes_used);
+    k_print_string("/");
+    k_print_dec(VFS_ICACHE_SIZE);
+    k_print_string(" (");
+    k_print_dec(pinned);
+    k_print_string(" open) lookups=");
+    k_print_dec(s.icache_lookups);
+    k_print_string(" hits=");
+    k_print_dec(s.icache_hits);
+    k_print_string(" (");
+    vfs_print_rate(s.icache_hits, s.icache_lookups);
+    k_print_string(" evict=");
+    k_print_dec(s.icache_evictions);
+    k_print_string("\n");
+}
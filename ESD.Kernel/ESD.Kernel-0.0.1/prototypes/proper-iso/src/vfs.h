@@ -0,0 +1,134 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+#include "blk.h"
+
+#define VFS_TYPE_FILE 1
+#define VFS_TYPE_DIR  2
+
+#define VFS_MAX_MOUNTS 8
+#define VFS_PATH_MAX   64
+#define VFS_NAME_MAX   40               // longer names bypass the dentry cache
+
+#define VFS_DCACHE_SIZE 512
+#define VFS_DCACHE_HASH 256
+#define VFS_ICACHE_SIZE 128
+#define VFS_ICACHE_HASH 64
+#define VFS_MAX_FILES   32
+
+typedef int (*vfs_filldir_t)(void *arg, const char *name, uint32_t len, uint32_t ino, uint16_t type);
+
+typedef struct {
+    uint32_t ino;
+    uint16_t type;
+    uint32_t size;
+} vfs_stat_t;
+
+// A filesystem names its files with 32-bit inode numbers of its choosing
+typedef struct vfs_fs_type {
+    const char *name;
+    void *(*mount)(block_device_t *dev, uint32_t *root);
+    int (*lookup)(void *fs, uint32_t dir, const char *name, uint32_t len, uint32_t *ino);
+    int (*stat)(void *fs, uint32_t ino, vfs_stat_t *st);
+    int (*read)(void *fs, uint32_t ino, uint32_t offset, void *buf, uint32_t len);
+    int (*write)(void *fs, uint32_t ino, uint32_t offset, const void *buf, uint32_t len);   // NULL if read-only
+    int (*readdir)(void *fs, uint32_t dir, vfs_filldir_t fn, void *arg);
+    const void *(*map)(void *fs, uint32_t ino, uint32_t *size);                             // NULL unless memory-backed
+    int (*create)(void *fs, uint32_t dir, const char *name, uint32_t len, uint16_t type, uint32_t *ino);
+    int (*unlink)(void *fs, uint32_t dir, const char *name, uint32_t len);
+} vfs_fs_type_t;
+
+typedef struct {
+    char path[VFS_PATH_MAX];
+    uint32_t path_len;
+    const vfs_fs_type_t *type;
+    void *fs;
+    uint32_t root;
+    block_device_t *dev;
+} vfs_mount_t;
+
+struct vfs_file;
+
+// Chosen per inode type when the inode enters the cache
+typedef struct {
+    int (*read)(struct vfs_file *file, void *buf, uint32_t len);
+    int (*write)(struct vfs_file *file, const void *buf, uint32_t len);
+    int (*readdir)(struct vfs_file *file, vfs_filldir_t fn, void *arg);
+} vfs_file_ops_t;
+
+typedef struct vfs_inode {
+    vfs_mount_t *mnt;
+    uint32_t ino;
+    uint16_t type;
+    uint32_t size;
+    uint32_t refs;                      // open files; pinned while nonzero
+    const vfs_file_ops_t *fops;
+    struct vfs_inode *hash_next;
+    struct vfs_inode *lru_prev;
+    struct vfs_inode *lru_next;
+} vfs_inode_t;
+
+// Name cache entry: (mount, directory inode, name) -> inode. A negative
+// entry records that the name does not exist.
+typedef struct vfs_dentry {
+    vfs_mount_t *mnt;
+    uint32_t dir;
+    uint32_t ino;
+    uint8_t negative;
+    uint8_t name_len;
+    char name[VFS_NAME_MAX];
+    struct vfs_dentry *hash_next;
+    struct vfs_dentry *lru_prev;
+    struct vfs_dentry *lru_next;
+} vfs_dentry_t;
+
+typedef struct vfs_file {
+    vfs_inode_t *inode;
+    const vfs_file_ops_t *ops;
+    uint32_t pos;
+    int in_use;
+} vfs_file_t;
+
+typedef struct {
+    vfs_mount_t *mnt;
+    uint32_t ino;
+    uint16_t type;
+    uint32_t size;
+} vfs_node_t;
+
+typedef struct {
+    uint32_t lookups;                   // path components resolved
+    uint32_t dcache_hits;
+    uint32_t dcache_negative;
+    uint32_t dcache_evictions;
+    uint32_t icache_lookups;
+    uint32_t icache_hits;
+    uint32_t icache_evictions;
+} vfs_stats_t;
+
+void vfs_init();
+int vfs_mount(const char *path, const vfs_fs_type_t *type, void *fs, uint32_t root, block_device_t *dev);
+void vfs_mount_all();
+int vfs_mount_count();
+vfs_mount_t *vfs_get_mount(int index);
+
+int vfs_lookup(const char *path, vfs_node_t *node);
+int vfs_read(vfs_node_t *node, uint32_t offset, void *buf, uint32_t len);
+int vfs_write(vfs_node_t *node, uint32_t offset, const void *buf, uint32_t len);
+int vfs_readdir(vfs_node_t *dir, vfs_filldir_t fn, void *arg);
+const void *vfs_map(vfs_node_t *node, uint32_t *size);
+int vfs_read_file(const char *path, void *buf, uint32_t max);
+int vfs_create(const char *path, uint16_t type);
+int vfs_unlink(const char *path);
+
+vfs_file_t *vfs_open(const char *path);
+int vfs_file_read(vfs_file_t *file, void *buf, uint32_t len);
+int vfs_file_write(vfs_file_t *file, const void *buf, uint32_t len);
+int vfs_file_readdir(vfs_file_t *file, vfs_filldir_t fn, void *arg);
+void vfs_close(vfs_file_t *file);
+
+void vfs_get_stats(vfs_stats_t *out);
+void vfs_print_stats();
+
+#endif
@@ -0,0 +1,539 @@
+#include "virtio.h"
+#include "msi.h"
+#include "isr.h"
+#include "pmm.h"
+#include "paging.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define PCI_SUBSYSTEM_ID 0x2E
+
+// Devices on legacy INTx, polled through their ISR register
+static virtio_device_t *intx_devices = NULL;
+
+pci_device_t *virtio_find(int type, pci_device_t *after) {
+    int i = 0;
+
+    if (after != NULL) {
+        while (i < pci_device_count() && pci_get_device(i) != after) {
+            i++;
+        }
+        i++;
+    }
+
+    for (; i < pci_device_count(); i++) {
+        pci_device_t *dev = pci_get_device(i);
+        if (dev->vendor_id != VIRTIO_VENDOR_ID) {
+            continue;
+        }
+        // Transitional devices carry the type in the subsystem ID
+        if (dev->device_id == 0x1040 + type ||
+            (dev->device_id >= 0x1000 && dev->device_id <= 0x103F &&
+             pci_read16(dev, PCI_SUBSYSTEM_ID) == type)) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+static void virtio_find_caps(virtio_device_t *vdev) {
+    pci_device_t *pci = vdev->pci;
+
+    if (!(pci_read16(pci, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return;
+    }
+
+    uint8_t cap = pci_read8(pci, PCI_CAP_POINTER) & ~3;
+    while (cap != 0) {
+        if (pci_read8(pci, cap) == PCI_CAP_ID_VENDOR) {
+            uint8_t type = pci_read8(pci, cap + 3);
+            uint8_t bar = pci_read8(pci, cap + 4);
+            uint32_t offset = pci_read32(pci, cap + 8);
+            uint8_t *base = bar < PCI_MAX_BARS ? pci_map_bar(pci, bar) : NULL;
+
+            if (base != NULL) {
+                switch (type) {
+                case VIRTIO_PCI_CAP_COMMON:
+                    vdev->common = (volatile virtio_common_cfg_t *)(base + offset);
+                    break;
+                case VIRTIO_PCI_CAP_NOTIFY:
+                    vdev->notify_base = base + offset;
+                    vdev->notify_mul = pci_read32(pci, cap + 16);
+                    break;
+                case VIRTIO_PCI_CAP_ISR:
+                    vdev->isr = base + offset;
+                    break;
+                case VIRTIO_PCI_CAP_DEVICE:
+                    vdev->device_cfg = base + offset;
+                    break;
+                }
+            }
+        }
+        cap = pci_read8(pci, cap + 1) & ~3;
+    }
+}
+
+static uint8_t virtio_get_status(virtio_device_t *vdev) {
+    if (vdev->modern) {
+        return vdev->common->device_status;
+    }
+    return inb(vdev->io_base + VIRTIO_LEGACY_STATUS);
+}
+
+static void virtio_set_status(virtio_device_t *vdev, uint8_t status) {
+    if (vdev->modern) {
+        vdev->common->device_status = status;
+    } else {
+        outb(vdev->io_base + VIRTIO_LEGACY_STATUS, status);
+    }
+}
+
+static uint8_t virtio_read_isr(virtio_device_t *vdev) {
+    if (vdev->modern) {
+        return *vdev->isr;
+    }
+    return inb(vdev->io_base + VIRTIO_LEGACY_ISR);
+}
+
+uint8_t virtio_cfg_read8(virtio_device_t *vdev, uint32_t offset) {
+    if (vdev->modern) {
+        return vdev->device_cfg[offset];
+    }
+    return inb(vdev->io_base + VIRTIO_LEGACY_CONFIG + (vdev->msix ? 4 : 0) + offset);
+}
+
+uint16_t virtio_cfg_read16(virtio_device_t *vdev, uint32_t offset) {
+    if (vdev->modern) {
+        return *(volatile uint16_t *)(vdev->device_cfg + offset);
+    }
+    return inw(vdev->io_base + VIRTIO_LEGACY_CONFIG + (vdev->msix ? 4 : 0) + offset);
+}
+
+uint32_t virtio_cfg_read32(virtio_device_t *vdev, uint32_t offset) {
+    if (vdev->modern) {
+        return *(volatile uint32_t *)(vdev->device_cfg + offset);
+    }
+    return inl(vdev->io_base + VIRTIO_LEGACY_CONFIG + (vdev->msix ? 4 : 0) + offset);
+}
+
+static void virtio_vector_handler(void *ctx, registers_t *regs) {
+    virtqueue_t *vq = ctx;
+    (void)regs;
+
+    vq->interrupts++;
+    vq->callback(vq->ctx);
+}
+
+static void virtio_config_handler(void *ctx, registers_t *regs) {
+    virtio_device_t *vdev = ctx;
+    (void)regs;
+
+    vdev->config_callback(vdev->config_ctx);
+}
+
+static void virtio_intx_handler(registers_t *regs) {
+    uint8_t line = regs->int_no - IRQ0;
+
+    for (virtio_device_t *vdev = intx_devices; vdev != NULL; vdev = vdev->next) {
+        if (vdev->pci->irq_line != line) {
+            continue;
+        }
+        // Reading the ISR register also deasserts the line
+        uint8_t isr = virtio_read_isr(vdev);
+        if ((isr & VIRTIO_ISR_CONFIG) && vdev->config_callback != NULL) {
+            vdev->config_callback(vdev->config_ctx);
+        }
+        if (!(isr & VIRTIO_ISR_QUEUE)) {
+            continue;
+        }
+        for (int i = 0; i < VIRTIO_MAX_QUEUES; i++) {
+            virtqueue_t *vq = vdev->queues[i];
+            if (vq != NULL) {
+                vq->interrupts++;
+                vq->callback(vq->ctx);
+            }
+        }
+    }
+}
+
+// Reset, negotiate features and leave the device ready for queue setup.
+// Returns -1 if the device cannot be driven.
+int virtio_init(virtio_device_t *vdev, pci_device_t *pci, uint64_t features) {
+    memset(vdev, 0, sizeof(*vdev));
+    vdev->pci = pci;
+
+    virtio_find_caps(vdev);
+    vdev->modern = vdev->common != NULL && vdev->notify_base != NULL &&
+                   vdev->isr != NULL && vdev->device_cfg != NULL;
+    if (!vdev->modern) {
+        if (!pci->bars[0].is_io) {
+            return -1;
+        }
+        vdev->io_base = pci->bars[0].base;
+    }
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    virtio_set_status(vdev, 0);
+    while (virtio_get_status(vdev) != 0) {
+        cpu_relax();
+    }
+    virtio_set_status(vdev, VIRTIO_STATUS_ACK);
+    virtio_set_status(vdev, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    vdev->msix = msix_enable(pci) == 0;
+
+    uint64_t offered;
+    if (vdev->modern) {
+        vdev->common->device_feature_select = 0;
+        offered = vdev->common->device_feature;
+        vdev->common->device_feature_select = 1;
+        offered |= (uint64_t)vdev->common->device_feature << 32;
+
+        vdev->features = offered & (features | VIRTIO_F_VERSION_1);
+        vdev->common->driver_feature_select = 0;
+        vdev->common->driver_feature = (uint32_t)vdev->features;
+        vdev->common->driver_feature_select = 1;
+        vdev->common->driver_feature = (uint32_t)(vdev->features >> 32);
+
+        virtio_set_status(vdev, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+        if (!(virtio_get_status(vdev) & VIRTIO_STATUS_FEATURES_OK)) {
+            virtio_set_status(vdev, VIRTIO_STATUS_FAILED);
+            return -1;
+        }
+        if (vdev->msix) {
+            vdev->common->msix_config = VIRTIO_NO_VECTOR;
+        }
+    } else {
+        offered = inl(vdev->io_base + VIRTIO_LEGACY_FEATURES);
+        vdev->features = offered & features & 0xFFFFFFFF;
+        outl(vdev->io_base + VIRTIO_LEGACY_GUEST_FEATURES, (uint32_t)vdev->features);
+        if (vdev->msix) {
+            outw(vdev->io_base + VIRTIO_LEGACY_CONFIG_VECTOR, VIRTIO_NO_VECTOR);
+        }
+    }
+    return 0;
+}
+
+static int virtio_setup_irq(virtio_device_t *vdev, virtqueue_t *vq) {
+    if (vdev->msix) {
+        if (msix_setup_vector(vdev->pci, vq->index, virtio_vector_handler, vq, 0) < 0) {
+            return -1;
+        }
+        uint16_t vector;
+        if (vdev->modern) {
+            vdev->common->queue_msix_vector = vq->index;
+            vector = vdev->common->queue_msix_vector;
+        } else {
+            outw(vdev->io_base + VIRTIO_LEGACY_QUEUE_VECTOR, vq->index);
+            vector = inw(vdev->io_base + VIRTIO_LEGACY_QUEUE_VECTOR);
+        }
+        return vector == VIRTIO_NO_VECTOR ? -1 : 0;
+    }
+
+    uint8_t line = vdev->pci->irq_line;
+    if (line >= 16) {
+        return -1;
+    }
+
+    virtio_device_t *d = intx_devices;
+    while (d != NULL && d != vdev) {
+        d = d->next;
+    }
+    if (d == NULL) {
+        uint32_t flags = irq_save();
+        vdev->next = intx_devices;
+        intx_devices = vdev;
+        irq_restore(flags);
+    }
+
+    isr_install_handler(IRQ0 + line, virtio_intx_handler);
+    if (line >= 8) {
+        pic_unmask_irq(2);
+    }
+    pic_unmask_irq(line);
+    return 0;
+}
+
+// Split ring in the legacy layout (used ring page aligned), which the
+// modern interface accepts as well
+static uint32_t vring_pages(uint16_t size, uint32_t *avail_off, uint32_t *used_off) {
+    *avail_off = size * sizeof(vring_desc_t);
+    *used_off = (*avail_off + 6 + 2 * size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    return (*used_off + 6 + 8 * size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+int virtio_setup_queue(virtio_device_t *vdev, virtqueue_t *vq, uint16_t index,
+                       void (*callback)(void *ctx), void *ctx) {
+    uint16_t size;
+
+    if (index >= VIRTIO_MAX_QUEUES) {
+        return -1;
+    }
+    if (vdev->modern) {
+        vdev->common->queue_select = index;
+        size = vdev->common->queue_size;
+        if (size > VIRTQ_MAX_SIZE) {
+            size = VIRTQ_MAX_SIZE;
+            vdev->common->queue_size = size;
+        }
+    } else {
+        outw(vdev->io_base + VIRTIO_LEGACY_QUEUE_SELECT, index);
+        size = inw(vdev->io_base + VIRTIO_LEGACY_QUEUE_SIZE);
+        if (size > VIRTQ_MAX_SIZE) {
+            return -1;
+        }
+    }
+    if (size == 0) {
+        return -1;
+    }
+
+    uint32_t avail_off, used_off;
+    uint32_t pages = vring_pages(size, &avail_off, &used_off);
+    uint8_t *ring = (uint8_t *)pmm_alloc_frames(pages);
+    if (ring == NULL) {
+        return -1;
+    }
+    memset(ring, 0, pages * PAGE_SIZE);
+
+    memset(vq, 0, sizeof(*vq));
+    vq->vdev = vdev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (vring_desc_t *)ring;
+    vq->avail = (volatile vring_avail_t *)(ring + avail_off);
+    vq->used = (volatile vring_used_t *)(ring + used_off);
+    vq->num_free = size;
+    vq->callback = callback;
+    vq->ctx = ctx;
+    for (uint16_t i = 0; i < size; i++) {
+        vq->desc[i].next = i + 1;
+    }
+
+    uint32_t phys = paging_translate((uint32_t)ring);
+    if (vdev->modern) {
+        vdev->common->queue_desc_lo = phys;
+        vdev->common->queue_desc_hi = 0;
+        vdev->common->queue_driver_lo = phys + avail_off;
+        vdev->common->queue_driver_hi = 0;
+        vdev->common->queue_device_lo = phys + used_off;
+        vdev->common->queue_device_hi = 0;
+        vq->notify = (volatile uint16_t *)(vdev->notify_base +
+                                           vdev->common->queue_notify_off * vdev->notify_mul);
+    } else {
+        outl(vdev->io_base + VIRTIO_LEGACY_QUEUE_PFN, phys / PAGE_SIZE);
+    }
+
+    vdev->queues[index] = vq;
+    if (virtio_setup_irq(vdev, vq) != 0) {
+        virtio_del_queue(vdev, vq);
+        return -1;
+    }
+    return 0;
+}
+
+// Undo virtio_setup_queue before virtio_driver_ok: the device forgets the
+// ring, the MSI-X entry gives up its vector and the ring frames are freed
+void virtio_del_queue(virtio_device_t *vdev, virtqueue_t *vq) {
+    uint32_t avail_off, used_off;
+
+    if (vdev->modern) {
+        vdev->common->queue_select = vq->index;
+        if (vdev->msix) {
+            vdev->common->queue_msix_vector = VIRTIO_NO_VECTOR;
+        }
+        vdev->common->queue_desc_lo = 0;
+        vdev->common->queue_driver_lo = 0;
+        vdev->common->queue_device_lo = 0;
+    } else {
+        outw(vdev->io_base + VIRTIO_LEGACY_QUEUE_SELECT, vq->index);
+        if (vdev->msix) {
+            outw(vdev->io_base + VIRTIO_LEGACY_QUEUE_VECTOR, VIRTIO_NO_VECTOR);
+        }
+        outl(vdev->io_base + VIRTIO_LEGACY_QUEUE_PFN, 0);
+    }
+    if (vdev->msix) {
+        msix_free_vector(vdev->pci, vq->index);
+    }
+
+    uint32_t flags = irq_save();
+    vdev->queues[vq->index] = NULL;
+    irq_restore(flags);
+
+    pmm_free_frames((uint32_t)vq->desc, vring_pages(vq->size, &avail_off, &used_off));
+    vq->size = 0;
+}
+
+// Deliver configuration-change interrupts. With MSI-X the last table entry
+// is used, which must not belong to a queue; on INTx they arrive through
+// the ISR register of the shared line.
+int virtio_setup_config_irq(virtio_device_t *vdev, void (*callback)(void *ctx), void *ctx) {
+    vdev->config_ctx = ctx;
+    vdev->config_callback = callback;
+    if (!vdev->msix) {
+        return 0;
+    }
+
+    int entry = msix_table_size(vdev->pci) - 1;
+    if (entry < 0 || (entry < VIRTIO_MAX_QUEUES && vdev->queues[entry] != NULL) ||
+        msix_setup_vector(vdev->pci, entry, virtio_config_handler, vdev, 0) < 0) {
+        vdev->config_callback = NULL;
+        return -1;
+    }
+
+    uint16_t vector;
+    if (vdev->modern) {
+        vdev->common->msix_config = entry;
+        vector = vdev->common->msix_config;
+    } else {
+        outw(vdev->io_base + VIRTIO_LEGACY_CONFIG_VECTOR, entry);
+        vector = inw(vdev->io_base + VIRTIO_LEGACY_CONFIG_VECTOR);
+    }
+    if (vector == VIRTIO_NO_VECTOR) {
+        msix_free_vector(vdev->pci, entry);
+        vdev->config_callback = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Queues still set up at this point go live together
+void virtio_driver_ok(virtio_device_t *vdev) {
+    if (vdev->modern) {
+        for (int i = 0; i < VIRTIO_MAX_QUEUES; i++) {
+            if (vdev->queues[i] != NULL) {
+                vdev->common->queue_select = i;
+                vdev->common->queue_enable = 1;
+            }
+        }
+    }
+    virtio_set_status(vdev, virtio_get_status(vdev) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+// Queues start out delivering to the BSP; INTx cannot be steered per queue
+int virtio_set_queue_affinity(virtio_device_t *vdev, virtqueue_t *vq, uint32_t cpu) {
+    if (!vdev->msix) {
+        return -1;
+    }
+    return msix_set_affinity(vdev->pci, vq->index, cpu);
+}
+
+static inline volatile uint16_t *vring_used_event(virtqueue_t *vq) {
+    return &vq->avail->ring[vq->size];
+}
+
+static inline volatile uint16_t *vring_avail_event(virtqueue_t *vq) {
+    return (volatile uint16_t *)&vq->used->ring[vq->size];
+}
+
+// True if new_idx has moved past event since old
+static inline int vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old);
+}
+
+// Chain out device-readable then in device-writable buffers. The chain
+// becomes visible to the device only at the next virtq_kick, so callers
+// can queue a whole batch behind a single notification.
+int virtq_add(virtqueue_t *vq, virtq_buf_t *bufs, int out, int in, void *cookie) {
+    int n = out + in;
+
+    if (n == 0 || n > vq->num_free) {
+        return -1;
+    }
+
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    for (int i = 0; i < n; i++) {
+        vring_desc_t *d = &vq->desc[idx];
+        d->addr = bufs[i].addr;
+        d->len = bufs[i].len;
+        d->flags = (i >= out ? VRING_DESC_F_WRITE : 0) | (i < n - 1 ? VRING_DESC_F_NEXT : 0);
+        idx = d->next;
+    }
+    vq->free_head = idx;
+    vq->num_free -= n;
+    vq->cookies[head] = cookie;
+
+    vq->avail->ring[(uint16_t)(vq->avail->idx + vq->added) % vq->size] = head;
+    vq->added++;
+    return head;
+}
+
+void virtq_kick(virtqueue_t *vq) {
+    if (vq->added == 0) {
+        return;
+    }
+
+    uint16_t old = vq->avail->idx;
+    uint16_t new_idx = old + vq->added;
+
+    barrier();
+    vq->avail->idx = new_idx;
+    vq->added = 0;
+    virtio_mb();
+
+    int notify;
+    if (vq->vdev->features & VIRTIO_F_RING_EVENT_IDX) {
+        notify = vring_need_event(*vring_avail_event(vq), new_idx, old);
+    } else {
+        notify = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+
+    if (!notify) {
+        vq->kicks_suppressed++;
+        return;
+    }
+    vq->kicks++;
+    if (vq->vdev->modern) {
+        *vq->notify = vq->index;
+    } else {
+        outw(vq->vdev->io_base + VIRTIO_LEGACY_QUEUE_NOTIFY, vq->index);
+    }
+}
+
+// Reap one completed chain, returning its cookie (NULL if none)
+void *virtq_get_used(virtqueue_t *vq, uint32_t *len) {
+    if (vq->last_used == vq->used->idx) {
+        return NULL;
+    }
+    barrier();
+
+    volatile vring_used_elem_t *elem = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = elem->id;
+    if (len != NULL) {
+        *len = elem->len;
+    }
+    vq->last_used++;
+
+    uint16_t idx = head;
+    uint16_t count = 1;
+    while (vq->desc[idx].flags & VRING_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+
+    void *cookie = vq->cookies[head];
+    vq->cookies[head] = NULL;
+    return cookie;
+}
+
+void virtq_disable_cb(virtqueue_t *vq) {
+    vq->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// Re-arm completion interrupts. Returns 0 if completions slipped in while
+// they were off, in which case the caller should reap again.
+int virtq_enable_cb(virtqueue_t *vq) {
+    if (vq->vdev->features & VIRTIO_F_RING_EVENT_IDX) {
+        *vring_used_event(vq) = vq->last_used;
+    } else {
+        vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+    }
+    virtio_mb();
+    return vq->last_used == vq->used->idx;
+}
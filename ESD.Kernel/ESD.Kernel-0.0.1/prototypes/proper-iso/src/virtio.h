@@ -0,0 +1,169 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include "pci.h"
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+
+#define VIRTIO_TYPE_NET 1
+#define VIRTIO_TYPE_BLK 2
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_F_RING_EVENT_IDX (1ULL << 29)
+#define VIRTIO_F_VERSION_1      (1ULL << 32)
+
+// Legacy I/O port layout (BAR0)
+#define VIRTIO_LEGACY_FEATURES       0x00
+#define VIRTIO_LEGACY_GUEST_FEATURES 0x04
+#define VIRTIO_LEGACY_QUEUE_PFN      0x08
+#define VIRTIO_LEGACY_QUEUE_SIZE     0x0C
+#define VIRTIO_LEGACY_QUEUE_SELECT   0x0E
+#define VIRTIO_LEGACY_QUEUE_NOTIFY   0x10
+#define VIRTIO_LEGACY_STATUS         0x12
+#define VIRTIO_LEGACY_ISR            0x13
+#define VIRTIO_LEGACY_CONFIG_VECTOR  0x14
+#define VIRTIO_LEGACY_QUEUE_VECTOR   0x16
+#define VIRTIO_LEGACY_CONFIG         0x14    // 0x18 with MSI-X enabled
+
+// Modern vendor capability types
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR    3
+#define VIRTIO_PCI_CAP_DEVICE 4
+#define PCI_CAP_ID_VENDOR     0x09
+
+#define VIRTIO_NO_VECTOR 0xFFFF
+
+#define VIRTIO_ISR_QUEUE  0x01
+#define VIRTIO_ISR_CONFIG 0x02
+
+#define VRING_DESC_F_NEXT  1
+#define VRING_DESC_F_WRITE 2
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY     1
+
+#define VIRTQ_MAX_SIZE   256
+#define VIRTIO_MAX_QUEUES 17    // a network queue pair per CPU plus control
+
+typedef struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+} __attribute__((packed)) virtio_common_cfg_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];            // followed by used_event
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];   // followed by avail_event
+} vring_used_t;
+
+// One physically contiguous piece of a request
+typedef struct {
+    uint32_t addr;
+    uint32_t len;
+} virtq_buf_t;
+
+struct virtio_device;
+
+typedef struct virtqueue {
+    struct virtio_device *vdev;
+    uint16_t index;
+    uint16_t size;
+    vring_desc_t *desc;
+    volatile vring_avail_t *avail;
+    volatile vring_used_t *used;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+    uint16_t added;             // descriptors chained since the last kick
+    volatile uint16_t *notify;  // modern only
+    void (*callback)(void *ctx);
+    void *ctx;
+    uint32_t kicks;
+    uint32_t kicks_suppressed;
+    uint32_t interrupts;
+    void *cookies[VIRTQ_MAX_SIZE];
+} virtqueue_t;
+
+typedef struct virtio_device {
+    pci_device_t *pci;
+    int modern;
+    int msix;
+    uint16_t io_base;
+    volatile virtio_common_cfg_t *common;
+    volatile uint8_t *isr;
+    volatile uint8_t *device_cfg;
+    volatile uint8_t *notify_base;
+    uint32_t notify_mul;
+    uint64_t features;
+    virtqueue_t *queues[VIRTIO_MAX_QUEUES];
+    void (*config_callback)(void *ctx);
+    void *config_ctx;
+    struct virtio_device *next;
+} virtio_device_t;
+
+// Full barrier; device memory ordering needs store->load on x86
+static inline void virtio_mb() {
+    asm volatile ( "lock; addl $0, (%%esp)" ::: "memory", "cc" );
+}
+
+pci_device_t *virtio_find(int type, pci_device_t *after);
+int virtio_init(virtio_device_t *vdev, pci_device_t *pci, uint64_t features);
+int virtio_setup_queue(virtio_device_t *vdev, virtqueue_t *vq, uint16_t index,
+                       void (*callback)(void *ctx), void *ctx);
+void virtio_del_queue(virtio_device_t *vdev, virtqueue_t *vq);
+int virtio_setup_config_irq(virtio_device_t *vdev, void (*callback)(void *ctx), void *ctx);
+void virtio_driver_ok(virtio_device_t *vdev);
+int virtio_set_queue_affinity(virtio_device_t *vdev, virtqueue_t *vq, uint32_t cpu);
+
+uint8_t virtio_cfg_read8(virtio_device_t *vdev, uint32_t offset);
+uint16_t virtio_cfg_read16(virtio_device_t *vdev, uint32_t offset);
+uint32_t virtio_cfg_read32(virtio_device_t *vdev, uint32_t offset);
+
+int virtq_add(virtqueue_t *vq, virtq_buf_t *bufs, int out, int in, void *cookie);
+void virtq_kick(virtqueue_t *vq);
+void *virtq_get_used(virtqueue_t *vq, uint32_t *len);
+void virtq_disable_cb(virtqueue_t *vq);
+int virtq_enable_cb(virtqueue_t *vq);
+
+#endif
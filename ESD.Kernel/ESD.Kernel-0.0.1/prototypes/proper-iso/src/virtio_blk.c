@@ -0,0 +1,226 @@
+#include "virtio_blk.h"
+#include "paging.h"
+#include "pmm.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+static virtio_blk_t vblk_devices[VIRTIO_BLK_MAX_DEVICES];
+static int vblk_count = 0;
+static const char *vblk_names[VIRTIO_BLK_MAX_DEVICES] = { "vda", "vdb" };
+
+// Append the physical pieces of [virt, virt + len) to bufs, merging
+// pieces that turn out to be physically contiguous
+static int vblk_map(virtq_buf_t *bufs, int n, int max, uint32_t virt, uint32_t len) {
+    while (len > 0) {
+        uint32_t phys = paging_translate(virt);
+        uint32_t chunk = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (phys == 0) {
+            return -1;
+        }
+
+        if (n > 0 && bufs[n - 1].addr + bufs[n - 1].len == phys) {
+            bufs[n - 1].len += chunk;
+        } else {
+            if (n >= max) {
+                return -1;
+            }
+            bufs[n].addr = phys;
+            bufs[n].len = chunk;
+            n++;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+// Move queued groups onto the ring and notify once for the whole batch.
+// Caller holds vblk->lock.
+static void vblk_dispatch(virtio_blk_t *vblk) {
+    virtq_buf_t bufs[VIRTIO_BLK_MAX_DESC];
+    int queued = 0;
+
+    while (!blk_queue_empty(&vblk->queue) && vblk->slot_top > 0 &&
+           vblk->vq.num_free >= vblk->max_desc) {
+        blk_request_t *group = blk_queue_next(&vblk->queue);
+        uint16_t index = vblk->slot_free[--vblk->slot_top];
+        virtio_blk_slot_t *slot = &vblk->slots[index];
+
+        slot->hdr.type = group->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        slot->hdr.reserved = 0;
+        slot->hdr.sector = group->lba;
+        slot->status = 0xFF;
+        slot->req = group;
+
+        int n = vblk_map(bufs, 0, vblk->max_desc, (uint32_t)&slot->hdr, sizeof(slot->hdr));
+        for (blk_request_t *seg = group; seg != NULL && n > 0; seg = seg->seg_next) {
+            n = vblk_map(bufs, n, vblk->max_desc - 1, (uint32_t)seg->buffer, seg->count * 512);
+        }
+        int out = group->write ? n : 1;
+        if (n > 0) {
+            bufs[n].addr = paging_translate((uint32_t)&slot->status);
+            bufs[n].len = 1;
+            n++;
+        }
+
+        if (n <= 0 || virtq_add(&vblk->vq, bufs, out, n - out, slot) < 0) {
+            vblk->slot_free[vblk->slot_top++] = index;
+            blk_complete(group, BLK_ERROR);
+            continue;
+        }
+        queued++;
+    }
+
+    if (queued > 0) {
+        vblk->batches++;
+        virtq_kick(&vblk->vq);
+    }
+}
+
+// Bottom half: reap every finished chain, refill the ring, then complete
+// requests outside the lock since done callbacks may submit more I/O
+static void vblk_bottom_half(void *ctx) {
+    virtio_blk_t *vblk = ctx;
+    blk_request_t *done[VIRTQ_MAX_SIZE];
+    uint8_t status[VIRTQ_MAX_SIZE];
+    int count = 0;
+    virtio_blk_slot_t *slot;
+
+    // At most one used entry per slot, so the arrays cannot overflow
+    uint32_t flags = spin_lock_irqsave(&vblk->lock);
+    do {
+        virtq_disable_cb(&vblk->vq);
+        while ((slot = virtq_get_used(&vblk->vq, NULL)) != NULL) {
+            done[count] = slot->req;
+            status[count] = slot->status;
+            count++;
+            vblk->slot_free[vblk->slot_top++] = slot - vblk->slots;
+            vblk->completed++;
+        }
+    } while (!virtq_enable_cb(&vblk->vq));
+    vblk_dispatch(vblk);
+    spin_unlock_irqrestore(&vblk->lock, flags);
+
+    for (int i = 0; i < count; i++) {
+        blk_complete(done[i], status[i] == VIRTIO_BLK_S_OK ? BLK_DONE : BLK_ERROR);
+    }
+}
+
+static void vblk_interrupt(void *ctx) {
+    virtio_blk_t *vblk = ctx;
+    tasklet_schedule(&vblk->bh);
+}
+
+static void vblk_submit(block_device_t *dev, blk_request_t *req) {
+    virtio_blk_t *vblk = dev->driver_data;
+    uint32_t flags = spin_lock_irqsave(&vblk->lock);
+
+    blk_queue_add(&vblk->queue, req);
+    if (!dev->plugged) {
+        vblk_dispatch(vblk);
+    }
+
+    spin_unlock_irqrestore(&vblk->lock, flags);
+}
+
+static void vblk_unplug(block_device_t *dev) {
+    virtio_blk_t *vblk = dev->driver_data;
+    uint32_t flags = spin_lock_irqsave(&vblk->lock);
+
+    vblk_dispatch(vblk);
+
+    spin_unlock_irqrestore(&vblk->lock, flags);
+}
+
+static int virtio_blk_probe(virtio_blk_t *vblk, pci_device_t *pci) {
+    if (virtio_init(&vblk->vdev, pci, VIRTIO_BLK_F_SEG_MAX | VIRTIO_F_RING_EVENT_IDX) != 0) {
+        return -1;
+    }
+
+    spin_init(&vblk->lock, "virtio_blk");
+    tasklet_init(&vblk->bh, vblk_bottom_half, vblk);
+    if (virtio_setup_queue(&vblk->vdev, &vblk->vq, 0, vblk_interrupt, vblk) != 0) {
+        return -1;
+    }
+
+    // A request needs a header, a status byte and at least two data
+    // descriptors for one page-crossing sector
+    if (vblk->vq.size < 4) {
+        return -1;
+    }
+    vblk->max_desc = vblk->vq.size < VIRTIO_BLK_MAX_DESC ? vblk->vq.size : VIRTIO_BLK_MAX_DESC;
+
+    // Data descriptors per request, which page splits add to: limited by
+    // the device's seg_max and by what a small ring can hold at once
+    uint32_t seg_max = vblk->max_desc - 2;
+    if (vblk->vdev.features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t dev_max = virtio_cfg_read32(&vblk->vdev, VIRTIO_BLK_CFG_SEG_MAX);
+        if (dev_max < seg_max) {
+            seg_max = dev_max;
+        }
+    }
+    uint32_t max_segs = VIRTIO_BLK_MAX_SEGS;
+    uint32_t max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    if (seg_max < VIRTIO_BLK_MAX_PAGES + VIRTIO_BLK_MAX_SEGS) {
+        max_segs = seg_max > VIRTIO_BLK_MAX_PAGES ? seg_max - VIRTIO_BLK_MAX_PAGES : 1;
+    }
+    if (seg_max <= VIRTIO_BLK_MAX_PAGES) {
+        max_sectors = seg_max > 1 ? (seg_max - 1) * 8 : 8;
+    }
+    blk_queue_init(&vblk->queue, max_sectors, max_segs);
+
+    vblk->slot_top = 0;
+    for (int i = vblk->vq.size - 1; i >= 0; i--) {
+        vblk->slot_free[vblk->slot_top++] = i;
+    }
+
+    uint32_t cap_hi = virtio_cfg_read32(&vblk->vdev, VIRTIO_BLK_CFG_CAPACITY + 4);
+    uint32_t cap_lo = virtio_cfg_read32(&vblk->vdev, VIRTIO_BLK_CFG_CAPACITY);
+
+    vblk->blk.name = vblk_names[vblk_count];
+    vblk->blk.sector_size = 512;
+    vblk->blk.sector_count = cap_hi ? 0xFFFFFFFF : cap_lo;
+    vblk->blk.submit = vblk_submit;
+    vblk->blk.unplug = vblk_unplug;
+    vblk->blk.driver_data = vblk;
+
+    virtio_driver_ok(&vblk->vdev);
+    blk_register(&vblk->blk);
+    return 0;
+}
+
+void virtio_blk_init() {
+    pci_device_t *pci = NULL;
+
+    while (vblk_count < VIRTIO_BLK_MAX_DEVICES &&
+           (pci = virtio_find(VIRTIO_TYPE_BLK, pci)) != NULL) {
+        if (virtio_blk_probe(&vblk_devices[vblk_count], pci) == 0) {
+            vblk_count++;
+        }
+    }
+}
+
+void virtio_blk_print_stats() {
+    for (int i = 0; i < vblk_count; i++) {
+        virtio_blk_t *vblk = &vblk_devices[i];
+        k_print_string(vblk->blk.name);
+        k_print_string(vblk->vdev.modern ? ": modern" : ": legacy");
+        k_print_string(vblk->vdev.msix ? " msix" : " intx");
+        k_print_string(" completed=");
+        k_print_dec(vblk->completed);
+        k_print_string(" batches=");
+        k_print_dec(vblk->batches);
+        k_print_string(" merges=");
+        k_print_dec(vblk->queue.merges);
+        k_print_string(" kicks=");
+        k_print_dec(vblk->vq.kicks);
+        k_print_string(" suppressed=");
+        k_print_dec(vblk->vq.kicks_suppressed);
+        k_print_string(" irqs=");
+        k_print_dec(vblk->vq.interrupts);
+        k_print_string("\n");
+    }
+}
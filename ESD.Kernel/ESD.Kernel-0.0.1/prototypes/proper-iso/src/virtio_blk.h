@@ -0,0 +1,59 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include "virtio.h"
+#include "blk.h"
+#include "tasklet.h"
+#include "spinlock.h"
+
+#define VIRTIO_BLK_F_SEG_MAX (1ULL << 2)
+#define VIRTIO_BLK_F_RO      (1ULL << 5)
+
+#define VIRTIO_BLK_CFG_CAPACITY 0
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTIO_BLK_MAX_DEVICES 2
+#define VIRTIO_BLK_MAX_SECTORS 256
+#define VIRTIO_BLK_MAX_SEGS    32
+#define VIRTIO_BLK_MAX_PAGES   (VIRTIO_BLK_MAX_SECTORS * 512 / 4096)
+// Header, status, and every segment crossing at most one extra page
+#define VIRTIO_BLK_MAX_DESC    (2 + VIRTIO_BLK_MAX_SEGS + VIRTIO_BLK_MAX_PAGES)
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_hdr_t;
+
+// Per in-flight request: header and status must be device-visible memory
+typedef struct {
+    virtio_blk_hdr_t hdr;
+    uint8_t status;
+    blk_request_t *req;
+} virtio_blk_slot_t;
+
+typedef struct {
+    virtio_device_t vdev;
+    virtqueue_t vq;
+    blk_queue_t queue;
+    block_device_t blk;
+    tasklet_t bh;
+    spinlock_t lock;
+    int max_desc;               // descriptors a request may take
+    uint32_t batches;
+    uint32_t completed;
+    uint16_t slot_free[VIRTQ_MAX_SIZE];
+    int slot_top;
+    virtio_blk_slot_t slots[VIRTQ_MAX_SIZE];
+} virtio_blk_t;
+
+void virtio_blk_init();
+void virtio_blk_print_stats();
+
+#endif
@@ -0,0 +1,376 @@
+#include "virtio_net.h"
+#include "apic.h"
+#include "paging.h"
+#include "pmm.h"
+#include "mem.h"
+#include "timer.h"
+#include "simple_kernel.h"
+#include <stddef.h>
+
+#define VIRTIO_NET_CTRL_TIMEOUT_MS 100
+
+static virtio_net_t vnet_devices[VIRTIO_NET_MAX_DEVICES];
+static int vnet_count = 0;
+static const char *vnet_names[VIRTIO_NET_MAX_DEVICES] = { "eth0" };
+
+// The header and frame go in separate descriptors, which legacy devices
+// without ANY_LAYOUT require
+static int vnet_post_rx(virtio_net_queue_t *q, uint8_t *buf) {
+    virtq_buf_t bufs[2];
+
+    bufs[0].addr = paging_translate((uint32_t)buf);
+    bufs[0].len = q->vnet->hdr_len;
+    bufs[1].addr = bufs[0].addr + VIRTIO_NET_DATA_OFF;
+    bufs[1].len = VIRTIO_NET_BUF_SIZE - VIRTIO_NET_DATA_OFF;
+    return virtq_add(&q->rx, bufs, 0, 2, buf) < 0 ? -1 : 0;
+}
+
+// TX completions raise no interrupt; finished frames are released
+// whenever the queue is next touched. Caller holds q->lock.
+static void vnet_reap_tx(virtio_net_queue_t *q) {
+    virtio_net_tx_slot_t *slot;
+
+    while ((slot = virtq_get_used(&q->tx, NULL)) != NULL) {
+        pbuf_free(slot->p);
+        slot->p = NULL;
+        q->tx_free[q->tx_top++] = slot - q->tx_slots;
+    }
+}
+
+// Caller holds q->lock
+static void vnet_flush_tx(virtio_net_queue_t *q) {
+    if (q->tx.added > 0) {
+        q->tx_batches++;
+        virtq_kick(&q->tx);
+    }
+}
+
+// Bottom half: hand every received frame up and put its buffer straight
+// back on the ring, then ring the TX doorbell for frames queued since
+static void vnet_bottom_half(void *ctx) {
+    virtio_net_queue_t *q = ctx;
+    virtio_net_t *vnet = q->vnet;
+    uint8_t *buf;
+    uint32_t len;
+
+    do {
+        virtq_disable_cb(&q->rx);
+        while ((buf = virtq_get_used(&q->rx, &len)) != NULL) {
+            virtio_net_hdr_t *hdr = (virtio_net_hdr_t *)buf;
+            // A partial checksum comes from a sender on the same host
+            // and counts as verified
+            uint32_t flags = hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM) ?
+                             NETDEV_RX_CSUM_VALID : 0;
+            if (len > vnet->hdr_len) {
+                netdev_receive(&vnet->netdev, buf + VIRTIO_NET_DATA_OFF, len - vnet->hdr_len, flags);
+            } else {
+                vnet->netdev.rx_dropped++;
+            }
+            if (vnet_post_rx(q, buf) == 0) {
+                q->rx_recycled++;
+            }
+        }
+    } while (!virtq_enable_cb(&q->rx));
+    virtq_kick(&q->rx);
+
+    uint32_t flags = spin_lock_irqsave(&q->lock);
+    vnet_reap_tx(q);
+    vnet_flush_tx(q);
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+static void vnet_interrupt(void *ctx) {
+    virtio_net_queue_t *q = ctx;
+    tasklet_schedule(&q->bh);
+}
+
+static void vnet_ctrl_interrupt(void *ctx) {
+    (void)ctx;
+}
+
+// The device flips the status bit as the host side of the link comes and goes
+static void vnet_config_changed(void *ctx) {
+    virtio_net_t *vnet = ctx;
+
+    if (vnet->vdev.features & VIRTIO_NET_F_STATUS) {
+        vnet->netdev.link_up = virtio_cfg_read16(&vnet->vdev, VIRTIO_NET_CFG_STATUS) & VIRTIO_NET_S_LINK_UP;
+    }
+}
+
+// The frame's pieces go to the device as they are, behind a header
+// descriptor. A full batch is kicked at once; a partial one waits for the
+// bottom half so a burst of sends shares one doorbell.
+static int vnet_xmit(net_device_t *dev, pbuf_t *p) {
+    virtio_net_t *vnet = dev->driver_data;
+    virtio_net_queue_t *q = &vnet->queues[cpu_id() % vnet->pairs];
+    virtq_buf_t bufs[1 + VIRTIO_NET_TX_SEGS];
+    int n = 1;
+
+    for (pbuf_t *piece = p; piece != NULL; piece = piece->next) {
+        if (piece->len == 0) {
+            continue;
+        }
+        if (n > VIRTIO_NET_TX_SEGS) {
+            return -1;
+        }
+        bufs[n].addr = paging_translate((uint32_t)piece->payload);
+        bufs[n].len = piece->len;
+        n++;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&q->lock);
+    if (q->tx_top == 0 || q->tx.num_free < n) {
+        vnet_reap_tx(q);
+    }
+    if (q->tx_top == 0 || q->tx.num_free < n) {
+        q->tx_full++;
+        spin_unlock_irqrestore(&q->lock, flags);
+        return -1;
+    }
+
+    uint16_t index = q->tx_free[--q->tx_top];
+    virtio_net_tx_slot_t *slot = &q->tx_slots[index];
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+    if (p->flags & PBUF_CSUM_PARTIAL) {
+        slot->hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        slot->hdr.csum_start = p->csum_start;
+        slot->hdr.csum_offset = p->csum_offset;
+    }
+    slot->p = p;
+
+    bufs[0].addr = paging_translate((uint32_t)&slot->hdr);
+    bufs[0].len = vnet->hdr_len;
+    if (virtq_add(&q->tx, bufs, n, 0, slot) < 0) {
+        slot->p = NULL;
+        q->tx_free[q->tx_top++] = index;
+        spin_unlock_irqrestore(&q->lock, flags);
+        return -1;
+    }
+
+    if (q->tx.added >= VIRTIO_NET_TX_BATCH) {
+        vnet_flush_tx(q);
+    } else {
+        tasklet_schedule(&q->bh);
+    }
+
+    spin_unlock_irqrestore(&q->lock, flags);
+    return 0;
+}
+
+static int vnet_setup_pair(virtio_net_t *vnet, int i) {
+    virtio_net_queue_t *q = &vnet->queues[i];
+
+    q->vnet = vnet;
+    q->cpu = i;
+    spin_init(&q->lock, "virtio_net");
+    tasklet_init(&q->bh, vnet_bottom_half, q);
+    if (virtio_setup_queue(&vnet->vdev, &q->rx, 2 * i, vnet_interrupt, q) != 0 ||
+        virtio_setup_queue(&vnet->vdev, &q->tx, 2 * i + 1, vnet_interrupt, q) != 0) {
+        return -1;
+    }
+    virtq_disable_cb(&q->tx);
+
+    // Each buffer takes two descriptors, so a ring holds half as many
+    q->rx_count = q->rx.size / 2 < VIRTIO_NET_RX_BUFS ? q->rx.size / 2 : VIRTIO_NET_RX_BUFS;
+    q->tx_count = q->tx.size / 2 < VIRTIO_NET_TX_SLOTS ? q->tx.size / 2 : VIRTIO_NET_TX_SLOTS;
+    q->rx_bufs = (uint8_t *)pmm_alloc_frames((q->rx_count * VIRTIO_NET_BUF_SIZE + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (q->rx_bufs == NULL) {
+        return -1;
+    }
+
+    for (int b = 0; b < q->rx_count; b++) {
+        vnet_post_rx(q, q->rx_bufs + b * VIRTIO_NET_BUF_SIZE);
+    }
+    q->tx_top = 0;
+    for (int b = q->tx_count - 1; b >= 0; b--) {
+        q->tx_free[q->tx_top++] = b;
+    }
+
+    if (vnet->vdev.msix) {
+        virtio_set_queue_affinity(&vnet->vdev, &q->rx, q->cpu);
+        virtio_set_queue_affinity(&vnet->vdev, &q->tx, q->cpu);
+    }
+    return 0;
+}
+
+// Undo a pair set up (possibly partly) by vnet_setup_pair
+static void vnet_release_pair(virtio_net_t *vnet, int i) {
+    virtio_net_queue_t *q = &vnet->queues[i];
+
+    if (q->rx_bufs != NULL) {
+        pmm_free_frames((uint32_t)q->rx_bufs, (q->rx_count * VIRTIO_NET_BUF_SIZE + PAGE_SIZE - 1) / PAGE_SIZE);
+        q->rx_bufs = NULL;
+    }
+    if (vnet->vdev.queues[2 * i] == &q->rx) {
+        virtio_del_queue(&vnet->vdev, &q->rx);
+    }
+    if (vnet->vdev.queues[2 * i + 1] == &q->tx) {
+        virtio_del_queue(&vnet->vdev, &q->tx);
+    }
+}
+
+// Polled: runs once at probe time with nothing else on the control queue
+static int vnet_set_pairs(virtio_net_t *vnet, uint16_t pairs) {
+    virtq_buf_t bufs[3];
+
+    vnet->ctrl_cmd.class = VIRTIO_NET_CTRL_MQ;
+    vnet->ctrl_cmd.cmd = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+    vnet->ctrl_cmd.pairs = pairs;
+    vnet->ctrl_cmd.ack = 0xFF;
+
+    bufs[0].addr = paging_translate((uint32_t)&vnet->ctrl_cmd.class);
+    bufs[0].len = 2;
+    bufs[1].addr = paging_translate((uint32_t)&vnet->ctrl_cmd.pairs);
+    bufs[1].len = 2;
+    bufs[2].addr = paging_translate((uint32_t)&vnet->ctrl_cmd.ack);
+    bufs[2].len = 1;
+    if (virtq_add(&vnet->ctrl, bufs, 2, 1, &vnet->ctrl_cmd) < 0) {
+        return -1;
+    }
+    virtq_kick(&vnet->ctrl);
+
+    uint32_t start = timer_ticks();
+    while (virtq_get_used(&vnet->ctrl, NULL) == NULL) {
+        if (timer_ticks() - start > MS_TO_TICKS(VIRTIO_NET_CTRL_TIMEOUT_MS)) {
+            return -1;
+        }
+        cpu_relax();
+    }
+    return vnet->ctrl_cmd.ack == VIRTIO_NET_OK ? 0 : -1;
+}
+
+static int virtio_net_probe(virtio_net_t *vnet, pci_device_t *pci) {
+    uint64_t want = VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC |
+                    VIRTIO_NET_F_STATUS | VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ |
+                    VIRTIO_F_RING_EVENT_IDX;
+    if (virtio_init(&vnet->vdev, pci, want) != 0) {
+        return -1;
+    }
+    uint64_t features = vnet->vdev.features;
+    vnet->hdr_len = (features & VIRTIO_F_VERSION_1) ? sizeof(virtio_net_hdr_t) : sizeof(virtio_net_hdr_t) - 2;
+
+    // One pair per online CPU, as far as the device and our queue table
+    // allow; the control queue sits after the device's last pair
+    uint16_t max_pairs = 1;
+    if ((features & VIRTIO_NET_F_MQ) && (features & VIRTIO_NET_F_CTRL_VQ)) {
+        max_pairs = virtio_cfg_read16(&vnet->vdev, VIRTIO_NET_CFG_MAX_PAIRS);
+    }
+    vnet->pairs = cpu_online_count();
+    if (vnet->pairs > max_pairs) {
+        vnet->pairs = max_pairs;
+    }
+    if (vnet->pairs > VIRTIO_NET_MAX_PAIRS || 2 * max_pairs >= VIRTIO_MAX_QUEUES) {
+        vnet->pairs = 1;
+    }
+    if (vnet->pairs < 1) {
+        vnet->pairs = 1;
+    }
+
+    for (int i = 0; i < vnet->pairs; i++) {
+        if (vnet_setup_pair(vnet, i) != 0) {
+            vnet_release_pair(vnet, i);
+            if (i == 0) {
+                return -1;
+            }
+            vnet->pairs = i;
+            break;
+        }
+    }
+    // Without a control queue the device never runs more than pair 0
+    if (vnet->pairs > 1 &&
+        virtio_setup_queue(&vnet->vdev, &vnet->ctrl, 2 * max_pairs, vnet_ctrl_interrupt, vnet) != 0) {
+        while (vnet->pairs > 1) {
+            vnet_release_pair(vnet, --vnet->pairs);
+        }
+    }
+
+    if (features & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < ETH_ALEN; i++) {
+            vnet->netdev.mac[i] = virtio_cfg_read8(&vnet->vdev, VIRTIO_NET_CFG_MAC + i);
+        }
+    } else {
+        // Locally administered, unicast
+        static const uint8_t fallback[ETH_ALEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+        memcpy(vnet->netdev.mac, fallback, ETH_ALEN);
+        vnet->netdev.mac[ETH_ALEN - 1] += vnet_count;
+    }
+    // Without STATUS the link is always up; with it, follow config changes
+    vnet->netdev.link_up = 1;
+    if (features & VIRTIO_NET_F_STATUS) {
+        virtio_setup_config_irq(&vnet->vdev, vnet_config_changed, vnet);
+        vnet_config_changed(vnet);
+    }
+
+    vnet->netdev.name = vnet_names[vnet_count];
+    vnet->netdev.mtu = ETH_MTU;
+    if (features & VIRTIO_NET_F_CSUM) {
+        vnet->netdev.features |= NETDEV_F_TX_CSUM;
+    }
+    if (features & VIRTIO_NET_F_GUEST_CSUM) {
+        vnet->netdev.features |= NETDEV_F_RX_CSUM;
+    }
+    vnet->netdev.xmit = vnet_xmit;
+    vnet->netdev.driver_data = vnet;
+
+    virtio_driver_ok(&vnet->vdev);
+    for (int i = 0; i < vnet->pairs; i++) {
+        virtq_kick(&vnet->queues[i].rx);
+    }
+    // The device starts with a single pair until told otherwise
+    if (vnet->pairs > 1 && vnet_set_pairs(vnet, vnet->pairs) != 0) {
+        vnet->pairs = 1;
+    }
+
+    netdev_register(&vnet->netdev);
+    return 0;
+}
+
+void virtio_net_init() {
+    pci_device_t *pci = NULL;
+
+    while (vnet_count < VIRTIO_NET_MAX_DEVICES &&
+           (pci = virtio_find(VIRTIO_TYPE_NET, pci)) != NULL) {
+        if (virtio_net_probe(&vnet_devices[vnet_count], pci) == 0) {
+            vnet_count++;
+        }
+    }
+}
+
+void virtio_net_print_stats() {
+    for (int i = 0; i < vnet_count; i++) {
+        virtio_net_t *vnet = &vnet_devices[i];
+        k_print_string(vnet->netdev.name);
+        k_print_string(vnet->vdev.modern ? ": modern" : ": legacy");
+        k_print_string(vnet->vdev.msix ? " msix" : " intx");
+        k_print_string(" pairs=");
+        k_print_dec(vnet->pairs);
+        k_print_string("\n");
+
+        for (int p = 0; p < vnet->pairs; p++) {
+            virtio_net_queue_t *q = &vnet->queues[p];
+            k_print_string("  q");
+            k_print_dec(p);
+            k_print_string(" cpu=");
+            k_print_dec(q->cpu);
+            k_print_string(" rx: bufs=");
+            k_print_dec(q->rx_count);
+            k_print_string(" recycled=");
+            k_print_dec(q->rx_recycled);
+            k_print_string(" kicks=");
+            k_print_dec(q->rx.kicks);
+            k_print_string(" irqs=");
+            k_print_dec(q->rx.interrupts);
+            k_print_string("\n     tx: slots=");
+            k_print_dec(q->tx_count);
+            k_print_string(" batches=");
+            k_print_dec(q->tx_batches);
+            k_print_string(" kicks=");
+            k_print_dec(q->tx.kicks);
+            k_print_string(" suppressed=");
+            k_print_dec(q->tx.kicks_suppressed);
+            k_print_string(" full=");
+            k_print_dec(q->tx_full);
+            k_print_string("\n");
+        }
+    }
+}
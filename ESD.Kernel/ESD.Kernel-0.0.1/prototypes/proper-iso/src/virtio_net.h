@@ -0,0 +1,97 @@
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+#include <stdint.h>
+#include "virtio.h"
+#include "netdev.h"
+#include "tasklet.h"
+#include "spinlock.h"
+#include "cpu.h"
+
+#define VIRTIO_NET_F_CSUM       (1ULL << 0)
+#define VIRTIO_NET_F_GUEST_CSUM (1ULL << 1)
+#define VIRTIO_NET_F_MAC     (1ULL << 5)
+#define VIRTIO_NET_F_STATUS  (1ULL << 16)
+#define VIRTIO_NET_F_CTRL_VQ (1ULL << 17)
+#define VIRTIO_NET_F_MQ      (1ULL << 22)
+
+#define VIRTIO_NET_CFG_MAC       0
+#define VIRTIO_NET_CFG_STATUS    6
+#define VIRTIO_NET_CFG_MAX_PAIRS 8
+
+#define VIRTIO_NET_S_LINK_UP 1
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+
+#define VIRTIO_NET_CTRL_MQ              4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+#define VIRTIO_NET_OK                   0
+
+#define VIRTIO_NET_MAX_DEVICES 1
+#define VIRTIO_NET_MAX_PAIRS   MAX_CPUS
+#define VIRTIO_NET_BUF_SIZE    2048    // two per page, never crossing one
+#define VIRTIO_NET_DATA_OFF    16      // frame follows the header slot
+#define VIRTIO_NET_RX_BUFS     128     // per queue, two descriptors each
+#define VIRTIO_NET_TX_SLOTS    64
+#define VIRTIO_NET_TX_SEGS     4       // pbuf pieces per frame
+#define VIRTIO_NET_TX_BATCH    16      // frames per doorbell under load
+
+// Header without mergeable buffers; num_buffers only exists with VERSION_1
+typedef struct {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+} __attribute__((packed)) virtio_net_hdr_t;
+
+// Per in-flight frame: the header must be device-visible memory, and the
+// pbuf stays referenced until the device is done reading it
+typedef struct {
+    virtio_net_hdr_t hdr;
+    pbuf_t *p;
+} virtio_net_tx_slot_t;
+
+struct virtio_net;
+
+// One RX/TX queue pair, normally serviced by a single CPU
+typedef struct {
+    struct virtio_net *vnet;
+    virtqueue_t rx;
+    virtqueue_t tx;
+    spinlock_t lock;            // TX ring and slots
+    tasklet_t bh;
+    uint32_t cpu;
+    uint8_t *rx_bufs;
+    uint16_t rx_count;
+    uint16_t tx_count;
+    uint16_t tx_free[VIRTIO_NET_TX_SLOTS];
+    int tx_top;
+    virtio_net_tx_slot_t tx_slots[VIRTIO_NET_TX_SLOTS];
+    uint32_t rx_recycled;
+    uint32_t tx_batches;
+    uint32_t tx_full;
+} virtio_net_queue_t;
+
+typedef struct virtio_net {
+    virtio_device_t vdev;
+    net_device_t netdev;
+    uint32_t hdr_len;
+    int pairs;
+    virtqueue_t ctrl;
+    struct {
+        uint8_t class;
+        uint8_t cmd;
+        uint16_t pairs;
+        uint8_t ack;
+    } __attribute__((packed)) ctrl_cmd;
+    virtio_net_queue_t queues[VIRTIO_NET_MAX_PAIRS];
+} virtio_net_t;
+
+void virtio_net_init();
+void virtio_net_print_stats();
+
+#endif
@@ -0,0 +1,606 @@
+#include "wm.h"
+#include "fbcon.h"
+#include "font.h"
+#include "input.h"
+#include "mem.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "tasklet.h"
+#include "simple_kernel.h"
+#include "cpu.h"
+#include <stddef.h>
+
+// Compositing window manager on top of the framebuffer console. Changes
+// only record damage; once per frame tick the damaged screen rectangles
+// are split against the window stack from the top down, so each pixel is
+// fetched from the one window that shows it and hidden parts of lower
+// windows are never touched.
+
+static struct {
+    int running;
+    fbcon_surface_t fb;
+    wm_window_t *stack[WM_MAX_WINDOWS]; // bottom to top
+    int count;
+    wm_rect_t damage[WM_MAX_DAMAGE];
+    int ndamage;
+    uint32_t background;
+
+    // Mouse pointer and an in-progress title bar drag
+    wm_window_t *pointer;
+    int px, py;
+    uint8_t buttons;
+    wm_window_t *drag;
+    int drag_x, drag_y;
+
+    volatile int composing;             // blitting from a frame snapshot
+} wm;
+
+static wm_window_t windows[WM_MAX_WINDOWS];
+static wm_stats_t stats;
+static spinlock_t wm_lock;
+static ktimer_t frame_timer;
+static tasklet_t frame_tasklet;
+static input_consumer_t wm_input;
+static int initialized;
+
+static inline int rect_empty(const wm_rect_t *r) {
+    return r->x0 >= r->x1 || r->y0 >= r->y1;
+}
+
+static inline uint32_t rect_area(const wm_rect_t *r) {
+    return rect_empty(r) ? 0 : (uint32_t)(r->x1 - r->x0) * (uint32_t)(r->y1 - r->y0);
+}
+
+static int rect_intersect(const wm_rect_t *a, const wm_rect_t *b, wm_rect_t *out) {
+    out->x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+    out->y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+    out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+    return !rect_empty(out);
+}
+
+// Overlapping or edge-adjacent
+static int rect_touches(const wm_rect_t *a, const wm_rect_t *b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static void rect_union(wm_rect_t *a, const wm_rect_t *b) {
+    a->x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+    a->y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+    a->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    a->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+}
+
+static wm_rect_t window_rect(const wm_window_t *win) {
+    wm_rect_t r = { win->x, win->y, win->x + (int)win->width, win->y + (int)win->height };
+    return r;
+}
+
+// Caller holds wm_lock
+static void damage_add(wm_rect_t r) {
+    wm_rect_t screen = { 0, 0, (int)wm.fb.width, (int)wm.fb.height };
+
+    if (!wm.running || !rect_intersect(&r, &screen, &r)) {
+        return;
+    }
+    stats.damage_rects++;
+
+    // Fold in everything the new rectangle touches, repeatedly, since a
+    // grown rectangle can reach further entries
+    for (int i = 0; i < wm.ndamage; i++) {
+        if (rect_touches(&wm.damage[i], &r)) {
+            rect_union(&r, &wm.damage[i]);
+            wm.damage[i] = wm.damage[--wm.ndamage];
+            stats.damage_merges++;
+            i = -1;
+        }
+    }
+
+    if (wm.ndamage == WM_MAX_DAMAGE) {
+        for (int i = 1; i < wm.ndamage; i++) {
+            rect_union(&wm.damage[0], &wm.damage[i]);
+        }
+        rect_union(&wm.damage[0], &r);
+        stats.damage_merges += wm.ndamage;
+        wm.ndamage = 1;
+        return;
+    }
+    wm.damage[wm.ndamage++] = r;
+}
+
+static void blit_window(const wm_window_t *win, const wm_rect_t *r) {
+    uint32_t bytes = (r->x1 - r->x0) * 4;
+    const uint32_t *src = win->pixels + (r->y0 - win->y) * win->width + (r->x0 - win->x);
+    uint8_t *dst = wm.fb.pixels + r->y0 * wm.fb.pitch + r->x0 * 4;
+
+    for (int y = r->y0; y < r->y1; y++) {
+        memcpy(dst, src, bytes);
+        src += win->width;
+        dst += wm.fb.pitch;
+    }
+}
+
+static void fill_background(const wm_rect_t *r) {
+    uint8_t *dst = wm.fb.pixels + r->y0 * wm.fb.pitch + r->x0 * 4;
+
+    for (int y = r->y0; y < r->y1; y++, dst += wm.fb.pitch) {
+        uint32_t *px = (uint32_t *)dst;
+        for (int x = r->x0; x < r->x1; x++) {
+            *px++ = wm.background;
+        }
+    }
+}
+
+// One frame's damage and window stack, copied under wm_lock so blitting
+// can run with interrupts enabled
+typedef struct {
+    wm_window_t stack[WM_MAX_WINDOWS];  // bottom to top
+    int count;
+    wm_rect_t damage[WM_MAX_DAMAGE];
+    int ndamage;
+    uint32_t pieces;
+    uint32_t pixels;
+    uint32_t pixels_painter;
+} wm_frame_t;
+
+// Paint r from the windows at stack positions <= level. The visible part
+// of the topmost overlapping window is blitted and the up to four bands
+// around it go on to the windows below.
+static void compose_rect(wm_frame_t *f, wm_rect_t r, int level) {
+    for (; level >= 0; level--) {
+        const wm_window_t *win = &f->stack[level];
+        wm_rect_t bounds = window_rect(win);
+        wm_rect_t in;
+
+        if (!rect_intersect(&r, &bounds, &in)) {
+            continue;
+        }
+        blit_window(win, &in);
+        f->pieces++;
+        f->pixels += rect_area(&in);
+
+        wm_rect_t above = { r.x0, r.y0, r.x1, in.y0 };
+        wm_rect_t below = { r.x0, in.y1, r.x1, r.y1 };
+        wm_rect_t left = { r.x0, in.y0, in.x0, in.y1 };
+        wm_rect_t right = { in.x1, in.y0, r.x1, in.y1 };
+        if (!rect_empty(&above)) {
+            compose_rect(f, above, level - 1);
+        }
+        if (!rect_empty(&below)) {
+            compose_rect(f, below, level - 1);
+        }
+        if (!rect_empty(&left)) {
+            compose_rect(f, left, level - 1);
+        }
+        if (!rect_empty(&right)) {
+            compose_rect(f, right, level - 1);
+        }
+        return;
+    }
+
+    fill_background(&r);
+    f->pieces++;
+    f->pixels += rect_area(&r);
+}
+
+void wm_compose() {
+    wm_frame_t frame;
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+
+    if (!wm.running || wm.ndamage == 0) {
+        spin_unlock_irqrestore(&wm_lock, flags);
+        return;
+    }
+    for (int w = 0; w < wm.count; w++) {
+        frame.stack[w] = *wm.stack[w];
+    }
+    frame.count = wm.count;
+    memcpy(frame.damage, wm.damage, wm.ndamage * sizeof(wm_rect_t));
+    frame.ndamage = wm.ndamage;
+    wm.ndamage = 0;
+    // wm_destroy waits for this before freeing pixels
+    wm.composing = 1;
+    spin_unlock_irqrestore(&wm_lock, flags);
+
+    frame.pieces = 0;
+    frame.pixels = 0;
+    frame.pixels_painter = 0;
+    for (int i = 0; i < frame.ndamage; i++) {
+        wm_rect_t *r = &frame.damage[i];
+        frame.pixels_painter += rect_area(r);
+        for (int w = 0; w < frame.count; w++) {
+            wm_rect_t bounds = window_rect(&frame.stack[w]);
+            wm_rect_t in;
+            if (rect_intersect(r, &bounds, &in)) {
+                frame.pixels_painter += rect_area(&in);
+            }
+        }
+        compose_rect(&frame, *r, frame.count - 1);
+    }
+
+    flags = spin_lock_irqsave(&wm_lock);
+    wm.composing = 0;
+    stats.pieces += frame.pieces;
+    stats.pixels += frame.pixels;
+    stats.pixels_painter += frame.pixels_painter;
+    stats.frames++;
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+// The timer fires in IRQ context; composing runs as a tasklet
+static void wm_frame_timer(void *ctx) {
+    tasklet_schedule(ctx);
+}
+
+// Topmost window under a screen point, ignoring the pointer
+static wm_window_t *window_at(int x, int y) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    wm_window_t *found = NULL;
+
+    for (int i = wm.count - 1; i >= 0 && found == NULL; i--) {
+        wm_window_t *win = wm.stack[i];
+        if (win != wm.pointer && x >= win->x && x < win->x + (int)win->width &&
+            y >= win->y && y < win->y + (int)win->height) {
+            found = win;
+        }
+    }
+
+    spin_unlock_irqrestore(&wm_lock, flags);
+    return found;
+}
+
+static void wm_mouse_event(const input_event_t *ev) {
+    int pressed = (ev->buttons & MOUSE_LEFT) && !(wm.buttons & MOUSE_LEFT);
+
+    wm.px += ev->dx;
+    wm.py += ev->dy;
+    wm.px = wm.px < 0 ? 0 : wm.px >= (int)wm.fb.width ? (int)wm.fb.width - 1 : wm.px;
+    wm.py = wm.py < 0 ? 0 : wm.py >= (int)wm.fb.height ? (int)wm.fb.height - 1 : wm.py;
+    wm.buttons = ev->buttons;
+
+    if (pressed) {
+        wm_window_t *win = window_at(wm.px, wm.py);
+        if (win != NULL) {
+            wm_raise(win);
+            if (wm.py - win->y < WM_TITLE_HEIGHT) {
+                wm.drag = win;
+                wm.drag_x = wm.px - win->x;
+                wm.drag_y = wm.py - win->y;
+            }
+        }
+    } else if (!(wm.buttons & MOUSE_LEFT)) {
+        wm.drag = NULL;
+    }
+
+    if (wm.drag != NULL) {
+        wm_move(wm.drag, wm.px - wm.drag_x, wm.py - wm.drag_y);
+    }
+    if (wm.pointer != NULL) {
+        wm_move(wm.pointer, wm.px, wm.py);
+    }
+}
+
+static void wm_frame_work(void *ctx) {
+    (void)ctx;
+    input_event_t events[32];
+    int count;
+
+    // Handle all input since the last frame, then draw once
+    while ((count = input_read(&wm_input, events, 32)) > 0) {
+        for (int i = 0; i < count; i++) {
+            wm_mouse_event(&events[i]);
+        }
+    }
+    wm_compose();
+    if (wm.running) {
+        timer_add(&frame_timer, MS_TO_TICKS(WM_FRAME_MS), wm_frame_timer, &frame_tasklet);
+    }
+}
+
+// Windows may be created before the first wm_start
+static void wm_setup() {
+    if (!initialized) {
+        spin_init(&wm_lock, "wm");
+        tasklet_init(&frame_tasklet, wm_frame_work, NULL);
+        initialized = 1;
+    }
+}
+
+static void draw_frame(wm_window_t *win) {
+    uint32_t border = fbcon_color(0x08);
+    uint32_t title_bg = fbcon_color(0x01);
+
+    wm_fill(win, 0, 0, win->width, win->height, border);
+    wm_fill(win, WM_BORDER, WM_BORDER, win->width - 2 * WM_BORDER, WM_TITLE_HEIGHT - WM_BORDER, title_bg);
+    wm_fill(win, WM_BORDER, WM_TITLE_HEIGHT, win->width - 2 * WM_BORDER,
+            win->height - WM_TITLE_HEIGHT - WM_BORDER, fbcon_color(0x07));
+    if (win->title != NULL) {
+        wm_text(win, 4, (WM_TITLE_HEIGHT - FONT_HEIGHT) / 2, win->title, fbcon_color(0x0F), title_bg);
+    }
+}
+
+// Caller holds wm_lock
+static int stack_index(wm_window_t *win) {
+    for (int i = 0; i < wm.count; i++) {
+        if (wm.stack[i] == win) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static wm_window_t *window_alloc(int x, int y, uint32_t width, uint32_t height, const char *title) {
+    wm_window_t *win = NULL;
+
+    wm_setup();
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    for (int i = 0; i < WM_MAX_WINDOWS; i++) {
+        if (!windows[i].used) {
+            win = &windows[i];
+            win->used = 1;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&wm_lock, flags);
+    if (win == NULL) {
+        return NULL;
+    }
+
+    uint32_t frames = (width * height * 4 + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t mem = pmm_alloc_frames(frames);
+    if (mem == 0) {
+        win->used = 0;
+        return NULL;
+    }
+    win->pixels = (uint32_t *)mem;
+    win->frames = frames;
+    win->x = x;
+    win->y = y;
+    win->width = width;
+    win->height = height;
+    win->title = title;
+    return win;
+}
+
+// Caller holds wm_lock. The pointer always stays on top.
+static void stack_push(wm_window_t *win) {
+    int top = wm.count;
+
+    if (wm.pointer != NULL && win != wm.pointer && top > 0 && wm.stack[top - 1] == wm.pointer) {
+        wm.stack[top] = wm.pointer;
+        top--;
+    }
+    wm.stack[top] = win;
+    wm.count++;
+}
+
+// Caller holds wm_lock
+static void stack_remove(int i) {
+    for (; i < wm.count - 1; i++) {
+        wm.stack[i] = wm.stack[i + 1];
+    }
+    wm.count--;
+}
+
+// Makes a fully drawn window visible
+static void window_show(wm_window_t *win) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    stack_push(win);
+    damage_add(window_rect(win));
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+// Opaque square with a diagonal; good enough without alpha
+static void draw_pointer(wm_window_t *win) {
+    wm_fill(win, 0, 0, win->width, win->height, fbcon_color(0x00));
+    wm_fill(win, 1, 1, win->width - 2, win->height - 2, fbcon_color(0x0F));
+    for (uint32_t i = 1; i + 1 < win->width; i++) {
+        wm_fill(win, i, i, 1, 1, fbcon_color(0x00));
+    }
+}
+
+wm_window_t *wm_create(int x, int y, uint32_t width, uint32_t height, const char *title) {
+    if (width < 2 * WM_BORDER + 1 || height < WM_TITLE_HEIGHT + WM_BORDER + 1) {
+        return NULL;
+    }
+
+    wm_window_t *win = window_alloc(x, y, width, height, title);
+    if (win != NULL) {
+        draw_frame(win);
+        window_show(win);
+    }
+    return win;
+}
+
+int wm_start() {
+    if (wm.running || fbcon_get_surface(&wm.fb) != 0) {
+        return -1;
+    }
+    wm_setup();
+
+    wm.background = fbcon_rgb(0x20, 0x40, 0x60);
+    fbcon_suspend(1);
+
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    wm.running = 1;
+    wm.ndamage = 0;
+    damage_add((wm_rect_t){ 0, 0, (int)wm.fb.width, (int)wm.fb.height });
+    spin_unlock_irqrestore(&wm_lock, flags);
+
+    wm.px = wm.fb.width / 2;
+    wm.py = wm.fb.height / 2;
+    wm.drag = NULL;
+    wm.pointer = window_alloc(wm.px, wm.py, WM_POINTER_SIZE, WM_POINTER_SIZE, NULL);
+    if (wm.pointer != NULL) {
+        draw_pointer(wm.pointer);
+        window_show(wm.pointer);
+    }
+    input_register(&wm_input, "wm", INPUT_MASK(INPUT_MOUSE));
+
+    timer_add(&frame_timer, MS_TO_TICKS(WM_FRAME_MS), wm_frame_timer, &frame_tasklet);
+    return 0;
+}
+
+// Windows survive; the console repaints the screen
+void wm_stop() {
+    if (!wm.running) {
+        return;
+    }
+    wm.running = 0;
+    timer_cancel(&frame_timer);
+    input_unregister(&wm_input);
+    if (wm.pointer != NULL) {
+        wm_window_t *pointer = wm.pointer;
+        wm.pointer = NULL;
+        wm_destroy(pointer);
+    }
+    wm.drag = NULL;
+    fbcon_suspend(0);
+}
+
+int wm_running() {
+    return wm.running;
+}
+
+void wm_destroy(wm_window_t *win) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    if (!win->used) {
+        spin_unlock_irqrestore(&wm_lock, flags);
+        return;
+    }
+    // The slot can be reused as soon as it is marked free
+    uint32_t pixels = (uint32_t)win->pixels;
+    uint32_t frames = win->frames;
+    win->used = 0;
+    win->pixels = NULL;
+
+    int i = stack_index(win);
+    if (i >= 0) {
+        stack_remove(i);
+        damage_add(window_rect(win));
+    }
+    // The mouse handler must not move a freed window
+    if (wm.drag == win) {
+        wm.drag = NULL;
+    }
+    if (wm.pointer == win) {
+        wm.pointer = NULL;
+    }
+    spin_unlock_irqrestore(&wm_lock, flags);
+
+    // A frame in progress may still be reading the pixels
+    while (wm.composing) {
+        cpu_relax();
+    }
+    pmm_free_frames(pixels, frames);
+}
+
+void wm_move(wm_window_t *win, int x, int y) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    damage_add(window_rect(win));
+    win->x = x;
+    win->y = y;
+    damage_add(window_rect(win));
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+void wm_raise(wm_window_t *win) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    int i = stack_index(win);
+    if (i >= 0 && wm.stack[wm.count - 1] != win) {
+        stack_remove(i);
+        stack_push(win);
+        damage_add(window_rect(win));
+    }
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+void wm_damage(wm_window_t *win, int x, int y, uint32_t width, uint32_t height) {
+    wm_rect_t local = { x, y, x + (int)width, y + (int)height };
+    wm_rect_t bounds = { 0, 0, (int)win->width, (int)win->height };
+
+    if (!rect_intersect(&local, &bounds, &local)) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    if (stack_index(win) >= 0) {
+        damage_add((wm_rect_t){ local.x0 + win->x, local.y0 + win->y, local.x1 + win->x, local.y1 + win->y });
+    }
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+void wm_fill(wm_window_t *win, int x, int y, uint32_t width, uint32_t height, uint32_t color) {
+    wm_rect_t r = { x, y, x + (int)width, y + (int)height };
+    wm_rect_t bounds = { 0, 0, (int)win->width, (int)win->height };
+
+    if (!rect_intersect(&r, &bounds, &r)) {
+        return;
+    }
+    for (int row = r.y0; row < r.y1; row++) {
+        uint32_t *px = win->pixels + row * win->width + r.x0;
+        for (int col = r.x0; col < r.x1; col++) {
+            *px++ = color;
+        }
+    }
+    wm_damage(win, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+}
+
+void wm_text(wm_window_t *win, int x, int y, const char *str, uint32_t fg, uint32_t bg) {
+    int start = x;
+
+    for (; *str != '\0' && x + FONT_WIDTH <= (int)win->width; str++, x += FONT_WIDTH) {
+        for (int row = 0; row < FONT_HEIGHT; row++) {
+            if (y + row < 0 || y + row >= (int)win->height || x < 0) {
+                continue;
+            }
+            uint8_t bits = font_row(*str, row);
+            uint32_t *px = win->pixels + (y + row) * win->width + x;
+            for (int col = 0; col < FONT_WIDTH; col++) {
+                px[col] = (bits & (0x80 >> col)) ? fg : bg;
+            }
+        }
+    }
+    if (x > start) {
+        wm_damage(win, start, y, x - start, FONT_HEIGHT);
+    }
+}
+
+void wm_get_stats(wm_stats_t *out) {
+    uint32_t flags = spin_lock_irqsave(&wm_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&wm_lock, flags);
+}
+
+// part * 100 / whole, scaled down until whole fits a 32-bit divisor
+static uint32_t wm_percent(uint64_t part, uint64_t whole) {
+    while (whole >> 32) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    return whole ? (uint32_t)div_u64(part * 100, (uint32_t)whole) : 0;
+}
+
+void wm_print_stats() {
+    wm_stats_t s;
+
+    wm_get_stats(&s);
+    k_print_string("wm: ");
+    k_print_string(wm.running ? "running, " : "stopped, ");
+    k_print_dec(wm.count);
+    k_print_string(" windows\n  frames=");
+    k_print_dec(s.frames);
+    k_print_string(" damage=");
+    k_print_dec(s.damage_rects);
+    k_print_string(" merged=");
+    k_print_dec(s.damage_merges);
+    k_print_string(" pieces=");
+    k_print_dec(s.pieces);
+    k_print_string("\n  kpixels=");
+    k_print_dec((uint32_t)div_u64(s.pixels, 1000));
+    k_print_string(" painter=");
+    k_print_dec((uint32_t)div_u64(s.pixels_painter, 1000));
+    k_print_string(" (saved ");
+    k_print_dec(wm_percent(s.pixels_painter - s.pixels, s.pixels_painter));
+    k_print_string("%)\n");
+}
@@ -0,0 +1,56 @@
+#ifndef WM_H
+#define WM_H
+
+#include <stdint.h>
+
+#define WM_MAX_WINDOWS  16
+#define WM_MAX_DAMAGE   32              // rects per frame before collapsing to one
+#define WM_FRAME_MS     16              // compose at most this often
+#define WM_TITLE_HEIGHT 18
+#define WM_BORDER       1
+#define WM_POINTER_SIZE 9
+
+// Screen rectangle, half-open: [x0, x1) x [y0, y1)
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} wm_rect_t;
+
+// Windows are opaque and own an off-screen buffer that includes their
+// decorations; clients draw in window coordinates.
+typedef struct wm_window {
+    int x, y;
+    uint32_t width, height;
+    uint32_t *pixels;
+    uint32_t frames;
+    const char *title;
+    int used;
+} wm_window_t;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t damage_rects;
+    uint32_t damage_merges;
+    uint32_t pieces;                    // visible rectangles blitted
+    uint64_t pixels;                    // pixels written to the framebuffer
+    uint64_t pixels_painter;            // what back-to-front painting would write
+} wm_stats_t;
+
+int wm_start();
+void wm_stop();
+int wm_running();
+
+wm_window_t *wm_create(int x, int y, uint32_t width, uint32_t height, const char *title);
+void wm_destroy(wm_window_t *win);
+void wm_move(wm_window_t *win, int x, int y);
+void wm_raise(wm_window_t *win);
+
+void wm_fill(wm_window_t *win, int x, int y, uint32_t width, uint32_t height, uint32_t color);
+void wm_text(wm_window_t *win, int x, int y, const char *str, uint32_t fg, uint32_t bg);
+void wm_damage(wm_window_t *win, int x, int y, uint32_t width, uint32_t height);
+void wm_compose();
+
+void wm_get_stats(wm_stats_t *out);
+void wm_print_stats();
+
+#endif
@@ -0,0 +1,69 @@
+#include "zero_pool.h"
+#include "pmm.h"
+#include "mem.h"
+#include "cpu.h"
+
+// Stack of frames already cleared by the idle loop. Getting a zero page is
+// a pop; the fault path only clears memory itself when the pool ran dry.
+static uint32_t pool[ZERO_POOL_SIZE];
+static uint32_t pool_top = 0;
+static uint32_t pool_hits = 0;
+static uint32_t pool_misses = 0;
+
+uint32_t zero_pool_get() {
+    uint32_t flags = irq_save();
+
+    if (pool_top > 0) {
+        uint32_t frame = pool[--pool_top];
+        pool_hits++;
+        irq_restore(flags);
+        return frame;
+    }
+    pool_misses++;
+    irq_restore(flags);
+
+    uint32_t frame = pmm_alloc_frame();
+    if (frame != 0) {
+        memset((void *)frame, 0, PAGE_SIZE);
+    }
+    return frame;
+}
+
+// Clear up to budget frames into the pool, returns how many were added
+int zero_pool_refill(int budget) {
+    int added = 0;
+
+    while (added < budget && pool_top < ZERO_POOL_SIZE) {
+        uint32_t frame = pmm_alloc_frame();
+        if (frame == 0) {
+            break;
+        }
+        memzero_nt((void *)frame, PAGE_SIZE);
+
+        uint32_t flags = irq_save();
+        if (pool_top < ZERO_POOL_SIZE) {
+            pool[pool_top++] = frame;
+            frame = 0;
+        }
+        irq_restore(flags);
+
+        if (frame != 0) {
+            pmm_free_frame(frame);
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+uint32_t zero_pool_count() {
+    return pool_top;
+}
+
+uint32_t zero_pool_hits() {
+    return pool_hits;
+}
+
+uint32_t zero_pool_misses() {
+    return pool_misses;
+}
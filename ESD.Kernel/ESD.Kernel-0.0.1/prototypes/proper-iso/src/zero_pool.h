@@ -0,0 +1,14 @@
+#ifndef ZERO_POOL_H
+#define ZERO_POOL_H
+
+#include <stdint.h>
+
+#define ZERO_POOL_SIZE 256
+
+uint32_t zero_pool_get();
+int zero_pool_refill(int budget);
+uint32_t zero_pool_count();
+uint32_t zero_pool_hits();
+uint32_t zero_pool_misses();
+
+#endif
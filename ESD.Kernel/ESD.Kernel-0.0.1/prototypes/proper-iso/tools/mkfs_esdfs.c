@@ -0,0 +1,229 @@
+// Host tool: create an esdfs image, optionally filled from a directory.
+//
+//   mkfs_esdfs <image> <size-MiB> [source-dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "esdfs_core.h"
+
+static uint8_t *image;
+static uint32_t image_blocks;
+
+static void *host_map(void *ctx, uint32_t block, void **cookie) {
+    (void)ctx;
+    *cookie = NULL;
+    if (block >= image_blocks) {
+        fprintf(stderr, "mkfs_esdfs: block %u out of range\n", block);
+        exit(1);
+    }
+    return image + (size_t)block * ESDFS_BLOCK_SIZE;
+}
+
+static void host_unmap(void *ctx, void *cookie, int dirty) {
+    (void)ctx;
+    (void)cookie;
+    (void)dirty;
+}
+
+static esdfs_io_t io = { NULL, host_map, host_unmap };
+
+static void set_bit(uint32_t *bits, uint32_t bit) {
+    bits[bit / 32] |= 1u << (bit & 31);
+}
+
+static void format(uint32_t blocks) {
+    void *cookie;
+    esdfs_super_t *sb = host_map(NULL, ESDFS_SUPER_BLOCK, &cookie);
+    esdfs_group_t *groups = host_map(NULL, ESDFS_GROUP_TABLE, &cookie);
+    uint32_t *inode_bits = host_map(NULL, ESDFS_INODE_BITMAP, &cookie);
+
+    uint32_t inodes = blocks / 4;
+    if (inodes > ESDFS_MAX_INODES) {
+        inodes = ESDFS_MAX_INODES;
+    }
+    inodes = (inodes + ESDFS_INODES_PER_BLOCK - 1) / ESDFS_INODES_PER_BLOCK * ESDFS_INODES_PER_BLOCK;
+
+    sb->magic = ESDFS_MAGIC;
+    sb->version = ESDFS_VERSION;
+    sb->block_size = ESDFS_BLOCK_SIZE;
+    sb->block_count = blocks;
+    sb->group_count = (blocks + ESDFS_GROUP_BLOCKS - 1) / ESDFS_GROUP_BLOCKS;
+    sb->inode_count = inodes;
+    sb->inode_blocks = inodes / ESDFS_INODES_PER_BLOCK;
+    sb->free_inodes = inodes - 1;
+    sb->mtime = (uint32_t)time(NULL);
+    set_bit(inode_bits, 0);
+
+    for (uint32_t g = 0; g < sb->group_count; g++) {
+        uint32_t start = g * ESDFS_GROUP_BLOCKS;
+        uint32_t nbits = blocks - start < ESDFS_GROUP_BLOCKS ? blocks - start : ESDFS_GROUP_BLOCKS;
+        uint32_t used;
+
+        if (g == 0) {
+            groups[g].bitmap = ESDFS_INODE_TABLE + sb->inode_blocks;
+            used = groups[g].bitmap + 1;
+        } else {
+            groups[g].bitmap = start;
+            used = 1;
+        }
+
+        uint32_t *bits = host_map(NULL, groups[g].bitmap, &cookie);
+        for (uint32_t b = 0; b < used; b++) {
+            set_bit(bits, b);
+        }
+        groups[g].free = nbits - used;
+        sb->free_blocks += groups[g].free;
+    }
+}
+
+static int copy_file(const char *path, uint32_t ino, off_t size) {
+    void *cookie;
+    esdfs_inode_t *inode = esdfs_map_inode(&io, ino, &cookie);
+    uint32_t blocks = (size + ESDFS_BLOCK_SIZE - 1) / ESDFS_BLOCK_SIZE;
+
+    if (esdfs_extend(&io, ino, inode, blocks) != 0) {
+        fprintf(stderr, "mkfs_esdfs: no space for %s\n", path);
+        return -1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    for (uint32_t b = 0; b < blocks; ) {
+        uint32_t run;
+        uint32_t disk = esdfs_bmap(&io, inode, b, &run);
+        if (run > blocks - b) {
+            run = blocks - b;
+        }
+        if (fread(image + (size_t)disk * ESDFS_BLOCK_SIZE, 1, (size_t)run * ESDFS_BLOCK_SIZE, f) == 0 &&
+            ferror(f)) {
+            perror(path);
+            fclose(f);
+            return -1;
+        }
+        b += run;
+    }
+    fclose(f);
+
+    inode->size = (uint32_t)size;
+    inode->links = 1;
+    inode->mtime = (uint32_t)time(NULL);
+    return 0;
+}
+
+static int copy_tree(const char *path, uint32_t dir_ino) {
+    DIR *d = opendir(path);
+    struct dirent *de;
+    int err = 0;
+
+    if (d == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (err == 0 && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+
+        char child[4096];
+        struct stat st;
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        if (stat(child, &st) != 0 || strlen(de->d_name) > ESDFS_NAME_MAX) {
+            fprintf(stderr, "mkfs_esdfs: skipping %s\n", child);
+            continue;
+        }
+
+        uint16_t type = S_ISDIR(st.st_mode) ? ESDFS_TYPE_DIR : ESDFS_TYPE_FILE;
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        uint32_t ino = esdfs_alloc_inode(&io, type);
+        if (ino == 0) {
+            fprintf(stderr, "mkfs_esdfs: out of inodes\n");
+            err = -1;
+            break;
+        }
+
+        void *cookie;
+        if (type == ESDFS_TYPE_DIR) {
+            esdfs_inode_t *inode = esdfs_map_inode(&io, ino, &cookie);
+            inode->links = 2;
+            err = esdfs_dir_init(&io, ino, inode, dir_ino);
+            if (err == 0) {
+                err = copy_tree(child, ino);
+            }
+        } else {
+            err = copy_file(child, ino, st.st_size);
+        }
+
+        esdfs_inode_t *dir = esdfs_map_inode(&io, dir_ino, &cookie);
+        if (err == 0 && esdfs_dir_insert(&io, dir, de->d_name, strlen(de->d_name), ino, type) != 0) {
+            fprintf(stderr, "mkfs_esdfs: cannot link %s\n", child);
+            err = -1;
+        } else if (err == 0 && type == ESDFS_TYPE_DIR) {
+            dir->links++;
+        }
+    }
+
+    closedir(d);
+    return err;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <image> <size-MiB> [source-dir]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t size_mb = (uint32_t)atoi(argv[2]);
+    image_blocks = size_mb * (1024 * 1024 / ESDFS_BLOCK_SIZE);
+    uint32_t max_blocks = ESDFS_MAX_GROUPS * ESDFS_GROUP_BLOCKS;
+    if (image_blocks < 64 || image_blocks > max_blocks) {
+        fprintf(stderr, "mkfs_esdfs: size must be between 1 and %u MiB\n",
+                max_blocks / (1024 * 1024 / ESDFS_BLOCK_SIZE));
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)image_blocks * ESDFS_BLOCK_SIZE) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    image = mmap(NULL, (size_t)image_blocks * ESDFS_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    format(image_blocks);
+
+    void *cookie;
+    uint32_t root = esdfs_alloc_inode(&io, ESDFS_TYPE_DIR);
+    esdfs_inode_t *inode = esdfs_map_inode(&io, root, &cookie);
+    inode->links = 2;
+    if (root != ESDFS_ROOT_INODE || esdfs_dir_init(&io, root, inode, root) != 0) {
+        fprintf(stderr, "mkfs_esdfs: cannot create root directory\n");
+        return 1;
+    }
+
+    int err = argc > 3 ? copy_tree(argv[3], root) : 0;
+
+    esdfs_super_t *sb = host_map(NULL, ESDFS_SUPER_BLOCK, &cookie);
+    printf("%s: %u blocks, %u groups, %u inodes, %u blocks free\n",
+           argv[1], sb->block_count, sb->group_count, sb->inode_count, sb->free_blocks);
+
+    munmap(image, (size_t)image_blocks * ESDFS_BLOCK_SIZE);
+    close(fd);
+    return err == 0 ? 0 : 1;
+}
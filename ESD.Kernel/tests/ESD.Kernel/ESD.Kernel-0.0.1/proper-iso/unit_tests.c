@@ -0,0 +1,1081 @@
+#include <stdio.h>
+#include "../../../test-tools/test-framework.h"
+
+// Mock implementations from proper-iso/src/mem.c. Only the paths that do
+// not need the FPU (generic and overlapping memmove) are exercised here.
+static inline void rep_movsb(void *dst, const void *src, size_t n) {
+    asm volatile ( "rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(n)
+                   : : "memory" );
+}
+
+void *memcpy_generic(void *dst, const void *src, size_t n) {
+    rep_movsb(dst, src, n);
+    return dst;
+}
+
+void *k_memmove(void *dst, const void *src, size_t n) {
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    if (d + n <= s || s + n <= d) {
+        return memcpy_generic(dst, src, n);
+    }
+
+    if (d < s) {
+        rep_movsb(d, s, n);
+    } else if (d > s) {
+        d += n - 1;
+        s += n - 1;
+        asm volatile ( "std\n\t"
+                       "rep movsb\n\t"
+                       "cld"
+                       : "+D"(d), "+S"(s), "+c"(n)
+                       : : "memory" );
+    }
+    return dst;
+}
+
+void *memset16(void *dst, uint16_t val, size_t count) {
+    void *d = dst;
+
+    asm volatile ( "rep stosw"
+                   : "+D"(d), "+c"(count)
+                   : "a"(val) : "memory" );
+    return dst;
+}
+
+// Mock implementations from proper-iso/src/blk.c (request merging and the
+// deadline elevator). Time is a plain counter instead of the PIT.
+#define BLK_READ_DEADLINE_TICKS  50
+#define BLK_WRITE_DEADLINE_TICKS 500
+
+typedef struct blk_request {
+    uint32_t lba;
+    uint32_t count;
+    int write;
+    uint32_t deadline;
+    uint32_t total;
+    uint32_t nsegs;
+    struct blk_request *sort_next;
+    struct blk_request *fifo_next;
+    struct blk_request *seg_next;
+} blk_request_t;
+
+typedef struct {
+    blk_request_t *sorted;
+    blk_request_t *fifo;
+    uint32_t head_pos;
+    uint32_t max_sectors;
+    uint32_t max_segs;
+    uint32_t merges;
+} blk_queue_t;
+
+uint32_t mock_ticks = 0;
+
+static inline int time_after(uint32_t a, uint32_t b) {
+    return (int32_t)(b - a) < 0;
+}
+
+void blk_queue_init(blk_queue_t *q, uint32_t max_sectors, uint32_t max_segs) {
+    q->sorted = NULL;
+    q->fifo = NULL;
+    q->head_pos = 0;
+    q->max_sectors = max_sectors;
+    q->max_segs = max_segs;
+    q->merges = 0;
+}
+
+static void blk_unlink(blk_request_t **list, blk_request_t *req, int fifo) {
+    for (blk_request_t **pos = list; *pos != NULL;
+         pos = fifo ? &(*pos)->fifo_next : &(*pos)->sort_next) {
+        if (*pos == req) {
+            *pos = fifo ? req->fifo_next : req->sort_next;
+            return;
+        }
+    }
+}
+
+static void blk_replace(blk_queue_t *q, blk_request_t *old, blk_request_t *new) {
+    for (blk_request_t **pos = &q->sorted; *pos != NULL; pos = &(*pos)->sort_next) {
+        if (*pos == old) {
+            new->sort_next = old->sort_next;
+            *pos = new;
+            break;
+        }
+    }
+    for (blk_request_t **pos = &q->fifo; *pos != NULL; pos = &(*pos)->fifo_next) {
+        if (*pos == old) {
+            new->fifo_next = old->fifo_next;
+            *pos = new;
+            break;
+        }
+    }
+}
+
+static int blk_try_merge(blk_queue_t *q, blk_request_t *req) {
+    for (blk_request_t *cur = q->sorted; cur != NULL; cur = cur->sort_next) {
+        if (cur->write != req->write ||
+            cur->total + req->count > q->max_sectors ||
+            cur->nsegs + 1 > q->max_segs) {
+            continue;
+        }
+        if (cur->lba + cur->total == req->lba) {
+            blk_request_t *tail = cur;
+            while (tail->seg_next != NULL) {
+                tail = tail->seg_next;
+            }
+            tail->seg_next = req;
+            cur->total += req->count;
+            cur->nsegs++;
+            q->merges++;
+            return 1;
+        }
+        if (req->lba + req->count == cur->lba) {
+            req->seg_next = cur;
+            req->total = cur->total + req->count;
+            req->nsegs = cur->nsegs + 1;
+            req->deadline = cur->deadline;
+            blk_replace(q, cur, req);
+            q->merges++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void blk_queue_add(blk_queue_t *q, blk_request_t *req) {
+    req->total = req->count;
+    req->nsegs = 1;
+    req->seg_next = NULL;
+    req->sort_next = NULL;
+    req->fifo_next = NULL;
+    req->deadline = mock_ticks +
+        (req->write ? BLK_WRITE_DEADLINE_TICKS : BLK_READ_DEADLINE_TICKS);
+
+    if (blk_try_merge(q, req)) {
+        return;
+    }
+
+    blk_request_t **pos = &q->sorted;
+    while (*pos != NULL && (*pos)->lba <= req->lba) {
+        pos = &(*pos)->sort_next;
+    }
+    req->sort_next = *pos;
+    *pos = req;
+
+    pos = &q->fifo;
+    while (*pos != NULL) {
+        pos = &(*pos)->fifo_next;
+    }
+    *pos = req;
+}
+
+blk_request_t *blk_queue_next(blk_queue_t *q) {
+    blk_request_t *req = NULL;
+
+    if (q->fifo != NULL && !time_after(q->fifo->deadline, mock_ticks)) {
+        req = q->fifo;
+    } else {
+        for (blk_request_t *cur = q->sorted; cur != NULL; cur = cur->sort_next) {
+            if (cur->lba >= q->head_pos) {
+                req = cur;
+                break;
+            }
+        }
+        if (req == NULL) {
+            req = q->sorted;
+        }
+    }
+
+    if (req != NULL) {
+        blk_unlink(&q->sorted, req, 0);
+        blk_unlink(&q->fifo, req, 1);
+        q->head_pos = req->lba + req->total;
+    }
+    return req;
+}
+
+blk_request_t requests[8];
+
+void make_request(blk_request_t *req, uint32_t lba, uint32_t count, int write) {
+    req->lba = lba;
+    req->count = count;
+    req->write = write;
+}
+
+// Mock implementations from proper-iso/src/bcache.c (LRU-2 replacement).
+// Devices, locking and I/O are left out; a lookup miss assigns a victim
+// and every lookup counts as one reference.
+#define MOCK_BCACHE_BUFFERS 4
+
+typedef struct {
+    int used;
+    uint32_t block;
+    uint32_t last_access;
+    uint32_t prev_access;
+} mock_buf_t;
+
+mock_buf_t mock_bufs[MOCK_BCACHE_BUFFERS];
+uint32_t access_clock;
+
+static void bcache_touch(mock_buf_t *buf) {
+    buf->prev_access = buf->last_access;
+    buf->last_access = ++access_clock;
+}
+
+static mock_buf_t *bcache_victim() {
+    mock_buf_t *victim = NULL;
+
+    for (int i = 0; i < MOCK_BCACHE_BUFFERS; i++) {
+        mock_buf_t *b = &mock_bufs[i];
+        if (victim == NULL || b->prev_access < victim->prev_access ||
+            (b->prev_access == victim->prev_access && b->last_access < victim->last_access)) {
+            victim = b;
+        }
+    }
+    return victim;
+}
+
+static void bcache_assign(mock_buf_t *buf, uint32_t block) {
+    buf->used = 1;
+    buf->block = block;
+    buf->prev_access = 0;
+    buf->last_access = 0;
+}
+
+mock_buf_t *bcache_get(uint32_t block) {
+    mock_buf_t *buf = NULL;
+
+    for (int i = 0; i < MOCK_BCACHE_BUFFERS; i++) {
+        if (mock_bufs[i].used && mock_bufs[i].block == block) {
+            buf = &mock_bufs[i];
+        }
+    }
+    if (buf == NULL) {
+        buf = bcache_victim();
+        bcache_assign(buf, block);
+    }
+    bcache_touch(buf);
+    return buf;
+}
+
+int bcache_cached(uint32_t block) {
+    for (int i = 0; i < MOCK_BCACHE_BUFFERS; i++) {
+        if (mock_bufs[i].used && mock_bufs[i].block == block) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// esdfs_core.c is shared with the host mkfs tool, so the real code runs
+// here against an image held in memory
+#define ESDFS_HOST
+#include "../../../../ESD.Kernel-0.0.1/prototypes/proper-iso/src/esdfs_core.c"
+
+#define TEST_ESDFS_BLOCKS 256
+#define TEST_ESDFS_INODES 128
+
+uint8_t esdfs_image[TEST_ESDFS_BLOCKS * ESDFS_BLOCK_SIZE];
+
+static void *esdfs_test_map(void *ctx, uint32_t block, void **cookie) {
+    (void)ctx;
+    *cookie = NULL;
+    return block < TEST_ESDFS_BLOCKS ? esdfs_image + block * ESDFS_BLOCK_SIZE : NULL;
+}
+
+static void esdfs_test_unmap(void *ctx, void *cookie, int dirty) {
+    (void)ctx;
+    (void)cookie;
+    (void)dirty;
+}
+
+esdfs_io_t esdfs_io = { NULL, esdfs_test_map, esdfs_test_unmap };
+
+// One allocation group, laid out as tools/mkfs_esdfs.c does
+esdfs_super_t *esdfs_format() {
+    memset(esdfs_image, 0, sizeof(esdfs_image));
+
+    esdfs_super_t *sb = (esdfs_super_t *)esdfs_image;
+    esdfs_group_t *groups = (esdfs_group_t *)(esdfs_image + ESDFS_GROUP_TABLE * ESDFS_BLOCK_SIZE);
+    uint32_t *inode_bits = (uint32_t *)(esdfs_image + ESDFS_INODE_BITMAP * ESDFS_BLOCK_SIZE);
+
+    sb->magic = ESDFS_MAGIC;
+    sb->version = ESDFS_VERSION;
+    sb->block_size = ESDFS_BLOCK_SIZE;
+    sb->block_count = TEST_ESDFS_BLOCKS;
+    sb->group_count = 1;
+    sb->inode_count = TEST_ESDFS_INODES;
+    sb->inode_blocks = TEST_ESDFS_INODES / ESDFS_INODES_PER_BLOCK;
+    sb->free_inodes = TEST_ESDFS_INODES - 1;
+    inode_bits[0] = 1;
+
+    groups[0].bitmap = ESDFS_INODE_TABLE + sb->inode_blocks;
+    uint32_t used = groups[0].bitmap + 1;
+    uint32_t *bits = (uint32_t *)(esdfs_image + groups[0].bitmap * ESDFS_BLOCK_SIZE);
+    for (uint32_t b = 0; b < used; b++) {
+        bits[b / 32] |= 1u << (b & 31);
+    }
+    groups[0].free = TEST_ESDFS_BLOCKS - used;
+    sb->free_blocks = groups[0].free;
+    return sb;
+}
+
+esdfs_inode_t *esdfs_test_root() {
+    void *cookie;
+    uint32_t ino = esdfs_alloc_inode(&esdfs_io, ESDFS_TYPE_DIR);
+    esdfs_inode_t *root = esdfs_map_inode(&esdfs_io, ino, &cookie);
+
+    esdfs_dir_init(&esdfs_io, ino, root, ino);
+    return root;
+}
+
+// Names are inserted out of order so leaves split in the middle
+#define TEST_ESDFS_NAMES 150
+
+static void esdfs_test_name(char *name, int i) {
+    name[0] = 'n';
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+}
+
+int esdfs_fill_dir(esdfs_inode_t *dir) {
+    char name[4];
+    int failed = 0;
+
+    for (int k = 0; k < TEST_ESDFS_NAMES; k++) {
+        int i = k * 37 % TEST_ESDFS_NAMES;
+        esdfs_test_name(name, i);
+        failed |= esdfs_dir_insert(&esdfs_io, dir, name, 4, 1000 + i, ESDFS_TYPE_FILE) != 0;
+    }
+    return failed;
+}
+
+typedef struct {
+    int count;
+    int ordered;
+    esdfs_dirent_t last;
+} esdfs_walk_t;
+
+static int esdfs_count_entry(void *arg, const esdfs_dirent_t *ent) {
+    esdfs_walk_t *walk = arg;
+
+    if (walk->count > 0 &&
+        name_cmp(walk->last.name, walk->last.name_len, ent->name, ent->name_len) >= 0) {
+        walk->ordered = 0;
+    }
+    walk->last = *ent;
+    walk->count++;
+    return 0;
+}
+
+// Mock implementations from proper-iso/src/checksum.c. The FPU needs no
+// saving in user space, and pbufs keep only what the walk reads.
+#define CSUM_SIMD_THRESHOLD 256
+#define CSUM_SIMD_CHUNK     (32 * 1024)
+
+typedef struct pbuf {
+    struct pbuf *next;
+    uint8_t *payload;
+    uint16_t len;
+} pbuf_t;
+
+static void kernel_fpu_begin() {}
+static void kernel_fpu_end() {}
+
+static uint32_t fold64(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+static uint32_t csum_generic(const uint8_t *buf, uint32_t len) {
+    uint64_t sum = 0;
+
+    for (; len >= 16; len -= 16, buf += 16) {
+        const uint32_t *w = (const uint32_t *)buf;
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    }
+    for (; len >= 4; len -= 4, buf += 4) {
+        sum += *(const uint32_t *)buf;
+    }
+    if (len >= 2) {
+        sum += *(const uint16_t *)buf;
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += *buf;
+    }
+    return fold64(sum);
+}
+
+static uint32_t csum_sse2(const uint8_t *buf, uint32_t len) {
+    if (len < CSUM_SIMD_THRESHOLD) {
+        return csum_generic(buf, len);
+    }
+
+    uint32_t lanes[4] __attribute__((aligned(16)));
+    uint64_t sum = 0;
+
+    kernel_fpu_begin();
+    while (len >= 32) {
+        uint32_t chunk = len < CSUM_SIMD_CHUNK ? len & ~31u : CSUM_SIMD_CHUNK;
+
+        asm volatile ( "pxor %%xmm0, %%xmm0\n\t"
+                       "pxor %%xmm1, %%xmm1\n\t"
+                       "pxor %%xmm7, %%xmm7"
+                       ::: "memory" );
+        for (uint32_t off = 0; off < chunk; off += 32) {
+            asm volatile ( "movdqu   (%0), %%xmm2\n\t"
+                           "movdqu 16(%0), %%xmm4\n\t"
+                           "movdqa %%xmm2, %%xmm3\n\t"
+                           "movdqa %%xmm4, %%xmm5\n\t"
+                           "punpcklwd %%xmm7, %%xmm2\n\t"
+                           "punpckhwd %%xmm7, %%xmm3\n\t"
+                           "punpcklwd %%xmm7, %%xmm4\n\t"
+                           "punpckhwd %%xmm7, %%xmm5\n\t"
+                           "paddd %%xmm2, %%xmm0\n\t"
+                           "paddd %%xmm3, %%xmm1\n\t"
+                           "paddd %%xmm4, %%xmm0\n\t"
+                           "paddd %%xmm5, %%xmm1"
+                           : : "r"(buf + off) : "memory" );
+        }
+        asm volatile ( "movdqa %%xmm0, (%0)" : : "r"(lanes) : "memory" );
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        asm volatile ( "movdqa %%xmm1, (%0)" : : "r"(lanes) : "memory" );
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+        buf += chunk;
+        len -= chunk;
+    }
+    kernel_fpu_end();
+
+    sum += csum_generic(buf, len);
+    return fold64(sum);
+}
+
+uint32_t (*csum_impl)(const uint8_t *buf, uint32_t len) = csum_generic;
+
+uint32_t csum_pbuf(const pbuf_t *p, uint32_t offset, uint32_t len, uint32_t sum) {
+    uint32_t pos = 0;
+
+    for (; p != NULL && len > 0; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint32_t chunk = p->len - offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        uint16_t part = csum_fold(csum_impl(p->payload + offset, chunk));
+        if (pos & 1) {
+            part = (uint16_t)((part << 8) | (part >> 8));
+        }
+        sum = fold64((uint64_t)sum + part);
+        pos += chunk;
+        len -= chunk;
+        offset = 0;
+    }
+    return sum;
+}
+
+// RFC 1071 one byte at a time in network order, swapped back to the
+// native order the kernel stores
+uint16_t csum_reference(const uint8_t *buf, uint32_t len) {
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        sum += (i & 1) ? buf[i] : (uint32_t)buf[i] << 8;
+    }
+    uint16_t folded = csum_fold(sum);
+    return (uint16_t)((folded << 8) | (folded >> 8));
+}
+
+#define CSUM_TEST_SIZE (80 * 1024)
+
+uint8_t csum_data[CSUM_TEST_SIZE + 8];
+
+// Mock implementations from proper-iso/src/tcp.c (sequence arithmetic)
+#define TCP_FIN 0x01
+
+#define TCP_SEG_NEXT  0
+#define TCP_SEG_OLD   1
+#define TCP_SEG_AHEAD 2
+
+static inline int seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline int seq_leq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+static inline int seq_gt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+static int tcp_seg_where(uint32_t rcv_nxt, uint32_t seq, uint32_t dlen, uint8_t flags, uint32_t *dup) {
+    *dup = 0;
+    if (seq_gt(seq, rcv_nxt)) {
+        return TCP_SEG_AHEAD;
+    }
+    if (seq_lt(seq, rcv_nxt)) {
+        *dup = rcv_nxt - seq;
+        if (*dup > dlen || (*dup == dlen && !(flags & TCP_FIN))) {
+            return TCP_SEG_OLD;
+        }
+    }
+    return TCP_SEG_NEXT;
+}
+
+// term.c runs as is; the console back end it draws on is a bare cursor
+// and attribute, which is all the parser tests look at
+#include "../../../../ESD.Kernel-0.0.1/prototypes/proper-iso/src/term.c"
+
+int cursor_x = 0;
+int cursor_y = 0;
+int console_width = VGA_WIDTH;
+int console_height = VGA_HEIGHT;
+unsigned char current_attr = DEFAULT_ATTR;
+
+void console_put_char(char c) {
+    if (c == '\n' || ++cursor_x == console_width) {
+        cursor_x = 0;
+        if (cursor_y < console_height - 1) {
+            cursor_y++;
+        }
+    }
+}
+
+void console_set_cell(int x, int y, char c, unsigned char attr) {
+    (void)x;
+    (void)y;
+    (void)c;
+    (void)attr;
+}
+
+static void term_test_start() {
+    term_reset();
+    current_attr = DEFAULT_ATTR;
+    cursor_x = cursor_y = 0;
+    console_width = VGA_WIDTH;
+    console_height = VGA_HEIGHT;
+}
+
+static void term_test_feed(const char *s) {
+    term_feed(s, strlen(s));
+}
+
+unsigned char buffer[512];
+
+// Initialize the test framework
+test_result_t test_results[100];
+int test_count = 0;
+int pass_count = 0;
+int fail_count = 0;
+
+void test_init() {
+    for (int i = 0; i < 512; i++) {
+        buffer[i] = (unsigned char)i;
+    }
+}
+
+void test_report_start(const char* test_name) {
+    test_results[test_count-1].name = test_name;
+    printf("==== TEST: %s ====\n", test_name);
+}
+
+void test_report_result(int result, const char* message) {
+    test_results[test_count-1].result = result;
+    test_results[test_count-1].message = message;
+    
+    if (result == TEST_PASS) {
+        printf("  [PASS] %s\n", message);
+    } else if (result == TEST_FAIL) {
+        printf("  [FAIL] %s\n", message);
+    } else {
+        printf("  [INFO] %s\n", message);
+    }
+}
+
+void test_report_summary() {
+    printf("\n==== TEST SUMMARY ====\n");
+    printf("Total tests: %d\n", test_count);
+    printf("Passed: %d\n", pass_count);
+    printf("Failed: %d\n", fail_count);
+    
+    if (fail_count == 0) {
+        printf("\nALL TESTS PASSED!\n");
+    } else {
+        printf("\nTESTS FAILED: %d of %d\n", fail_count, test_count);
+    }
+}
+
+// Scrolling moves rows towards lower addresses
+void test_memmove_forward_overlap() {
+    TEST_CASE("memmove copies overlapping regions downwards");
+    
+    test_init();
+    
+    k_memmove(buffer, buffer + 160, 320);
+    
+    TEST_ASSERT(buffer[0] == 160, "First byte should come from the source start");
+    TEST_ASSERT(buffer[319] == (unsigned char)479, "Last byte should come from the source end");
+}
+
+void test_memmove_backward_overlap() {
+    TEST_CASE("memmove copies overlapping regions upwards");
+    
+    test_init();
+    
+    k_memmove(buffer + 160, buffer, 320);
+    
+    TEST_ASSERT(buffer[160] == 0, "Destination start should hold the original first byte");
+    TEST_ASSERT(buffer[479] == (unsigned char)319, "Destination end should hold the original last byte");
+    TEST_ASSERT(buffer[0] == 0, "Bytes before the destination should be untouched");
+}
+
+void test_memset16_cells() {
+    TEST_CASE("memset16 fills VGA character/attribute cells");
+    
+    test_init();
+    
+    memset16(buffer, (0x1E << 8) | ' ', 80);
+    
+    TEST_ASSERT(buffer[0] == ' ' && buffer[1] == 0x1E, "First cell should hold char and attribute");
+    TEST_ASSERT(buffer[158] == ' ' && buffer[159] == 0x1E, "Last cell should hold char and attribute");
+    TEST_ASSERT(buffer[160] == 160, "Bytes past the count should be untouched");
+}
+
+void test_blk_merge() {
+    TEST_CASE("Block queue merges adjacent requests");
+    
+    blk_queue_t q;
+    blk_queue_init(&q, 256, 32);
+    mock_ticks = 0;
+    
+    make_request(&requests[0], 100, 8, 0);
+    make_request(&requests[1], 108, 8, 0);     // back merge
+    make_request(&requests[2], 92, 8, 0);      // front merge, new anchor
+    make_request(&requests[3], 116, 8, 1);     // write, not merged
+    blk_queue_add(&q, &requests[0]);
+    blk_queue_add(&q, &requests[1]);
+    blk_queue_add(&q, &requests[2]);
+    blk_queue_add(&q, &requests[3]);
+    
+    TEST_ASSERT(q.merges == 2, "Two requests should have been merged");
+    
+    blk_request_t *group = blk_queue_next(&q);
+    TEST_ASSERT(group == &requests[2], "Front-merged request should anchor the group");
+    TEST_ASSERT(group->total == 24 && group->nsegs == 3, "Group should cover all three reads");
+    TEST_ASSERT(group->seg_next == &requests[0] && requests[0].seg_next == &requests[1],
+                "Segments should be chained in LBA order");
+    TEST_ASSERT(blk_queue_next(&q) == &requests[3], "Write should be dispatched separately");
+    TEST_ASSERT(blk_queue_next(&q) == NULL, "Queue should be empty");
+}
+
+void test_blk_cscan() {
+    TEST_CASE("Block queue sweeps in one direction");
+    
+    blk_queue_t q;
+    blk_queue_init(&q, 256, 32);
+    mock_ticks = 0;
+    q.head_pos = 500;
+    
+    make_request(&requests[0], 100, 1, 0);
+    make_request(&requests[1], 900, 1, 0);
+    make_request(&requests[2], 600, 1, 0);
+    blk_queue_add(&q, &requests[0]);
+    blk_queue_add(&q, &requests[1]);
+    blk_queue_add(&q, &requests[2]);
+    
+    TEST_ASSERT(blk_queue_next(&q) == &requests[2], "Sweep should continue above the head");
+    TEST_ASSERT(blk_queue_next(&q) == &requests[1], "Sweep should take the next higher LBA");
+    TEST_ASSERT(blk_queue_next(&q) == &requests[0], "Sweep should wrap to the lowest LBA");
+}
+
+void test_blk_deadline() {
+    TEST_CASE("Block queue serves expired requests first");
+    
+    blk_queue_t q;
+    blk_queue_init(&q, 256, 32);
+    mock_ticks = 0;
+    q.head_pos = 500;
+    
+    make_request(&requests[0], 10, 1, 0);
+    blk_queue_add(&q, &requests[0]);
+    mock_ticks = 40;
+    make_request(&requests[1], 600, 1, 0);
+    blk_queue_add(&q, &requests[1]);
+    
+    mock_ticks = 60;
+    TEST_ASSERT(blk_queue_next(&q) == &requests[0], "Expired read should jump the sweep");
+    TEST_ASSERT(blk_queue_next(&q) == &requests[1], "Remaining read should follow");
+}
+
+void test_bcache_lru2_scan() {
+    TEST_CASE("Block cache keeps a twice-used block through a scan");
+    
+    for (int i = 0; i < MOCK_BCACHE_BUFFERS; i++) {
+        mock_bufs[i].used = 0;
+    }
+    access_clock = 0;
+    
+    bcache_get(1000);
+    bcache_get(1000);
+    bcache_get(2000);
+    TEST_ASSERT(bcache_get(2000)->prev_access != 0, "Second reference should be recorded");
+    
+    int single = 1;
+    for (uint32_t block = 0; block < 32; block++) {
+        single &= bcache_get(block)->prev_access == 0;
+    }
+    TEST_ASSERT(single, "Blocks read once should have no second reference");
+    
+    TEST_ASSERT(bcache_cached(1000), "Hot block should survive the scan");
+    TEST_ASSERT(bcache_cached(2000), "Second hot block should survive the scan");
+    TEST_ASSERT(bcache_cached(31), "Most recent scan block should be cached");
+    TEST_ASSERT(!bcache_cached(0), "Early scan blocks should have been evicted");
+}
+
+void test_esdfs_root_split() {
+    TEST_CASE("esdfs directory grows a new root when a leaf fills");
+    
+    esdfs_format();
+    esdfs_inode_t *dir = esdfs_test_root();
+    uint32_t first_root = dir->dir_root;
+    
+    TEST_ASSERT(esdfs_fill_dir(dir) == 0, "Every name should insert");
+    TEST_ASSERT(dir->dir_root != first_root, "Root should have moved up a level");
+    void *cookie;
+    esdfs_node_t *root = esdfs_test_map(NULL, dir->dir_root, &cookie);
+    TEST_ASSERT(root->level == 1 && root->count > 2, "New root should index several leaves");
+    TEST_ASSERT(dir->size == TEST_ESDFS_NAMES + 2, "Size should count . and .. too");
+    TEST_ASSERT(esdfs_dir_insert(&esdfs_io, dir, "n042", 4, 1, ESDFS_TYPE_FILE) != 0,
+                "Duplicate name should be refused");
+    
+    esdfs_walk_t walk = { 0, 1, { 0 } };
+    esdfs_dir_iterate(&esdfs_io, dir, esdfs_count_entry, &walk);
+    TEST_ASSERT(walk.count == TEST_ESDFS_NAMES + 2, "Leaf chain should reach every entry");
+    TEST_ASSERT(walk.ordered, "Leaf chain should be in name order");
+}
+
+void test_esdfs_lookup_after_split() {
+    TEST_CASE("esdfs lookup finds every name across split leaves");
+    
+    esdfs_format();
+    esdfs_inode_t *dir = esdfs_test_root();
+    esdfs_fill_dir(dir);
+    
+    esdfs_dirent_t ent;
+    char name[4];
+    int found = 1;
+    for (int i = 0; i < TEST_ESDFS_NAMES; i++) {
+        esdfs_test_name(name, i);
+        found &= esdfs_dir_lookup(&esdfs_io, dir, name, 4, &ent) == 0 && ent.inode == 1000 + (uint32_t)i;
+    }
+    TEST_ASSERT(found, "Each name should map to its own inode");
+    TEST_ASSERT(esdfs_dir_lookup(&esdfs_io, dir, "..", 2, &ent) == 0 && ent.inode == ESDFS_ROOT_INODE,
+                "Dot-dot should survive the split");
+    TEST_ASSERT(esdfs_dir_lookup(&esdfs_io, dir, "n999", 4, &ent) != 0, "Missing name past the end");
+    TEST_ASSERT(esdfs_dir_lookup(&esdfs_io, dir, "a", 1, &ent) != 0, "Missing name before the start");
+}
+
+void test_esdfs_unlink() {
+    TEST_CASE("esdfs removes names without disturbing their neighbours");
+    
+    esdfs_format();
+    esdfs_inode_t *dir = esdfs_test_root();
+    esdfs_fill_dir(dir);
+    
+    char name[4];
+    int removed = 1;
+    for (int i = 0; i < TEST_ESDFS_NAMES; i += 2) {
+        esdfs_test_name(name, i);
+        removed &= esdfs_dir_remove(&esdfs_io, dir, name, 4) == 0;
+    }
+    TEST_ASSERT(removed, "Every even name should be removed");
+    TEST_ASSERT(esdfs_dir_remove(&esdfs_io, dir, "n000", 4) != 0, "Second removal should fail");
+    
+    int correct = 1;
+    for (int i = 0; i < TEST_ESDFS_NAMES; i++) {
+        esdfs_test_name(name, i);
+        correct &= (esdfs_dir_lookup(&esdfs_io, dir, name, 4, NULL) == 0) == (i % 2 == 1);
+    }
+    TEST_ASSERT(correct, "Only odd names should remain");
+    
+    esdfs_walk_t walk = { 0, 1, { 0 } };
+    esdfs_dir_iterate(&esdfs_io, dir, esdfs_count_entry, &walk);
+    TEST_ASSERT(walk.count == TEST_ESDFS_NAMES / 2 + 2 && dir->size == (uint32_t)walk.count,
+                "Size and leaf chain should agree");
+    TEST_ASSERT(esdfs_dir_insert(&esdfs_io, dir, "n000", 4, 7, ESDFS_TYPE_FILE) == 0,
+                "A removed name should be reusable");
+}
+
+void test_esdfs_extents() {
+    TEST_CASE("esdfs allocates contiguous extents and spills to an extent block");
+    
+    esdfs_super_t *sb = esdfs_format();
+    uint32_t free_before = sb->free_blocks;
+    void *cookie;
+    uint32_t a_ino = esdfs_alloc_inode(&esdfs_io, ESDFS_TYPE_FILE);
+    uint32_t b_ino = esdfs_alloc_inode(&esdfs_io, ESDFS_TYPE_FILE);
+    esdfs_inode_t *a = esdfs_map_inode(&esdfs_io, a_ino, &cookie);
+    esdfs_inode_t *b = esdfs_map_inode(&esdfs_io, b_ino, &cookie);
+    
+    uint32_t run = 0;
+    TEST_ASSERT(esdfs_extend(&esdfs_io, a_ino, a, 4) == 0 && a->extent_count == 1,
+                "One request should give one extent");
+    uint32_t start = esdfs_bmap(&esdfs_io, a, 0, &run);
+    TEST_ASSERT(start != 0 && run == 4, "Whole allocation should be one run");
+    TEST_ASSERT(esdfs_bmap(&esdfs_io, a, 3, &run) == start + 3 && run == 1, "Run shrinks towards the end");
+    TEST_ASSERT(esdfs_bmap(&esdfs_io, a, 4, &run) == 0, "No block past the allocation");
+    
+    // Growing the files in turn fragments both past the inline extents
+    int grown = 1;
+    for (uint32_t n = 1; n <= ESDFS_INLINE_EXTENTS + 2; n++) {
+        grown &= esdfs_extend(&esdfs_io, b_ino, b, n) == 0;
+        grown &= esdfs_extend(&esdfs_io, a_ino, a, 4 + n) == 0;
+    }
+    TEST_ASSERT(grown, "Interleaved growth should succeed");
+    TEST_ASSERT(a->extent_count > ESDFS_INLINE_EXTENTS && a->extent_block != 0,
+                "Extents should move to their own block");
+    
+    int mapped = 1;
+    for (uint32_t fb = 0; fb < a->blocks; fb++) {
+        uint32_t disk = esdfs_bmap(&esdfs_io, a, fb, &run);
+        for (uint32_t other = 0; other < b->blocks; other++) {
+            mapped &= disk != 0 && disk != esdfs_bmap(&esdfs_io, b, other, NULL);
+        }
+    }
+    TEST_ASSERT(mapped, "Every block should map, and never to the other file's blocks");
+    
+    esdfs_release_blocks(&esdfs_io, a);
+    esdfs_release_blocks(&esdfs_io, b);
+    TEST_ASSERT(sb->free_blocks == free_before, "Releasing should return every block");
+}
+
+void test_csum_generic() {
+    TEST_CASE("Checksum matches RFC 1071 at every length and alignment");
+    
+    for (uint32_t i = 0; i < sizeof(csum_data); i++) {
+        csum_data[i] = (uint8_t)(i * 131 + (i >> 8));
+    }
+    
+    int match = 1;
+    for (uint32_t start = 0; start < 4; start++) {
+        for (uint32_t len = 0; len <= 300; len++) {
+            const uint8_t *buf = csum_data + start;
+            match &= csum_fold(csum_generic(buf, len)) == csum_reference(buf, len);
+        }
+    }
+    TEST_ASSERT(match, "Generic sum should agree with the byte-wise reference");
+    
+    uint8_t ones[64];
+    for (int i = 0; i < 64; i++) {
+        ones[i] = 0xFF;
+    }
+    TEST_ASSERT(csum_fold(csum_generic(ones, 64)) == 0xFFFF, "All-ones data should fold to 0xFFFF");
+    TEST_ASSERT(csum_fold(csum_generic(ones, 0)) == 0, "Empty data should sum to zero");
+}
+
+void test_csum_sse2() {
+    TEST_CASE("SSE2 checksum agrees with the generic one");
+    
+    static const uint32_t lengths[] = {
+        255, 256, 257, 287, 288, 1500, 4095, CSUM_SIMD_CHUNK - 1, CSUM_SIMD_CHUNK,
+        CSUM_SIMD_CHUNK + 33, CSUM_TEST_SIZE
+    };
+    int match = 1;
+    for (uint32_t start = 0; start < 4; start++) {
+        for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            const uint8_t *buf = csum_data + start;
+            match &= csum_fold(csum_sse2(buf, lengths[i])) == csum_fold(csum_generic(buf, lengths[i]));
+        }
+    }
+    TEST_ASSERT(match, "Both sums should fold to the same value");
+    
+    static uint8_t ones[CSUM_TEST_SIZE];
+    for (uint32_t i = 0; i < CSUM_TEST_SIZE; i++) {
+        ones[i] = 0xFF;
+    }
+    TEST_ASSERT(csum_fold(csum_sse2(ones, CSUM_TEST_SIZE)) == csum_reference(ones, CSUM_TEST_SIZE),
+                "Lanes should not wrap on all-ones data");
+}
+
+void test_csum_pbuf_chain() {
+    TEST_CASE("Checksum over a pbuf chain matches one flat buffer");
+    
+    const uint32_t total = 1000;
+    pbuf_t pieces[3];
+    int match = 1;
+    
+    for (int impl = 0; impl < 2; impl++) {
+        csum_impl = impl ? csum_sse2 : csum_generic;
+        for (uint32_t cut1 = 1; cut1 < 20; cut1++) {
+            for (uint32_t cut2 = cut1 + 1; cut2 < cut1 + 300; cut2 += 37) {
+                pieces[0] = (pbuf_t){ &pieces[1], csum_data, cut1 };
+                pieces[1] = (pbuf_t){ &pieces[2], csum_data + cut1, cut2 - cut1 };
+                pieces[2] = (pbuf_t){ NULL, csum_data + cut2, total - cut2 };
+                
+                for (uint32_t offset = 0; offset < 4; offset++) {
+                    uint32_t len = total - offset - 3;
+                    uint16_t chained = csum_fold(csum_pbuf(pieces, offset, len, 0));
+                    match &= chained == csum_reference(csum_data + offset, len);
+                }
+            }
+        }
+    }
+    csum_impl = csum_generic;
+    TEST_ASSERT(match, "Odd splits and offsets should not change the sum");
+    
+    pieces[0] = (pbuf_t){ NULL, csum_data, 10 };
+    TEST_ASSERT(csum_pbuf(pieces, 10, 4, 0x1234) == 0x1234, "An offset past the chain should add nothing");
+}
+
+void test_tcp_seq_wrap() {
+    TEST_CASE("TCP sequence comparisons survive wraparound");
+    
+    TEST_ASSERT(seq_lt(0xFFFFFFF0u, 0x10), "Just before zero is less than just after");
+    TEST_ASSERT(seq_gt(0x10, 0xFFFFFFF0u), "Just after zero is greater");
+    TEST_ASSERT(seq_leq(5, 5) && !seq_lt(5, 5) && !seq_gt(5, 5), "Equal numbers compare equal");
+    TEST_ASSERT(seq_lt(0, 0x7FFFFFFF) && seq_gt(0, 0x80000001u), "Half the space decides the order");
+}
+
+void test_tcp_seg_where() {
+    TEST_CASE("TCP places segments against the receive point");
+    
+    uint32_t dup;
+    uint32_t nxt = 0xFFFFFFFEu;
+    
+    TEST_ASSERT(tcp_seg_where(nxt, nxt, 100, 0, &dup) == TCP_SEG_NEXT && dup == 0,
+                "In-order segment should be taken whole");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt + 1, 100, 0, &dup) == TCP_SEG_AHEAD,
+                "Segment after a hole should wait for the hole");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt - 10, 100, 0, &dup) == TCP_SEG_NEXT && dup == 10,
+                "Overlapping segment should drop its old bytes");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt - 100, 100, 0, &dup) == TCP_SEG_OLD,
+                "Fully received data should be old");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt - 100, 100, TCP_FIN, &dup) == TCP_SEG_NEXT && dup == 100,
+                "A new FIN after old data should still count");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt - 1, 0, TCP_FIN, &dup) == TCP_SEG_OLD,
+                "A retransmitted bare FIN should be old");
+    TEST_ASSERT(tcp_seg_where(nxt, nxt - 1, 0, 0, &dup) == TCP_SEG_OLD,
+                "A keepalive should be old");
+    TEST_ASSERT(tcp_seg_where(2, 0xFFFFFFFCu, 10, 0, &dup) == TCP_SEG_NEXT && dup == 6,
+                "Trimming should work across zero");
+}
+
+void test_term_csi_params() {
+    TEST_CASE("VT100 parser reads CSI parameters");
+    
+    term_test_start();
+    term_test_feed("\x1b[5;10H");
+    TEST_ASSERT(cursor_y == 4 && cursor_x == 9, "Row and column should be one-based");
+    
+    term_test_feed("\x1b[;7H");
+    TEST_ASSERT(cursor_y == 0 && cursor_x == 6, "An empty parameter should take the default");
+    
+    term_test_feed("\x1b[0C");
+    TEST_ASSERT(cursor_x == 7, "A zero count should move by one");
+    
+    term_test_feed("\x1b[1;2;3;4;5;6;7;8;9;10;3H");
+    TEST_ASSERT(cursor_y == 0 && cursor_x == 1, "Parameters past the limit should be dropped");
+    
+    term_test_feed("\x1b[?25l\x1b[3G");
+    TEST_ASSERT(cursor_x == 2, "Private sequences should be ignored");
+    
+    term_test_feed("\x1b[2\r0d");
+    TEST_ASSERT(cursor_y == 19 && cursor_x == 0, "Controls inside a sequence should act and let it continue");
+    
+    term_test_feed("ab\x1b[");
+    term_test_feed("4");
+    term_test_feed("D");
+    TEST_ASSERT(cursor_x == 0, "A sequence split across writes should still apply");
+}
+
+void test_term_sgr() {
+    TEST_CASE("VT100 SGR sets, reverses and resets attributes");
+    
+    term_test_start();
+    term_test_feed("\x1b[31;44m");
+    TEST_ASSERT(current_attr == 0x1C, "ANSI colours should map to the VGA palette");
+    
+    term_test_feed("\x1b[7m");
+    TEST_ASSERT(current_attr == 0xC1, "Reverse should swap foreground and background");
+    
+    term_test_feed("\x1b[32m");
+    TEST_ASSERT(current_attr == 0xA1, "A colour change under reverse should hit the foreground");
+    
+    term_test_feed("\x1b[27m");
+    TEST_ASSERT(current_attr == 0x1A, "Reverse off should swap back");
+    
+    term_test_feed("\x1b[7;1m\x1b[m");
+    TEST_ASSERT(current_attr == DEFAULT_ATTR && term.reverse == 0, "A bare SGR should reset colours and reverse");
+    
+    term_test_feed("\x1b[7m");
+    term_set_attr(0x12);
+    term_test_feed("\x1b[1m");
+    TEST_ASSERT(current_attr == 0x1A, "Setting the attribute directly should end reverse");
+}
+
+void test_term_cursor_clamp() {
+    TEST_CASE("VT100 cursor movement stays on screen");
+    
+    term_test_start();
+    term_test_feed("\x1b[5D\x1b[5A");
+    TEST_ASSERT(cursor_x == 0 && cursor_y == 0, "Moves past the top left should stop there");
+    
+    term_test_feed("\x1b[200C\x1b[100B");
+    TEST_ASSERT(cursor_x == VGA_WIDTH - 1 && cursor_y == VGA_HEIGHT - 1, "Moves past the bottom right should stop there");
+    
+    term_test_feed("\x1b[99999999;99999999H");
+    TEST_ASSERT(cursor_x == VGA_WIDTH - 1 && cursor_y == VGA_HEIGHT - 1, "Huge positions should clamp");
+    
+    term_test_feed("\x1b[3F");
+    TEST_ASSERT(cursor_x == 0 && cursor_y == VGA_HEIGHT - 4, "Previous line should go to the first column");
+    
+    term_test_feed("\x1b[20;70H\x1b[s");
+    console_width = 40;
+    console_height = 10;
+    term_test_feed("\x1b[u");
+    TEST_ASSERT(cursor_x == 39 && cursor_y == 9, "A saved position should clamp to a smaller console");
+}
+
+int main() {
+    // Run all tests
+    test_memmove_forward_overlap();
+    test_memmove_backward_overlap();
+    test_memset16_cells();
+    test_blk_merge();
+    test_blk_cscan();
+    test_blk_deadline();
+    test_bcache_lru2_scan();
+    test_esdfs_root_split();
+    test_esdfs_lookup_after_split();
+    test_esdfs_unlink();
+    test_esdfs_extents();
+    test_csum_generic();
+    test_csum_sse2();
+    test_csum_pbuf_chain();
+    test_tcp_seq_wrap();
+    test_tcp_seg_where();
+    test_term_csi_params();
+    test_term_sgr();
+    test_term_cursor_clamp();
+    
+    // Report results
+    TEST_SUMMARY();
+    
+    return 0;
+}